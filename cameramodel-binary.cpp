@@ -0,0 +1,264 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mrcal.h"
+#include "util.h"
+
+// The binary .cameramodel format. The layout is described in mrcal.h
+
+#define BYTE_ORDER_MARK 0x01020304U
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint32_t Nintrinsics;
+    uint32_t imagersize[2];
+    uint32_t intrinsics_offset;
+    double   rt_cam_ref[6];
+    char     lensmodel[176];
+} header_t;
+
+static_assert(sizeof(MRCAL_CAMERAMODEL_BINARY_MAGIC)-1 == sizeof(((header_t*)0)->magic),
+              "The magic string must fill the magic field exactly");
+static_assert(offsetof(header_t, rt_cam_ref) == 32 &&
+              offsetof(header_t, lensmodel)  == 80 &&
+              sizeof(header_t)               == 256,
+              "The header layout must match the documentation in mrcal.h");
+static_assert(sizeof(header_t) % MRCAL_CAMERAMODEL_BINARY_ALIGNMENT == 0,
+              "The intrinsics are written right after the header, so it must be aligned");
+
+bool mrcal_write_cameramodel_binary_file(const char* filename,
+                                         const mrcal_cameramodel_t* cameramodel)
+{
+    header_t header = {};
+    memcpy(header.magic, MRCAL_CAMERAMODEL_BINARY_MAGIC, sizeof(header.magic));
+    header.version           = MRCAL_CAMERAMODEL_BINARY_VERSION;
+    header.byte_order_mark   = BYTE_ORDER_MARK;
+    header.imagersize[0]     = cameramodel->imagersize[0];
+    header.imagersize[1]     = cameramodel->imagersize[1];
+    header.intrinsics_offset = sizeof(header_t);
+    memcpy(header.rt_cam_ref, cameramodel->rt_cam_ref, sizeof(header.rt_cam_ref));
+
+    if(!mrcal_lensmodel_name(header.lensmodel, sizeof(header.lensmodel),
+                             &cameramodel->lensmodel))
+    {
+        MSG("Couldn't construct lensmodel string. Unconfigured string: '%s'",
+            mrcal_lensmodel_name_unconfigured(&cameramodel->lensmodel));
+        return false;
+    }
+
+    const int Nintrinsics = mrcal_lensmodel_num_params(&cameramodel->lensmodel);
+    if(Nintrinsics < 0)
+    {
+        MSG("Couldn't get valid Nintrinsics from lensmodel string '%s'",
+            header.lensmodel);
+        return false;
+    }
+    header.Nintrinsics = (uint32_t)Nintrinsics;
+
+    FILE* fp = fopen(filename, "w");
+    if(fp == NULL)
+    {
+        MSG("Couldn't open('%s')", filename);
+        return false;
+    }
+
+    bool result =
+        1                   == fwrite(&header, sizeof(header), 1, fp) &&
+        (size_t)Nintrinsics == fwrite(cameramodel->intrinsics, sizeof(double), Nintrinsics, fp);
+    // fclose() flushes, so it can fail too
+    result = (0 == fclose(fp)) && result;
+    if(!result)
+        MSG("Couldn't write '%s'", filename);
+    return result;
+}
+
+// Validates the file contents in buf, and fills in everything except the
+// mapping. cameramodel->intrinsics points into buf
+static bool parse(// output
+                  mrcal_cameramodel_mmapped_t* cameramodel,
+                  // input
+                  const void* buf, size_t size,
+                  const char* filename)
+{
+    if(size < sizeof(header_t))
+    {
+        MSG("'%s' is too small to be a binary cameramodel", filename);
+        return false;
+    }
+
+    const header_t* header = (const header_t*)buf;
+    if(0 != memcmp(header->magic, MRCAL_CAMERAMODEL_BINARY_MAGIC, sizeof(header->magic)))
+    {
+        MSG("'%s' is not a binary cameramodel: the magic string doesn't match", filename);
+        return false;
+    }
+    if(header->byte_order_mark != BYTE_ORDER_MARK)
+    {
+        MSG("'%s' was written on a machine with a different byte order", filename);
+        return false;
+    }
+    if(header->version != MRCAL_CAMERAMODEL_BINARY_VERSION)
+    {
+        MSG("'%s' has binary cameramodel version %u. I only know about version %d",
+            filename, header->version, MRCAL_CAMERAMODEL_BINARY_VERSION);
+        return false;
+    }
+    if(header->intrinsics_offset < sizeof(header_t) ||
+       header->intrinsics_offset % MRCAL_CAMERAMODEL_BINARY_ALIGNMENT != 0 ||
+       header->intrinsics_offset > size ||
+       (size - header->intrinsics_offset) / sizeof(double) < header->Nintrinsics)
+    {
+        MSG("'%s' is corrupt: the intrinsics at offset %u don't fit into the file",
+            filename, header->intrinsics_offset);
+        return false;
+    }
+    if(memchr(header->lensmodel, '\0', sizeof(header->lensmodel)) == NULL)
+    {
+        MSG("'%s' is corrupt: the lensmodel string isn't terminated", filename);
+        return false;
+    }
+
+    if(!mrcal_lensmodel_from_name(&cameramodel->lensmodel, header->lensmodel))
+    {
+        MSG("'%s' has an unparseable lensmodel '%s'", filename, header->lensmodel);
+        return false;
+    }
+    const int Nintrinsics = mrcal_lensmodel_num_params(&cameramodel->lensmodel);
+    if(Nintrinsics < 0 || (uint32_t)Nintrinsics != header->Nintrinsics)
+    {
+        MSG("'%s' has %u intrinsics, but lensmodel '%s' needs %d",
+            filename, header->Nintrinsics, header->lensmodel, Nintrinsics);
+        return false;
+    }
+    if(header->imagersize[0] == 0 || header->imagersize[1] == 0)
+    {
+        MSG("'%s' has an invalid imagersize: (%u,%u)",
+            filename, header->imagersize[0], header->imagersize[1]);
+        return false;
+    }
+
+    memcpy(cameramodel->rt_cam_ref, header->rt_cam_ref, sizeof(cameramodel->rt_cam_ref));
+    cameramodel->imagersize[0] = header->imagersize[0];
+    cameramodel->imagersize[1] = header->imagersize[1];
+    cameramodel->Nintrinsics   = Nintrinsics;
+    cameramodel->intrinsics    =
+        (const double*)&((const uint8_t*)buf)[header->intrinsics_offset];
+    return true;
+}
+
+// A malloc()-ed copy of a parsed model, as returned by
+// mrcal_read_cameramodel_file()
+static mrcal_cameramodel_t* copy(const mrcal_cameramodel_mmapped_t* parsed)
+{
+    const size_t Nbytes_intrinsics = parsed->Nintrinsics*sizeof(double);
+    mrcal_cameramodel_t* cameramodel =
+        (mrcal_cameramodel_t*)malloc(sizeof(mrcal_cameramodel_t) + Nbytes_intrinsics);
+    if(cameramodel == NULL)
+    {
+        MSG("Couldn't allocate the cameramodel");
+        return NULL;
+    }
+
+    memcpy(cameramodel->rt_cam_ref, parsed->rt_cam_ref, sizeof(cameramodel->rt_cam_ref));
+    cameramodel->imagersize[0] = parsed->imagersize[0];
+    cameramodel->imagersize[1] = parsed->imagersize[1];
+    cameramodel->lensmodel     = parsed->lensmodel;
+    memcpy(cameramodel->intrinsics, parsed->intrinsics, Nbytes_intrinsics);
+    return cameramodel;
+}
+
+bool mrcal_map_cameramodel_binary_file(// output
+                                       mrcal_cameramodel_mmapped_t* cameramodel,
+                                       // input
+                                       const char* filename)
+{
+    *cameramodel = (mrcal_cameramodel_mmapped_t){};
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        MSG("Couldn't open(\"%s\")", filename);
+        return false;
+    }
+
+    struct stat st;
+    if(0 != fstat(fd, &st))
+    {
+        MSG("Couldn't stat(\"%s\")", filename);
+        close(fd);
+        return false;
+    }
+    if(st.st_size < (off_t)sizeof(header_t))
+    {
+        MSG("'%s' is too small to be a binary cameramodel", filename);
+        close(fd);
+        return false;
+    }
+
+    void* buf = mmap(NULL, st.st_size,
+                     PROT_READ,
+                     MAP_PRIVATE,
+                     fd, 0);
+    // The mapping stays valid after the file is closed
+    close(fd);
+    if(buf == MAP_FAILED)
+    {
+        MSG("Couldn't mmap(\"%s\")", filename);
+        return false;
+    }
+
+    // The mapping is page-aligned, so the intrinsics are aligned too
+    if(!parse(cameramodel, buf, st.st_size, filename))
+    {
+        munmap(buf, st.st_size);
+        *cameramodel = (mrcal_cameramodel_mmapped_t){};
+        return false;
+    }
+
+    cameramodel->_mmap      = buf;
+    cameramodel->_mmap_size = st.st_size;
+    return true;
+}
+
+void mrcal_unmap_cameramodel_binary_file(mrcal_cameramodel_mmapped_t* cameramodel)
+{
+    if(cameramodel->_mmap != NULL)
+        munmap(cameramodel->_mmap, cameramodel->_mmap_size);
+    *cameramodel = (mrcal_cameramodel_mmapped_t){};
+}
+
+mrcal_cameramodel_t* mrcal_read_cameramodel_binary_file(const char* filename)
+{
+    mrcal_cameramodel_mmapped_t mapped;
+    if(!mrcal_map_cameramodel_binary_file(&mapped, filename))
+        return NULL;
+
+    mrcal_cameramodel_t* cameramodel = copy(&mapped);
+    mrcal_unmap_cameramodel_binary_file(&mapped);
+    return cameramodel;
+}
+
+mrcal_cameramodel_t* _mrcal_read_cameramodel_binary_buffer(const void* buf, size_t size,
+                                                           const char* what)
+{
+    mrcal_cameramodel_mmapped_t parsed = {};
+    if(!parse(&parsed, buf, size, what))
+        return NULL;
+    return copy(&parsed);
+}
@@ -0,0 +1,316 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "mrcal.h"
+#include "parallel.h"
+#include "util.h"
+
+// The cache of parsed cameramodels used by mrcal_read_cameramodel_files(). It
+// is keyed on the full contents of each file, so a hit is always exact: a file
+// that changed in any way is parsed again. The file names aren't a part of the
+// key, so identical files share an entry. The hash is only used for quick
+// rejection
+
+// How many models we remember (MRCAL_CAMERAMODEL_CACHE_NENTRIES). A service
+// loads a few dozen, and keeps a few stale versions around after reloading its
+// configuration
+#define CACHE_NENTRIES MRCAL_CAMERAMODEL_CACHE_NENTRIES
+
+typedef struct
+{
+    // The key: the file contents, and their hash
+    uint64_t             hash;
+    std::vector<uint8_t> contents;
+
+    // malloc()-ed. NULL if this entry is unused
+    mrcal_cameramodel_t* cameramodel;
+    mrcal_projection_precomputed_t precomputed;
+
+    // For the least-recently-used eviction
+    unsigned long        last_used;
+} cache_entry_t;
+
+static struct
+{
+    std::mutex    mutex;
+    cache_entry_t entries[CACHE_NENTRIES];
+    unsigned long Nlookups;
+
+    // Reported by _mrcal_cameramodel_cache_stats()
+    unsigned long Nhits, Nmisses;
+} cache;
+
+static uint64_t contents_hash(const std::vector<uint8_t>& contents)
+{
+    // FNV-1a, but mixing in 8 bytes at a time: the text files of splined
+    // models are ~100kB, and hashing them bytewise would be a noticeable
+    // fraction of the cost of a cache hit
+    uint64_t h = 14695981039346656037ULL;
+    const size_t   size = contents.size();
+    const uint8_t* d    = contents.data();
+
+    size_t k = 0;
+    for(; k+8 <= size; k += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &d[k], sizeof(word));
+        h ^= word;
+        h *= 1099511628211ULL;
+    }
+    for(; k<size; k++)
+    {
+        h ^= d[k];
+        h *= 1099511628211ULL;
+    }
+    h ^= (uint64_t)size;
+    h *= 1099511628211ULL;
+    return h;
+}
+
+static bool read_contents(// output
+                          std::vector<uint8_t>& contents,
+                          // input
+                          const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        MSG("Couldn't open(\"%s\")", filename);
+        return false;
+    }
+
+    bool result = false;
+    struct stat st;
+    if(0 != fstat(fd, &st))
+    {
+        MSG("Couldn't stat(\"%s\")", filename);
+        goto done;
+    }
+
+    contents.resize(st.st_size);
+    for(size_t Nread = 0; Nread < contents.size(); )
+    {
+        ssize_t n = read(fd, &contents[Nread], contents.size() - Nread);
+        if(n <= 0)
+        {
+            MSG("Couldn't read(\"%s\")", filename);
+            goto done;
+        }
+        Nread += n;
+    }
+    result = true;
+
+ done:
+    close(fd);
+    return result;
+}
+
+// Parses either format. Returns a malloc()-ed model or NULL
+static mrcal_cameramodel_t* parse(const std::vector<uint8_t>& contents,
+                                  const char* filename)
+{
+    const size_t Nmagic = strlen(MRCAL_CAMERAMODEL_BINARY_MAGIC);
+    if(contents.size() >= Nmagic &&
+       0 == memcmp(contents.data(), MRCAL_CAMERAMODEL_BINARY_MAGIC, Nmagic))
+        return _mrcal_read_cameramodel_binary_buffer(contents.data(), contents.size(),
+                                                     filename);
+
+    // mrcal_read_cameramodel_string() takes an int length, and len <= 0 means
+    // something else
+    if(contents.empty() || contents.size() > INT_MAX)
+    {
+        MSG("'%s' has an unsupported size: %zu bytes", filename, contents.size());
+        return NULL;
+    }
+    mrcal_cameramodel_t* cameramodel =
+        mrcal_read_cameramodel_string((const char*)contents.data(), (int)contents.size());
+    if(cameramodel == NULL)
+        MSG("Couldn't parse '%s'", filename);
+    return cameramodel;
+}
+
+static mrcal_cameramodel_t* copy(const mrcal_cameramodel_t* cameramodel)
+{
+    const size_t size =
+        sizeof(mrcal_cameramodel_t) +
+        mrcal_lensmodel_num_params(&cameramodel->lensmodel)*sizeof(double);
+    mrcal_cameramodel_t* out = (mrcal_cameramodel_t*)malloc(size);
+    if(out == NULL)
+    {
+        MSG("Couldn't allocate the cameramodel");
+        return NULL;
+    }
+    memcpy(out, cameramodel, size);
+    return out;
+}
+
+static void free_entry(cache_entry_t* entry)
+{
+    free(entry->cameramodel);
+    entry->cameramodel = NULL;
+    entry->contents.clear(); entry->contents.shrink_to_fit();
+}
+
+// Must be called with the mutex held
+static cache_entry_t* lookup(const std::vector<uint8_t>& contents, uint64_t hash)
+{
+    cache.Nlookups++;
+    for(int k=0; k<CACHE_NENTRIES; k++)
+    {
+        cache_entry_t* entry = &cache.entries[k];
+        if(entry->cameramodel != NULL &&
+           entry->hash        == hash &&
+           entry->contents    == contents)
+        {
+            entry->last_used = cache.Nlookups;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Must be called with the mutex held. Takes over the contents, and stores a
+// COPY of the cameramodel
+static void store(std::vector<uint8_t>& contents, uint64_t hash,
+                  const mrcal_cameramodel_t* cameramodel,
+                  const mrcal_projection_precomputed_t* precomputed)
+{
+    mrcal_cameramodel_t* cameramodel_copy = copy(cameramodel);
+    if(cameramodel_copy == NULL)
+        return;
+
+    // An unused entry, or the least-recently-used one
+    cache_entry_t* entry = &cache.entries[0];
+    for(int k=0; k<CACHE_NENTRIES; k++)
+    {
+        if(cache.entries[k].cameramodel == NULL)
+        {
+            entry = &cache.entries[k];
+            break;
+        }
+        if(cache.entries[k].last_used < entry->last_used)
+            entry = &cache.entries[k];
+    }
+
+    free_entry(entry);
+    entry->hash        = hash;
+    entry->contents    = std::move(contents);
+    entry->cameramodel = cameramodel_copy;
+    entry->precomputed = *precomputed;
+    entry->last_used   = ++cache.Nlookups;
+}
+
+static mrcal_cameramodel_t* read_cached(// output
+                                        mrcal_projection_precomputed_t* precomputed,
+                                        // input
+                                        const char* filename)
+{
+    std::vector<uint8_t> contents;
+    if(!read_contents(contents, filename))
+        return NULL;
+    const uint64_t hash = contents_hash(contents);
+
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        const cache_entry_t* entry = lookup(contents, hash);
+        if(entry != NULL)
+        {
+            MRCAL_TRACE(MRCAL_TRACE_CAMERAMODEL_CACHE,
+                        "Reusing the parsed '%s'", filename);
+            cache.Nhits++;
+            *precomputed = entry->precomputed;
+            return copy(entry->cameramodel);
+        }
+        cache.Nmisses++;
+    }
+
+    // Not cached. I parse without holding the lock: this is the slow part
+    MRCAL_TRACE(MRCAL_TRACE_CAMERAMODEL_CACHE,
+                "Parsing '%s'", filename);
+    mrcal_cameramodel_t* cameramodel = parse(contents, filename);
+    if(cameramodel == NULL)
+        return NULL;
+
+    *precomputed = (mrcal_projection_precomputed_t){};
+    _mrcal_precompute_lensmodel_data(precomputed, &cameramodel->lensmodel);
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if(lookup(contents, hash) == NULL)
+        store(contents, hash, cameramodel, precomputed);
+    return cameramodel;
+}
+
+bool _mrcal_read_cameramodel_files_precomputed(// output
+                                               mrcal_cameramodel_t** cameramodels,
+                                               mrcal_projection_precomputed_t* precomputed,
+                                               // input
+                                               const char* const* filenames,
+                                               int N)
+{
+    if(N <= 0)
+        return true;
+
+    // This is mostly waiting for the disk, so each file gets its own thread, if
+    // we have enough cores
+    const int Nthreads = std::min(_mrcal_num_threads(0), N);
+    _mrcal_parallel_for(N, Nthreads,
+                        [&](int i0, int i1, int)
+                        {
+                            for(int i=i0; i<i1; i++)
+                            {
+                                mrcal_projection_precomputed_t p = {};
+                                cameramodels[i] = read_cached(&p, filenames[i]);
+                                if(precomputed != NULL)
+                                    precomputed[i] = p;
+                            }
+                        });
+
+    for(int i=0; i<N; i++)
+        if(cameramodels[i] == NULL)
+            return false;
+    return true;
+}
+
+bool mrcal_read_cameramodel_files(// output
+                                  mrcal_cameramodel_t** cameramodels,
+                                  // input
+                                  const char* const* filenames,
+                                  int N)
+{
+    return _mrcal_read_cameramodel_files_precomputed(cameramodels, NULL,
+                                                     filenames, N);
+}
+
+void mrcal_cameramodel_cache_clear(void)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    for(int k=0; k<CACHE_NENTRIES; k++)
+        free_entry(&cache.entries[k]);
+    cache.Nhits   = 0;
+    cache.Nmisses = 0;
+}
+
+void _mrcal_cameramodel_cache_stats(// output
+                                    unsigned long* Nhits,
+                                    unsigned long* Nmisses)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    *Nhits   = cache.Nhits;
+    *Nmisses = cache.Nmisses;
+}
@@ -0,0 +1,288 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+#include "mrcal-types.h"
+#include "cholmod-cache.h"
+#include "util.h"
+
+// How many patterns we remember. A calibration session usually only has one
+// or two active at a time
+#define CACHE_NENTRIES 4
+
+// The settings in cholmod_common that affect cholmod_analyze(). An analysis
+// made with one set of these can't be given to a caller that asked for
+// another: a supernodal factor can't be factored by a simplicial-only caller,
+// a different ordering is a different factor, and so on
+typedef struct
+{
+    int    itype;
+    int    supernodal;
+    double supernodal_switch;
+    int    postorder;
+    int    nmethods;
+    int    ordering[CHOLMOD_MAXMETHODS+1];
+} analysis_config_t;
+
+typedef struct
+{
+    // The key: the full sparsity pattern of Jt, the configuration it was
+    // analyzed with, and their hash for quick rejection
+    uint64_t          hash;
+    int               nrow, ncol;
+    std::vector<int>  p, i;
+    analysis_config_t config;
+
+    // Symbolic only. Allocated with cache.common
+    cholmod_factor*  L;
+
+    // For the least-recently-used eviction
+    unsigned long    last_used;
+} cache_entry_t;
+
+static struct
+{
+    std::mutex    mutex;
+    bool          inited_common;
+    cholmod_common common;
+    cache_entry_t entries[CACHE_NENTRIES];
+    unsigned long Nlookups;
+    int           Nhits, Nmisses;
+} cache;
+
+// We can only handle the compressed-column int matrices that mrcal produces.
+// Anything else is passed through to cholmod_analyze() without caching
+static bool cacheable(const cholmod_sparse* Jt)
+{
+    return Jt != NULL && Jt->packed && Jt->itype == CHOLMOD_INT;
+}
+
+static analysis_config_t analysis_config(const cholmod_common* common)
+{
+    // memset() to make the padding deterministic: this is hashed and memcmp()-ed
+    analysis_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.itype             = common->itype;
+    config.supernodal        = common->supernodal;
+    config.supernodal_switch = common->supernodal_switch;
+    config.postorder         = common->postorder;
+    config.nmethods          = common->nmethods;
+    for(int k=0; k<=CHOLMOD_MAXMETHODS; k++)
+        config.ordering[k] = common->method[k].ordering;
+    return config;
+}
+
+static uint64_t pattern_hash(const cholmod_sparse* Jt,
+                             const analysis_config_t* config)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    auto mix = [&](const void* data, size_t size)
+    {
+        const uint8_t* d = (const uint8_t*)data;
+        for(size_t k=0; k<size; k++)
+        {
+            h ^= d[k];
+            h *= 1099511628211ULL;
+        }
+    };
+
+    const int nrow = (int)Jt->nrow;
+    const int ncol = (int)Jt->ncol;
+    const int* p   = (const int*)Jt->p;
+    mix(&nrow, sizeof(nrow));
+    mix(&ncol, sizeof(ncol));
+    mix(p,       (ncol+1)*sizeof(int));
+    mix(Jt->i,   p[ncol] *sizeof(int));
+    mix(config,  sizeof(*config));
+    return h;
+}
+
+static bool pattern_matches(const cache_entry_t* entry,
+                            const cholmod_sparse* Jt,
+                            const analysis_config_t* config,
+                            uint64_t hash)
+{
+    if(entry->L    == NULL           ||
+       entry->hash != hash           ||
+       entry->nrow != (int)Jt->nrow  ||
+       entry->ncol != (int)Jt->ncol  ||
+       0 != memcmp(&entry->config, config, sizeof(*config)))
+        return false;
+    const int* p = (const int*)Jt->p;
+    const int nnz = p[Jt->ncol];
+    return
+        (int)entry->i.size() == nnz &&
+        0 == memcmp(entry->p.data(), p,     (Jt->ncol+1)*sizeof(int)) &&
+        0 == memcmp(entry->i.data(), Jt->i, nnz         *sizeof(int));
+}
+
+static bool init_common(void)
+{
+    if(cache.inited_common)
+        return true;
+    if(!cholmod_start(&cache.common))
+    {
+        MSG("Error trying to cholmod_start");
+        return false;
+    }
+    cache.inited_common = true;
+    return true;
+}
+
+static void free_entry(cache_entry_t* entry)
+{
+    if(entry->L != NULL)
+        cholmod_free_factor(&entry->L, &cache.common);
+    entry->L = NULL;
+    entry->p.clear(); entry->p.shrink_to_fit();
+    entry->i.clear(); entry->i.shrink_to_fit();
+}
+
+// Must be called with the mutex held
+static cache_entry_t* lookup(const cholmod_sparse* Jt,
+                             const analysis_config_t* config,
+                             uint64_t hash)
+{
+    cache.Nlookups++;
+    for(int k=0; k<CACHE_NENTRIES; k++)
+        if(pattern_matches(&cache.entries[k], Jt, config, hash))
+        {
+            cache.entries[k].last_used = cache.Nlookups;
+            return &cache.entries[k];
+        }
+    return NULL;
+}
+
+// Must be called with the mutex held. Takes a COPY of L, and strips out any
+// numerical data
+static void store(const cholmod_sparse* Jt,
+                  const analysis_config_t* config,
+                  uint64_t hash,
+                  const cholmod_factor* L)
+{
+    if(!init_common())
+        return;
+
+    cache_entry_t* entry = &cache.entries[0];
+    for(int k=1; k<CACHE_NENTRIES; k++)
+        if(cache.entries[k].L == NULL ||
+           (entry->L != NULL && cache.entries[k].last_used < entry->last_used))
+            entry = &cache.entries[k];
+    free_entry(entry);
+
+    cholmod_factor* Lcopy =
+        cholmod_copy_factor((cholmod_factor*)L, &cache.common);
+    if(Lcopy == NULL)
+        return;
+    // We only want the symbolic part. This throws away the numerical values,
+    // but keeps the factor's type: a supernodal analysis must stay supernodal
+    if(!cholmod_change_factor(CHOLMOD_PATTERN, Lcopy->is_ll,
+                              Lcopy->is_super, true, true,
+                              Lcopy, &cache.common))
+    {
+        cholmod_free_factor(&Lcopy, &cache.common);
+        return;
+    }
+
+    const int* p = (const int*)Jt->p;
+    try
+    {
+        entry->p.assign(p, p + Jt->ncol+1);
+        entry->i.assign((const int*)Jt->i, (const int*)Jt->i + p[Jt->ncol]);
+    }
+    catch(...)
+    {
+        cholmod_free_factor(&Lcopy, &cache.common);
+        free_entry(entry);
+        return;
+    }
+    entry->hash      = hash;
+    entry->config    = *config;
+    entry->nrow      = (int)Jt->nrow;
+    entry->ncol      = (int)Jt->ncol;
+    entry->L         = Lcopy;
+    entry->last_used = ++cache.Nlookups;
+}
+
+cholmod_factor* _mrcal_cholmod_analyze_cached(cholmod_sparse* Jt,
+                                              cholmod_common* common)
+{
+    if(!cacheable(Jt))
+        return cholmod_analyze(Jt, common);
+
+    const analysis_config_t config = analysis_config(common);
+    const uint64_t          hash   = pattern_hash(Jt, &config);
+
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache_entry_t* entry = lookup(Jt, &config, hash);
+        if(entry != NULL)
+        {
+            cache.Nhits++;
+            MRCAL_TRACE(MRCAL_TRACE_CHOLMOD_CACHE,
+                        "Reusing the analysis of a %dx%d Jt", entry->nrow, entry->ncol);
+            return cholmod_copy_factor(entry->L, common);
+        }
+    }
+
+    // Not cached. I analyze without holding the lock: this is the slow part
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.Nmisses++;
+    }
+    MRCAL_TRACE(MRCAL_TRACE_CHOLMOD_CACHE,
+                "Analyzing a %dx%d Jt", (int)Jt->nrow, (int)Jt->ncol);
+    cholmod_factor* L = cholmod_analyze(Jt, common);
+    if(L == NULL)
+        return NULL;
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if(lookup(Jt, &config, hash) == NULL)
+        store(Jt, &config, hash, L);
+    return L;
+}
+
+void _mrcal_cholmod_cache_store(const cholmod_sparse* Jt,
+                                const cholmod_factor* L,
+                                const cholmod_common* common)
+{
+    if(!cacheable(Jt) || L == NULL)
+        return;
+
+    const analysis_config_t config = analysis_config(common);
+    const uint64_t          hash   = pattern_hash(Jt, &config);
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if(lookup(Jt, &config, hash) == NULL)
+        store(Jt, &config, hash, L);
+}
+
+void _mrcal_cholmod_cache_stats(int* Nhits, int* Nmisses)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    *Nhits   = cache.Nhits;
+    *Nmisses = cache.Nmisses;
+}
+
+void _mrcal_cholmod_cache_clear(void)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.Nhits   = 0;
+    cache.Nmisses = 0;
+    if(!cache.inited_common)
+        return;
+    for(int k=0; k<CACHE_NENTRIES; k++)
+        free_entry(&cache.entries[k]);
+    cholmod_finish(&cache.common);
+    cache.inited_common = false;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#pragma once
+
+// This is an internal header to cache the CHOLMOD symbolic analysis. Not to be
+// seen by the end-users or installed
+//
+// cholmod_analyze() computes a fill-reducing ordering and a symbolic
+// factorization of Jt Jt'. This is expensive, and it depends only on the
+// sparsity pattern of Jt. And THAT is a function only of the structure of the
+// problem: the observation lists, the lens model and the problem selections.
+// So every factorization of a problem with the same structure (a
+// recalibration of the same rig, an uncertainty computation after a solve,
+// ...) can reuse the same analysis.
+//
+// The cache is keyed on the sparsity pattern itself, and on the cholmod_common
+// settings that affect the analysis (the orderings, the supernodal switch, the
+// integer type), so a hit is always exact: we never reuse an analysis for a
+// different structure or configuration. A small number of
+// recently-used patterns is kept. The cache is process-global and thread-safe
+
+#include <cholmod.h>
+
+// Drop-in replacement for cholmod_analyze(Jt, common). If we've seen this
+// sparsity pattern before, a copy of the cached analysis is returned; otherwise
+// we call cholmod_analyze(), and cache the result. Either way the caller owns
+// the returned factor, and must free it with cholmod_free_factor(..., common).
+// Returns NULL on error
+cholmod_factor* _mrcal_cholmod_analyze_cached(cholmod_sparse* Jt,
+                                              cholmod_common* common);
+
+// Adds the analysis of L, an existing symbolic or numeric factor of Jt Jt'
+// made with the given cholmod_common, to the cache. This lets us harvest the
+// analysis done by someone else (libdogleg, for instance). Nothing is done if
+// this pattern is already cached. L is not modified
+void _mrcal_cholmod_cache_store(const cholmod_sparse* Jt,
+                                const cholmod_factor* L,
+                                const cholmod_common* common);
+
+// Frees everything in the cache, and resets the counts reported by
+// _mrcal_cholmod_cache_stats()
+void _mrcal_cholmod_cache_clear(void);
+
+// How many _mrcal_cholmod_analyze_cached() calls were answered from the cache,
+// and how many had to call cholmod_analyze(). Counted since the last
+// _mrcal_cholmod_cache_clear()
+void _mrcal_cholmod_cache_stats(int* Nhits, int* Nmisses);
@@ -0,0 +1,608 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <math.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include <utility>
+
+#include "mrcal-types.h"
+#include "dogleg-solver.h"
+#include "cholmod-cache.h"
+#include "util.h"
+
+typedef struct
+{
+    std::vector<double> p, x;
+
+    // The jacobian, transposed
+    std::vector<int>    Jt_p, Jt_i;
+    std::vector<double> Jt_values;
+    cholmod_sparse      Jt;
+
+    double              norm2_x;
+    // Jt x: half the gradient of norm2(x)
+    std::vector<double> Jt_x;
+
+    // The steps from this point. Each one is computed when first needed, and
+    // kept while we try smaller and smaller trust regions
+    std::vector<double> step_cauchy, step_gn;
+    double              step_cauchy_norm2, step_gn_norm2;
+    bool                have_step_cauchy, have_step_gn;
+
+    // Whether the latest step from this point was cut short by the trust
+    // region
+    bool                step_to_edge;
+} operating_point_t;
+
+struct _mrcal_dogleg_solver_t
+{
+    // The current operating point, and the one we're trying. Swapped when a
+    // step is accepted
+    operating_point_t  points[2];
+    operating_point_t* current;
+    operating_point_t* trial;
+
+    int Nstate, Nmeasurements;
+
+    bool            inited_common;
+    cholmod_common  common;
+
+    // The factorization of JtJ. Refactored in place at each operating point.
+    // Kept after the solve, so that the next solve can reuse its symbolic
+    // analysis, if the sparsity pattern is the same
+    cholmod_factor*  factorization;
+    // The pattern of Jt that the factorization was analyzed for
+    int              factorization_nrow;
+    std::vector<int> factorization_p, factorization_i;
+    // The pattern is fixed during a solve, so I check it only at the first
+    // factorization of each solve
+    bool             factorization_checked;
+
+    // If JtJ is singular, we factor JtJ + lambda I instead. Starts at 0 in each
+    // solve, and only grows
+    double lambda;
+
+    // How many times we called the callback in this solve
+    int Nevaluations;
+
+    // Scratch
+    std::vector<double> step;
+    cholmod_dense*      solve_Y;
+    cholmod_dense*      solve_E;
+};
+
+static bool operating_point_init(operating_point_t* pt,
+                                 int Nstate, int Nmeasurements, int N_j_nonzero)
+{
+    try
+    {
+        pt->p          .resize(Nstate);
+        pt->x          .resize(Nmeasurements);
+        pt->Jt_p       .resize(Nmeasurements+1);
+        pt->Jt_i       .resize(N_j_nonzero);
+        pt->Jt_values  .resize(N_j_nonzero);
+        pt->Jt_x       .resize(Nstate);
+        pt->step_cauchy.resize(Nstate);
+        pt->step_gn    .resize(Nstate);
+    }
+    catch(...)
+    {
+        return false;
+    }
+
+    pt->Jt = cholmod_sparse{};
+    pt->Jt.nrow   = Nstate;
+    pt->Jt.ncol   = Nmeasurements;
+    pt->Jt.nzmax  = N_j_nonzero;
+    pt->Jt.p      = pt->Jt_p.data();
+    pt->Jt.i      = pt->Jt_i.data();
+    pt->Jt.x      = pt->Jt_values.data();
+    pt->Jt.stype  = 0;
+    pt->Jt.itype  = CHOLMOD_INT;
+    pt->Jt.xtype  = CHOLMOD_REAL;
+    pt->Jt.dtype  = CHOLMOD_DOUBLE;
+    pt->Jt.sorted = 0;
+    pt->Jt.packed = 1;
+
+    pt->have_step_cauchy = false;
+    pt->have_step_gn     = false;
+    pt->step_to_edge     = false;
+    return true;
+}
+
+// Evaluates the callback at pt->p. Returns true if the gradient is small
+// enough for us to be done
+static bool evaluate(operating_point_t* pt,
+                     _mrcal_dogleg_solver_t* s,
+                     void (*f)(const double*, double*, cholmod_sparse*, void*),
+                     void* cookie,
+                     const dogleg_parameters2_t* parameters)
+{
+    f(pt->p.data(), pt->x.data(), &pt->Jt, cookie);
+    s->Nevaluations++;
+
+    double norm2 = 0.0;
+    for(int i=0; i<s->Nmeasurements; i++)
+        norm2 += pt->x[i]*pt->x[i];
+    pt->norm2_x = norm2;
+
+    const int*    Jt_p      = pt->Jt_p.data();
+    const int*    Jt_i      = pt->Jt_i.data();
+    const double* Jt_values = pt->Jt_values.data();
+    double*       Jt_x      = pt->Jt_x.data();
+    memset(Jt_x, 0, s->Nstate*sizeof(double));
+    for(int irow=0; irow<s->Nmeasurements; irow++)
+        for(int k=Jt_p[irow]; k<Jt_p[irow+1]; k++)
+            Jt_x[Jt_i[k]] += Jt_values[k]*pt->x[irow];
+
+    pt->have_step_cauchy = false;
+    pt->have_step_gn     = false;
+
+    for(int i=0; i<s->Nstate; i++)
+        if(fabs(Jt_x[i]) > parameters->Jt_x_threshold)
+            return false;
+    return true;
+}
+
+// norm2(J v)
+static double norm2_J_v(const operating_point_t* pt, int Nmeasurements,
+                        const double* v)
+{
+    const int*    Jt_p      = pt->Jt_p.data();
+    const int*    Jt_i      = pt->Jt_i.data();
+    const double* Jt_values = pt->Jt_values.data();
+
+    double norm2 = 0.0;
+    for(int irow=0; irow<Nmeasurements; irow++)
+    {
+        double d = 0.0;
+        for(int k=Jt_p[irow]; k<Jt_p[irow+1]; k++)
+            d += Jt_values[k]*v[Jt_i[k]];
+        norm2 += d*d;
+    }
+    return norm2;
+}
+
+// The Cauchy point: the minimum of the quadratic model of norm2(x) along the
+// steepest-descent direction -Jt x. Along that direction, norm2(x + k J Jt x)
+// is minimized at k = -norm2(Jt x) / norm2(J Jt x)
+static void compute_step_cauchy(operating_point_t* pt,
+                                const _mrcal_dogleg_solver_t* s)
+{
+    double norm2_Jt_x = 0.0;
+    for(int i=0; i<s->Nstate; i++)
+        norm2_Jt_x += pt->Jt_x[i]*pt->Jt_x[i];
+    const double norm2_J_Jt_x = norm2_J_v(pt, s->Nmeasurements, pt->Jt_x.data());
+
+    const double k = norm2_J_Jt_x > 0.0 ? -norm2_Jt_x / norm2_J_Jt_x : 0.0;
+    for(int i=0; i<s->Nstate; i++)
+        pt->step_cauchy[i] = k*pt->Jt_x[i];
+    pt->step_cauchy_norm2 = k*k*norm2_Jt_x;
+    pt->have_step_cauchy  = true;
+}
+
+static bool factorization_pattern_matches(const _mrcal_dogleg_solver_t* s,
+                                          const operating_point_t* pt)
+{
+    const int Nmeasurements = s->Nmeasurements;
+    const int nnz           = pt->Jt_p[Nmeasurements];
+    return
+        s->factorization_nrow              == s->Nstate        &&
+        (int)s->factorization_p.size()     == Nmeasurements+1 &&
+        (int)s->factorization_i.size()     == nnz             &&
+        0 == memcmp(s->factorization_p.data(), pt->Jt_p.data(), (Nmeasurements+1)*sizeof(int)) &&
+        0 == memcmp(s->factorization_i.data(), pt->Jt_i.data(), nnz              *sizeof(int));
+}
+
+// Factors JtJ at pt into s->factorization. If JtJ is singular, s->lambda is
+// raised until JtJ + lambda I isn't. Returns false on error
+static bool factorize(_mrcal_dogleg_solver_t* s, operating_point_t* pt,
+                      bool verbose)
+{
+    if(!s->factorization_checked)
+    {
+        if(s->factorization != NULL &&
+           !factorization_pattern_matches(s, pt))
+            cholmod_free_factor(&s->factorization, &s->common);
+
+        if(s->factorization != NULL)
+            MRCAL_TRACE(MRCAL_TRACE_CHOLMOD_CACHE,
+                        "Refactoring the %dx%d Jt of the previous solve in place",
+                        s->Nstate, s->Nmeasurements);
+        else
+        {
+            s->factorization = _mrcal_cholmod_analyze_cached(&pt->Jt, &s->common);
+            if(s->factorization == NULL)
+            {
+                MSG("Couldn't analyze JtJ");
+                return false;
+            }
+
+            const int nnz = pt->Jt_p[s->Nmeasurements];
+            try
+            {
+                s->factorization_p.assign(pt->Jt_p.begin(), pt->Jt_p.begin() + s->Nmeasurements+1);
+                s->factorization_i.assign(pt->Jt_i.begin(), pt->Jt_i.begin() + nnz);
+            }
+            catch(...)
+            {
+                MSG("Couldn't allocate the sparsity pattern");
+                cholmod_free_factor(&s->factorization, &s->common);
+                return false;
+            }
+            s->factorization_nrow = s->Nstate;
+        }
+        s->factorization_checked = true;
+    }
+
+    while(true)
+    {
+        bool result;
+        if(s->lambda == 0.0)
+            result = cholmod_factorize(&pt->Jt, s->factorization, &s->common);
+        else
+        {
+            double beta[] = { s->lambda, 0.0 };
+            result = cholmod_factorize_p(&pt->Jt, beta, NULL, 0,
+                                         s->factorization, &s->common);
+        }
+        if(!result)
+        {
+            MSG("cholmod_factorize() failed");
+            return false;
+        }
+
+        if(s->factorization->minor == s->factorization->n)
+            return true;
+
+        // Singular JtJ. Raise lambda and go again
+        s->lambda = s->lambda == 0.0 ? 1e-10 : s->lambda*10.0;
+        if(!isfinite(s->lambda))
+        {
+            MSG("JtJ is singular, and no amount of regularization helps. Giving up");
+            return false;
+        }
+        if(verbose)
+            MSG("dogleg solver: singular JtJ. Have rank/full rank: %zd/%d. Adding %g I from now on",
+                (size_t)s->factorization->minor, s->Nstate, s->lambda);
+    }
+}
+
+// The Gauss-Newton step: the minimum of the quadratic model of norm2(x):
+// -inv(JtJ) Jt x
+static bool compute_step_gn(operating_point_t* pt,
+                            _mrcal_dogleg_solver_t* s,
+                            bool verbose)
+{
+    if(!factorize(s, pt, verbose))
+        return false;
+
+    cholmod_dense b = {
+        .nrow  = (size_t)s->Nstate,
+        .ncol  = 1,
+        .nzmax = (size_t)s->Nstate,
+        .d     = (size_t)s->Nstate,
+        .x     = pt->Jt_x.data(),
+        .xtype = CHOLMOD_REAL,
+        .dtype = CHOLMOD_DOUBLE };
+    cholmod_dense out = {
+        .nrow  = (size_t)s->Nstate,
+        .ncol  = 1,
+        .nzmax = (size_t)s->Nstate,
+        .d     = (size_t)s->Nstate,
+        .x     = pt->step_gn.data(),
+        .xtype = CHOLMOD_REAL,
+        .dtype = CHOLMOD_DOUBLE };
+    cholmod_dense* M = &out;
+
+    if(!cholmod_solve2(CHOLMOD_A, s->factorization,
+                       &b, NULL,
+                       &M, NULL, &s->solve_Y, &s->solve_E,
+                       &s->common))
+    {
+        MSG("cholmod_solve2() failed");
+        return false;
+    }
+    if(M != &out)
+    {
+        MSG("cholmod_solve2() reallocated its output");
+        cholmod_free_dense(&M, &s->common);
+        return false;
+    }
+
+    double norm2 = 0.0;
+    for(int i=0; i<s->Nstate; i++)
+    {
+        pt->step_gn[i] *= -1.0;
+        norm2 += pt->step_gn[i]*pt->step_gn[i];
+    }
+    pt->step_gn_norm2 = norm2;
+    pt->have_step_gn  = true;
+    return true;
+}
+
+// Computes the dogleg step from "from", within the given trust region, and
+// writes the new point into to->p. On success, *expected_improvement is the
+// reduction in norm2(x) predicted by the linear model. If the step is too
+// small to bother with, it is <0 instead: we're done. Returns false on error
+static bool take_step(// out
+                      double* expected_improvement,
+                      operating_point_t* to,
+
+                      // in, out
+                      operating_point_t* from,
+                      _mrcal_dogleg_solver_t* s,
+
+                      // in
+                      double trustregion,
+                      const dogleg_parameters2_t* parameters)
+{
+    const int Nstate = s->Nstate;
+    double*   step   = s->step.data();
+
+    if(!from->have_step_cauchy)
+        compute_step_cauchy(from, s);
+
+    if(from->step_cauchy_norm2 >= trustregion*trustregion)
+    {
+        // The Cauchy point is outside the trust region. I go as far as I can
+        // in the steepest-descent direction
+        const double k = sqrt(trustregion*trustregion / from->step_cauchy_norm2);
+        for(int i=0; i<Nstate; i++)
+            step[i] = k*from->step_cauchy[i];
+        from->step_to_edge = true;
+    }
+    else
+    {
+        if(!from->have_step_gn &&
+           !compute_step_gn(from, s, parameters->dogleg_debug != 0))
+            return false;
+
+        if(from->step_gn_norm2 <= trustregion*trustregion)
+        {
+            memcpy(step, from->step_gn.data(), Nstate*sizeof(double));
+            from->step_to_edge = false;
+        }
+        else
+        {
+            // The dogleg: from the Cauchy point towards the Gauss-Newton
+            // point, until we hit the edge of the trust region. With
+            // a = gn - cauchy and b = cauchy, I solve
+            //
+            //   norm2(b + k a) = trustregion^2
+            //   norm2(a) k^2 + 2 inner(a,b) k + norm2(b) - trustregion^2 = 0
+            double norm2_a = 0.0;
+            double inner_ab = 0.0;
+            for(int i=0; i<Nstate; i++)
+            {
+                const double a = from->step_gn[i] - from->step_cauchy[i];
+                norm2_a  += a*a;
+                inner_ab += a*from->step_cauchy[i];
+            }
+            const double c = from->step_cauchy_norm2 - trustregion*trustregion;
+            const double k = (sqrt(inner_ab*inner_ab - norm2_a*c) - inner_ab) / norm2_a;
+            for(int i=0; i<Nstate; i++)
+                step[i] = from->step_cauchy[i] + k*(from->step_gn[i] - from->step_cauchy[i]);
+            from->step_to_edge = true;
+        }
+    }
+
+    bool step_is_small = true;
+    for(int i=0; i<Nstate; i++)
+    {
+        if(fabs(step[i]) > parameters->update_threshold)
+            step_is_small = false;
+        to->p[i] = from->p[i] + step[i];
+    }
+    if(step_is_small)
+    {
+        *expected_improvement = -1.0;
+        return true;
+    }
+
+    // norm2(x) - norm2(x + J step) = -2 inner(Jt x, step) - norm2(J step)
+    double inner_Jt_x_step = 0.0;
+    for(int i=0; i<Nstate; i++)
+        inner_Jt_x_step += from->Jt_x[i]*step[i];
+    *expected_improvement =
+        -2.0*inner_Jt_x_step - norm2_J_v(from, s->Nmeasurements, step);
+    return true;
+}
+
+_mrcal_dogleg_solver_t* _mrcal_dogleg_solver_create(void)
+{
+    return new(std::nothrow) _mrcal_dogleg_solver_t{};
+}
+
+void _mrcal_dogleg_solver_free(_mrcal_dogleg_solver_t* s)
+{
+    if(s == NULL)
+        return;
+    if(s->inited_common)
+    {
+        if(s->factorization != NULL) cholmod_free_factor(&s->factorization, &s->common);
+        if(s->solve_Y       != NULL) cholmod_free_dense (&s->solve_Y,       &s->common);
+        if(s->solve_E       != NULL) cholmod_free_dense (&s->solve_E,       &s->common);
+        cholmod_finish(&s->common);
+    }
+    delete s;
+}
+
+const double* _mrcal_dogleg_solver_x(const _mrcal_dogleg_solver_t* s)
+{
+    return s->current->x.data();
+}
+
+double _mrcal_dogleg_optimize(// out, in
+                              double* p,
+                              _mrcal_dogleg_solver_t* s,
+
+                              // in
+                              int Nstate, int Nmeasurements, int N_j_nonzero,
+                              void (*f)(const double*   p,
+                                        double*         x,
+                                        cholmod_sparse* Jt,
+                                        void*           cookie),
+                              void* cookie,
+                              const dogleg_parameters2_t* parameters,
+                              _mrcal_solver_iteration_callback_t* iteration_callback,
+                              void* iteration_cookie)
+{
+    const bool verbose = parameters->dogleg_debug != 0;
+
+    if(!s->inited_common)
+    {
+        if(!cholmod_start(&s->common))
+        {
+            MSG("Error trying to cholmod_start");
+            return -1.0;
+        }
+        s->inited_common = true;
+
+        // As in libdogleg: I want to use the LGPL parts of CHOLMOD only, so I
+        // turn off the supernodal routines
+        s->common.supernodal = 0;
+    }
+
+    s->Nstate                = Nstate;
+    s->Nmeasurements         = Nmeasurements;
+    s->current               = &s->points[0];
+    s->trial                 = &s->points[1];
+    s->lambda                = 0.0;
+    s->Nevaluations          = 0;
+    s->factorization_checked = false;
+
+    if(!operating_point_init(s->current, Nstate, Nmeasurements, N_j_nonzero) ||
+       !operating_point_init(s->trial,   Nstate, Nmeasurements, N_j_nonzero))
+    {
+        MSG("Couldn't allocate the operating points");
+        return -1.0;
+    }
+    try
+    {
+        s->step.resize(Nstate);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the step");
+        return -1.0;
+    }
+
+    memcpy(s->current->p.data(), p, Nstate*sizeof(double));
+    bool done = evaluate(s->current, s, f, cookie, parameters);
+    if(verbose)
+        MSG("dogleg solver: initial norm2(x)=%.10g", s->current->norm2_x);
+    if(done && verbose)
+        MSG("dogleg solver: converged. Jt x is small at the seed");
+
+    double trustregion = parameters->trustregion0;
+
+    _mrcal_solver_iteration_t report = { .iteration    = 0,
+                                         .Nevaluations = s->Nevaluations,
+                                         .norm2_x      = s->current->norm2_x,
+                                         .step_norm    = -1.0,
+                                         .trustregion  = trustregion };
+    if(iteration_callback != NULL &&
+       !iteration_callback(&report, iteration_cookie))
+    {
+        if(verbose)
+            MSG("dogleg solver: stopped by the caller");
+        done = true;
+    }
+
+    for(int iteration=0;
+        !done && iteration<parameters->max_iterations;
+        iteration++)
+    {
+        // Try smaller and smaller steps until one of them improves things
+        while(true)
+        {
+            double expected_improvement;
+            if(!take_step(&expected_improvement, s->trial,
+                          s->current, s, trustregion, parameters))
+                return -1.0;
+            if(expected_improvement < 0.0)
+            {
+                if(verbose)
+                    MSG("dogleg solver: converged. The step is small");
+                done = true;
+                break;
+            }
+
+            const bool done_after = evaluate(s->trial, s, f, cookie, parameters);
+
+            const double improvement = s->current->norm2_x - s->trial->norm2_x;
+            const double rho         = improvement / expected_improvement;
+
+            if(verbose)
+                MSG("dogleg solver: iteration %d: norm2(x)=%.10g, trial norm2(x)=%.10g, trustregion=%g, rho=%g",
+                    iteration, s->current->norm2_x, s->trial->norm2_x,
+                    trustregion, rho);
+
+            // The NaN-safe comparison: a non-finite trial point shrinks the
+            // trust region too
+            if(!(rho >= parameters->trustregion_decrease_threshold))
+            {
+                // The model doesn't fit well. If the trust region didn't limit
+                // the step, I first drop it to the size of the step we took
+                if(!s->current->step_to_edge)
+                    trustregion = sqrt(s->current->step_gn_norm2);
+                trustregion *= parameters->trustregion_decrease_factor;
+            }
+            else if(rho > parameters->trustregion_increase_threshold &&
+                    s->current->step_to_edge)
+                trustregion *= parameters->trustregion_increase_factor;
+
+            if(rho > 0.0)
+            {
+                std::swap(s->current, s->trial);
+                if(done_after)
+                {
+                    if(verbose)
+                        MSG("dogleg solver: converged. Jt x is small");
+                    done = true;
+                }
+
+                if(iteration_callback != NULL)
+                {
+                    double step_norm2 = 0.0;
+                    for(int i=0; i<Nstate; i++)
+                    {
+                        const double d = s->current->p[i] - s->trial->p[i];
+                        step_norm2 += d*d;
+                    }
+                    report = _mrcal_solver_iteration_t{ .iteration    = iteration+1,
+                                                        .Nevaluations = s->Nevaluations,
+                                                        .norm2_x      = s->current->norm2_x,
+                                                        .step_norm    = sqrt(step_norm2),
+                                                        .trustregion  = trustregion };
+                    if(!iteration_callback(&report, iteration_cookie))
+                    {
+                        if(verbose)
+                            MSG("dogleg solver: stopped by the caller");
+                        done = true;
+                    }
+                }
+                break;
+            }
+
+            if(trustregion < parameters->trustregion_threshold)
+            {
+                if(verbose)
+                    MSG("dogleg solver: converged. The trust region is small: %g", trustregion);
+                done = true;
+                break;
+            }
+        }
+    }
+
+    memcpy(p, s->current->p.data(), Nstate*sizeof(double));
+    return s->current->norm2_x;
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#pragma once
+
+// This is an internal header for the sparse dogleg solver. Not to be seen by
+// the end-users or installed
+//
+// A least-squares solver for sparse problems: Powell's dogleg method, with the
+// Gauss-Newton steps computed by CHOLMOD. This is the algorithm libdogleg
+// implements, with the same parameters and the same convergence criteria.
+// mrcal_optimize() uses libdogleg itself. This solver is used where libdogleg
+// can't do the job: the calibration sessions, and the solves that report each
+// iteration to the user.
+//
+// dogleg_optimize2() creates a new solver context in each call and frees it at
+// the end, so nothing can be carried from one solve to the next. Here the
+// solver object owns all the state, and it persists:
+//
+// - JtJ is refactored in place. The symbolic analysis is reused for as long as
+//   the sparsity pattern of the Jacobian stays the same: across iterations,
+//   outlier-rejection passes and solves
+// - When the pattern changes, the new analysis comes from the cache in
+//   cholmod-cache.h
+// - The operating points and the scratch memory are reused, and grown as
+//   needed
+//
+// The interface mirrors dogleg_optimize2(): the same callback, and the same
+// dogleg_parameters2_t. Additionally, the caller may be told about each
+// iteration, and may stop the solve
+
+#include <stdbool.h>
+#include <dogleg.h>
+
+typedef struct _mrcal_dogleg_solver_t _mrcal_dogleg_solver_t;
+
+// Reported by the solvers (this one and the one in schur-solver.h) at the seed,
+// and after each accepted step
+typedef struct
+{
+    // 0 for the seed. Then 1, 2, ... for each accepted step
+    int    iteration;
+    // How many times the problem has been evaluated. Each rejected step
+    // costs an evaluation too
+    int    Nevaluations;
+    // norm2(x) at the current operating point: the point we return if we stop
+    // now
+    double norm2_x;
+    // The length of the accepted step. <0 for the seed
+    double step_norm;
+    // The trust-region radius for the next step. <0 if the solver doesn't know
+    // it yet
+    double trustregion;
+} _mrcal_solver_iteration_t;
+
+// Returns true to keep going, or false to stop the solve. A stopped solve
+// succeeds, and returns the current operating point
+typedef bool (_mrcal_solver_iteration_callback_t)(const _mrcal_solver_iteration_t* iteration,
+                                                  void* cookie);
+
+// Returns NULL on error. Must be freed with _mrcal_dogleg_solver_free(). A
+// solver may be used for any number of _mrcal_dogleg_optimize() calls
+_mrcal_dogleg_solver_t* _mrcal_dogleg_solver_create(void);
+void _mrcal_dogleg_solver_free(_mrcal_dogleg_solver_t* solver);
+
+// Solves the problem, starting at the seed in p. On success p contains the
+// optimum, and we return norm2(x) at the optimum. On error we return <0
+double _mrcal_dogleg_optimize(// out, in
+                              double* p,
+                              _mrcal_dogleg_solver_t* solver,
+
+                              // in
+                              int Nstate, int Nmeasurements, int N_j_nonzero,
+                              void (*f)(const double*   p,
+                                        double*         x,
+                                        cholmod_sparse* Jt,
+                                        void*           cookie),
+                              void* cookie,
+                              const dogleg_parameters2_t* parameters,
+                              // May be NULL
+                              _mrcal_solver_iteration_callback_t* iteration_callback,
+                              void* iteration_cookie);
+
+// The measurement vector x at the optimum found by the latest
+// _mrcal_dogleg_optimize(). Nmeasurements of these. Valid until the next
+// _mrcal_dogleg_optimize() or _mrcal_dogleg_solver_free()
+const double* _mrcal_dogleg_solver_x(const _mrcal_dogleg_solver_t* solver);
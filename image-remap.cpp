@@ -0,0 +1,312 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "mrcal-image.h"
+#include "parallel.h"
+#include "util.h"
+#include "image-remap.h"
+
+// Don't bother with threads unless each one gets at least this many output
+// pixels
+#define NPIXELS_PER_THREAD_MIN 65536
+
+// The rows are split across threads in tiles of this many rows
+#define NROWS_PER_TILE         16
+
+// Output pixels are processed in blocks of this many. The coordinates and
+// weights of a whole block are computed first, in simple branch-free loops that
+// the compiler vectorizes. The pixel gathers happen afterwards
+#define REMAP_BLOCK            64
+
+// The channels of each pixel type. Each channel is sampled independently
+template<typename T> struct pixel_traits;
+template<> struct pixel_traits<uint8_t>
+{
+    typedef uint8_t channel_t;
+    static const int Nchannels = 1;
+};
+template<> struct pixel_traits<uint16_t>
+{
+    typedef uint16_t channel_t;
+    static const int Nchannels = 1;
+};
+template<> struct pixel_traits<bgr_t>
+{
+    typedef uint8_t channel_t;
+    static const int Nchannels = 3;
+};
+
+// I is the mrcal_image_..._t type that contains pixels of type T
+template<typename T, typename I>
+static inline const typename pixel_traits<T>::channel_t*
+pixel_at(const I* image, int x, int y)
+{
+    return (const typename pixel_traits<T>::channel_t*)
+        &((const uint8_t*)image->data)[(size_t)y*image->stride + (size_t)x*sizeof(T)];
+}
+
+// Bilinear interpolation at integer pixel (ix,iy) with the given weights. The
+// caller has already checked that the sample point is within 1 pixel of the
+// image. Neighbors outside the image contribute 0
+template<typename T, typename I>
+static inline void sample_bilinear(// out
+                                   typename pixel_traits<T>::channel_t* out,
+                                   // in
+                                   const I* in,
+                                   int ix, int iy,
+                                   const float* w)
+{
+    typedef typename pixel_traits<T>::channel_t channel_t;
+    const int Nchannels = pixel_traits<T>::Nchannels;
+
+    float acc[Nchannels] = {};
+    if(ix >= 0 && iy >= 0 && ix+1 < in->w && iy+1 < in->h)
+    {
+        const channel_t* p0 = pixel_at<T>(in, ix, iy  );
+        const channel_t* p1 = pixel_at<T>(in, ix, iy+1);
+        for(int k=0; k<Nchannels; k++)
+            acc[k] =
+                w[0]*(float)p0[k] + w[1]*(float)p0[k+Nchannels] +
+                w[2]*(float)p1[k] + w[3]*(float)p1[k+Nchannels];
+    }
+    else
+    {
+        // On the edge. Some of the neighbors are outside, and contribute 0
+        for(int i=0; i<4; i++)
+        {
+            const int xi = ix + (i&1);
+            const int yi = iy + (i>>1);
+            if(xi < 0 || yi < 0 || xi >= in->w || yi >= in->h)
+                continue;
+            const channel_t* p = pixel_at<T>(in, xi, yi);
+            for(int k=0; k<Nchannels; k++)
+                acc[k] += w[i]*(float)p[k];
+        }
+    }
+
+    for(int k=0; k<Nchannels; k++)
+        out[k] = (channel_t)(acc[k] + 0.5f);
+}
+
+// Remaps row y of the output. map_row contains out->w (x,y) input-image
+// coordinates. Points more than 1 pixel outside the input image (or NaN) produce
+// 0
+template<typename T, typename I>
+static void remap_row(// out
+                      I* out,
+                      // in
+                      const I* in,
+                      const float* map_row,
+                      int y)
+{
+    typedef typename pixel_traits<T>::channel_t channel_t;
+    const int Nchannels = pixel_traits<T>::Nchannels;
+
+    const float W = (float)in->w;
+    const float H = (float)in->h;
+
+    channel_t* pout =
+        (channel_t*)&((uint8_t*)out->data)[(size_t)y*out->stride];
+
+    for(int x0=0; x0<out->w; x0+=REMAP_BLOCK)
+    {
+        const int N = std::min(REMAP_BLOCK, out->w - x0);
+        const float* m = &map_row[2*x0];
+
+        int   ix[REMAP_BLOCK], iy[REMAP_BLOCK];
+        bool  inside[REMAP_BLOCK];
+        float w[REMAP_BLOCK][4];
+
+        for(int i=0; i<N; i++)
+        {
+            const float qx = m[2*i + 0];
+            const float qy = m[2*i + 1];
+
+            // The negated comparison catches NaN too. Out-of-bounds points
+            // are moved to (0,0) to keep the integer conversion well-defined;
+            // they're written as 0 below
+            inside[i] = qx > -1.f && qy > -1.f && qx < W && qy < H;
+            const float xc = inside[i] ? qx : 0.f;
+            const float yc = inside[i] ? qy : 0.f;
+
+            const float fxi = floorf(xc);
+            const float fyi = floorf(yc);
+            ix[i] = (int)fxi;
+            iy[i] = (int)fyi;
+
+            const float fx = xc - fxi;
+            const float fy = yc - fyi;
+            w[i][0] = (1.f-fx)*(1.f-fy);
+            w[i][1] = fx      *(1.f-fy);
+            w[i][2] = (1.f-fx)*fy;
+            w[i][3] = fx      *fy;
+        }
+
+        channel_t* p = &pout[(size_t)x0*Nchannels];
+        for(int i=0; i<N; i++)
+        {
+            if(!inside[i])
+            {
+                for(int k=0; k<Nchannels; k++)
+                    p[i*Nchannels + k] = 0;
+                continue;
+            }
+            sample_bilinear<T>(&p[i*Nchannels], in, ix[i], iy[i], w[i]);
+        }
+    }
+}
+
+static int num_threads_for(int w, int h)
+{
+    return std::min(_mrcal_num_threads(0),
+                    std::max(1, (int)(((size_t)w*h) / NPIXELS_PER_THREAD_MIN)));
+}
+
+template<typename T, typename I>
+static bool remap(// out
+                  I* out,
+                  // in
+                  const I* in,
+                  const float* map)
+{
+    if(out->w <= 0 || out->h <= 0)
+        return true;
+
+    const int Ntiles   = (out->h + NROWS_PER_TILE-1) / NROWS_PER_TILE;
+    const int Nthreads = num_threads_for(out->w, out->h);
+
+    _mrcal_parallel_for(Ntiles, Nthreads,
+                        [&](int itile0, int itile1, int)
+                        {
+                            const int y0 = itile0 * NROWS_PER_TILE;
+                            const int y1 = std::min(itile1 * NROWS_PER_TILE, out->h);
+                            for(int y=y0; y<y1; y++)
+                                remap_row<T>(out, in,
+                                             &map[(size_t)y*out->w*2], y);
+                        });
+    return true;
+}
+
+template<typename T, typename I>
+static bool remap_sparse(// out
+                         I* out,
+                         // in
+                         const I* in,
+                         const float* map_sparse,
+                         int spacing)
+{
+    if(spacing <= 0)
+    {
+        MSG("spacing must be > 0. Got %d", spacing);
+        return false;
+    }
+    if(out->w <= 0 || out->h <= 0)
+        return true;
+
+    // Same as mrcal_rectification_maps_sparse_gridsize()
+    const int Naz_grid = (out->w - 1 + spacing-1) / spacing + 1;
+
+    const int Ntiles   = (out->h + NROWS_PER_TILE-1) / NROWS_PER_TILE;
+    const int Nthreads = num_threads_for(out->w, out->h);
+
+    // Per thread: one row of the grid, interpolated vertically, followed by one
+    // full row of the map, interpolated horizontally from that
+    const size_t Nscratch = (size_t)(Naz_grid + out->w)*2;
+    float* scratch_all = (float*)malloc((size_t)Nthreads*Nscratch*sizeof(float));
+    if(scratch_all == NULL)
+    {
+        MSG("Couldn't allocate the per-thread scratch");
+        return false;
+    }
+
+    _mrcal_parallel_for(Ntiles, Nthreads,
+                        [&](int itile0, int itile1, int ichunk)
+                        {
+                            float* gridrow = &scratch_all[(size_t)ichunk*Nscratch];
+                            float* maprow  = &gridrow[Naz_grid*2];
+
+                            const int y0 = itile0 * NROWS_PER_TILE;
+                            const int y1 = std::min(itile1 * NROWS_PER_TILE, out->h);
+                            for(int y=y0; y<y1; y++)
+                            {
+                                // The grid nodes sit on integer pixels, so the
+                                // interpolation weights are exact
+                                const int   iy = y / spacing;
+                                const float fy = (float)(y % spacing) / (float)spacing;
+
+                                const float* m0 = &map_sparse[(size_t)iy*Naz_grid*2];
+                                if(fy == 0.f)
+                                    memcpy(gridrow, m0, Naz_grid*2*sizeof(float));
+                                else
+                                {
+                                    const float* m1 = m0 + Naz_grid*2;
+                                    for(int k=0; k<Naz_grid*2; k++)
+                                        gridrow[k] = m0[k] + (m1[k] - m0[k])*fy;
+                                }
+
+                                for(int x=0; x<out->w; x++)
+                                {
+                                    const int    ix = x / spacing;
+                                    const float  fx = (float)(x % spacing) / (float)spacing;
+                                    const float* q0 = &gridrow[ix*2];
+
+                                    float qx = q0[0];
+                                    float qy = q0[1];
+                                    if(fx != 0.f)
+                                    {
+                                        qx += (q0[2] - q0[0])*fx;
+                                        qy += (q0[3] - q0[1])*fx;
+                                    }
+                                    maprow[2*x + 0] = qx;
+                                    maprow[2*x + 1] = qy;
+                                }
+
+                                remap_row<T>(out, in, maprow, y);
+                            }
+                        });
+
+    free(scratch_all);
+    return true;
+}
+
+#define REMAP_DEFINE(T, Tname)                                          \
+bool mrcal_image_ ## Tname ## _remap(/* output */                       \
+                                     mrcal_image_ ## Tname ## _t* out,  \
+                                     /* input */                        \
+                                     const mrcal_image_ ## Tname ## _t* in, \
+                                     const float* map)                  \
+{                                                                       \
+    return remap<T>(out, in, map);                                      \
+}                                                                       \
+bool mrcal_image_ ## Tname ## _remap_sparse(/* output */                \
+                                            mrcal_image_ ## Tname ## _t* out, \
+                                            /* input */                 \
+                                            const mrcal_image_ ## Tname ## _t* in, \
+                                            const float* map_sparse,    \
+                                            int spacing)                \
+{                                                                       \
+    return remap_sparse<T>(out, in, map_sparse, spacing);               \
+}                                                                       \
+void _mrcal_image_ ## Tname ## _remap_row(void*        out,             \
+                                          const void*  in,              \
+                                          const float* map_row,         \
+                                          int          y)               \
+{                                                                       \
+    remap_row<T>((mrcal_image_ ## Tname ## _t*)out,                     \
+                 (const mrcal_image_ ## Tname ## _t*)in,                \
+                 map_row, y);                                           \
+}
+
+REMAP_DEFINE(uint8_t,  uint8)
+REMAP_DEFINE(uint16_t, uint16)
+REMAP_DEFINE(bgr_t,    bgr)
@@ -0,0 +1,38 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#pragma once
+
+// This is an internal header for the image remapping kernels. Not to be seen by
+// the end-users or installed
+//
+// The public mrcal_image_..._remap...() functions are built on these. They're
+// also used by mrcal_image_..._rectify() in stereo.c, which computes each row of
+// the rectification map, and immediately applies it with these functions. So
+// these are implemented in C++, and have C linkage
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Remaps row y of the output image "out" from the input image "in". map_row
+// contains out->w (x,y) pixel coordinates in the input image. "out" and "in"
+// point to mrcal_image_TYPE_t structures of the type in the function name.
+// These are thread-safe, as long as different threads write different rows
+typedef void (_mrcal_image_remap_row_t)(void*        out,
+                                        const void*  in,
+                                        const float* map_row,
+                                        int          y);
+
+_mrcal_image_remap_row_t _mrcal_image_uint8_remap_row;
+_mrcal_image_remap_row_t _mrcal_image_uint16_remap_row;
+_mrcal_image_remap_row_t _mrcal_image_bgr_remap_row;
+
+#ifdef __cplusplus
+}
+#endif
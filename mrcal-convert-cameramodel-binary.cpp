@@ -0,0 +1,72 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Converts a .cameramodel file between the text and binary formats. The
+// direction is determined by the input: a text model is written as binary, and
+// a binary model is written as text. The values are written with full precision
+// in both directions, so converting a model and back again reproduces it exactly
+//
+// Usage: mrcal-convert-cameramodel-binary INPUT OUTPUT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mrcal.h"
+
+static bool is_binary(const char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    if(fp == NULL)
+        return false;
+
+    char magic[sizeof(MRCAL_CAMERAMODEL_BINARY_MAGIC)-1];
+    bool result =
+        1 == fread(magic, sizeof(magic), 1, fp) &&
+        0 == memcmp(magic, MRCAL_CAMERAMODEL_BINARY_MAGIC, sizeof(magic));
+    fclose(fp);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 3)
+    {
+        fprintf(stderr,
+                "Usage: %s INPUT OUTPUT\n"
+                "\n"
+                "Converts a text .cameramodel to the binary format, or a binary one to text\n",
+                argv[0]);
+        return 1;
+    }
+
+    const char* filename_in  = argv[1];
+    const char* filename_out = argv[2];
+
+    // mrcal_read_cameramodel_file() reads either format
+    const bool binary_in = is_binary(filename_in);
+    mrcal_cameramodel_t* cameramodel = mrcal_read_cameramodel_file(filename_in);
+    if(cameramodel == NULL)
+    {
+        fprintf(stderr, "Couldn't read the cameramodel from '%s'\n", filename_in);
+        return 1;
+    }
+
+    const bool result =
+        binary_in ?
+        mrcal_write_cameramodel_file       (filename_out, cameramodel) :
+        mrcal_write_cameramodel_binary_file(filename_out, cameramodel);
+    mrcal_free_cameramodel(&cameramodel);
+
+    if(!result)
+    {
+        fprintf(stderr, "Couldn't write the cameramodel to '%s'\n", filename_out);
+        return 1;
+    }
+    return 0;
+}
@@ -97,6 +97,41 @@ MRCAL_IMAGE_DECLARE(uint8_t,  uint8);
 MRCAL_IMAGE_DECLARE(uint16_t, uint16);
 MRCAL_IMAGE_DECLARE(bgr_t,    bgr);
 
+// Remap images
+//
+// mrcal_image_..._remap() takes a dense map of shape (out->h, out->w, Nxy=2)
+// containing the pixel coordinates in the input image for each output pixel.
+// This is what mrcal_rectification_maps() produces for each camera
+//
+// mrcal_image_..._remap_sparse() takes a sparse map from
+// mrcal_rectification_maps_sparse(). map_sparse is the map for ONE camera: a
+// dense array of shape (Nel_grid, Naz_grid, Nxy=2). The grid size is given by
+// mrcal_rectification_maps_sparse_gridsize() with imagersize = (out->w,
+// out->h). The map is interpolated bilinearly on the fly, so the full map is
+// never stored
+//
+// In both cases the input image is sampled bilinearly, and anything outside of
+// it reads as 0. This matches mrcal.transform_image() with its default
+// settings. Large images are processed in parallel, in row tiles. To rectify a
+// stereo pair without computing any maps at all, see mrcal_image_..._rectify()
+// in stereo.h
+#define MRCAL_IMAGE_REMAP_DECLARE(T, Tname)                             \
+bool mrcal_image_ ## Tname ## _remap(/* output */                       \
+                                     mrcal_image_ ## Tname ## _t* out,  \
+                                     /* input */                        \
+                                     const mrcal_image_ ## Tname ## _t* in, \
+                                     const float* map);                 \
+bool mrcal_image_ ## Tname ## _remap_sparse(/* output */                \
+                                            mrcal_image_ ## Tname ## _t* out, \
+                                            /* input */                 \
+                                            const mrcal_image_ ## Tname ## _t* in, \
+                                            const float* map_sparse,    \
+                                            int spacing);
+
+MRCAL_IMAGE_REMAP_DECLARE(uint8_t,  uint8);
+MRCAL_IMAGE_REMAP_DECLARE(uint16_t, uint16);
+MRCAL_IMAGE_REMAP_DECLARE(bgr_t,    bgr);
+
 // Load the image into whatever type is stored on disk
 bool mrcal_image_anytype_load(// output
                               // This is ONE of the known types
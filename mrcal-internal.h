@@ -24,12 +24,22 @@ typedef struct {} mrcal_LENSMODEL_CAHVOR__precomputed_t;
 typedef struct {} mrcal_LENSMODEL_CAHVORE__precomputed_t;
 
 // The splined stereographic models configuration parameters can be used to
-// compute the segment size. I cache this computation
+// compute the segment size and the knot layout. I cache these computations
 typedef struct
 {
     // The distance between adjacent knots (1 segment) is u_per_segment =
     // 1/segments_per_u
     double segments_per_u;
+
+    // The knots are evenly spaced, and centered at u=0. The knot-index
+    // coordinates of a point u are
+    //
+    //   ix = u.x*segments_per_u + ix_center
+    //   iy = u.y*segments_per_u + iy_center
+    //
+    // So knot (ix,iy) sits at u = ( (ix-ix_center)/segments_per_u,
+    //                               (iy-iy_center)/segments_per_u )
+    double ix_center, iy_center;
 } mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed_t;
 
 typedef struct
@@ -64,8 +74,9 @@ bool _mrcal_project_internal( // out
                              // array of shape (N,2,Nintrinsics). This is a DENSE array.
                              // High-parameter-count lens models have very sparse
                              // gradients here, and the internal project() function
-                             // returns those sparsely. For now THIS function densifies
-                             // all of these
+                             // returns those sparsely. THIS function densifies all
+                             // of these. mrcal_project_sparse_intrinsics_gradients()
+                             // reports the sparse form
                              double*   dq_dintrinsics,
 
                              // in
@@ -77,6 +88,20 @@ bool _mrcal_project_internal( // out
 
                              int Nintrinsics,
                              const mrcal_projection_precomputed_t* precomputed);
+// Projects N points with a MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC model. No
+// gradients. The points are processed in blocks: the spline basis weights of a
+// whole block are computed together, and then applied to the control points.
+// Produces the same results as _mrcal_project_internal()
+void _mrcal_project_internal_splined( // out
+                                     mrcal_point2_t* q,
+
+                                     // in
+                                     const mrcal_point3_t* p,
+                                     int N,
+                                     const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__config_t* config,
+                                     // core, control points concatenated
+                                     const double* intrinsics,
+                                     const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed_t* precomputed);
 void _mrcal_precompute_lensmodel_data(mrcal_projection_precomputed_t* precomputed,
                                       const mrcal_lensmodel_t* lensmodel);
 bool _mrcal_unproject_internal( // out
@@ -102,3 +127,53 @@ int _mrcal_num_j_nonzero(int Nobservations_board,
                          const mrcal_observation_point_t* observations_point,
                          mrcal_problem_selections_t problem_selections,
                          const mrcal_lensmodel_t* lensmodel);
+
+// Parses the contents of a binary .cameramodel file in buf. "what" identifies
+// the data in the error messages. Returns a malloc()-ed copy, like
+// mrcal_read_cameramodel_file()
+mrcal_cameramodel_t* _mrcal_read_cameramodel_binary_buffer(const void* buf, size_t size,
+                                                           const char* what);
+
+// Same as mrcal_read_cameramodel_files(), but also reports the precomputed
+// projection data of each model, ready to be passed to _mrcal_project_internal().
+// These come out of the cache too. precomputed may be NULL
+bool _mrcal_read_cameramodel_files_precomputed(// output
+                                               mrcal_cameramodel_t** cameramodels,
+                                               mrcal_projection_precomputed_t* precomputed,
+                                               // input
+                                               const char* const* filenames,
+                                               int N);
+
+// How many models the cameramodel cache holds, and how many lookups hit and
+// missed since the last mrcal_cameramodel_cache_clear(). For the tests
+#define MRCAL_CAMERAMODEL_CACHE_NENTRIES 256
+void _mrcal_cameramodel_cache_stats(// output
+                                    unsigned long* Nhits,
+                                    unsigned long* Nmisses);
+
+// Same as mrcal_drt_ref_refperturbed__dbpacked_no_ie(), but with an explicit
+// thread count. Nthreads <= 0 picks it from the problem size and the available
+// cores, like mrcal_drt_ref_refperturbed__dbpacked_no_ie() does. The results
+// don't depend on Nthreads. For the tests
+bool _mrcal_drt_ref_refperturbed__dbpacked_no_ie(// output
+                                                 double* K,
+                                                 int K_stride0,
+                                                 int K_stride1,
+
+                                                 // inputs
+                                                 const double* b_packed,
+                                                 int buffer_size_b_packed,
+                                                 struct cholmod_sparse_struct* Jt,
+
+                                                 int Ncameras_intrinsics, int Ncameras_extrinsics, int Nframes,
+                                                 int Npoints, int Npoints_fixed,
+                                                 int Nobservations_board,
+                                                 int Nobservations_point,
+
+                                                 const mrcal_lensmodel_t* lensmodel,
+                                                 mrcal_problem_selections_t problem_selections,
+
+                                                 int calibration_object_width_n,
+                                                 int calibration_object_height_n,
+
+                                                 int Nthreads);
@@ -23,6 +23,7 @@
 #include "mrcal.h"
 #include "mrcal-image.h"
 #include "stereo.h"
+#include "cholmod-cache.h"
 
 #define IS_NULL(x) ((x) == NULL || (PyObject*)(x) == Py_None)
 
@@ -282,11 +283,13 @@ _CHOLMOD_factorization_init_from_cholmod_sparse(CHOLMOD_factorization* self, cho
 #endif
     }
 
-    self->factorization = cholmod_analyze(Jt, &self->common);
+    // Repeated calibrations of the same rig produce the same sparsity pattern,
+    // so the symbolic analysis is usually cached
+    self->factorization = _mrcal_cholmod_analyze_cached(Jt, &self->common);
 
     if(self->factorization == NULL)
     {
-        BARF("cholmod_analyze() failed");
+        BARF("_mrcal_cholmod_analyze_cached() failed");
         return false;
     }
     if( !cholmod_factorize(Jt, self->factorization, &self->common) )
@@ -1467,6 +1470,8 @@ PyObject* _optimize(optimizemode_t optimizemode,
                                 calibration_object_width_n,
                                 calibration_object_height_n,
                                 verbose,
+                                NULL, // the default solver options
+                                NULL, NULL, // no progress reports
 
                                 false);
 
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
 #include "basic-geometry.h"
@@ -165,6 +166,17 @@ typedef struct
     MRCAL_LENSMODEL_META_LIST(_MRCAL_ITEM_DEFINE_ELEMENT, )
 } mrcal_lensmodel_metadata_t;
 
+// The layout of the sparse intrinsics gradients reported by
+// mrcal_project_sparse_intrinsics_gradients(). Each projected point depends on
+// a run_side_length x run_side_length patch of control points; the rows of this
+// patch are ivar_stridey apart in the intrinsics vector. Query with
+// mrcal_gradient_sparse_meta()
+typedef struct
+{
+    int run_side_length;
+    int ivar_stridey;
+} mrcal_gradient_sparse_meta_t;
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //////////////////// Optimization
@@ -270,6 +282,131 @@ typedef struct
     double  point_max_range;
 } mrcal_problem_constants_t;
 
+// How mrcal_optimize() solves the linear system in each step
+typedef enum
+{
+    // The full sparse JtJ is factored with CHOLMOD, in a dogleg loop.
+    // mrcal_optimize() uses libdogleg. The calibration sessions and the solves
+    // that report their progress use mrcal's own implementation of the same
+    // algorithm: it keeps its factorization across solves, and reports each
+    // iteration. Works for any problem
+    MRCAL_SOLVER_SPARSE_CHOLMOD = 0,
+
+    // The frame poses and discrete points are eliminated with a Schur
+    // complement, and the remaining intrinsics, extrinsics and calobject_warp
+    // system is solved densely, in a Levenberg-Marquardt loop. Much faster and
+    // smaller for problems with many frames and a modest number of cameras.
+    // The dense system is (Nintrinsics_state + Nextrinsics_state)^2, so this
+    // is NOT a good choice for many cameras with splined models. If that
+    // system has more than 1000 variables, MRCAL_SOLVER_SPARSE_CHOLMOD is used
+    // instead
+    MRCAL_SOLVER_SCHUR
+} mrcal_solver_t;
+
+// Named sets of mrcal_solver_options_t. Produced by
+// mrcal_solver_options_preset()
+typedef enum
+{
+    // What mrcal has always used: high accuracy and fast convergence, without
+    // serious concern for performance
+    MRCAL_SOLVER_PRESET_DEFAULT = 0,
+
+    // For real-time recalibration: a coarser optimum, fewer iterations, and
+    // at most one re-solve after outlier rejection. Meant for updating a good
+    // seed, such as a previous solution
+    MRCAL_SOLVER_PRESET_FAST,
+
+    // For offline runs: tighter convergence, and more iterations allowed
+    MRCAL_SOLVER_PRESET_PRECISE
+} mrcal_solver_preset_t;
+
+// How mrcal_optimize() solves the problem. Get one of these from
+// mrcal_solver_options_preset(), and adjust it as needed
+typedef struct
+{
+    mrcal_solver_t solver;
+
+    // How many threads to use to evaluate the optimization callback. <=0 means
+    // "use all the available cores". The results are identical regardless of
+    // this setting
+    int Nthreads;
+
+    // The convergence criteria, passed through to the solver. We stop after
+    // max_iterations, or when the step is shorter than update_threshold, or
+    // when the largest element of the gradient Jt x is smaller than
+    // Jt_x_threshold, or when the trust region shrinks below
+    // trustregion_threshold. A threshold of 0 disables that check.
+    // MRCAL_SOLVER_SCHUR has no explicit trust region: it stops when a rejected
+    // step is shorter than trustregion_threshold
+    int    max_iterations;
+    double update_threshold;
+    double Jt_x_threshold;
+    double trustregion_threshold;
+
+    // Outlier rejection. Applies only if
+    // problem_selections.do_apply_outlier_rejection. After a solve, the
+    // residual stdev is computed. If any feature is more than outlier_k1
+    // stdevs off, we throw out all the features that are more than outlier_k0
+    // stdevs off, and solve again. outlier_k0 <= outlier_k1
+    double outlier_k0;
+    double outlier_k1;
+    // How many times we may solve again after throwing out outliers. <0 means
+    // "as many as needed"
+    int    max_outlier_passes;
+} mrcal_solver_options_t;
+
+// Reported to the mrcal_optimizer_progress_callback_t while the optimizer runs
+typedef struct
+{
+    // Which solve this is. 0 for the initial solve. Each outlier-rejection
+    // pass that finds new outliers starts another one
+    int    ipass;
+
+    // The solver iteration in this pass. 0 for the seed, then 1, 2, ... after
+    // each accepted step
+    int    iteration;
+
+    // How many times the solver has evaluated the problem in this pass. Once
+    // per iteration, plus once per rejected step
+    int    Nevaluations;
+
+    // false for the per-iteration reports. true for the one report at the end
+    // of each pass, after the outlier rejection ran
+    bool   pass_done;
+
+    // Only valid if pass_done. true if new outliers were found, so another
+    // pass will follow, unless the callback stops the solve
+    bool   more_passes;
+
+    // norm2 of the measurement vector at the current solver state. This is
+    // what we end up with if we stop now
+    double norm2_error;
+
+    // The length of the step just accepted, in the (packed, unitless) state
+    // space. <0 for the seed, and for the pass_done reports
+    double step_norm;
+
+    // The trust-region radius the solver will use for its next step, in the
+    // same space. MRCAL_SOLVER_SCHUR has no explicit trust region: it reports
+    // the length of the accepted step, which its damping limited it to. <0 if
+    // not known: the seed of a MRCAL_SOLVER_SCHUR solve, and the pass_done
+    // reports
+    double trustregion;
+
+    // How many board features are currently marked as outliers
+    int    Noutliers;
+
+    // Wall time since the start of the solve
+    double elapsed__s;
+} mrcal_optimizer_progress_t;
+
+// The progress callback passed to mrcal_optimize(). Called from the thread
+// running the solve. Return true to keep going, or false to stop the solve
+// early. A stopped solve still succeeds: it returns the state in the last report,
+// and sets mrcal_stats_t.stopped_early
+typedef bool (mrcal_optimizer_progress_callback_t)(const mrcal_optimizer_progress_t* progress,
+                                                   void* cookie);
+
 
 // An X-macro-generated mrcal_stats_t. This structure is returned by the
 // optimizer, and contains some statistics about the optimization
@@ -283,7 +420,25 @@ typedef struct
     /* How many pixel observations were thrown out as outliers. Each pixel */ \
     /* observation produces two measurements. Note that this INCLUDES any */ \
     /* outliers that were passed-in at the start */                     \
-    _(int,            Noutliers,                  PyLong_FromLong)
+    _(int,            Noutliers,                  PyLong_FromLong)      \
+                                                                        \
+    /* How many times the optimizer evaluated the measurements and the */ \
+    /* jacobian */                                                      \
+    _(int,            Ncallbacks,                 PyLong_FromLong)      \
+                                                                        \
+    /* How many heap allocations were made to set up the scratch memory */ \
+    /* used by the callback. This is done once, before the solve */     \
+    _(int,            Nallocations_workspace,     PyLong_FromLong)      \
+                                                                        \
+    /* How many heap allocations the callback made while running. This */ \
+    /* should be 0: all the memory comes from the workspace */          \
+    _(int,            Nallocations_callback,      PyLong_FromLong)      \
+                                                                        \
+    /* Total wall time spent in the callback, over all the invocations */ \
+    _(double,         time_callback__s,           PyFloat_FromDouble)   \
+                                                                        \
+    /* 1 if the progress callback stopped the solve before it converged */ \
+    _(int,            stopped_early,              PyBool_FromLong)
 #define MRCAL_STATS_ITEM_DEFINE(type, name, pyconverter) type name;
 typedef struct
 {
@@ -340,3 +495,71 @@ typedef union                                           \
 
 MRCAL_LENSMODEL_NOCONFIG_LIST(                 DEFINE_mrcal_cameramodel_MODEL_t)
 MRCAL_LENSMODEL_WITHCONFIG_STATIC_NPARAMS_LIST(DEFINE_mrcal_cameramodel_MODEL_t)
+
+// A camera model read from a binary .cameramodel file with
+// mrcal_map_cameramodel_binary_file(). The intrinsics are NOT copied: they
+// point into a read-only mapping of the file, which stays alive until
+// mrcal_unmap_cameramodel_binary_file() is called
+typedef struct
+{
+    MRCAL_CAMERAMODEL_ELEMENTS_NO_INTRINSICS;
+    int               Nintrinsics;
+    const double*     intrinsics;
+
+    // The mapping. Used by mrcal_unmap_cameramodel_binary_file() only
+    void*             _mmap;
+    size_t            _mmap_size;
+} mrcal_cameramodel_mmapped_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////// Stereo
+////////////////////////////////////////////////////////////////////////////////
+
+// Configuration of mrcal_stereo_matching_sgm(). Get the defaults from
+// mrcal_stereo_matching_sgm_defaults(), and adjust as needed
+typedef struct
+{
+    // The disparities to search, in pixels: [disparity_min, disparity_min +
+    // Ndisparities). disparity_min >= 0
+    int disparity_min;
+    int Ndisparities;
+
+    // The smoothness penalties: P1 for a disparity change of 1 pixel between
+    // neighboring pixels, P2 for larger jumps. These are in units of the
+    // matching cost: the number of differing bits in the 62-bit census
+    // descriptors. 0 <= P1 <= P2 <= 4096
+    int P1;
+    int P2;
+
+    // A match is rejected if some other disparity (except the immediate
+    // neighbors of the best one) has a cost within this many percent of the best
+    // one. 0 disables this check
+    int uniqueness_percent;
+
+    // A match is rejected if the disparity computed from the right image
+    // disagrees by more than this many pixels. <0 disables this check
+    int lr_max_diff;
+} mrcal_stereo_matching_sgm_parameters_t;
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////// Diagnostics
+////////////////////////////////////////////////////////////////////////////////
+
+// The categories of diagnostic output that can be turned on with
+// mrcal_trace_set_categories(). This is only available if the library was
+// built with MRCAL_ENABLE_TRACE
+#define MRCAL_TRACE_CATEGORY_LIST(_)                                    \
+    /* The memory layout of the optimizer callback workspace */         \
+    _(OPTIMIZER_LAYOUT,         0)                                      \
+    /* The regularization scales and terms in the optimizer callback */ \
+    _(REGULARIZATION,           1)                                      \
+    /* Hits and misses in the CHOLMOD symbolic analysis cache */        \
+    _(CHOLMOD_CACHE,            2)                                      \
+    /* Hits and misses in the cameramodel cache */                      \
+    _(CAMERAMODEL_CACHE,        3)
+#define MRCAL_TRACE_CATEGORY_DEFINE(name, bit) MRCAL_TRACE_ ## name = 1U << (bit),
+typedef enum
+{
+    MRCAL_TRACE_CATEGORY_LIST(MRCAL_TRACE_CATEGORY_DEFINE)
+} mrcal_trace_category_t;
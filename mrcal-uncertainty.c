@@ -9,6 +9,7 @@
 #include <cholmod.h>
 
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 #include <stdarg.h>
 
@@ -16,6 +17,7 @@
 #include "minimath/minimath-extra.h"
 #include "util.h"
 #include "strides.h"
+#include "parallel.h"
 
 
 #warning "don't duplicate these"
@@ -192,6 +194,14 @@ For each frame, both of these expressions need
 
 I compute this in a loop, and accumulate in finish_Jcross_computations()
 
+Each frame is independent of the others, except for the calobject_warp
+columns of Jcross_t J_no_ie*, and for Jcross_t Jcross: these are sums over
+all the frames. So I process the frames in parallel. Each frame writes its
+own columns of K directly, and its contributions to the shared sums into its
+own partial accumulators. Those are added together at the end, in frame
+order, so the result doesn't depend on the number of threads or on their
+scheduling
+
 */
 
 static
@@ -200,6 +210,13 @@ void finish_Jcross_computations(// output
                                 int     Jcross_t__J_fcw_stride0_elems,
                                 // rows are assumed stored densely, so there is
                                 // no Jcross_t__J_fcw_stride1
+                                //
+                                // The calobject_warp columns of
+                                // Jcross_t__J_fcw. These are accumulated
+                                // across frames, so they're given separately:
+                                // the caller may accumulate them elsewhere
+                                double* Jcross_t__J_cw,
+                                int     Jcross_t__J_cw_stride0_elems,
                                 double* Jcross_t__Jcross,
 
                                 // input
@@ -210,7 +227,6 @@ void finish_Jcross_computations(// output
                                 const double* rt1_packed,
                                 int state_index_frame_current,
                                 int state_index_frame0,
-                                int state_index_calobject_warp0,
                                 int Nstate_noi_noe)
 {
     // I accumulated sum(outer(dx/drt_ref_frame,dx/drt_ref_frame)) into
@@ -289,8 +305,8 @@ void finish_Jcross_computations(// output
     double* D = &Jcross_t__J_fcw[3*Jcross_t__J_fcw_stride0_elems + state_index_frame_current-state_index_frame0 + 3];
 
     // for calobject_warp
-    double* Acw = &Jcross_t__J_fcw[0*Jcross_t__J_fcw_stride0_elems + state_index_calobject_warp0-state_index_frame0];
-    double* Ccw = &Jcross_t__J_fcw[3*Jcross_t__J_fcw_stride0_elems + state_index_calobject_warp0-state_index_frame0];
+    double* Acw = &Jcross_t__J_cw[0*Jcross_t__J_cw_stride0_elems];
+    double* Ccw = &Jcross_t__J_cw[3*Jcross_t__J_cw_stride0_elems];
 
     // I can compute Jcross_t Jcross from the blocks comprising Jcross_t
     // J_fcw. From above:
@@ -325,7 +341,7 @@ void finish_Jcross_computations(// output
         // Acw = drr_t Dinv S; ~
         // -> Acwt = St Dinv drr;
         mul_genNM_genML_accum(// transposed
-                              Acw, 1, Jcross_t__J_fcw_stride0_elems,
+                              Acw, 1, Jcross_t__J_cw_stride0_elems,
 
                               2,3,3,
                               // transposed
@@ -365,7 +381,7 @@ void finish_Jcross_computations(// output
             if(j<2)
             {
                 i = 0;
-                Acw[i*Jcross_t__J_fcw_stride0_elems + j] +=
+                Acw[i*Jcross_t__J_cw_stride0_elems + j] +=
                     (
                      /*skew[i*3 + 0]   + (  0)*sum_outer_jf_jcw_packed[(0+3)*2 + j] */
                      /*skew[i*3 + 1]*/ + (-t2)*sum_outer_jf_jcw_packed[(1+3)*2 + j]
@@ -373,7 +389,7 @@ void finish_Jcross_computations(// output
                      ) / SCALE_TRANSLATION_FRAME;
 
                 i = 1;
-                Acw[i*Jcross_t__J_fcw_stride0_elems + j] +=
+                Acw[i*Jcross_t__J_cw_stride0_elems + j] +=
                     (
                      /*skew[i*3 + 0]*/ + ( t2)*sum_outer_jf_jcw_packed[(0+3)*2 + j]
                      /*skew[i*3 + 1]   + (  0)*sum_outer_jf_jcw_packed[(1+3)*2 + j] */
@@ -381,7 +397,7 @@ void finish_Jcross_computations(// output
                      ) / SCALE_TRANSLATION_FRAME;
 
                 i = 2;
-                Acw[i*Jcross_t__J_fcw_stride0_elems + j] +=
+                Acw[i*Jcross_t__J_cw_stride0_elems + j] +=
                     (
                      /*skew[i*3 + 0]*/ + (-t1)*sum_outer_jf_jcw_packed[(0+3)*2 + j]
                      /*skew[i*3 + 1]*/ + ( t0)*sum_outer_jf_jcw_packed[(1+3)*2 + j]
@@ -438,7 +454,7 @@ void finish_Jcross_computations(// output
         // and similar for calobject_warp
         for(int i=0; i<3; i++)
             for(int j=0; j<2; j++)
-                Ccw[i*Jcross_t__J_fcw_stride0_elems + j] +=
+                Ccw[i*Jcross_t__J_cw_stride0_elems + j] +=
                     sum_outer_jf_jcw_packed[(3+i)*2 + j]/SCALE_TRANSLATION_FRAME;
 
     }
@@ -514,38 +530,188 @@ void finish_Jcross_computations(// output
     memset(sum_outer_jf_jcw_packed, 0, 6*2      *sizeof(double));
 }
 
+// Don't bother with threads unless each one gets at least this many
+// measurements
+#define UNCERTAINTY_NMEAS_PER_THREAD_MIN 65536
 
-bool mrcal_drt_ref_refperturbed__dbpacked_no_ie(// output
-                                                // Shape (6,Nstate_noi_noe)
-                                                double* K,
-                                                int K_stride0, // in bytes. <= 0 means "contiguous"
-                                                int K_stride1, // in bytes. <= 0 means "contiguous"
+// One observed frame: a contiguous range of measurements
+typedef struct
+{
+    int imeas0, imeas1;
+    int state_index_frame;
 
-                                                // inputs
-                                                // stuff that describes this solve
-                                                const double* b_packed,
-                                                // used only to confirm that the user passed-in the buffer they
-                                                // should have passed-in. The size must match exactly
-                                                int buffer_size_b_packed,
+    // This frame's contributions to Jcross_t__Jcross and to the calobject_warp
+    // columns of K. Shapes (21,) (upper triangle of (6,6)) and (6,2)
+    double Jcross_t__Jcross[(6+1)*6/2];
+    double Jcross_t__J_cw  [6*2];
 
-                                                // The unitless Jacobian, used by the internal
-                                                // optimization routines
-                                                // cholmod_analyze() and cholmod_factorize()
-                                                // require non-const
-                                                /* const */
-                                                cholmod_sparse* Jt,
+    // false if the jacobian didn't have the structure I expect
+    bool ok;
+} uncertainty_frame_t;
 
-                                                // meta-parameters
-                                                int Ncameras_intrinsics, int Ncameras_extrinsics, int Nframes,
-                                                int Npoints, int Npoints_fixed, // at the end of points[]
-                                                int Nobservations_board,
-                                                int Nobservations_point,
+typedef struct
+{
+    uncertainty_frame_t* frames;
 
-                                                const mrcal_lensmodel_t* lensmodel,
-                                                mrcal_problem_selections_t problem_selections,
+    double*              K;
+    int                  K_stride0_elems;
 
-                                                int calibration_object_width_n,
-                                                int calibration_object_height_n)
+    const double*        b_packed;
+    const cholmod_sparse* Jt;
+
+    int state_index_frame0;
+    int state_index_calobject_warp0;
+    int num_states_calobject_warp;
+    int Nstate_noi_noe;
+} uncertainty_ctx_t;
+
+// Processes frames [iframe0,iframe1). Each frame writes only its own columns of
+// K and its own partial sums, so the frames can be processed in any order, by
+// any thread
+static void accumulate_frames(int iframe0, int iframe1, int ichunk,
+                              void* cookie)
+{
+    const uncertainty_ctx_t* ctx = (const uncertainty_ctx_t*)cookie;
+
+    const int*    Jrowptr = (const int*)   ctx->Jt->p;
+    const int*    Jcolidx = (const int*)   ctx->Jt->i;
+    const double* Jval    = (const double*)ctx->Jt->x;
+
+    for(int iframe=iframe0; iframe<iframe1; iframe++)
+    {
+        uncertainty_frame_t* frame = &ctx->frames[iframe];
+
+        // sum(outer(dx/drt_ref_frame,dx/drt_ref_frame)) for this frame. I sum
+        // over all the observations. Uses PACKED gradients. Only the upper
+        // triangle is stored, in the usual row-major order
+        double sum_outer_jf_jf_packed[(6+1)*6/2] = {};
+
+        // sum(outer(j_frame_measi*, j_calobject_warp_measi*)) for this frame.
+        // Uses PACKED gradients. Stored densely, since it isn't symmetric.
+        // Shape (6,2)
+        double sum_outer_jf_jcw_packed[6*2] = {};
+
+        memset(frame->Jcross_t__Jcross, 0, sizeof(frame->Jcross_t__Jcross));
+        memset(frame->Jcross_t__J_cw,   0, sizeof(frame->Jcross_t__J_cw));
+        frame->ok = true;
+
+        for(int imeas=frame->imeas0; imeas<frame->imeas1; imeas++)
+        {
+            // I have dx/drt_ref_frame for this frame. This is 6 numbers
+            const double* dx_drt_ref_frame_packed = NULL;
+
+            for(int32_t ival = Jrowptr[imeas]; ival < Jrowptr[imeas+1]; ival++)
+            {
+                int32_t icol = Jcolidx[ival];
+#warning "I can do better than a linear search here. I know the structure of J."
+                if(icol < ctx->state_index_frame0)
+                    // not a rt_ref_frame gradient. Ignore
+                    continue;
+
+                if( icol < ctx->state_index_calobject_warp0 )
+                {
+                    // We're looking at SOME rt_ref_frame gradient. It must
+                    // be THIS frame
+                    if(icol != frame->state_index_frame)
+                    {
+                        frame->ok = false;
+                        break;
+                    }
+
+                    // I have dx/drt_ref_frame for this frame. This is 6 numbers
+                    dx_drt_ref_frame_packed = &Jval[ival];
+
+                    // sum(outer(dx/drt_ref_frame,dx/drt_ref_frame)) into sum_outer_jf_jf_packed
+                    {
+                        // This is used to compute Jcross_t J_no_ie* and Jcross_t
+                        // Jcross. This result is used in finish_Jcross_computations()
+                        //
+                        // Uses PACKED gradients. Only the upper triangle is stored, in
+                        // the usual row-major order
+                        int ivalue = 0;
+                        for(int i=0; i<6; i++)
+                            for(int j=i; j<6; j++, ivalue++)
+                                sum_outer_jf_jf_packed[ivalue] +=
+                                    dx_drt_ref_frame_packed[i]*dx_drt_ref_frame_packed[j];
+                    }
+
+                    // fast-forward past the frame gradients
+                    ival += 6-1;
+                }
+                else
+                {
+                    // if() statements above guarantee that this is
+                    // calobject_warp. The frame gradients come first
+                    if(dx_drt_ref_frame_packed == NULL)
+                    {
+                        frame->ok = false;
+                        break;
+                    }
+                    const double* dx_dcalobject_warp_packed = &Jval[ival];
+
+                    // Similar to the above, but this isn't symmetric, so I store it
+                    // densely
+                    int ivalue = 0;
+                    for(int i=0; i<6; i++)
+                        for(int j=0; j<2; j++, ivalue++)
+                            sum_outer_jf_jcw_packed[ivalue] +=
+                                dx_drt_ref_frame_packed[i]*
+                                dx_dcalobject_warp_packed[j];
+
+                    ival += ctx->num_states_calobject_warp-1;
+                }
+            }
+            if(!frame->ok)
+                break;
+        }
+        if(!frame->ok)
+            continue;
+
+        finish_Jcross_computations( ctx->K, ctx->K_stride0_elems,
+                                    frame->Jcross_t__J_cw, 2,
+                                    frame->Jcross_t__Jcross,
+                                    sum_outer_jf_jf_packed,
+                                    sum_outer_jf_jcw_packed,
+                                    &ctx->b_packed[frame->state_index_frame],
+                                    frame->state_index_frame,
+                                    ctx->state_index_frame0,
+                                    ctx->Nstate_noi_noe);
+    }
+}
+
+bool _mrcal_drt_ref_refperturbed__dbpacked_no_ie(// output
+                                                 // Shape (6,Nstate_noi_noe)
+                                                 double* K,
+                                                 int K_stride0, // in bytes. <= 0 means "contiguous"
+                                                 int K_stride1, // in bytes. <= 0 means "contiguous"
+
+                                                 // inputs
+                                                 // stuff that describes this solve
+                                                 const double* b_packed,
+                                                 // used only to confirm that the user passed-in the buffer they
+                                                 // should have passed-in. The size must match exactly
+                                                 int buffer_size_b_packed,
+
+                                                 // The unitless Jacobian, used by the internal
+                                                 // optimization routines
+                                                 // cholmod_analyze() and cholmod_factorize()
+                                                 // require non-const
+                                                 /* const */
+                                                 cholmod_sparse* Jt,
+
+                                                 // meta-parameters
+                                                 int Ncameras_intrinsics, int Ncameras_extrinsics, int Nframes,
+                                                 int Npoints, int Npoints_fixed, // at the end of points[]
+                                                 int Nobservations_board,
+                                                 int Nobservations_point,
+
+                                                 const mrcal_lensmodel_t* lensmodel,
+                                                 mrcal_problem_selections_t problem_selections,
+
+                                                 int calibration_object_width_n,
+                                                 int calibration_object_height_n,
+
+                                                 int Nthreads)
 {
     const int Nmeas_boards =
         mrcal_num_measurements_boards(Nobservations_board,
@@ -669,112 +835,110 @@ bool mrcal_drt_ref_refperturbed__dbpacked_no_ie(// output
         return false;
     }
 
-#warning "I should reuse some other memory for this. Chunks of K ?"
-    // sum(outer(dx/drt_ref_frame,dx/drt_ref_frame)) for this frame. I sum over
-    // all the observations. Uses PACKED gradients. Only the upper triangle is
-    // stored, in the usual row-major order
-    double sum_outer_jf_jf_packed[(6+1)*6/2] = {};
-
-    // sum(outer(j_frame_measi*, j_calobject_warp_measi*)) for this frame. Uses
-    // PACKED gradients. Stored densely, since it isn't symmetric. Shape (6,2)
-    double sum_outer_jf_jcw_packed[6*2] = {};
-
-    int state_index_frame_current = -1;
+    const int Nmeas_per_observation =
+        calibration_object_width_n*calibration_object_height_n*2;
 
     const int*    Jrowptr = (int*)   Jt->p;
     const int*    Jcolidx = (int*)   Jt->i;
-    const double* Jval    = (double*)Jt->x;
-    for(int imeas=0; imeas<Nmeas_obs; imeas++)
+
+    // Each board observation is a contiguous chunk of Nmeas_per_observation
+    // measurements, all looking at the same frame. Consecutive observations of
+    // the same frame are grouped together, and each group is processed by one
+    // thread. I find the frame of each observation from the first measurement
+    // of that observation: even the outlier measurements have the full
+    // jacobian structure
+    uncertainty_frame_t* frames =
+        (uncertainty_frame_t*)malloc((Nobservations_board > 0 ? Nobservations_board : 1)*
+                                     sizeof(frames[0]));
+    if(frames == NULL)
     {
-        // I have dx/drt_ref_frame for this frame. This is 6 numbers
-        const double* dx_drt_ref_frame_packed = NULL;
+        MSG("Couldn't allocate the per-frame accumulators");
+        return false;
+    }
+    int Nframes_observed = 0;
 
-        for(int32_t ival = Jrowptr[imeas]; ival < Jrowptr[imeas+1]; ival++)
+    for(int i_observation=0; i_observation<Nobservations_board; i_observation++)
+    {
+        const int imeas0 = i_observation*Nmeas_per_observation;
+
+        int state_index_frame = -1;
+        for(int32_t ival = Jrowptr[imeas0]; ival < Jrowptr[imeas0+1]; ival++)
         {
-            int32_t icol = Jcolidx[ival];
-#warning "I can do better than a linear search here. I know the structure of J."
-            if(icol < state_index_frame0)
-                // not a rt_ref_frame gradient. Ignore
-                continue;
-
-            // We're looking at SOME rt_ref_frame gradient. I expect these to be
-            // non-decreasing: consecutive chunks of Nw*Nh*2 measurements will
-            // represent the same board pose, and the same rt_ref_frame
-            if(icol < state_index_frame_current)
+            const int32_t icol = Jcolidx[ival];
+            if( state_index_frame0 <= icol &&
+                icol < state_index_calobject_warp0 )
             {
-                MSG("Unexpected jacobian structure. I'm assuming non-decreasing frame references");
-                return false;
+                state_index_frame = icol;
+                break;
             }
-            else if( state_index_frame0 <= icol &&
-                     icol < state_index_calobject_warp0 )
-            {
-                // Looking at a new frame. Finish the previous frame
-                if(icol != state_index_frame_current)
-                {
-                    if(state_index_frame_current >= 0)
-                    {
-                        finish_Jcross_computations( K, K_stride0_elems,
-                                                    Jcross_t__Jcross,
-                                                    sum_outer_jf_jf_packed,
-                                                    sum_outer_jf_jcw_packed,
-                                                    &b_packed[state_index_frame_current],
-                                                    state_index_frame_current,
-                                                    state_index_frame0,
-                                                    state_index_calobject_warp0,
-                                                    Nstate_noi_noe);
-                    }
-                    state_index_frame_current = icol;
-                }
+        }
+        if(state_index_frame < 0)
+        {
+            MSG("Unexpected jacobian structure. Board observation %d has no frame gradients",
+                i_observation);
+            free(frames);
+            return false;
+        }
 
-                // I have dx/drt_ref_frame for this frame. This is 6 numbers
-                dx_drt_ref_frame_packed = &Jval[ival];
+        if(Nframes_observed > 0 &&
+           state_index_frame == frames[Nframes_observed-1].state_index_frame)
+        {
+            frames[Nframes_observed-1].imeas1 += Nmeas_per_observation;
+            continue;
+        }
+        if(Nframes_observed > 0 &&
+           state_index_frame < frames[Nframes_observed-1].state_index_frame)
+        {
+            MSG("Unexpected jacobian structure. I'm assuming non-decreasing frame references");
+            free(frames);
+            return false;
+        }
 
-                // sum(outer(dx/drt_ref_frame,dx/drt_ref_frame)) into sum_outer_jf_jf_packed
-                {
-                    // This is used to compute Jcross_t J_no_ie* and Jcross_t
-                    // Jcross. This result is used in finish_Jcross_computations()
-                    //
-                    // Uses PACKED gradients. Only the upper triangle is stored, in
-                    // the usual row-major order
-                    int ivalue = 0;
-                    for(int i=0; i<6; i++)
-                        for(int j=i; j<6; j++, ivalue++)
-                            sum_outer_jf_jf_packed[ivalue] +=
-                                dx_drt_ref_frame_packed[i]*dx_drt_ref_frame_packed[j];
-                }
+        frames[Nframes_observed++] =
+            (uncertainty_frame_t){ .imeas0            = imeas0,
+                                   .imeas1            = imeas0 + Nmeas_per_observation,
+                                   .state_index_frame = state_index_frame };
+    }
 
-                // fast-forward past the frame gradients
-                ival += 6-1;
-            }
-            else
-            {
-                // if() statements above guarantee that this is calobject_warp.
-                const double* dx_dcalobject_warp_packed = &Jval[ival];
-
-                // Similar to the above, but this isn't symmetric, so I store it
-                // densely
-                int ivalue = 0;
-                for(int i=0; i<6; i++)
-                    for(int j=0; j<2; j++, ivalue++)
-                        sum_outer_jf_jcw_packed[ivalue] +=
-                            dx_drt_ref_frame_packed[i]*
-                            dx_dcalobject_warp_packed[j];
-
-                ival += num_states_calobject_warp-1;
-            }
-        }
+    uncertainty_ctx_t ctx =
+        { .frames                      = frames,
+          .K                           = K,
+          .K_stride0_elems             = K_stride0_elems,
+          .b_packed                    = b_packed,
+          .Jt                          = Jt,
+          .state_index_frame0          = state_index_frame0,
+          .state_index_calobject_warp0 = state_index_calobject_warp0,
+          .num_states_calobject_warp   = num_states_calobject_warp,
+          .Nstate_noi_noe              = Nstate_noi_noe };
+
+    if(Nthreads <= 0)
+    {
+        Nthreads = Nmeas_obs / UNCERTAINTY_NMEAS_PER_THREAD_MIN;
+        if(Nthreads < 1)                       Nthreads = 1;
+        if(Nthreads > _mrcal_num_threads(0))   Nthreads = _mrcal_num_threads(0);
     }
+    _mrcal_parallel_for(Nframes_observed, Nthreads,
+                        accumulate_frames, &ctx);
 
-    if(state_index_frame_current >= 0)
-        finish_Jcross_computations( K, K_stride0_elems,
-                                    Jcross_t__Jcross,
-                                    sum_outer_jf_jf_packed,
-                                    sum_outer_jf_jcw_packed,
-                                    &b_packed[state_index_frame_current],
-                                    state_index_frame_current,
-                                    state_index_frame0,
-                                    state_index_calobject_warp0,
-                                    Nstate_noi_noe);
+    // Reduce the per-frame partial sums, in frame order
+    double* Jcross_t__J_cw =
+        &K[state_index_calobject_warp0-state_index_frame0];
+    for(int i=0; i<Nframes_observed; i++)
+    {
+        if(!frames[i].ok)
+        {
+            MSG("Unexpected jacobian structure. I'm assuming that each board observation looks at exactly one frame");
+            free(frames);
+            return false;
+        }
+
+        for(int j=0; j<(6+1)*6/2; j++)
+            Jcross_t__Jcross[j] += frames[i].Jcross_t__Jcross[j];
+        for(int j=0; j<6; j++)
+            for(int k=0; k<2; k++)
+                Jcross_t__J_cw[j*K_stride0_elems + k] += frames[i].Jcross_t__J_cw[j*2 + k];
+    }
+    free(frames);
 
 
     // I now have filled Jcross_t__Jcross and K. I can
@@ -799,3 +963,49 @@ bool mrcal_drt_ref_refperturbed__dbpacked_no_ie(// output
 
     return true;
 }
+
+bool mrcal_drt_ref_refperturbed__dbpacked_no_ie(// output
+                                                // Shape (6,Nstate_noi_noe)
+                                                double* K,
+                                                int K_stride0, // in bytes. <= 0 means "contiguous"
+                                                int K_stride1, // in bytes. <= 0 means "contiguous"
+
+                                                // inputs
+                                                // stuff that describes this solve
+                                                const double* b_packed,
+                                                // used only to confirm that the user passed-in the buffer they
+                                                // should have passed-in. The size must match exactly
+                                                int buffer_size_b_packed,
+
+                                                // The unitless Jacobian, used by the internal
+                                                // optimization routines
+                                                // cholmod_analyze() and cholmod_factorize()
+                                                // require non-const
+                                                /* const */
+                                                cholmod_sparse* Jt,
+
+                                                // meta-parameters
+                                                int Ncameras_intrinsics, int Ncameras_extrinsics, int Nframes,
+                                                int Npoints, int Npoints_fixed, // at the end of points[]
+                                                int Nobservations_board,
+                                                int Nobservations_point,
+
+                                                const mrcal_lensmodel_t* lensmodel,
+                                                mrcal_problem_selections_t problem_selections,
+
+                                                int calibration_object_width_n,
+                                                int calibration_object_height_n)
+{
+    return _mrcal_drt_ref_refperturbed__dbpacked_no_ie(K, K_stride0, K_stride1,
+                                                       b_packed, buffer_size_b_packed,
+                                                       Jt,
+                                                       Ncameras_intrinsics, Ncameras_extrinsics, Nframes,
+                                                       Npoints, Npoints_fixed,
+                                                       Nobservations_board,
+                                                       Nobservations_point,
+                                                       lensmodel,
+                                                       problem_selections,
+                                                       calibration_object_width_n,
+                                                       calibration_object_height_n,
+                                                       0);
+}
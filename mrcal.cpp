@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <locale.h>
 
 #include <malloc.h>
 
@@ -18,11 +19,20 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <string.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <new>
 
 #include "mrcal.h"
 #include "minimath/minimath.h"
 #include "cahvore.h"
 #include "util.h"
+#include "parallel.h"
+#include "cholmod-cache.h"
+#include "schur-solver.h"
+#include "dogleg-solver.h"
+#include "project-batch.h"
 
 // Huge hack
 #ifndef M_PI
@@ -32,20 +42,6 @@
 // Defines
 #define restrict __restrict 
 
-template<typename T>
-struct TwoDArray {
-    std::vector<T> store;
-    std::vector<T*> ptr_array;
-    
-    TwoDArray(int dim1, int dim2) {
-        store.resize(dim1 * dim2);
-        ptr_array.resize(dim1);
-        for ( size_t i = 0; i < dim1; i++ ) ptr_array[i] = &(store[i * dim2]);
-    }
-
-    inline T** data() { return  ptr_array.data(); }
-};
-
 
 // These are parameter variable scales. They have the units of the parameters
 // themselves, so the optimizer sees x/SCALE_X for each parameter. I.e. as far
@@ -93,6 +89,33 @@ struct TwoDArray {
 
 
 
+locale_t _mrcal_locale_C(void)
+{
+    // Initialized once, thread-safely, and never freed
+    static const locale_t locale_C = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+    return locale_C;
+}
+
+// The lensmodel strings and the .cameramodel files always use '.' as the
+// decimal point, whatever the locale. snprintf() and sscanf() have no variants
+// that take a locale, so while one of these exists, this thread uses the C
+// locale
+struct numeric_locale_C_t
+{
+    locale_t locale_prev;
+
+    numeric_locale_C_t()
+    {
+        const locale_t locale_C = _mrcal_locale_C();
+        locale_prev = (locale_C != (locale_t)0) ? uselocale(locale_C) : (locale_t)0;
+    }
+    ~numeric_locale_C_t()
+    {
+        if(locale_prev != (locale_t)0)
+            uselocale(locale_prev);
+    }
+};
+
 // Returns a static string, using "..." as a placeholder for any configuration
 // values
 #define LENSMODEL_PRINT_CFG_ELEMENT_TEMPLATE(name, type, pybuildvaluecode, PRIcode,SCNcode, bitfield, cookie) \
@@ -138,6 +161,7 @@ static int LENSMODEL_CAHVORE__snprintf_model
   (char* out, int size,
    const mrcal_LENSMODEL_CAHVORE__config_t* config)
 {
+    numeric_locale_C_t numeric_locale_C;
     return
         snprintf( out, size, "LENSMODEL_CAHVORE"
                   MRCAL_LENSMODEL_CAHVORE_CONFIG_LIST(LENSMODEL_PRINT_CFG_ELEMENT_FMT, )
@@ -147,6 +171,7 @@ static int LENSMODEL_SPLINED_STEREOGRAPHIC__snprintf_model
   (char* out, int size,
    const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__config_t* config)
 {
+    numeric_locale_C_t numeric_locale_C;
     return
         snprintf( out, size, "LENSMODEL_SPLINED_STEREOGRAPHIC"
                   MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC_CONFIG_LIST(LENSMODEL_PRINT_CFG_ELEMENT_FMT, )
@@ -179,6 +204,7 @@ bool mrcal_lensmodel_name( char* out, int size, const mrcal_lensmodel_t* lensmod
 
 static bool LENSMODEL_CAHVORE__scan_model_config( mrcal_LENSMODEL_CAHVORE__config_t* config, const char* config_str)
 {
+    numeric_locale_C_t numeric_locale_C;
     int pos;
     int Nelements = 0 MRCAL_LENSMODEL_CAHVORE_CONFIG_LIST(LENSMODEL_SCAN_CFG_ELEMENT_PLUS1, );
     return
@@ -191,6 +217,7 @@ static bool LENSMODEL_CAHVORE__scan_model_config( mrcal_LENSMODEL_CAHVORE__confi
 }
 static bool LENSMODEL_SPLINED_STEREOGRAPHIC__scan_model_config( mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__config_t* config, const char* config_str)
 {
+    numeric_locale_C_t numeric_locale_C;
     int pos;
     int Nelements = 0 MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC_CONFIG_LIST(LENSMODEL_SCAN_CFG_ELEMENT_PLUS1, );
     return
@@ -560,26 +587,13 @@ static bool has_calobject_warp(mrcal_problem_selections_t problem_selections,
     return problem_selections.do_optimize_calobject_warp && Nobservations_board>0;
 }
 
-int _mrcal_num_j_nonzero(int Nobservations_board,
-                         int Nobservations_point,
-                         int calibration_object_width_n,
-                         int calibration_object_height_n,
-                         int Ncameras_intrinsics, int Ncameras_extrinsics,
-                         int Nframes,
-                         int Npoints, int Npoints_fixed,
-                         const mrcal_observation_board_t* observations_board,
-                         const mrcal_observation_point_t* observations_point,
-                         mrcal_problem_selections_t problem_selections,
-                         const mrcal_lensmodel_t* lensmodel)
+// Each projected point has an x and y measurement, and each one depends on
+// some number of the intrinsic parameters. Parametric models are simple: each
+// one depends on ALL of the intrinsics. Splined models are sparse, however, and
+// there's only a partial dependence
+static int num_intrinsics_per_measurement(mrcal_problem_selections_t problem_selections,
+                                          const mrcal_lensmodel_t* lensmodel)
 {
-    // each observation depends on all the parameters for THAT frame and for
-    // THAT camera. Camera0 doesn't have extrinsics, so I need to loop through
-    // all my observations
-
-    // Each projected point has an x and y measurement, and each one depends on
-    // some number of the intrinsic parameters. Parametric models are simple:
-    // each one depends on ALL of the intrinsics. Splined models are sparse,
-    // however, and there's only a partial dependence
     int Nintrinsics_per_measurement;
     if(lensmodel->type == MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC)
     {
@@ -598,40 +612,63 @@ int _mrcal_num_j_nonzero(int Nobservations_board,
         modelHasCore_fxfycxcy(lensmodel) )
         Nintrinsics_per_measurement -= 2;
 
-    int N = Nobservations_board * ( (problem_selections.do_optimize_frames         ? 6 : 0) +
-                                    (problem_selections.do_optimize_extrinsics     ? 6 : 0) +
-                                    (has_calobject_warp(problem_selections,Nobservations_board) ? MRCAL_NSTATE_CALOBJECT_WARP : 0) +
-                                  Nintrinsics_per_measurement );
-
-    // initial estimate counts extrinsics for the reference camera, which need
-    // to be subtracted off
-    if(problem_selections.do_optimize_extrinsics)
-        for(int i=0; i<Nobservations_board; i++)
-            if(observations_board[i].icam.extrinsics < 0)
-                N -= 6;
-    // *2 because I have separate x and y measurements
-    N *= 2*calibration_object_width_n*calibration_object_height_n;
+    return Nintrinsics_per_measurement;
+}
 
-    // Now the point observations
-    for(int i=0; i<Nobservations_point; i++)
-    {
-        N += 2*Nintrinsics_per_measurement;
-        if( problem_selections.do_optimize_frames &&
-            observations_point[i].i_point < Npoints-Npoints_fixed )
-            N += 2*3;
-        if( problem_selections.do_optimize_extrinsics &&
-            observations_point[i].icam.extrinsics >= 0 )
-            N += 2*6;
+// The number of non-zero entries in the jacobian that come from ONE board
+// observation: all its calibration_object_width_n*calibration_object_height_n
+// points. Outliers have the same sparsity structure as inliers
+static int num_j_nonzero_board_observation(const mrcal_observation_board_t* observation,
+                                           int Nobservations_board,
+                                           int calibration_object_width_n,
+                                           int calibration_object_height_n,
+                                           int Nintrinsics_per_measurement,
+                                           mrcal_problem_selections_t problem_selections)
+{
+    // each observation depends on all the parameters for THAT frame and for
+    // THAT camera. Camera0 doesn't have extrinsics
+    int N =
+        (problem_selections.do_optimize_frames ? 6 : 0) +
+        (problem_selections.do_optimize_extrinsics &&
+         observation->icam.extrinsics >= 0     ? 6 : 0) +
+        (has_calobject_warp(problem_selections,Nobservations_board) ? MRCAL_NSTATE_CALOBJECT_WARP : 0) +
+        Nintrinsics_per_measurement;
 
-        // range normalization
-        if(problem_selections.do_optimize_frames &&
-            observations_point[i].i_point < Npoints-Npoints_fixed )
-            N += 3;
-        if( problem_selections.do_optimize_extrinsics &&
-            observations_point[i].icam.extrinsics >= 0 )
-            N += 6;
-    }
+    // *2 because I have separate x and y measurements
+    return N * 2*calibration_object_width_n*calibration_object_height_n;
+}
+
+// The number of non-zero entries in the jacobian that come from ONE point
+// observation: the x,y measurements and the range normalization. Outliers have
+// the same sparsity structure as inliers
+static int num_j_nonzero_point_observation(const mrcal_observation_point_t* observation,
+                                           int Npoints, int Npoints_fixed,
+                                           int Nintrinsics_per_measurement,
+                                           mrcal_problem_selections_t problem_selections)
+{
+    int N = 2*Nintrinsics_per_measurement;
+    if( problem_selections.do_optimize_frames &&
+        observation->i_point < Npoints-Npoints_fixed )
+        N += 2*3;
+    if( problem_selections.do_optimize_extrinsics &&
+        observation->icam.extrinsics >= 0 )
+        N += 2*6;
+
+    // range normalization
+    if(problem_selections.do_optimize_frames &&
+       observation->i_point < Npoints-Npoints_fixed )
+        N += 3;
+    if( problem_selections.do_optimize_extrinsics &&
+        observation->icam.extrinsics >= 0 )
+        N += 6;
+    return N;
+}
 
+static int num_j_nonzero_regularization(int Ncameras_intrinsics,
+                                        mrcal_problem_selections_t problem_selections,
+                                        const mrcal_lensmodel_t* lensmodel)
+{
+    int N = 0;
     if(lensmodel->type == MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC)
     {
         if(problem_selections.do_apply_regularization)
@@ -655,10 +692,151 @@ int _mrcal_num_j_nonzero(int Nobservations_board,
             Ncameras_intrinsics *
             num_regularization_terms_percamera(problem_selections,
                                                lensmodel);
+    return N;
+}
+
+int _mrcal_num_j_nonzero(int Nobservations_board,
+                         int Nobservations_point,
+                         int calibration_object_width_n,
+                         int calibration_object_height_n,
+                         int Ncameras_intrinsics, int Ncameras_extrinsics,
+                         int Nframes,
+                         int Npoints, int Npoints_fixed,
+                         const mrcal_observation_board_t* observations_board,
+                         const mrcal_observation_point_t* observations_point,
+                         mrcal_problem_selections_t problem_selections,
+                         const mrcal_lensmodel_t* lensmodel)
+{
+    const int Nintrinsics_per_measurement =
+        num_intrinsics_per_measurement(problem_selections, lensmodel);
+
+    int N = 0;
+    for(int i=0; i<Nobservations_board; i++)
+        N += num_j_nonzero_board_observation(&observations_board[i],
+                                             Nobservations_board,
+                                             calibration_object_width_n,
+                                             calibration_object_height_n,
+                                             Nintrinsics_per_measurement,
+                                             problem_selections);
+    for(int i=0; i<Nobservations_point; i++)
+        N += num_j_nonzero_point_observation(&observations_point[i],
+                                             Npoints, Npoints_fixed,
+                                             Nintrinsics_per_measurement,
+                                             problem_selections);
 
+    N += num_j_nonzero_regularization(Ncameras_intrinsics,
+                                      problem_selections, lensmodel);
     return N;
 }
 
+// Computes the index of the first jacobian non-zero entry for each board and
+// point observation. These are consistent with _mrcal_num_j_nonzero(): the
+// entries are laid out in the same order that optimizer_callback() writes them.
+// This allows the observations to be evaluated independently, in any order.
+//
+// ijacobian0_board has Nobservations_board+1 entries and ijacobian0_point has
+// Nobservations_point+1 entries. The extra entry at the end contains the
+// index one-past the last entry: ijacobian0_board[Nobservations_board] ==
+// ijacobian0_point[0] and ijacobian0_point[Nobservations_point] is where the
+// regularization terms begin
+static void jacobian_offsets_observations(// out
+                                          int* ijacobian0_board,
+                                          int* ijacobian0_point,
+
+                                          // in
+                                          int Nobservations_board,
+                                          int Nobservations_point,
+                                          int calibration_object_width_n,
+                                          int calibration_object_height_n,
+                                          int Npoints, int Npoints_fixed,
+                                          const mrcal_observation_board_t* observations_board,
+                                          const mrcal_observation_point_t* observations_point,
+                                          mrcal_problem_selections_t problem_selections,
+                                          const mrcal_lensmodel_t* lensmodel)
+{
+    const int Nintrinsics_per_measurement =
+        num_intrinsics_per_measurement(problem_selections, lensmodel);
+
+    int N = 0;
+    for(int i=0; i<Nobservations_board; i++)
+    {
+        ijacobian0_board[i] = N;
+        N += num_j_nonzero_board_observation(&observations_board[i],
+                                             Nobservations_board,
+                                             calibration_object_width_n,
+                                             calibration_object_height_n,
+                                             Nintrinsics_per_measurement,
+                                             problem_selections);
+    }
+    ijacobian0_board[Nobservations_board] = N;
+
+    for(int i=0; i<Nobservations_point; i++)
+    {
+        ijacobian0_point[i] = N;
+        N += num_j_nonzero_point_observation(&observations_point[i],
+                                             Npoints, Npoints_fixed,
+                                             Nintrinsics_per_measurement,
+                                             problem_selections);
+    }
+    ijacobian0_point[Nobservations_point] = N;
+}
+
+// The B-spline basis functions. These assume evenly spaced knots.
+//
+// Cubic: a,b,c,d are sequential control points. x is in [0,1] between b and c.
+// Function looks like this:
+//   double A = fA(x);
+//   double B = fB(x);
+//   double C = fC(x);
+//   double D = fD(x);
+//   return A*a + B*b + C*c + D*d;
+//
+// Quadratic: a,b,c are sequential control points. x is in [-1/2,1/2] around b.
+// Function looks like this:
+//   double A = fA(x);
+//   double B = fB(x);
+//   double C = fC(x);
+//   return A*a + B*b + C*c;
+//
+// I need to sample many such 1D segments, so I compute A,B,C,D separately, and
+// apply them together. The sampling functions below and
+// _mrcal_project_internal_splined() all use these, so they produce identical
+// results
+static inline
+void bspline_basis_cubic(double* ABCD, double x)
+{
+    double x2 = x*x;
+    double x3 = x2*x;
+    ABCD[0] =  (-x3 + 3*x2 - 3*x + 1)/6;
+    ABCD[1] = (3 * x3/2 - 3*x2 + 2)/3;
+    ABCD[2] = (-3 * x3 + 3*x2 + 3*x + 1)/6;
+    ABCD[3] = x3 / 6;
+}
+static inline
+void bspline_basis_cubic_grad(double* ABCDgrad, double x)
+{
+    double x2 = x*x;
+    ABCDgrad[0] =  -x2/2 + x - 1./2.;
+    ABCDgrad[1] = 3*x2/2 - 2*x;
+    ABCDgrad[2] = -3*x2/2 + x + 1./2.;
+    ABCDgrad[3] = x2 / 2;
+}
+static inline
+void bspline_basis_quadratic(double* ABC, double x)
+{
+    double x2 = x*x;
+    ABC[0] = (4*x2 - 4*x + 1)/8;
+    ABC[1] = (3 - 4*x2)/4;
+    ABC[2] = (4*x2 + 4*x + 1)/8;
+}
+static inline
+void bspline_basis_quadratic_grad(double* ABCgrad, double x)
+{
+    ABCgrad[0] = x - 1./2.;
+    ABCgrad[1] = -2.*x;
+    ABCgrad[2] = x + 1./2.;
+}
+
 // Used in the spline-based projection function.
 //
 // See bsplines.py for the derivation of the spline expressions and for
@@ -685,29 +863,10 @@ void sample_bspline_surface_cubic(double* out,
     double* ABCDx = &ABCDx_ABCDy[0];
     double* ABCDy = &ABCDx_ABCDy[4];
 
-    // The sampling function assumes evenly spaced knots.
-    // a,b,c,d are sequential control points
-    // x is in [0,1] between b and c. Function looks like this:
-    //   double A = fA(x);
-    //   double B = fB(x);
-    //   double C = fC(x);
-    //   double D = fD(x);
-    //   return A*a + B*b + C*c + D*d;
-    // I need to sample many such 1D segments, so I compute A,B,C,D separately,
-    // and apply them together
     auto get_sample_coeffs = [&](double* ABCD, double* ABCDgrad, double x)
     {
-        double x2 = x*x;
-        double x3 = x2*x;
-        ABCD[0] =  (-x3 + 3*x2 - 3*x + 1)/6;
-        ABCD[1] = (3 * x3/2 - 3*x2 + 2)/3;
-        ABCD[2] = (-3 * x3 + 3*x2 + 3*x + 1)/6;
-        ABCD[3] = x3 / 6;
-
-        ABCDgrad[0] =  -x2/2 + x - 1./2.;
-        ABCDgrad[1] = 3*x2/2 - 2*x;
-        ABCDgrad[2] = -3*x2/2 + x + 1./2.;
-        ABCDgrad[3] = x2 / 2;
+        bspline_basis_cubic     (ABCD,     x);
+        bspline_basis_cubic_grad(ABCDgrad, x);
     };
 
     // 4 samples along one dimension, and then one sample along the other
@@ -764,25 +923,10 @@ void sample_bspline_surface_quadratic(double* out,
     double* ABCx = &ABCx_ABCy[0];
     double* ABCy = &ABCx_ABCy[3];
 
-    // The sampling function assumes evenly spaced knots.
-    // a,b,c are sequential control points
-    // x is in [-1/2,1/2] around b. Function looks like this:
-    //   double A = fA(x);
-    //   double B = fB(x);
-    //   double C = fC(x);
-    //   return A*a + B*b + C*c;
-    // I need to sample many such 1D segments, so I compute A,B,C separately,
-    // and apply them together
     auto get_sample_coeffs = [&](double* ABC, double* ABCgrad, double x)
     {
-        double x2 = x*x;
-        ABC[0] = (4*x2 - 4*x + 1)/8;
-        ABC[1] = (3 - 4*x2)/4;
-        ABC[2] = (4*x2 + 4*x + 1)/8;
-
-        ABCgrad[0] = x - 1./2.;
-        ABCgrad[1] = -2.*x;
-        ABCgrad[2] = x + 1./2.;
+        bspline_basis_quadratic     (ABC,     x);
+        bspline_basis_quadratic_grad(ABCgrad, x);
     };
 
     // 3 samples along one dimension, and then one sample along the other
@@ -1724,6 +1868,9 @@ static void _mrcal_precompute_lensmodel_data_MRCAL_LENSMODEL_SPLINED_STEREOGRAPH
     double th_edge_x = (double)config->fov_x_deg/2. * M_PI / 180.;
     double u_edge_x  = tan(th_edge_x / 2.) * 2;
     precomputed->segments_per_u = (config->Nx - 1 - Nknots_margin) / (u_edge_x*2.);
+
+    precomputed->ix_center = (double)(config->Nx-1)/2.;
+    precomputed->iy_center = (double)(config->Ny-1)/2.;
 }
 
 // NOT A PART OF THE EXTERNAL API. This is exported for the mrcal python wrapper
@@ -1761,14 +1908,14 @@ bool mrcal_knots_for_splined_models( // buffers must hold at least
         &precomputed_all.LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed;
 
     // The logic I'm reversing is
-    //     double ix = u.x*segments_per_u + (double)(Nx-1)/2.;
+    //     double ix = u.x*segments_per_u + ix_center;
     for(int i=0; i<config->Nx; i++)
         ux[i] =
-            ((double)i - (double)(config->Nx-1)/2.) /
+            ((double)i - precomputed->ix_center) /
             precomputed->segments_per_u;
     for(int i=0; i<config->Ny; i++)
         uy[i] =
-            ((double)i - (double)(config->Ny-1)/2.) /
+            ((double)i - precomputed->iy_center) /
             precomputed->segments_per_u;
     return true;
 }
@@ -1823,8 +1970,10 @@ void _project_point_splined( // outputs
                             bool camera_at_identity,
                             int spline_order,
                             uint16_t Nx, uint16_t Ny,
-                            double segments_per_u)
+                            const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed_t* precomputed)
 {
+    const double segments_per_u = precomputed->segments_per_u;
+
     // projections out-of-bounds will yield SOME value (function remains
     // continuous as we move out-of-bounds), but it wont be particularly
     // meaningful
@@ -1881,8 +2030,8 @@ void _project_point_splined( // outputs
                              p->y * (B * p->y)      + scale,
                              p->y * (B * p->z + A) } };
 
-    double ix = u.x*segments_per_u + (double)(Nx-1)/2.;
-    double iy = u.y*segments_per_u + (double)(Ny-1)/2.;
+    double ix = u.x*segments_per_u + precomputed->ix_center;
+    double iy = u.y*segments_per_u + precomputed->iy_center;
 
     mrcal_point2_t deltau;
     double ddeltau_dux[2];
@@ -2026,6 +2175,153 @@ void _project_point_splined( // outputs
     }
 }
 
+// _mrcal_project_internal_splined() processes the points in blocks of this
+// many. Small enough for the per-block basis weights to live on the stack, in L1
+#define NPOINTS_PER_BLOCK_SPLINED 64
+
+// The no-gradients equivalent of _project_point_splined(), for a whole block of
+// points at a time. The stereographic projections, the spline segment lookups
+// and the basis weights are computed for all the points first, in branch-free
+// loops that the compiler can vectorize. Then the weights are applied to the
+// control points. The operation order matches _project_point_splined(), so the
+// results are identical
+template<int spline_order>
+static void project_splined_block( // out
+                                   mrcal_point2_t* q,
+
+                                   // in
+                                   const mrcal_point3_t* p,
+                                   int N,
+                                   int Nx, int Ny,
+                                   const double* intrinsics,
+                                   const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed_t* precomputed)
+{
+    // Each point is affected by a (spline_order+1)x(spline_order+1) patch of
+    // control points
+    const int Nrun = spline_order + 1;
+
+    const double fx = intrinsics[0];
+    const double fy = intrinsics[1];
+    const double cx = intrinsics[2];
+    const double cy = intrinsics[3];
+
+    const double segments_per_u = precomputed->segments_per_u;
+    const double ix_center      = precomputed->ix_center;
+    const double iy_center      = precomputed->iy_center;
+
+    // The patches that the points may use. Out-of-bounds points are clamped
+    // to the nearest valid one, as in _project_point_splined()
+    const int ix0_max = (spline_order == 3) ? Nx-3 : Nx-2;
+    const int iy0_max = (spline_order == 3) ? Ny-3 : Ny-2;
+
+    double ux   [NPOINTS_PER_BLOCK_SPLINED];
+    double uy   [NPOINTS_PER_BLOCK_SPLINED];
+    double wx   [NPOINTS_PER_BLOCK_SPLINED][Nrun];
+    double wy   [NPOINTS_PER_BLOCK_SPLINED][Nrun];
+    int    ivar0[NPOINTS_PER_BLOCK_SPLINED];
+
+    for(int i=0; i<N; i++)
+    {
+        const double mag_p = sqrt( p[i].x*p[i].x +
+                                   p[i].y*p[i].y +
+                                   p[i].z*p[i].z );
+        const double scale = 2.0 / (mag_p + p[i].z);
+        ux[i] = p[i].x * scale;
+        uy[i] = p[i].y * scale;
+
+        const double ix = ux[i]*segments_per_u + ix_center;
+        const double iy = uy[i]*segments_per_u + iy_center;
+
+        int ix0, iy0;
+        if constexpr(spline_order == 3)
+        {
+            ix0 = (int)ix;
+            iy0 = (int)iy;
+        }
+        else
+        {
+            ix0 = (int)(ix + 0.5);
+            iy0 = (int)(iy + 0.5);
+        }
+        ix0 = std::max(1, std::min(ix0, ix0_max));
+        iy0 = std::max(1, std::min(iy0, iy0_max));
+
+        ivar0[i] =
+            4 + // skip the core
+            2*( (iy0-1)*Nx +
+                (ix0-1) );
+
+        if constexpr(spline_order == 3)
+        {
+            bspline_basis_cubic(wx[i], ix - ix0);
+            bspline_basis_cubic(wy[i], iy - iy0);
+        }
+        else
+        {
+            bspline_basis_quadratic(wx[i], ix - ix0);
+            bspline_basis_quadratic(wy[i], iy - iy0);
+        }
+    }
+
+    // stridex is 2: the control points from the two surfaces are next to each
+    // other
+    const int stridey = 2*Nx;
+    for(int i=0; i<N; i++)
+    {
+        const double* c = &intrinsics[ivar0[i]];
+
+        double deltau[2];
+        for(int k=0; k<2; k++)
+        {
+            double cinterp[Nrun];
+            for(int iy=0; iy<Nrun; iy++)
+            {
+                cinterp[iy] = wx[i][0] * c[iy*stridey + k];
+                for(int ix=1; ix<Nrun; ix++)
+                    cinterp[iy] += wx[i][ix] * c[iy*stridey + 2*ix + k];
+            }
+            deltau[k] = wy[i][0] * cinterp[0];
+            for(int iy=1; iy<Nrun; iy++)
+                deltau[k] += wy[i][iy] * cinterp[iy];
+        }
+
+        q[i].x = (ux[i] + deltau[0]) * fx + cx;
+        q[i].y = (uy[i] + deltau[1]) * fy + cy;
+    }
+}
+
+void _mrcal_project_internal_splined( // out
+                                     mrcal_point2_t* q,
+
+                                     // in
+                                     const mrcal_point3_t* p,
+                                     int N,
+                                     const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__config_t* config,
+                                     // core, control points concatenated
+                                     const double* intrinsics,
+                                     const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed_t* precomputed)
+{
+    for(int i0=0; i0<N; i0 += NPOINTS_PER_BLOCK_SPLINED)
+    {
+        const int n = std::min(NPOINTS_PER_BLOCK_SPLINED, N-i0);
+
+        if(config->order == 3)
+            project_splined_block<3>(&q[i0], &p[i0], n,
+                                     config->Nx, config->Ny,
+                                     intrinsics, precomputed);
+        else if(config->order == 2)
+            project_splined_block<2>(&q[i0], &p[i0], n,
+                                     config->Nx, config->Ny,
+                                     intrinsics, precomputed);
+        else
+        {
+            MSG("I only support spline order==2 or 3. Somehow got %d. This is a bug. Barfing",
+                config->order);
+            assert(0);
+        }
+    }
+}
+
 typedef struct
 {
     double* pool;
@@ -2376,7 +2672,7 @@ void project( // out
                                    lensmodel->LENSMODEL_SPLINED_STEREOGRAPHIC__config.order,
                                    lensmodel->LENSMODEL_SPLINED_STEREOGRAPHIC__config.Nx,
                                    lensmodel->LENSMODEL_SPLINED_STEREOGRAPHIC__config.Ny,
-                                   precomputed->LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed.segments_per_u);
+                                   &precomputed->LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed);
             // WARNING: if I could assume that dq_dintrinsics_pool_double!=NULL then I wouldnt need to copy the context
             if(dq_dintrinsics_pool_int != NULL)
             {
@@ -2474,7 +2770,7 @@ void project( // out
 
     if( calibration_object_width_n == 0 )
     { // projecting discrete points
-        mrcal_point3_t empty; 
+        mrcal_point3_t empty = {};
         mrcal_point3_t p =
             propagate_extrinsics( &empty,
                                   camera_at_identity ? NULL : &gg,
@@ -2585,6 +2881,16 @@ bool _mrcal_project_internal( // out
                              int Nintrinsics,
                              const mrcal_projection_precomputed_t* precomputed)
 {
+    if( dq_dintrinsics == NULL && dq_dp == NULL &&
+        lensmodel->type == MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC )
+    {
+        _mrcal_project_internal_splined(q, p, N,
+                                        &lensmodel->LENSMODEL_SPLINED_STEREOGRAPHIC__config,
+                                        intrinsics,
+                                        &precomputed->LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed);
+        return true;
+    }
+
     if( dq_dintrinsics == NULL )
     {
         for(int i=0; i<N; i++)
@@ -2601,6 +2907,10 @@ bool _mrcal_project_internal( // out
                      intrinsics, NULL, &frame, NULL, true,
                      lensmodel, precomputed,
                      0.0, 0,0);
+
+            // advance
+            if(dq_dp != NULL)
+                dq_dp = &dq_dp[2];
         }
         return true;
     }
@@ -2611,14 +2921,17 @@ bool _mrcal_project_internal( // out
 
     int Ngradients = get_Ngradients(lensmodel, Nintrinsics);
 
+    // Allocated once, and reused by each point. An alloca() inside the loop
+    // would grow the stack by Ngradients doubles for EACH point
+    // double dq_dintrinsics_pool_double[Ngradients];
+    double *dq_dintrinsics_pool_double = (double*)alloca(Ngradients * sizeof(double));
+
     for(int i=0; i<N; i++)
     {
         mrcal_pose_t frame = {.r = {},
                               .t = p[i]};
 
         // simple non-intrinsics-gradient path
-        // double dq_dintrinsics_pool_double[Ngradients];
-        double *dq_dintrinsics_pool_double = (double*)alloca(Ngradients * sizeof(double));
         int    dq_dintrinsics_pool_int   [1];
         double* dq_dfxy               = NULL;
         double* dq_dintrinsics_nocore = NULL;
@@ -2745,28 +3058,92 @@ bool mrcal_project( // out
         }
     }
 
-    int Nintrinsics = mrcal_lensmodel_num_params(lensmodel);
+    // Large batches are split across all the cores. The common models have
+    // fast paths if no gradients are requested
+    return
+        _mrcal_project_batch(q, dq_dp, dq_dintrinsics,
+                             p, N, lensmodel, intrinsics,
+                             NULL, 0);
+}
 
-    // Special-case for opencv/pinhole and projection-only. cvProjectPoints2 and
-    // project() have a lot of overhead apparently, and calling either in a loop
-    // is very slow. I can call it once, and use its fast internal loop,
-    // however. This special case does the same thing, but much faster.
-    if(dq_dintrinsics == NULL && dq_dp == NULL &&
-       (MRCAL_LENSMODEL_IS_OPENCV(lensmodel->type) ||
-        lensmodel->type == MRCAL_LENSMODEL_PINHOLE))
+bool mrcal_gradient_sparse_meta( // out
+                                 mrcal_gradient_sparse_meta_t* meta,
+                                 // in
+                                 const mrcal_lensmodel_t* lensmodel)
+{
+    if(lensmodel->type != MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC)
     {
-        _mrcal_project_internal_opencv( q, NULL,NULL,
-                                        p, N, intrinsics, Nintrinsics);
-        return true;
+        MSG("Sparse intrinsics gradients are only available with the MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC model. '%s' passed in",
+            mrcal_lensmodel_name_unconfigured(lensmodel));
+        return false;
     }
 
+    // Same as in project()
+    meta->run_side_length = lensmodel->LENSMODEL_SPLINED_STEREOGRAPHIC__config.order + 1;
+    meta->ivar_stridey    = 2*lensmodel->LENSMODEL_SPLINED_STEREOGRAPHIC__config.Nx;
+    return true;
+}
+
+// Don't bother with threads unless each one gets at least this many points
+#define PROJECT_SPARSE_NPOINTS_PER_THREAD_MIN 16384
+
+bool mrcal_project_sparse_intrinsics_gradients( // out
+                                               mrcal_point2_t* q,
+                                               mrcal_point3_t* dq_dp,
+                                               mrcal_point2_t* dq_dfxy,
+                                               int*            ivar0,
+                                               double*         pool,
+
+                                               // in
+                                               const mrcal_point3_t* p,
+                                               int N,
+                                               const mrcal_lensmodel_t* lensmodel,
+                                               // core, distortions concatenated
+                                               const double* intrinsics)
+{
+    mrcal_gradient_sparse_meta_t meta;
+    if(!mrcal_gradient_sparse_meta(&meta, lensmodel))
+        return false;
+    if(N <= 0)
+        return true;
+
     mrcal_projection_precomputed_t precomputed;
     _mrcal_precompute_lensmodel_data(&precomputed, lensmodel);
 
-    return
-        _mrcal_project_internal(q, dq_dp, dq_dintrinsics,
-                                p, N, lensmodel, intrinsics,
-                                Nintrinsics, &precomputed);
+    const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__config_t* config =
+        &lensmodel->LENSMODEL_SPLINED_STEREOGRAPHIC__config;
+    const int runlen = meta.run_side_length;
+
+    const int Nthreads =
+        std::min(_mrcal_num_threads(0),
+                 std::max(1, N / PROJECT_SPARSE_NPOINTS_PER_THREAD_MIN));
+
+    _mrcal_parallel_for(N, Nthreads,
+                        [&](int i0, int i1, int)
+                        {
+                            for(int i=i0; i<i1; i++)
+                                // The camera is at the reference, and the
+                                // "frame" is a pure translation by p. So
+                                // dq/dtframe is dq/dp
+                                _project_point_splined( // outputs
+                                                       &q[i],
+                                                       dq_dfxy == NULL ? NULL : &dq_dfxy[i],
+                                                       &pool[(size_t)i*runlen*2],
+                                                       &ivar0[i],
+
+                                                       NULL, NULL, NULL,
+                                                       dq_dp == NULL ? NULL : &dq_dp[2*i],
+
+                                                       // inputs
+                                                       &p[i],
+                                                       NULL, NULL, NULL, NULL,
+                                                       intrinsics,
+                                                       true,
+                                                       config->order,
+                                                       config->Nx, config->Ny,
+                                                       &precomputed.LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed);
+                        });
+    return true;
 }
 
 
@@ -2805,6 +3182,327 @@ bool mrcal_unproject( // out
     return _mrcal_unproject_internal(out, q, N, lensmodel, intrinsics, &precomputed);
 }
 
+// Don't bother with threads unless each one gets at least this many points.
+// Each point needs a few projections with gradients, so this is far fewer than
+// in project-batch.cpp
+#define UNPROJECT_NPOINTS_PER_THREAD_MIN 512
+
+// The Newton iterations in unproject_newton(). Convergence is quadratic from
+// the seeds we use, so we either converge in a handful of iterations, or we
+// never will, and dogleg takes over
+#define UNPROJECT_NEWTON_MAX_ITERATIONS  20
+#define UNPROJECT_NEWTON_MAX_HALVINGS    10
+
+// Converged when the step is smaller than this, in pixels. Matches the default
+// update_threshold in libdogleg, which the fallback path uses
+#define UNPROJECT_NEWTON_UPDATE_THRESHOLD 1e-8
+
+// I optimize in the space of the stereographic projection. This is a 2D space
+// with a direct mapping to/from observation vectors with a single singularity
+// directly behind the camera. The allows me to run an unconstrained
+// optimization here
+//
+// u is the constant-fxy-cxy 2D stereographic projection of the hypothesis v. I
+// unproject it stereographically, and project it using the actual model. x is
+// the 2-element reprojection error and J = dx/du is the 2x2 jacobian, stored
+// row-first. J may be NULL
+static void unproject_residual( // out
+                                double* x,
+                                double* J,
+
+                                // in
+                                const double* u,
+                                const mrcal_point2_t* q,
+                                const mrcal_lensmodel_t* lensmodel,
+                                const double* intrinsics,
+                                const mrcal_projection_precomputed_t* precomputed)
+{
+    mrcal_point2_t dv_du[3];
+    mrcal_pose_t frame = {};
+    mrcal_unproject_stereographic( &frame.t, dv_du,
+                                   (const mrcal_point2_t*)u, 1,
+                                   intrinsics );
+
+    mrcal_point3_t dq_dtframe[2];
+    mrcal_point2_t q_hypothesis;
+    project( &q_hypothesis,
+             NULL,NULL,NULL,NULL,NULL,
+             NULL, NULL, NULL, dq_dtframe,
+             NULL,
+
+             // in
+             intrinsics,
+             NULL,
+             &frame,
+             NULL,
+             true,
+             lensmodel, precomputed,
+             0.0, 0,0);
+    x[0] = q_hypothesis.x - q->x;
+    x[1] = q_hypothesis.y - q->y;
+    if(J == NULL)
+        return;
+
+    J[0*2 + 0] =
+        dq_dtframe[0].x*dv_du[0].x +
+        dq_dtframe[0].y*dv_du[1].x +
+        dq_dtframe[0].z*dv_du[2].x;
+    J[0*2 + 1] =
+        dq_dtframe[0].x*dv_du[0].y +
+        dq_dtframe[0].y*dv_du[1].y +
+        dq_dtframe[0].z*dv_du[2].y;
+    J[1*2 + 0] =
+        dq_dtframe[1].x*dv_du[0].x +
+        dq_dtframe[1].y*dv_du[1].x +
+        dq_dtframe[1].z*dv_du[2].x;
+    J[1*2 + 1] =
+        dq_dtframe[1].x*dv_du[0].y +
+        dq_dtframe[1].y*dv_du[1].y +
+        dq_dtframe[1].z*dv_du[2].y;
+}
+
+// The initial estimates for the solvers, in the same stereographic space they
+// use: u for Newton, and u_pinhole for the dogleg fallback. u_pinhole is the
+// pinhole unprojection, which is what we always used with dogleg. u is a better
+// estimate for some models, if we have one
+static void unproject_seed( // out
+                            double* u,
+                            double* u_pinhole,
+
+                            // in
+                            const mrcal_point2_t* q,
+                            const mrcal_lensmodel_t* lensmodel,
+                            const double* intrinsics,
+                            const mrcal_projection_precomputed_t* precomputed)
+{
+    const double fx = intrinsics[0];
+    const double fy = intrinsics[1];
+    const double cx = intrinsics[2];
+    const double cy = intrinsics[3];
+
+    // pinhole unprojection
+    mrcal_point3_t v = {.x = (q->x-cx)/fx,
+                        .y = (q->y-cy)/fy,
+                        .z = 1.};
+    mrcal_project_stereographic( (mrcal_point2_t*)u_pinhole, NULL,
+                                 &v,
+                                 1,
+                                 intrinsics );
+    u[0] = u_pinhole[0];
+    u[1] = u_pinhole[1];
+
+    // The splined models are a stereographic projection with a correction, so
+    // q itself is a very good estimate
+    if(lensmodel->type == MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC)
+    {
+        u[0] = q->x;
+        u[1] = q->y;
+        return;
+    }
+
+    // The OPENCV models: the usual fixed-point undistortion, as in OpenCV's
+    // cvUndistortPoints(). A few iterations get us very close for mild
+    // distortions. With strong distortions, near the edges of a wide lens, the
+    // iteration may diverge or land on a finite, but wrong point. So we use
+    // its result only if it reprojects closer to q than the pinhole estimate
+    // does
+    if(MRCAL_LENSMODEL_IS_OPENCV(lensmodel->type))
+    {
+        const int Ndistortions = mrcal_lensmodel_num_params(lensmodel) - 4;
+        double k[12] = {};
+        for(int i=0; i<Ndistortions; i++)
+            k[i] = intrinsics[4+i];
+
+        const double x0 = v.x;
+        const double y0 = v.y;
+        double x = x0;
+        double y = y0;
+        for(int iter=0; iter<5; iter++)
+        {
+            const double r2 = x*x + y*y;
+            const double r4 = r2*r2;
+            const double r6 = r4*r2;
+            const double icdist =
+                (1 + k[5]*r2 + k[6]*r4 + k[7]*r6) /
+                (1 + k[0]*r2 + k[1]*r4 + k[4]*r6);
+            const double dx = 2*k[2]*x*y + k[3]*(r2 + 2*x*x) + k[8] *r2 + k[9] *r4;
+            const double dy = 2*k[3]*x*y + k[2]*(r2 + 2*y*y) + k[10]*r2 + k[11]*r4;
+            const double xnext = (x0 - dx)*icdist;
+            const double ynext = (y0 - dy)*icdist;
+            if(!std::isfinite(xnext) || !std::isfinite(ynext))
+                break;
+            x = xnext;
+            y = ynext;
+        }
+        v.x = x;
+        v.y = y;
+
+        double u_fixedpoint[2];
+        mrcal_project_stereographic( (mrcal_point2_t*)u_fixedpoint, NULL,
+                                     &v,
+                                     1,
+                                     intrinsics );
+
+        double x_pinhole[2], x_fixedpoint[2];
+        unproject_residual(x_pinhole,    NULL, u_pinhole,    q, lensmodel, intrinsics, precomputed);
+        unproject_residual(x_fixedpoint, NULL, u_fixedpoint, q, lensmodel, intrinsics, precomputed);
+        const double norm2x_pinhole    = x_pinhole   [0]*x_pinhole   [0] + x_pinhole   [1]*x_pinhole   [1];
+        const double norm2x_fixedpoint = x_fixedpoint[0]*x_fixedpoint[0] + x_fixedpoint[1]*x_fixedpoint[1];
+        // A non-finite residual is worse than any finite one
+        if(norm2x_fixedpoint < norm2x_pinhole ||
+           (std::isfinite(norm2x_fixedpoint) && !std::isfinite(norm2x_pinhole)))
+        {
+            u[0] = u_fixedpoint[0];
+            u[1] = u_fixedpoint[1];
+        }
+    }
+}
+
+// Newton's method with closed-form 2x2 solves. The step is halved if it doesn't
+// reduce the error, so we can't run away from a good seed. Returns true if we
+// converged. u is updated in-place either way
+static bool unproject_newton( // out, in
+                              double* u,
+
+                              // in
+                              const mrcal_point2_t* q,
+                              const mrcal_lensmodel_t* lensmodel,
+                              const double* intrinsics,
+                              const mrcal_projection_precomputed_t* precomputed)
+{
+    double x[2], J[4];
+    unproject_residual(x, J, u, q, lensmodel, intrinsics, precomputed);
+    double norm2x = x[0]*x[0] + x[1]*x[1];
+
+    for(int iter=0; iter<UNPROJECT_NEWTON_MAX_ITERATIONS; iter++)
+    {
+        if(norm2x == 0.0)
+            return true;
+
+        // J du = -x
+        const double det = J[0]*J[3] - J[1]*J[2];
+        if(!std::isfinite(det) || det == 0.0)
+            return false;
+        double du[2] = { (-J[3]*x[0] + J[1]*x[1]) / det,
+                         ( J[2]*x[0] - J[0]*x[1]) / det };
+        const double norm2du_newton = du[0]*du[0] + du[1]*du[1];
+
+        double u_next[2], x_next[2], norm2x_next = 0.0;
+        int ihalving;
+        for(ihalving=0; ihalving<UNPROJECT_NEWTON_MAX_HALVINGS; ihalving++)
+        {
+            u_next[0] = u[0] + du[0];
+            u_next[1] = u[1] + du[1];
+            unproject_residual(x_next, NULL, u_next, q, lensmodel, intrinsics, precomputed);
+            norm2x_next = x_next[0]*x_next[0] + x_next[1]*x_next[1];
+            if(norm2x_next < norm2x)
+                break;
+            du[0] *= 0.5;
+            du[1] *= 0.5;
+        }
+        if(ihalving == UNPROJECT_NEWTON_MAX_HALVINGS)
+            // No step reduces the error, so we're either at the optimum already
+            // or stuck. The caller looks at the error to decide which
+            return norm2x/2.0 <= 1e-4 &&
+                   norm2du_newton <
+                   UNPROJECT_NEWTON_UPDATE_THRESHOLD*UNPROJECT_NEWTON_UPDATE_THRESHOLD;
+
+        u[0] = u_next[0];
+        u[1] = u_next[1];
+
+        if(du[0]*du[0] + du[1]*du[1] <
+           UNPROJECT_NEWTON_UPDATE_THRESHOLD*UNPROJECT_NEWTON_UPDATE_THRESHOLD)
+            return norm2x_next/2.0 <= 1e-4;
+
+        unproject_residual(x, J, u, q, lensmodel, intrinsics, precomputed);
+        norm2x = x[0]*x[0] + x[1]*x[1];
+    }
+    return false;
+}
+
+// The general-purpose solver. Slower, but more robust than unproject_newton().
+// Returns norm2(x) at the optimum
+static double unproject_dogleg( // out, in
+                                double* u,
+
+                                // in
+                                const mrcal_point2_t* q,
+                                const mrcal_lensmodel_t* lensmodel,
+                                const double* intrinsics,
+                                const mrcal_projection_precomputed_t* precomputed)
+{
+    dogleg_callback_dense_t cb = [&](const double*   u,
+            double*         x,
+            double*         J,
+            void*           cookie //__attribute__((unused))
+    ) {
+        unproject_residual(x, J, u, q, lensmodel, intrinsics, precomputed);
+    };
+
+    dogleg_parameters2_t dogleg_parameters;
+    dogleg_getDefaultParameters(&dogleg_parameters);
+    dogleg_parameters.dogleg_debug = 0;
+    return
+        dogleg_optimize_dense2(u, 2, 2, &cb, NULL,
+                               &dogleg_parameters,
+                               NULL);
+}
+
+static void unproject_one( // out
+                           mrcal_point3_t* out,
+
+                           // in
+                           const mrcal_point2_t* q,
+                           const mrcal_lensmodel_t* lensmodel,
+                           const double* intrinsics,
+                           const mrcal_projection_precomputed_t* precomputed)
+{
+    double u_newton[2];
+    unproject_seed(u_newton, out->xyz, q, lensmodel, intrinsics, precomputed);
+
+    // Newton usually gets there in a few iterations. If it doesn't, I restart
+    // dogleg from the pinhole seed, as we did before Newton existed: Newton,
+    // or its seed, may have been somewhere unhelpful
+    bool converged =
+        unproject_newton(u_newton, q, lensmodel, intrinsics, precomputed);
+    if(converged)
+    {
+        out->xyz[0] = u_newton[0];
+        out->xyz[1] = u_newton[1];
+    }
+    else
+    {
+        double norm2x =
+            unproject_dogleg(out->xyz, q, lensmodel, intrinsics, precomputed);
+
+        //This needs to be precise; if it isn't, I barf. Shouldn't happen
+        //very often
+        if(norm2x/2.0 > 1e-4)
+        {
+            double nan = strtod("NAN", NULL);
+            out->xyz[0] = nan;
+            out->xyz[1] = nan;
+            out->xyz[2] = nan;
+            return;
+        }
+    }
+
+    // out[0,1] is the stereographic representation of the observation
+    // vector using idealized fx,fy,cx,cy. This is already the right
+    // thing if we're reporting in 2d. Otherwise I need to unproject
+
+    // This is the normal no-error path
+    mrcal_unproject_stereographic((mrcal_point3_t*)out, NULL,
+                                  (mrcal_point2_t*)out, 1,
+                                  intrinsics);
+    if(!model_supports_projection_behind_camera(lensmodel) && out->xyz[2] < 0.0)
+    {
+        out->xyz[0] *= -1.0;
+        out->xyz[1] *= -1.0;
+        out->xyz[2] *= -1.0;
+    }
+}
+
 // NOT A PART OF THE EXTERNAL API. This is exported for the mrcal python wrapper
 // only
 bool _mrcal_unproject_internal( // out
@@ -2852,125 +3550,15 @@ bool _mrcal_unproject_internal( // out
             }
     }
 
-    // I optimize in the space of the stereographic projection. This is a 2D
-    // space with a direct mapping to/from observation vectors with a single
-    // singularity directly behind the camera. The allows me to run an
-    // unconstrained optimization here
-    for(int i=0; i<N; i++)
-    {
-        dogleg_callback_dense_t cb = [&](const double*   u,
-                double*         x,
-                double*         J,
-                void*           cookie //__attribute__((unused))
-        ) {
-            // u is the constant-fxy-cxy 2D stereographic
-            // projection of the hypothesis v. I unproject it stereographically,
-            // and project it using the actual model
-            mrcal_point2_t dv_du[3];
-            mrcal_pose_t frame = {};
-            mrcal_unproject_stereographic( &frame.t, dv_du,
-                                           (mrcal_point2_t*)u, 1,
-                                           intrinsics );
-
-            mrcal_point3_t dq_dtframe[2];
-            mrcal_point2_t q_hypothesis;
-            project( &q_hypothesis,
-                     NULL,NULL,NULL,NULL,NULL,
-                     NULL, NULL, NULL, dq_dtframe,
-                     NULL,
-
-                     // in
-                     intrinsics,
-                     NULL,
-                     &frame,
-                     NULL,
-                     true,
-                     lensmodel, precomputed,
-                     0.0, 0,0);
-            x[0] = q_hypothesis.x - q[i].x;
-            x[1] = q_hypothesis.y - q[i].y;
-            J[0*2 + 0] =
-                dq_dtframe[0].x*dv_du[0].x +
-                dq_dtframe[0].y*dv_du[1].x +
-                dq_dtframe[0].z*dv_du[2].x;
-            J[0*2 + 1] =
-                dq_dtframe[0].x*dv_du[0].y +
-                dq_dtframe[0].y*dv_du[1].y +
-                dq_dtframe[0].z*dv_du[2].y;
-            J[1*2 + 0] =
-                dq_dtframe[1].x*dv_du[0].x +
-                dq_dtframe[1].y*dv_du[1].x +
-                dq_dtframe[1].z*dv_du[2].x;
-            J[1*2 + 1] =
-                dq_dtframe[1].x*dv_du[0].y +
-                dq_dtframe[1].y*dv_du[1].y +
-                dq_dtframe[1].z*dv_du[2].y;
-        };
-
-
-        const double fx = intrinsics[0];
-        const double fy = intrinsics[1];
-        const double cx = intrinsics[2];
-        const double cy = intrinsics[3];
-
-        // MSG("init. q=(%g,%g)", q[i].x, q[i].y);
-
-        // initial estimate: pinhole projection
-        mrcal_point3_t v = {.x = (q[i].x-cx)/fx,
-                                                       .y = (q[i].y-cy)/fy,
-                                                       .z = 1.};
-        mrcal_project_stereographic( (mrcal_point2_t*)out->xyz, NULL,
-                                     &v,
-                                     1,
-                                     intrinsics );
-        // MSG("init. out->xyz[]=(%g,%g)", out->x, out->y);
-
-
-        dogleg_parameters2_t dogleg_parameters;
-        dogleg_getDefaultParameters(&dogleg_parameters);
-        dogleg_parameters.dogleg_debug = 0;
-        double norm2x =
-            dogleg_optimize_dense2(out->xyz, 2, 2, &cb, NULL,
-                                   &dogleg_parameters,
-                                   NULL);
-        //This needs to be precise; if it isn't, I barf. Shouldn't happen
-        //very often
-
-        static bool already_complained = false;
-        // MSG("norm2x = %g", norm2x);
-        if(norm2x/2.0 > 1e-4)
-        {
-            if(!already_complained)
-            {
-                // MSG("WARNING: I wasn't able to precisely compute some points. norm2x=%f. Returning nan for those. Will complain just once",
-                //     norm2x);
-                already_complained = true;
-            }
-            double nan = strtod("NAN", NULL);
-            out->xyz[0] = nan;
-            out->xyz[1] = nan;
-        }
-        else
-        {
-            // out[0,1] is the stereographic representation of the observation
-            // vector using idealized fx,fy,cx,cy. This is already the right
-            // thing if we're reporting in 2d. Otherwise I need to unproject
-
-            // This is the normal no-error path
-            mrcal_unproject_stereographic((mrcal_point3_t*)out, NULL,
-                                          (mrcal_point2_t*)out, 1,
-                                          intrinsics);
-            if(!model_supports_projection_behind_camera(lensmodel) && out->xyz[2] < 0.0)
-            {
-                out->xyz[0] *= -1.0;
-                out->xyz[1] *= -1.0;
-                out->xyz[2] *= -1.0;
-            }
-        }
-
-        // Advance to the next point. Error or not
-        out++;
-    }
+    const int Nthreads = std::min(_mrcal_num_threads(0),
+                                  std::max(1, N / UNPROJECT_NPOINTS_PER_THREAD_MIN));
+    _mrcal_parallel_for(N, Nthreads,
+                        [&](int i0, int i1, int)
+                        {
+                            for(int i=i0; i<i1; i++)
+                                unproject_one(&out[i], &q[i],
+                                              lensmodel, intrinsics, precomputed);
+                        });
     return true;
 }
 
@@ -3670,6 +4258,7 @@ bool markOutliers(// output, input
                   int calibration_object_height_n,
 
                   const double* x_measurements,
+                  double k0, double k1,
                   bool verbose)
 {
     // I define an outlier as a feature that's > k stdevs past the mean. I make
@@ -3683,9 +4272,6 @@ bool markOutliers(// output, input
     // higher threshold, then I will need to reoptimize, so I throw out some
     // extra points: all points worse than the lower threshold. This serves to
     // reduce the required re-optimizations
-
-    const double k0 = 4.0;
-    const double k1 = 5.0;
     *Noutliers = 0;
 
     int i_pt,i_feature;
@@ -3815,6 +4401,103 @@ bool markOutliers(// output, input
 #undef LOOP_FEATURE_HEADER
 }
 
+// Scratch memory used by each thread in optimizer_callback()
+typedef struct
+{
+    // Used by the board observations. Npoints_board*2 of each of these, where
+    // Npoints_board = calibration_object_width_n*calibration_object_height_n
+    std::vector<mrcal_point3_t>         dq_drcamera, dq_dtcamera, dq_drframe, dq_dtframe;
+    std::vector<mrcal_calobject_warp_t> dq_dcalobject_warp;
+    // Npoints_board of these
+    std::vector<mrcal_point2_t>         q_hypothesis;
+
+    // Used by the board and point observations. Npoints_board*Ngradients and
+    // Npoints_board of these respectively; at least one point's worth
+    std::vector<double>                 dq_dintrinsics_pool_double;
+    std::vector<int>                    dq_dintrinsics_pool_int;
+
+    // How many times this thread had to grow its scratch memory inside the
+    // callback. Should be 0 if the workspace was sized properly
+    int Nallocations;
+} callback_workspace_thread_t;
+
+// All the memory optimizer_callback() needs. This is sized once by
+// callback_workspace_init() before the solve, and then reused by every
+// callback invocation. In the steady state the callback does no heap
+// allocations at all
+typedef struct
+{
+    // The full intrinsics of each camera, reconstituted from the state vector
+    // and the passed-in intrinsics. Ncameras_intrinsics*Nintrinsics of these,
+    // with intrinsics_all[i] pointing to the start of each camera's chunk
+    std::vector<double>       intrinsics_all_store;
+    std::vector<double*>      intrinsics_all;
+
+    // The extrinsics of each camera, reconstituted similarly.
+    // Ncameras_extrinsics+1 of these: camera_rt_store[0] is a placeholder for
+    // the reference camera (icam_extrinsics == -1), so that camera_rt =
+    // &camera_rt_store[1] can be indexed with icam_extrinsics directly
+    std::vector<mrcal_pose_t> camera_rt_store;
+    mrcal_pose_t*             camera_rt;
+
+    // SPLINED_STEREOGRAPHIC models only. The directions used by the splined
+    // regularization. These depend only on the knot layout, so they're computed
+    // once here, and not in every callback. 3 values for each of the Nx*Ny
+    // knots: the unit radial direction (ux,uy), and the scale applied to the
+    // tangential regularization term
+    std::vector<double>       regularization_splined_directions;
+
+    // One of these for each thread
+    std::vector<callback_workspace_thread_t> threads;
+    _mrcal_thread_pool_t*     pool;
+
+    // The norm2 of the measurements of each block of
+    // CALLBACK_NOBSERVATIONS_PER_BLOCK observations
+    std::vector<double>       norm2_error_blocks;
+
+    // Diagnostics
+    int    Nallocations_workspace; // during callback_workspace_init()
+    int    Ncallbacks;
+    double time_callback__s;
+} callback_workspace_t;
+
+// optimizer_callback() evaluates the observations in blocks of this many. Each
+// block accumulates its own norm2, and these are added together in block
+// order. The blocks don't depend on the number of threads, so neither does the
+// result
+#define CALLBACK_NOBSERVATIONS_PER_BLOCK 8
+
+// Returns a buffer of at least N elements in v, growing v if needed. Each
+// allocation increments *Nallocations
+template<typename T>
+static T* workspace_buffer(std::vector<T>& v, size_t N, int* Nallocations)
+{
+    if(N < 1) N = 1;
+    if(v.size() < N)
+    {
+        if(v.capacity() < N)
+            (*Nallocations)++;
+        v.resize(N);
+    }
+    return v.data();
+}
+
+// Progress-reporting state for one call to optimize_packed_state(). Only used
+// if the user asked for progress reports
+typedef struct
+{
+    mrcal_optimizer_progress_callback_t* callback;
+    void*                                cookie;
+
+    std::chrono::steady_clock::time_point time0;
+
+    // What we report next. Updated as we go
+    mrcal_optimizer_progress_t report;
+
+    // Set once the callback asks us to stop
+    bool stopped;
+} optimizer_progress_t;
+
 typedef struct
 {
     // these are all UNPACKED
@@ -3850,28 +4533,145 @@ typedef struct
 
     const int Nmeasurements, N_j_nonzero, Nintrinsics;
     const char* reportFitMsg;
-} callback_context_t;
 
-static
-void optimizer_callback(// input state
-                       const double*   packed_state,
+    // Where each observation's jacobian entries start. Computed by
+    // jacobian_offsets_observations(). Nobservations_board+1 and
+    // Nobservations_point+1 of these respectively
+    const int* ijacobian0_board;
+    const int* ijacobian0_point;
 
-                       // output measurements
-                       double*         x,
+    // How many threads to use to evaluate the observations. <=0 means "use all
+    // available cores"
+    int Nthreads;
 
-                       // Jacobian
-                       cholmod_sparse* Jt,
+    // Scratch memory. Initialized with callback_workspace_init()
+    callback_workspace_t* workspace;
 
-                       const callback_context_t* ctx)
+    // NULL if the user doesn't want progress reports
+    optimizer_progress_t* progress;
+} callback_context_t;
+
+static void callback_workspace_free(callback_workspace_t* workspace)
 {
-    double norm2_error = 0.0;
+    _mrcal_thread_pool_free(workspace->pool);
+    workspace->pool = NULL;
+}
 
-    int    iJacobian          = 0;
-    int    iMeasurement       = 0;
+// Allocates all the memory optimizer_callback() will need for this context.
+// Must be followed by callback_workspace_free(). The workspace must be
+// zero-initialized before the first call. It may then be passed here again to
+// resize it for a new, larger context: the thread pool and any existing buffers
+// are reused, and the diagnostic counters are reset
+static bool callback_workspace_init(callback_workspace_t* workspace,
+                                    const callback_context_t* ctx)
+{
+    workspace->Nallocations_workspace = 0;
+    workspace->Ncallbacks             = 0;
+    workspace->time_callback__s       = 0.0;
+    for(callback_workspace_thread_t& t : workspace->threads)
+        t.Nallocations = 0;
 
-    int*    Jrowptr = Jt ? (int*)   Jt->p : NULL;
-    int*    Jcolidx = Jt ? (int*)   Jt->i : NULL;
-    double* Jval    = Jt ? (double*)Jt->x : NULL;
+    int* Nallocations = &workspace->Nallocations_workspace;
+
+    if(workspace->pool == NULL)
+    {
+        workspace->pool = _mrcal_thread_pool_create(ctx->Nthreads);
+        if(workspace->pool == NULL)
+        {
+            MSG("Couldn't create the thread pool");
+            return false;
+        }
+        (*Nallocations)++;
+    }
+
+    double* intrinsics_all_store =
+        workspace_buffer(workspace->intrinsics_all_store,
+                         ctx->Ncameras_intrinsics*ctx->Nintrinsics, Nallocations);
+    double** intrinsics_all =
+        workspace_buffer(workspace->intrinsics_all,
+                         ctx->Ncameras_intrinsics, Nallocations);
+    for(int i=0; i<ctx->Ncameras_intrinsics; i++)
+        intrinsics_all[i] = &intrinsics_all_store[i*ctx->Nintrinsics];
+
+    workspace->camera_rt =
+        &workspace_buffer(workspace->camera_rt_store,
+                          ctx->Ncameras_extrinsics+1, Nallocations)[1];
+
+    if(ctx->lensmodel.type == MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC)
+    {
+        const int Nx = ctx->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.Nx;
+        const int Ny = ctx->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.Ny;
+
+        double* d =
+            workspace_buffer(workspace->regularization_splined_directions,
+                             Nx*Ny*3, Nallocations);
+        for(int iy=0; iy<Ny; iy++)
+            for(int ix=0; ix<Nx; ix++)
+            {
+                double* uxy = &d[3*(iy*Nx + ix)];
+
+                // The radial direction of this knot. The knot at the center
+                // (if there is one) has no radial direction, so I regularize
+                // it isotropically
+                uxy[0] = (double)(2*ix - Nx + 1);
+                uxy[1] = (double)(2*iy - Ny + 1);
+                if(2*ix == Nx - 1 &&
+                   2*iy == Ny - 1 )
+                {
+                    uxy[0] = 1.0;
+                    uxy[2] = 1.0;
+                }
+                else
+                {
+                    double mag = sqrt(uxy[0]*uxy[0] + uxy[1]*uxy[1]);
+                    uxy[0] /= mag;
+                    uxy[1] /= mag;
+
+                    // I REALLY penalize tangential corrections
+                    uxy[2] = 10.;
+                }
+            }
+    }
+
+    const int Npoints_board =
+        ctx->Nobservations_board > 0 ?
+        ctx->calibration_object_width_n*ctx->calibration_object_height_n :
+        0;
+    const int Ngradients = get_Ngradients(&ctx->lensmodel, ctx->Nintrinsics);
+
+    workspace_buffer(workspace->norm2_error_blocks,
+                     (ctx->Nobservations_board + ctx->Nobservations_point +
+                      CALLBACK_NOBSERVATIONS_PER_BLOCK-1) / CALLBACK_NOBSERVATIONS_PER_BLOCK,
+                     Nallocations);
+
+    if(workspace->threads.size() != (size_t)_mrcal_thread_pool_num_threads(workspace->pool))
+    {
+        workspace->threads.resize(_mrcal_thread_pool_num_threads(workspace->pool));
+        (*Nallocations)++;
+    }
+    for(callback_workspace_thread_t& t : workspace->threads)
+    {
+        workspace_buffer(t.dq_drcamera,                Npoints_board*2, Nallocations);
+        workspace_buffer(t.dq_dtcamera,                Npoints_board*2, Nallocations);
+        workspace_buffer(t.dq_drframe,                 Npoints_board*2, Nallocations);
+        workspace_buffer(t.dq_dtframe,                 Npoints_board*2, Nallocations);
+        workspace_buffer(t.dq_dcalobject_warp,         Npoints_board*2, Nallocations);
+        workspace_buffer(t.q_hypothesis,               Npoints_board,   Nallocations);
+        workspace_buffer(t.dq_dintrinsics_pool_double, std::max(Npoints_board,1)*Ngradients, Nallocations);
+        workspace_buffer(t.dq_dintrinsics_pool_int,    std::max(Npoints_board,1), Nallocations);
+    }
+
+    MRCAL_TRACE(MRCAL_TRACE_OPTIMIZER_LAYOUT,
+                "Workspace for %d threads: %d board points/observation, %d intrinsics gradients/point, %d allocations",
+                (int)workspace->threads.size(), Npoints_board, Ngradients, *Nallocations);
+    MRCAL_TRACE(MRCAL_TRACE_OPTIMIZER_LAYOUT,
+                "Observations: %d board, %d point; measurements: %d; Jacobian nonzeros: %d",
+                ctx->Nobservations_board, ctx->Nobservations_point,
+                ctx->Nmeasurements, ctx->N_j_nonzero);
+    return true;
+}
+
+// These use the iJacobian, Jcolidx, Jval, Jt local variables
 #define STORE_JACOBIAN(col, g)                  \
     do                                          \
     {                                           \
@@ -3918,528 +4718,403 @@ void optimizer_callback(// input state
         iJacobian += N;                             \
     } while(0)
 
+// Evaluates the measurements and jacobian entries for a single board
+// observation. The measurements are written starting at iMeasurement, and the
+// jacobian entries starting at iJacobian. These are precomputed, so the
+// observations can be evaluated in any order, in parallel. Returns the
+// norm2 of the measurements written
+static
+double optimizer_callback_board_observation(// output measurements
+                                            double*         x,
+                                            // Jacobian
+                                            cholmod_sparse* Jt,
+
+                                            int i_observation_board,
+                                            int iMeasurement,
+                                            int iJacobian,
+                                            callback_workspace_thread_t* workspace,
+
+                                            // in
+                                            const double* packed_state,
+                                            double*const* intrinsics_all,
+                                            const mrcal_pose_t* camera_rt,
+                                            const mrcal_calobject_warp_t* calobject_warp_local,
+                                            int i_var_calobject_warp,
+                                            const callback_context_t* ctx)
+{
+    double norm2_error = 0.0;
+
+    int*    Jrowptr = Jt ? (int*)   Jt->p : NULL;
+    int*    Jcolidx = Jt ? (int*)   Jt->i : NULL;
+    double* Jval    = Jt ? (double*)Jt->x : NULL;
 
     int Ncore = modelHasCore_fxfycxcy(&ctx->lensmodel) ? 4 : 0;
     int Ncore_state = (modelHasCore_fxfycxcy(&ctx->lensmodel) &&
                        ctx->problem_selections.do_optimize_intrinsics_core) ? 4 : 0;
 
-    // If I'm locking down some parameters, then the state vector contains a
-    // subset of my data. I reconstitute the intrinsics and extrinsics here.
-    // I do the frame poses later. This is a good way to do it if I have few
-    // cameras. With many cameras (this will be slow)
-
-    // WARNING: sparsify this. This is potentially a BIG thing on the stack
-    TwoDArray<double> i_all_backing_arr(ctx->Ncameras_intrinsics, ctx->Nintrinsics);
-    double** intrinsics_all = i_all_backing_arr.data();
-
-    std::vector<mrcal_pose_t> camera_rt_arr(std::max(ctx->Ncameras_extrinsics, 1)); //[ctx->Ncameras_extrinsics];
-    mrcal_pose_t *camera_rt = camera_rt_arr.data();
-
-    mrcal_calobject_warp_t calobject_warp_local = {};
-    const int i_var_calobject_warp =
-        mrcal_state_index_calobject_warp(ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                         ctx->Nframes,
-                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                         ctx->problem_selections, &ctx->lensmodel);
-    if(has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board))
-        unpack_solver_state_calobject_warp(&calobject_warp_local, &packed_state[i_var_calobject_warp]);
-    else if(ctx->calobject_warp != NULL)
-        calobject_warp_local = *ctx->calobject_warp;
-
-    for(int icam_intrinsics=0;
-        icam_intrinsics<ctx->Ncameras_intrinsics;
-        icam_intrinsics++)
-    {
-        // Construct the FULL intrinsics vector, based on either the
-        // optimization vector or the inputs, depending on what we're optimizing
-        double* intrinsics_here  = &intrinsics_all[icam_intrinsics][0];
-        double* distortions_here = &intrinsics_all[icam_intrinsics][Ncore];
-
-        int i_var_intrinsics =
-            mrcal_state_index_intrinsics(icam_intrinsics,
-                                         ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                         ctx->Nframes,
-                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                         ctx->problem_selections, &ctx->lensmodel);
-        if(Ncore)
-        {
-            if( ctx->problem_selections.do_optimize_intrinsics_core )
-            {
-                intrinsics_here[0] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_FOCAL_LENGTH;
-                intrinsics_here[1] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_FOCAL_LENGTH;
-                intrinsics_here[2] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_CENTER_PIXEL;
-                intrinsics_here[3] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_CENTER_PIXEL;
-            }
-            else
-                memcpy( intrinsics_here,
-                        &ctx->intrinsics[ctx->Nintrinsics*icam_intrinsics],
-                        Ncore*sizeof(double) );
-        }
-        if( ctx->problem_selections.do_optimize_intrinsics_distortions )
-        {
-            for(int i = 0; i<ctx->Nintrinsics-Ncore; i++)
-                distortions_here[i] = packed_state[i_var_intrinsics++] * SCALE_DISTORTION;
-        }
-        else
-            memcpy( distortions_here,
-                    &ctx->intrinsics[ctx->Nintrinsics*icam_intrinsics + Ncore],
-                    (ctx->Nintrinsics-Ncore)*sizeof(double) );
-    }
-    for(int icam_extrinsics=0;
-        icam_extrinsics<ctx->Ncameras_extrinsics;
-        icam_extrinsics++)
-    {
-        if( icam_extrinsics < 0 ) continue;
+    const mrcal_observation_board_t* observation = &ctx->observations_board[i_observation_board];
 
-        const int i_var_camera_rt =
-            mrcal_state_index_extrinsics(icam_extrinsics,
-                                         ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                         ctx->Nframes,
-                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                         ctx->problem_selections, &ctx->lensmodel);
-        if(ctx->problem_selections.do_optimize_extrinsics)
-            unpack_solver_state_extrinsics_one(&camera_rt[icam_extrinsics], &packed_state[i_var_camera_rt]);
-        else
-            memcpy(&camera_rt[icam_extrinsics], &ctx->extrinsics_fromref[icam_extrinsics], sizeof(mrcal_pose_t));
-    }
+    const int icam_intrinsics = observation->icam.intrinsics;
+    const int icam_extrinsics = observation->icam.extrinsics;
+    const int iframe          = observation->iframe;
 
-    int i_feature = 0;
-    for(int i_observation_board = 0;
-        i_observation_board < ctx->Nobservations_board;
-        i_observation_board++)
-    {
-        const mrcal_observation_board_t* observation = &ctx->observations_board[i_observation_board];
 
-        const int icam_intrinsics = observation->icam.intrinsics;
-        const int icam_extrinsics = observation->icam.extrinsics;
-        const int iframe          = observation->iframe;
+    // Some of these are bogus if problem_selections says they're inactive
+    const int i_var_frame_rt =
+        mrcal_state_index_frames(iframe,
+                                 ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                 ctx->Nframes,
+                                 ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                 ctx->problem_selections, &ctx->lensmodel);
 
+    mrcal_pose_t frame_rt;
+    if(ctx->problem_selections.do_optimize_frames)
+        unpack_solver_state_framert_one(&frame_rt, &packed_state[i_var_frame_rt]);
+    else
+        memcpy(&frame_rt, &ctx->frames_toref[iframe], sizeof(mrcal_pose_t));
 
-        // Some of these are bogus if problem_selections says they're inactive
-        const int i_var_frame_rt =
-            mrcal_state_index_frames(iframe,
+    const int i_var_intrinsics =
+        mrcal_state_index_intrinsics(icam_intrinsics,
+                                     ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                     ctx->Nframes,
+                                     ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                     ctx->problem_selections, &ctx->lensmodel);
+    // invalid if icam_extrinsics < 0, but unused in that case
+    const int i_var_camera_rt  =
+        mrcal_state_index_extrinsics(icam_extrinsics,
                                      ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
                                      ctx->Nframes,
                                      ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
                                      ctx->problem_selections, &ctx->lensmodel);
 
-        mrcal_pose_t frame_rt;
-        if(ctx->problem_selections.do_optimize_frames)
-            unpack_solver_state_framert_one(&frame_rt, &packed_state[i_var_frame_rt]);
-        else
-            memcpy(&frame_rt, &ctx->frames_toref[iframe], sizeof(mrcal_pose_t));
-
-        const int i_var_intrinsics =
-            mrcal_state_index_intrinsics(icam_intrinsics,
-                                         ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                         ctx->Nframes,
-                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                         ctx->problem_selections, &ctx->lensmodel);
-        // invalid if icam_extrinsics < 0, but unused in that case
-        const int i_var_camera_rt  =
-            mrcal_state_index_extrinsics(icam_extrinsics,
-                                         ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                         ctx->Nframes,
-                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                         ctx->problem_selections, &ctx->lensmodel);
-
-        // these are computed in respect to the real-unit parameters,
-        // NOT the unit-scale parameters used by the optimizer
-
-        TwoDArray<mrcal_point3_t> dq_drcamera_backing(ctx->calibration_object_width_n*ctx->calibration_object_height_n, 2);
-        mrcal_point3_t** dq_drcamera = dq_drcamera_backing.data();
-
-        mrcal_point3_t dq_drcamera_test       [ctx->calibration_object_width_n*ctx->calibration_object_height_n][2];
-        mrcal_point3_t dq_dtcamera       [ctx->calibration_object_width_n*ctx->calibration_object_height_n][2];
-        mrcal_point3_t dq_drframe        [ctx->calibration_object_width_n*ctx->calibration_object_height_n][2];
-        mrcal_point3_t dq_dtframe        [ctx->calibration_object_width_n*ctx->calibration_object_height_n][2];
-        mrcal_calobject_warp_t dq_dcalobject_warp[ctx->calibration_object_width_n*ctx->calibration_object_height_n][2];
-        // mrcal_point2_t q_hypothesis      [ctx->calibration_object_width_n*ctx->calibration_object_height_n];
-
-        std::vector<mrcal_point2_t> q_hypothesis(ctx->calibration_object_width_n*ctx->calibration_object_height_n);
-
-        for (int i = 0; i < ctx->calibration_object_width_n*ctx->calibration_object_height_n; i++) {
-            for (int j = 0; j < 2; j++)
-                printf("[%i][%i] offset 1: %lu - offset 2: %lu - delta %lu\n", i, j, 
-                    (char*)&dq_drcamera[i][j] - (char*)&dq_drcamera[0][0],
-                    (char*)&dq_drcamera_test[i][j] - (char*)&dq_drcamera_test[0][0],
-                   ((char*)&dq_drcamera[i][j] - (char*)&dq_drcamera[0][0]) - ((char*)&dq_drcamera_test[i][j] - (char*)&dq_drcamera_test[0][0])
-            );
-        }
-
-
-        // I get the intrinsics gradients in separate arrays, possibly sparsely.
-        // All the data lives in dq_dintrinsics_pool_double[], with the other data
-        // indicating the meaning of the values in the pool.
-        //
-        // dq_dfxy serves a special-case for a perspective core. Such models
-        // are very common, and they have x = fx vx/vz + cx and y = fy vy/vz +
-        // cy. So x depends on fx and NOT on fy, and similarly for y. Similar
-        // for cx,cy, except we know the gradient value beforehand. I support
-        // this case explicitly here. I store dx/dfx and dy/dfy; no cross terms
-        int Ngradients = get_Ngradients(&ctx->lensmodel, ctx->Nintrinsics);
-
-        std::vector<double> dq_dintrinsics_pool_double(ctx->calibration_object_width_n*ctx->calibration_object_height_n*Ngradients);
-        std::vector<int> dq_dintrinsics_pool_int(ctx->calibration_object_width_n*ctx->calibration_object_height_n);
+    const int Npoints_board = ctx->calibration_object_width_n*ctx->calibration_object_height_n;
+
+    // these are computed in respect to the real-unit parameters,
+    // NOT the unit-scale parameters used by the optimizer. They live in the
+    // workspace, which was sized ahead of time
+    mrcal_point3_t (*dq_drcamera)[2] =
+        (mrcal_point3_t (*)[2])workspace_buffer(workspace->dq_drcamera, Npoints_board*2, &workspace->Nallocations);
+    mrcal_point3_t (*dq_dtcamera)[2] =
+        (mrcal_point3_t (*)[2])workspace_buffer(workspace->dq_dtcamera, Npoints_board*2, &workspace->Nallocations);
+    mrcal_point3_t (*dq_drframe)[2] =
+        (mrcal_point3_t (*)[2])workspace_buffer(workspace->dq_drframe,  Npoints_board*2, &workspace->Nallocations);
+    mrcal_point3_t (*dq_dtframe)[2] =
+        (mrcal_point3_t (*)[2])workspace_buffer(workspace->dq_dtframe,  Npoints_board*2, &workspace->Nallocations);
+    mrcal_calobject_warp_t (*dq_dcalobject_warp)[2] =
+        (mrcal_calobject_warp_t (*)[2])workspace_buffer(workspace->dq_dcalobject_warp, Npoints_board*2, &workspace->Nallocations);
+    mrcal_point2_t* q_hypothesis =
+        workspace_buffer(workspace->q_hypothesis, Npoints_board, &workspace->Nallocations);
+
+    // I get the intrinsics gradients in separate arrays, possibly sparsely.
+    // All the data lives in dq_dintrinsics_pool_double[], with the other data
+    // indicating the meaning of the values in the pool.
+    //
+    // dq_dfxy serves a special-case for a perspective core. Such models
+    // are very common, and they have x = fx vx/vz + cx and y = fy vy/vz +
+    // cy. So x depends on fx and NOT on fy, and similarly for y. Similar
+    // for cx,cy, except we know the gradient value beforehand. I support
+    // this case explicitly here. I store dx/dfx and dy/dfy; no cross terms
+    int Ngradients = get_Ngradients(&ctx->lensmodel, ctx->Nintrinsics);
+
+    double* dq_dintrinsics_pool_double =
+        workspace_buffer(workspace->dq_dintrinsics_pool_double, Npoints_board*Ngradients, &workspace->Nallocations);
+    int*    dq_dintrinsics_pool_int    =
+        workspace_buffer(workspace->dq_dintrinsics_pool_int,    Npoints_board,            &workspace->Nallocations);
+
+    double* dq_dfxy = NULL;
+    double* dq_dintrinsics_nocore = NULL;
+    gradient_sparse_meta_t gradient_sparse_meta = {};
+
+    int splined_intrinsics_grad_irun = 0;
+
+    project(q_hypothesis,
+
+            ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
+              dq_dintrinsics_pool_double : NULL,
+            ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
+              dq_dintrinsics_pool_int : NULL,
+            &dq_dfxy, &dq_dintrinsics_nocore, &gradient_sparse_meta,
+
+            ctx->problem_selections.do_optimize_extrinsics ?
+            (mrcal_point3_t*)dq_drcamera : NULL,
+            ctx->problem_selections.do_optimize_extrinsics ?
+            (mrcal_point3_t*)dq_dtcamera : NULL,
+            ctx->problem_selections.do_optimize_frames ?
+            (mrcal_point3_t*)dq_drframe : NULL,
+            ctx->problem_selections.do_optimize_frames ?
+            (mrcal_point3_t*)dq_dtframe : NULL,
+            has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board) ?
+            (mrcal_calobject_warp_t*)dq_dcalobject_warp : NULL,
+
+            // input
+            intrinsics_all[icam_intrinsics],
+            &camera_rt[icam_extrinsics], &frame_rt,
+            ctx->calobject_warp == NULL ? NULL : calobject_warp_local,
+            icam_extrinsics < 0,
+            &ctx->lensmodel, &ctx->precomputed,
+            ctx->calibration_object_spacing,
+            ctx->calibration_object_width_n,
+            ctx->calibration_object_height_n);
+
+    for(int i_pt=0;
+        i_pt < Npoints_board;
+        i_pt++)
+    {
+        const mrcal_point3_t* qx_qy_w__observed = &ctx->observations_board_pool[i_observation_board*Npoints_board + i_pt];
+        double weight = qx_qy_w__observed->z;
 
-        double* dq_dfxy = NULL;
-        double* dq_dintrinsics_nocore = NULL;
-        gradient_sparse_meta_t gradient_sparse_meta = {};
-
-        int splined_intrinsics_grad_irun = 0;
-
-        // Seems like things (specifically, the contents of dq_drframe_array) get corrupted when this function is called? Why is that?
-        project(q_hypothesis.data(),
-
-                ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
-                  dq_dintrinsics_pool_double.data() : NULL,
-                ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
-                  dq_dintrinsics_pool_int.data() : NULL,
-                &dq_dfxy, &dq_dintrinsics_nocore, &gradient_sparse_meta,
-
-                ctx->problem_selections.do_optimize_extrinsics ?
-                (mrcal_point3_t*)dq_drcamera : NULL,
-                ctx->problem_selections.do_optimize_extrinsics ?
-                (mrcal_point3_t*)dq_dtcamera : NULL,
-                ctx->problem_selections.do_optimize_frames ?
-                (mrcal_point3_t*)dq_drframe : NULL,
-                ctx->problem_selections.do_optimize_frames ?
-                (mrcal_point3_t*)dq_dtframe : NULL,
-                has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board) ?
-                (mrcal_calobject_warp_t*)dq_dcalobject_warp : NULL,
-
-                // input
-                intrinsics_all[icam_intrinsics],
-                &camera_rt[icam_extrinsics], &frame_rt,
-                ctx->calobject_warp == NULL ? NULL : &calobject_warp_local,
-                icam_extrinsics < 0,
-                &ctx->lensmodel, &ctx->precomputed,
-                ctx->calibration_object_spacing,
-                ctx->calibration_object_width_n,
-                ctx->calibration_object_height_n);
-
-        for(int i_pt=0;
-            i_pt < ctx->calibration_object_width_n*ctx->calibration_object_height_n;
-            i_pt++, i_feature++)
+        if(weight >= 0.0)
         {
-            const mrcal_point3_t* qx_qy_w__observed = &ctx->observations_board_pool[i_feature];
-            double weight = qx_qy_w__observed->z;
-
-            if(weight >= 0.0)
+            // I have my two measurements (dx, dy). I propagate their
+            // gradient and store them
+            for( int i_xy=0; i_xy<2; i_xy++ )
             {
-                // I have my two measurements (dx, dy). I propagate their
-                // gradient and store them
-                for( int i_xy=0; i_xy<2; i_xy++ )
+                double err = (q_hypothesis[i_pt].xy[i_xy] - qx_qy_w__observed->xyz[i_xy]) * weight;
+
+                if( ctx->reportFitMsg )
                 {
-                    double err = (q_hypothesis[i_pt].xy[i_xy] - qx_qy_w__observed->xyz[i_xy]) * weight;
+                    MSG("%s: obs/frame/cam_i/cam_e/dot: %d %d %d %d %d err: %g",
+                        ctx->reportFitMsg,
+                        i_observation_board, iframe, icam_intrinsics, icam_extrinsics, i_pt, err);
+                    continue;
+                }
 
-                    if( ctx->reportFitMsg )
-                    {
-                        MSG("%s: obs/frame/cam_i/cam_e/dot: %d %d %d %d %d err: %g",
-                            ctx->reportFitMsg,
-                            i_observation_board, iframe, icam_intrinsics, icam_extrinsics, i_pt, err);
-                        continue;
-                    }
+                if(Jt) Jrowptr[iMeasurement] = iJacobian;
+                x[iMeasurement] = err;
+                norm2_error += err*err;
 
-                    if(Jt) Jrowptr[iMeasurement] = iJacobian;
-                    x[iMeasurement] = err;
-                    norm2_error += err*err;
+                if( ctx->problem_selections.do_optimize_intrinsics_core )
+                {
+                    // fx,fy. x depends on fx only. y depends on fy only
+                    STORE_JACOBIAN( i_var_intrinsics + i_xy,
+                                    dq_dfxy[i_pt*2 + i_xy] *
+                                    weight * SCALE_INTRINSICS_FOCAL_LENGTH );
 
-                    if( ctx->problem_selections.do_optimize_intrinsics_core )
-                    {
-                        // fx,fy. x depends on fx only. y depends on fy only
-                        STORE_JACOBIAN( i_var_intrinsics + i_xy,
-                                        dq_dfxy[i_pt*2 + i_xy] *
-                                        weight * SCALE_INTRINSICS_FOCAL_LENGTH );
-
-                        // cx,cy. The gradients here are known to be 1. And x depends on cx only. And y depends on cy only
-                        STORE_JACOBIAN( i_var_intrinsics + i_xy+2,
-                                        weight * SCALE_INTRINSICS_CENTER_PIXEL );
-                    }
+                    // cx,cy. The gradients here are known to be 1. And x depends on cx only. And y depends on cy only
+                    STORE_JACOBIAN( i_var_intrinsics + i_xy+2,
+                                    weight * SCALE_INTRINSICS_CENTER_PIXEL );
+                }
 
-                    if( ctx->problem_selections.do_optimize_intrinsics_distortions )
+                if( ctx->problem_selections.do_optimize_intrinsics_distortions )
+                {
+                    if(gradient_sparse_meta.pool != NULL)
                     {
-                        if(gradient_sparse_meta.pool != NULL)
-                        {
-                            // u = stereographic(p)
-                            // q = (u + deltau(u)) * f + c
-                            //
-                            // Intrinsics:
-                            //   dq/diii = f ddeltau/diii
-                            //
-                            // ddeltau/diii = flatten(ABCDx[0..3] * ABCDy[0..3])
-                            const int ivar0 = dq_dintrinsics_pool_int[splined_intrinsics_grad_irun] -
-                                ( ctx->problem_selections.do_optimize_intrinsics_core ? 0 : 4 );
-
-                            const int     len   = gradient_sparse_meta.run_side_length;
-                            const double* ABCDx = &gradient_sparse_meta.pool[len*2*splined_intrinsics_grad_irun + 0];
-                            const double* ABCDy = &gradient_sparse_meta.pool[len*2*splined_intrinsics_grad_irun + len];
-
-                            const int ivar_stridey = gradient_sparse_meta.ivar_stridey;
-                            const double* fxy = &intrinsics_all[icam_intrinsics][0];
-
-                            for(int iy=0; iy<len; iy++)
-                                for(int ix=0; ix<len; ix++)
-                                    STORE_JACOBIAN( i_var_intrinsics + ivar0 + iy*ivar_stridey + ix*2 + i_xy,
-                                                    ABCDx[ix]*ABCDy[iy]*fxy[i_xy] *
-                                                    weight * SCALE_DISTORTION );
-                        }
-                        else
-                        {
-                            for(int i=0; i<ctx->Nintrinsics-Ncore; i++)
-                                STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i,
-                                                dq_dintrinsics_nocore[i_pt*2*(ctx->Nintrinsics-Ncore) +
-                                                                       i_xy*(ctx->Nintrinsics-Ncore) +
-                                                                       i] *
+                        // u = stereographic(p)
+                        // q = (u + deltau(u)) * f + c
+                        //
+                        // Intrinsics:
+                        //   dq/diii = f ddeltau/diii
+                        //
+                        // ddeltau/diii = flatten(ABCDx[0..3] * ABCDy[0..3])
+                        const int ivar0 = dq_dintrinsics_pool_int[splined_intrinsics_grad_irun] -
+                            ( ctx->problem_selections.do_optimize_intrinsics_core ? 0 : 4 );
+
+                        const int     len   = gradient_sparse_meta.run_side_length;
+                        const double* ABCDx = &gradient_sparse_meta.pool[len*2*splined_intrinsics_grad_irun + 0];
+                        const double* ABCDy = &gradient_sparse_meta.pool[len*2*splined_intrinsics_grad_irun + len];
+
+                        const int ivar_stridey = gradient_sparse_meta.ivar_stridey;
+                        const double* fxy = &intrinsics_all[icam_intrinsics][0];
+
+                        for(int iy=0; iy<len; iy++)
+                            for(int ix=0; ix<len; ix++)
+                                STORE_JACOBIAN( i_var_intrinsics + ivar0 + iy*ivar_stridey + ix*2 + i_xy,
+                                                ABCDx[ix]*ABCDy[iy]*fxy[i_xy] *
                                                 weight * SCALE_DISTORTION );
-                        }
                     }
-
-                    if( ctx->problem_selections.do_optimize_extrinsics )
-                        if( icam_extrinsics >= 0 )
-                        {
-                            STORE_JACOBIAN3( i_var_camera_rt + 0,
-                                             dq_drcamera[i_pt][i_xy].xyz[0] *
-                                             weight * SCALE_ROTATION_CAMERA,
-                                             dq_drcamera[i_pt][i_xy].xyz[1] *
-                                             weight * SCALE_ROTATION_CAMERA,
-                                             dq_drcamera[i_pt][i_xy].xyz[2] *
-                                             weight * SCALE_ROTATION_CAMERA);
-                            STORE_JACOBIAN3( i_var_camera_rt + 3,
-                                             dq_dtcamera[i_pt][i_xy].xyz[0] *
-                                             weight * SCALE_TRANSLATION_CAMERA,
-                                             dq_dtcamera[i_pt][i_xy].xyz[1] *
-                                             weight * SCALE_TRANSLATION_CAMERA,
-                                             dq_dtcamera[i_pt][i_xy].xyz[2] *
-                                             weight * SCALE_TRANSLATION_CAMERA);
-                        }
-
-                    if( ctx->problem_selections.do_optimize_frames )
+                    else
                     {
-                        STORE_JACOBIAN3( i_var_frame_rt + 0,
-                                         dq_drframe[i_pt][i_xy].xyz[0] *
-                                         weight * SCALE_ROTATION_FRAME,
-                                         dq_drframe[i_pt][i_xy].xyz[1] *
-                                         weight * SCALE_ROTATION_FRAME,
-                                         dq_drframe[i_pt][i_xy].xyz[2] *
-                                         weight * SCALE_ROTATION_FRAME);
-                        STORE_JACOBIAN3( i_var_frame_rt + 3,
-                                         dq_dtframe[i_pt][i_xy].xyz[0] *
-                                         weight * SCALE_TRANSLATION_FRAME,
-                                         dq_dtframe[i_pt][i_xy].xyz[1] *
-                                         weight * SCALE_TRANSLATION_FRAME,
-                                         dq_dtframe[i_pt][i_xy].xyz[2] *
-                                         weight * SCALE_TRANSLATION_FRAME);
+                        for(int i=0; i<ctx->Nintrinsics-Ncore; i++)
+                            STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i,
+                                            dq_dintrinsics_nocore[i_pt*2*(ctx->Nintrinsics-Ncore) +
+                                                                   i_xy*(ctx->Nintrinsics-Ncore) +
+                                                                   i] *
+                                            weight * SCALE_DISTORTION );
                     }
+                }
 
-                    if( has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board) )
+                if( ctx->problem_selections.do_optimize_extrinsics )
+                    if( icam_extrinsics >= 0 )
                     {
-                        STORE_JACOBIAN_N( i_var_calobject_warp,
-                                          dq_dcalobject_warp[i_pt][i_xy].values,
-                                          weight * SCALE_CALOBJECT_WARP,
-                                          MRCAL_NSTATE_CALOBJECT_WARP);
+                        STORE_JACOBIAN3( i_var_camera_rt + 0,
+                                         dq_drcamera[i_pt][i_xy].xyz[0] *
+                                         weight * SCALE_ROTATION_CAMERA,
+                                         dq_drcamera[i_pt][i_xy].xyz[1] *
+                                         weight * SCALE_ROTATION_CAMERA,
+                                         dq_drcamera[i_pt][i_xy].xyz[2] *
+                                         weight * SCALE_ROTATION_CAMERA);
+                        STORE_JACOBIAN3( i_var_camera_rt + 3,
+                                         dq_dtcamera[i_pt][i_xy].xyz[0] *
+                                         weight * SCALE_TRANSLATION_CAMERA,
+                                         dq_dtcamera[i_pt][i_xy].xyz[1] *
+                                         weight * SCALE_TRANSLATION_CAMERA,
+                                         dq_dtcamera[i_pt][i_xy].xyz[2] *
+                                         weight * SCALE_TRANSLATION_CAMERA);
                     }
 
-                    iMeasurement++;
+                if( ctx->problem_selections.do_optimize_frames )
+                {
+                    STORE_JACOBIAN3( i_var_frame_rt + 0,
+                                     dq_drframe[i_pt][i_xy].xyz[0] *
+                                     weight * SCALE_ROTATION_FRAME,
+                                     dq_drframe[i_pt][i_xy].xyz[1] *
+                                     weight * SCALE_ROTATION_FRAME,
+                                     dq_drframe[i_pt][i_xy].xyz[2] *
+                                     weight * SCALE_ROTATION_FRAME);
+                    STORE_JACOBIAN3( i_var_frame_rt + 3,
+                                     dq_dtframe[i_pt][i_xy].xyz[0] *
+                                     weight * SCALE_TRANSLATION_FRAME,
+                                     dq_dtframe[i_pt][i_xy].xyz[1] *
+                                     weight * SCALE_TRANSLATION_FRAME,
+                                     dq_dtframe[i_pt][i_xy].xyz[2] *
+                                     weight * SCALE_TRANSLATION_FRAME);
                 }
-            }
-            else
-            {
-                // Outlier.
-
-                // This is arbitrary. I'm skipping this observation, so I don't
-                // touch the projection results, and I set the measurement and
-                // all its gradients to 0. I need to have SOME dependency on the
-                // frame parameters to ensure a full-rank Hessian, so if we're
-                // skipping all observations for this frame the system will
-                // become singular. I don't currently handle this. libdogleg
-                // will complain loudly, and add small diagonal L2
-                // regularization terms
-                for( int i_xy=0; i_xy<2; i_xy++ )
-                {
-                    const double err = 0.0;
-
-                    if( ctx->reportFitMsg )
-                    {
-                        MSG( "%s: obs/frame/cam_i/cam_e/dot: %d %d %d %d %d err: %g",
-                             ctx->reportFitMsg,
-                             i_observation_board, iframe, icam_intrinsics, icam_extrinsics, i_pt, err);
-                        continue;
-                    }
-
-                    if(Jt) Jrowptr[iMeasurement] = iJacobian;
-                    x[iMeasurement] = err;
-                    norm2_error += err*err;
-
-                    if( ctx->problem_selections.do_optimize_intrinsics_core )
-                    {
-                        STORE_JACOBIAN( i_var_intrinsics + i_xy,   0.0 );
-                        STORE_JACOBIAN( i_var_intrinsics + i_xy+2, 0.0 );
-                    }
 
-                    if( ctx->problem_selections.do_optimize_intrinsics_distortions )
-                    {
-                        if(gradient_sparse_meta.pool != NULL)
-                        {
-                            const int ivar0 = dq_dintrinsics_pool_int[splined_intrinsics_grad_irun] -
-                                ( ctx->problem_selections.do_optimize_intrinsics_core ? 0 : 4 );
-                            const int len          = gradient_sparse_meta.run_side_length;
-                            const int ivar_stridey = gradient_sparse_meta.ivar_stridey;
-
-                            for(int iy=0; iy<len; iy++)
-                                for(int ix=0; ix<len; ix++)
-                                    STORE_JACOBIAN( i_var_intrinsics + ivar0 + iy*ivar_stridey + ix*2 + i_xy, 0.0 );
-                        }
-                        else
-                        {
-                            for(int i=0; i<ctx->Nintrinsics-Ncore; i++)
-                                STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i, 0.0 );
-                        }
-                    }
-
-                    if( ctx->problem_selections.do_optimize_extrinsics )
-                        if( icam_extrinsics >= 0 )
-                        {
-                            STORE_JACOBIAN3( i_var_camera_rt + 0, 0.0, 0.0, 0.0);
-                            STORE_JACOBIAN3( i_var_camera_rt + 3, 0.0, 0.0, 0.0);
-                        }
-
-                    if( ctx->problem_selections.do_optimize_frames )
-                    {
-                        // Arbitrary differences between the dimensions to keep
-                        // my Hessian non-singular. This is 100% arbitrary. I'm
-                        // skipping these measurements so these variables
-                        // actually don't affect the computation at all
-                        STORE_JACOBIAN3( i_var_frame_rt + 0, 0,0,0);
-                        STORE_JACOBIAN3( i_var_frame_rt + 3, 0,0,0);
-                    }
-
-                    if( has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board) )
-                        STORE_JACOBIAN_N( i_var_calobject_warp,
-                                          (double*)NULL, 0.0,
-                                          MRCAL_NSTATE_CALOBJECT_WARP);
-
-                    iMeasurement++;
+                if( has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board) )
+                {
+                    STORE_JACOBIAN_N( i_var_calobject_warp,
+                                      dq_dcalobject_warp[i_pt][i_xy].values,
+                                      weight * SCALE_CALOBJECT_WARP,
+                                      MRCAL_NSTATE_CALOBJECT_WARP);
                 }
+
+                iMeasurement++;
             }
-            if(gradient_sparse_meta.pool != NULL)
-                splined_intrinsics_grad_irun++;
         }
-
-        
-        // // Cleanup
-        // for (const auto& thing : dq_drcamera_array) delete thing;
-        // for (const auto& thing : dq_dtcamera_array) delete thing;
-        // for (const auto& thing : dq_drframe_array) delete thing;
-        // for (const auto& thing : dq_dtframe_array) delete thing;
-        // for (const auto& thing : dq_dcalobject_warp_array) delete thing;
-    }
-
-    // Handle all the point observations. This is VERY similar to the
-    // board-observation loop above. Please consolidate
-    for(int i_observation_point = 0;
-        i_observation_point < ctx->Nobservations_point;
-        i_observation_point++)
-    {
-        const mrcal_observation_point_t* observation = &ctx->observations_point[i_observation_point];
-
-        const int icam_intrinsics = observation->icam.intrinsics;
-        const int icam_extrinsics = observation->icam.extrinsics;
-        const int i_point          = observation->i_point;
-        const bool use_position_from_state =
-            ctx->problem_selections.do_optimize_frames &&
-            i_point < ctx->Npoints - ctx->Npoints_fixed;
-
-        const mrcal_point3_t* qx_qy_w__observed = &observation->px;
-        double weight = qx_qy_w__observed->z;
-
-        if(weight <= 0.0)
+        else
         {
-            // Outlier. Cost = 0. Jacobians are 0 too, but I must preserve the
-            // structure
-            const int i_var_intrinsics =
-                mrcal_state_index_intrinsics(icam_intrinsics,
-                                             ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                             ctx->Nframes,
-                                             ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                             ctx->problem_selections, &ctx->lensmodel);
-            // invalid if icam_extrinsics < 0, but unused in that case
-            const int i_var_camera_rt  =
-                mrcal_state_index_extrinsics(icam_extrinsics,
-                                             ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                             ctx->Nframes,
-                                             ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                             ctx->problem_selections, &ctx->lensmodel);
-            const int i_var_point      =
-                mrcal_state_index_points(i_point,
-                                         ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
-                                         ctx->Nframes,
-                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
-                                         ctx->problem_selections, &ctx->lensmodel);
-
-            // I have my two measurements (dx, dy). I propagate their
-            // gradient and store them
+            // Outlier.
+
+            // This is arbitrary. I'm skipping this observation, so I don't
+            // touch the projection results, and I set the measurement and
+            // all its gradients to 0. I need to have SOME dependency on the
+            // frame parameters to ensure a full-rank Hessian, so if we're
+            // skipping all observations for this frame the system will
+            // become singular. I don't currently handle this. libdogleg
+            // will complain loudly, and add small diagonal L2
+            // regularization terms
             for( int i_xy=0; i_xy<2; i_xy++ )
             {
+                const double err = 0.0;
+
+                if( ctx->reportFitMsg )
+                {
+                    MSG( "%s: obs/frame/cam_i/cam_e/dot: %d %d %d %d %d err: %g",
+                         ctx->reportFitMsg,
+                         i_observation_board, iframe, icam_intrinsics, icam_extrinsics, i_pt, err);
+                    continue;
+                }
+
                 if(Jt) Jrowptr[iMeasurement] = iJacobian;
-                x[iMeasurement] = 0;
+                x[iMeasurement] = err;
+                norm2_error += err*err;
 
                 if( ctx->problem_selections.do_optimize_intrinsics_core )
                 {
-                    // fx,fy. x depends on fx only. y depends on fy only
-                    STORE_JACOBIAN( i_var_intrinsics + i_xy, 0 );
-
-                    // cx,cy. The gradients here are known to be 1. And x depends on cx only. And y depends on cy only
-                    STORE_JACOBIAN( i_var_intrinsics + i_xy+2, 0);
+                    STORE_JACOBIAN( i_var_intrinsics + i_xy,   0.0 );
+                    STORE_JACOBIAN( i_var_intrinsics + i_xy+2, 0.0 );
                 }
 
                 if( ctx->problem_selections.do_optimize_intrinsics_distortions )
                 {
-                    if( (ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions) &&
-                        ctx->lensmodel.type == MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC )
+                    if(gradient_sparse_meta.pool != NULL)
                     {
-                        // sparse gradient. This is an outlier, so it doesn't
-                        // matter which points I say I depend on, as long as I
-                        // pick the right number, and says that j=0. I pick the
-                        // control points at the start because why not
-                        const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__config_t* config =
-                            &ctx->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config;
-                        int runlen = config->order+1;
-                        for(int i=0; i<runlen*runlen; i++)
-                            STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i, 0);
+                        const int ivar0 = dq_dintrinsics_pool_int[splined_intrinsics_grad_irun] -
+                            ( ctx->problem_selections.do_optimize_intrinsics_core ? 0 : 4 );
+                        const int len          = gradient_sparse_meta.run_side_length;
+                        const int ivar_stridey = gradient_sparse_meta.ivar_stridey;
+
+                        for(int iy=0; iy<len; iy++)
+                            for(int ix=0; ix<len; ix++)
+                                STORE_JACOBIAN( i_var_intrinsics + ivar0 + iy*ivar_stridey + ix*2 + i_xy, 0.0 );
                     }
                     else
+                    {
                         for(int i=0; i<ctx->Nintrinsics-Ncore; i++)
-                            STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i, 0);
+                            STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i, 0.0 );
+                    }
                 }
 
-                if(icam_extrinsics >= 0 && ctx->problem_selections.do_optimize_extrinsics )
+                if( ctx->problem_selections.do_optimize_extrinsics )
+                    if( icam_extrinsics >= 0 )
+                    {
+                        STORE_JACOBIAN3( i_var_camera_rt + 0, 0.0, 0.0, 0.0);
+                        STORE_JACOBIAN3( i_var_camera_rt + 3, 0.0, 0.0, 0.0);
+                    }
+
+                if( ctx->problem_selections.do_optimize_frames )
                 {
-                    STORE_JACOBIAN3( i_var_camera_rt + 0, 0,0,0 );
-                    STORE_JACOBIAN3( i_var_camera_rt + 3, 0,0,0 );
+                    // Arbitrary differences between the dimensions to keep
+                    // my Hessian non-singular. This is 100% arbitrary. I'm
+                    // skipping these measurements so these variables
+                    // actually don't affect the computation at all
+                    STORE_JACOBIAN3( i_var_frame_rt + 0, 0,0,0);
+                    STORE_JACOBIAN3( i_var_frame_rt + 3, 0,0,0);
                 }
 
-                if( use_position_from_state )
-                    STORE_JACOBIAN3( i_var_point, 0,0,0 );
+                if( has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board) )
+                    STORE_JACOBIAN_N( i_var_calobject_warp,
+                                      (double*)NULL, 0.0,
+                                      MRCAL_NSTATE_CALOBJECT_WARP);
 
                 iMeasurement++;
             }
+        }
+        if(gradient_sparse_meta.pool != NULL)
+            splined_intrinsics_grad_irun++;
+    }
 
-            if(Jt) Jrowptr[iMeasurement] = iJacobian;
-            x[iMeasurement] = 0;
-            if(icam_extrinsics >= 0 && ctx->problem_selections.do_optimize_extrinsics )
-            {
-                STORE_JACOBIAN3( i_var_camera_rt + 0, 0,0,0 );
-                STORE_JACOBIAN3( i_var_camera_rt + 3, 0,0,0 );
-            }
-            if( use_position_from_state )
-                STORE_JACOBIAN3( i_var_point, 0,0,0 );
-            iMeasurement++;
+    
 
-            continue;
-        }
+    return norm2_error;
+}
 
+// Evaluates the measurements and jacobian entries for a single point
+// observation. Like optimizer_callback_board_observation(), this writes to
+// precomputed locations, and returns the norm2 of the measurements written
+static
+double optimizer_callback_point_observation(// output measurements
+                                            double*         x,
+                                            // Jacobian
+                                            cholmod_sparse* Jt,
+
+                                            int i_observation_point,
+                                            int iMeasurement,
+                                            int iJacobian,
+                                            callback_workspace_thread_t* workspace,
+
+                                            // in
+                                            const double* packed_state,
+                                            double*const* intrinsics_all,
+                                            const mrcal_pose_t* camera_rt,
+                                            const callback_context_t* ctx)
+{
+    double norm2_error = 0.0;
 
+    int*    Jrowptr = Jt ? (int*)   Jt->p : NULL;
+    int*    Jcolidx = Jt ? (int*)   Jt->i : NULL;
+    double* Jval    = Jt ? (double*)Jt->x : NULL;
+
+    int Ncore = modelHasCore_fxfycxcy(&ctx->lensmodel) ? 4 : 0;
+    int Ncore_state = (modelHasCore_fxfycxcy(&ctx->lensmodel) &&
+                       ctx->problem_selections.do_optimize_intrinsics_core) ? 4 : 0;
+
+    const mrcal_observation_point_t* observation = &ctx->observations_point[i_observation_point];
+
+    const int icam_intrinsics = observation->icam.intrinsics;
+    const int icam_extrinsics = observation->icam.extrinsics;
+    const int i_point          = observation->i_point;
+    const bool use_position_from_state =
+        ctx->problem_selections.do_optimize_frames &&
+        i_point < ctx->Npoints - ctx->Npoints_fixed;
+
+    const mrcal_point3_t* qx_qy_w__observed = &observation->px;
+    double weight = qx_qy_w__observed->z;
+
+    if(weight <= 0.0)
+    {
+        // Outlier. Cost = 0. Jacobians are 0 too, but I must preserve the
+        // structure
         const int i_var_intrinsics =
             mrcal_state_index_intrinsics(icam_intrinsics,
                                          ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
@@ -4459,298 +5134,552 @@ void optimizer_callback(// input state
                                      ctx->Nframes,
                                      ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
                                      ctx->problem_selections, &ctx->lensmodel);
-        mrcal_point3_t point_ref;
-        if(use_position_from_state)
-            unpack_solver_state_point_one(&point_ref, &packed_state[i_var_point]);
-        else
-            point_ref = ctx->points[i_point];
-
-        int Ngradients = get_Ngradients(&ctx->lensmodel, ctx->Nintrinsics);
-
-        // WARNING: "compute size(dq_dintrinsics_pool_double) correctly and maybe bounds-check"
-        double * dq_dintrinsics_pool_double = (double*)alloca(Ngradients * sizeof(double));
-        // used for LENSMODEL_SPLINED_STEREOGRAPHIC only, but getting rid of
-        // this in other cases isn't worth the trouble
-        int    dq_dintrinsics_pool_int   [1];
-        double* dq_dfxy                             = NULL;
-        double* dq_dintrinsics_nocore               = NULL;
-        gradient_sparse_meta_t gradient_sparse_meta = {};
-
-        mrcal_point3_t dq_drcamera[2];
-        mrcal_point3_t dq_dtcamera[2];
-        mrcal_point3_t dq_dpoint  [2];
-
-        // The array reference [-3] is intended, but the compiler throws a
-        // warning. I silence it here
-#if 0
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Warray-bounds"
-#endif
-        mrcal_point2_t q_hypothesis;
-        project(&q_hypothesis,
-
-                ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
-                dq_dintrinsics_pool_double : NULL,
-                ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
-                dq_dintrinsics_pool_int : NULL,
-                &dq_dfxy, &dq_dintrinsics_nocore, &gradient_sparse_meta,
-
-                ctx->problem_selections.do_optimize_extrinsics ?
-                dq_drcamera : NULL,
-                ctx->problem_selections.do_optimize_extrinsics ?
-                dq_dtcamera : NULL,
-                NULL, // frame rotation. I only have a point position
-                use_position_from_state ? dq_dpoint : NULL,
-                NULL,
-
-                // input
-                intrinsics_all[icam_intrinsics],
-                &camera_rt[icam_extrinsics],
-
-                // I only have the point position, so the 'rt' memory
-                // points 3 back. The fake "r" here will not be
-                // referenced
-                (mrcal_pose_t*)(&point_ref.xyz[-3]),
-                NULL,
-
-                icam_extrinsics < 0,
-                &ctx->lensmodel, &ctx->precomputed,
-                0,0,0);
-#if 0
-#pragma GCC diagnostic pop
-#endif
 
         // I have my two measurements (dx, dy). I propagate their
         // gradient and store them
         for( int i_xy=0; i_xy<2; i_xy++ )
         {
-            const double err = (q_hypothesis.xy[i_xy] - qx_qy_w__observed->xyz[i_xy])*weight;
-
             if(Jt) Jrowptr[iMeasurement] = iJacobian;
-            x[iMeasurement] = err;
-            norm2_error += err*err;
+            x[iMeasurement] = 0;
 
             if( ctx->problem_selections.do_optimize_intrinsics_core )
             {
                 // fx,fy. x depends on fx only. y depends on fy only
-                STORE_JACOBIAN( i_var_intrinsics + i_xy,
-                                dq_dfxy[i_xy] *
-                                weight * SCALE_INTRINSICS_FOCAL_LENGTH );
+                STORE_JACOBIAN( i_var_intrinsics + i_xy, 0 );
 
                 // cx,cy. The gradients here are known to be 1. And x depends on cx only. And y depends on cy only
-                STORE_JACOBIAN( i_var_intrinsics + i_xy+2,
-                                weight * SCALE_INTRINSICS_CENTER_PIXEL );
+                STORE_JACOBIAN( i_var_intrinsics + i_xy+2, 0);
             }
 
             if( ctx->problem_selections.do_optimize_intrinsics_distortions )
             {
-                if(gradient_sparse_meta.pool != NULL)
+                if( (ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions) &&
+                    ctx->lensmodel.type == MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC )
                 {
-                    // u = stereographic(p)
-                    // q = (u + deltau(u)) * f + c
-                    //
-                    // Intrinsics:
-                    //   dq/diii = f ddeltau/diii
-                    //
-                    // ddeltau/diii = flatten(ABCDx[0..3] * ABCDy[0..3])
-                    const int ivar0 = dq_dintrinsics_pool_int[0] -
-                        ( ctx->problem_selections.do_optimize_intrinsics_core ? 0 : 4 );
-
-                    const int     len   = gradient_sparse_meta.run_side_length;
-                    const double* ABCDx = &gradient_sparse_meta.pool[0];
-                    const double* ABCDy = &gradient_sparse_meta.pool[len];
-
-                    const int ivar_stridey = gradient_sparse_meta.ivar_stridey;
-                    const double* fxy = &intrinsics_all[icam_intrinsics][0];
-
-                    for(int iy=0; iy<len; iy++)
-                        for(int ix=0; ix<len; ix++)
-                        {
-                            STORE_JACOBIAN( i_var_intrinsics + ivar0 + iy*ivar_stridey + ix*2 + i_xy,
-                                            ABCDx[ix]*ABCDy[iy]*fxy[i_xy] *
-                                            weight * SCALE_DISTORTION );
-                        }
+                    // sparse gradient. This is an outlier, so it doesn't
+                    // matter which points I say I depend on, as long as I
+                    // pick the right number, and says that j=0. I pick the
+                    // control points at the start because why not
+                    const mrcal_LENSMODEL_SPLINED_STEREOGRAPHIC__config_t* config =
+                        &ctx->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config;
+                    int runlen = config->order+1;
+                    for(int i=0; i<runlen*runlen; i++)
+                        STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i, 0);
                 }
                 else
-                {
                     for(int i=0; i<ctx->Nintrinsics-Ncore; i++)
-                        STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i,
-                                        dq_dintrinsics_nocore[i_xy*(ctx->Nintrinsics-Ncore) +
-                                                               i] *
-                                        weight * SCALE_DISTORTION );
-                }
+                        STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i, 0);
             }
 
-            if( ctx->problem_selections.do_optimize_extrinsics )
-                if( icam_extrinsics >= 0 )
-                {
-                    STORE_JACOBIAN3( i_var_camera_rt + 0,
-                                     dq_drcamera[i_xy].xyz[0] *
-                                     weight * SCALE_ROTATION_CAMERA,
-                                     dq_drcamera[i_xy].xyz[1] *
-                                     weight * SCALE_ROTATION_CAMERA,
-                                     dq_drcamera[i_xy].xyz[2] *
-                                     weight * SCALE_ROTATION_CAMERA);
-                    STORE_JACOBIAN3( i_var_camera_rt + 3,
-                                     dq_dtcamera[i_xy].xyz[0] *
-                                     weight * SCALE_TRANSLATION_CAMERA,
-                                     dq_dtcamera[i_xy].xyz[1] *
-                                     weight * SCALE_TRANSLATION_CAMERA,
-                                     dq_dtcamera[i_xy].xyz[2] *
-                                     weight * SCALE_TRANSLATION_CAMERA);
-                }
+            if(icam_extrinsics >= 0 && ctx->problem_selections.do_optimize_extrinsics )
+            {
+                STORE_JACOBIAN3( i_var_camera_rt + 0, 0,0,0 );
+                STORE_JACOBIAN3( i_var_camera_rt + 3, 0,0,0 );
+            }
 
             if( use_position_from_state )
-                STORE_JACOBIAN3( i_var_point,
-                                 dq_dpoint[i_xy].xyz[0] *
-                                 weight * SCALE_POSITION_POINT,
-                                 dq_dpoint[i_xy].xyz[1] *
-                                 weight * SCALE_POSITION_POINT,
-                                 dq_dpoint[i_xy].xyz[2] *
-                                 weight * SCALE_POSITION_POINT);
+                STORE_JACOBIAN3( i_var_point, 0,0,0 );
 
             iMeasurement++;
         }
 
-        // Now the range normalization (make sure the range isn't
-        // aphysically high or aphysically low)
-        auto get_penalty = [&](// out
-                         double* penalty, double* dpenalty_ddistsq,
+        if(Jt) Jrowptr[iMeasurement] = iJacobian;
+        x[iMeasurement] = 0;
+        if(icam_extrinsics >= 0 && ctx->problem_selections.do_optimize_extrinsics )
+        {
+            STORE_JACOBIAN3( i_var_camera_rt + 0, 0,0,0 );
+            STORE_JACOBIAN3( i_var_camera_rt + 3, 0,0,0 );
+        }
+        if( use_position_from_state )
+            STORE_JACOBIAN3( i_var_point, 0,0,0 );
+        iMeasurement++;
+
+        return norm2_error;
+    }
 
-                         // in
-                         // SIGNED distance. <0 means "behind the camera"
-                         const double distsq)
+
+    const int i_var_intrinsics =
+        mrcal_state_index_intrinsics(icam_intrinsics,
+                                     ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                     ctx->Nframes,
+                                     ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                     ctx->problem_selections, &ctx->lensmodel);
+    // invalid if icam_extrinsics < 0, but unused in that case
+    const int i_var_camera_rt  =
+        mrcal_state_index_extrinsics(icam_extrinsics,
+                                     ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                     ctx->Nframes,
+                                     ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                     ctx->problem_selections, &ctx->lensmodel);
+    const int i_var_point      =
+        mrcal_state_index_points(i_point,
+                                 ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                 ctx->Nframes,
+                                 ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                 ctx->problem_selections, &ctx->lensmodel);
+    mrcal_point3_t point_ref;
+    if(use_position_from_state)
+        unpack_solver_state_point_one(&point_ref, &packed_state[i_var_point]);
+    else
+        point_ref = ctx->points[i_point];
+
+    int Ngradients = get_Ngradients(&ctx->lensmodel, ctx->Nintrinsics);
+
+    double* dq_dintrinsics_pool_double =
+        workspace_buffer(workspace->dq_dintrinsics_pool_double, Ngradients, &workspace->Nallocations);
+    // used for LENSMODEL_SPLINED_STEREOGRAPHIC only, but getting rid of
+    // this in other cases isn't worth the trouble
+    int    dq_dintrinsics_pool_int   [1];
+    double* dq_dfxy                             = NULL;
+    double* dq_dintrinsics_nocore               = NULL;
+    gradient_sparse_meta_t gradient_sparse_meta = {};
+
+    mrcal_point3_t dq_drcamera[2];
+    mrcal_point3_t dq_dtcamera[2];
+    mrcal_point3_t dq_dpoint  [2];
+
+    // The array reference [-3] is intended, but the compiler throws a
+    // warning. I silence it here
+#if 0
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#endif
+    mrcal_point2_t q_hypothesis;
+    project(&q_hypothesis,
+
+            ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
+            dq_dintrinsics_pool_double : NULL,
+            ctx->problem_selections.do_optimize_intrinsics_core || ctx->problem_selections.do_optimize_intrinsics_distortions ?
+            dq_dintrinsics_pool_int : NULL,
+            &dq_dfxy, &dq_dintrinsics_nocore, &gradient_sparse_meta,
+
+            ctx->problem_selections.do_optimize_extrinsics ?
+            dq_drcamera : NULL,
+            ctx->problem_selections.do_optimize_extrinsics ?
+            dq_dtcamera : NULL,
+            NULL, // frame rotation. I only have a point position
+            use_position_from_state ? dq_dpoint : NULL,
+            NULL,
+
+            // input
+            intrinsics_all[icam_intrinsics],
+            &camera_rt[icam_extrinsics],
+
+            // I only have the point position, so the 'rt' memory
+            // points 3 back. The fake "r" here will not be
+            // referenced
+            (mrcal_pose_t*)(&point_ref.xyz[-3]),
+            NULL,
+
+            icam_extrinsics < 0,
+            &ctx->lensmodel, &ctx->precomputed,
+            0,0,0);
+#if 0
+#pragma GCC diagnostic pop
+#endif
+
+    // I have my two measurements (dx, dy). I propagate their
+    // gradient and store them
+    for( int i_xy=0; i_xy<2; i_xy++ )
+    {
+        const double err = (q_hypothesis.xy[i_xy] - qx_qy_w__observed->xyz[i_xy])*weight;
+
+        if(Jt) Jrowptr[iMeasurement] = iJacobian;
+        x[iMeasurement] = err;
+        norm2_error += err*err;
+
+        if( ctx->problem_selections.do_optimize_intrinsics_core )
         {
-            const double maxsq = ctx->problem_constants->point_max_range*ctx->problem_constants->point_max_range;
-            if(distsq > maxsq)
-            {
-                *penalty = weight * (distsq/maxsq - 1.0);
-                *dpenalty_ddistsq = weight*(1. / maxsq);
-                return;
-            }
+            // fx,fy. x depends on fx only. y depends on fy only
+            STORE_JACOBIAN( i_var_intrinsics + i_xy,
+                            dq_dfxy[i_xy] *
+                            weight * SCALE_INTRINSICS_FOCAL_LENGTH );
+
+            // cx,cy. The gradients here are known to be 1. And x depends on cx only. And y depends on cy only
+            STORE_JACOBIAN( i_var_intrinsics + i_xy+2,
+                            weight * SCALE_INTRINSICS_CENTER_PIXEL );
+        }
 
-            const double minsq = ctx->problem_constants->point_min_range*ctx->problem_constants->point_min_range;
-            if(distsq < minsq)
+        if( ctx->problem_selections.do_optimize_intrinsics_distortions )
+        {
+            if(gradient_sparse_meta.pool != NULL)
             {
-                // too close OR behind the camera
-                *penalty = weight*(1.0 - distsq/minsq);
-                *dpenalty_ddistsq = weight*(-1. / minsq);
-                return;
-            }
+                // u = stereographic(p)
+                // q = (u + deltau(u)) * f + c
+                //
+                // Intrinsics:
+                //   dq/diii = f ddeltau/diii
+                //
+                // ddeltau/diii = flatten(ABCDx[0..3] * ABCDy[0..3])
+                const int ivar0 = dq_dintrinsics_pool_int[0] -
+                    ( ctx->problem_selections.do_optimize_intrinsics_core ? 0 : 4 );
 
-            *penalty = *dpenalty_ddistsq = 0.0;
-        };
+                const int     len   = gradient_sparse_meta.run_side_length;
+                const double* ABCDx = &gradient_sparse_meta.pool[0];
+                const double* ABCDy = &gradient_sparse_meta.pool[len];
 
+                const int ivar_stridey = gradient_sparse_meta.ivar_stridey;
+                const double* fxy = &intrinsics_all[icam_intrinsics][0];
 
-        if(icam_extrinsics < 0)
-        {
-            double distsq =
-                point_ref.x*point_ref.x +
-                point_ref.y*point_ref.y +
-                point_ref.z*point_ref.z;
-            double penalty, dpenalty_ddistsq;
-            if(model_supports_projection_behind_camera(&ctx->lensmodel) ||
-               point_ref.z > 0.0)
-                get_penalty(&penalty, &dpenalty_ddistsq, distsq);
+                for(int iy=0; iy<len; iy++)
+                    for(int ix=0; ix<len; ix++)
+                    {
+                        STORE_JACOBIAN( i_var_intrinsics + ivar0 + iy*ivar_stridey + ix*2 + i_xy,
+                                        ABCDx[ix]*ABCDy[iy]*fxy[i_xy] *
+                                        weight * SCALE_DISTORTION );
+                    }
+            }
             else
             {
-                get_penalty(&penalty, &dpenalty_ddistsq, -distsq);
-                dpenalty_ddistsq *= -1.;
+                for(int i=0; i<ctx->Nintrinsics-Ncore; i++)
+                    STORE_JACOBIAN( i_var_intrinsics+Ncore_state + i,
+                                    dq_dintrinsics_nocore[i_xy*(ctx->Nintrinsics-Ncore) +
+                                                           i] *
+                                    weight * SCALE_DISTORTION );
             }
+        }
 
-            if(Jt) Jrowptr[iMeasurement] = iJacobian;
-            x[iMeasurement] = penalty;
-            norm2_error += penalty*penalty;
-
-            if( use_position_from_state )
+        if( ctx->problem_selections.do_optimize_extrinsics )
+            if( icam_extrinsics >= 0 )
             {
-                double scale = 2.0 * dpenalty_ddistsq * SCALE_POSITION_POINT;
-                STORE_JACOBIAN3( i_var_point,
-                                 scale*point_ref.x,
-                                 scale*point_ref.y,
-                                 scale*point_ref.z );
+                STORE_JACOBIAN3( i_var_camera_rt + 0,
+                                 dq_drcamera[i_xy].xyz[0] *
+                                 weight * SCALE_ROTATION_CAMERA,
+                                 dq_drcamera[i_xy].xyz[1] *
+                                 weight * SCALE_ROTATION_CAMERA,
+                                 dq_drcamera[i_xy].xyz[2] *
+                                 weight * SCALE_ROTATION_CAMERA);
+                STORE_JACOBIAN3( i_var_camera_rt + 3,
+                                 dq_dtcamera[i_xy].xyz[0] *
+                                 weight * SCALE_TRANSLATION_CAMERA,
+                                 dq_dtcamera[i_xy].xyz[1] *
+                                 weight * SCALE_TRANSLATION_CAMERA,
+                                 dq_dtcamera[i_xy].xyz[2] *
+                                 weight * SCALE_TRANSLATION_CAMERA);
             }
 
-            iMeasurement++;
+        if( use_position_from_state )
+            STORE_JACOBIAN3( i_var_point,
+                             dq_dpoint[i_xy].xyz[0] *
+                             weight * SCALE_POSITION_POINT,
+                             dq_dpoint[i_xy].xyz[1] *
+                             weight * SCALE_POSITION_POINT,
+                             dq_dpoint[i_xy].xyz[2] *
+                             weight * SCALE_POSITION_POINT);
+
+        iMeasurement++;
+    }
+
+    // Now the range normalization (make sure the range isn't
+    // aphysically high or aphysically low)
+    auto get_penalty = [&](// out
+                     double* penalty, double* dpenalty_ddistsq,
+
+                     // in
+                     // SIGNED distance. <0 means "behind the camera"
+                     const double distsq)
+    {
+        const double maxsq = ctx->problem_constants->point_max_range*ctx->problem_constants->point_max_range;
+        if(distsq > maxsq)
+        {
+            *penalty = weight * (distsq/maxsq - 1.0);
+            *dpenalty_ddistsq = weight*(1. / maxsq);
+            return;
+        }
+
+        const double minsq = ctx->problem_constants->point_min_range*ctx->problem_constants->point_min_range;
+        if(distsq < minsq)
+        {
+            // too close OR behind the camera
+            *penalty = weight*(1.0 - distsq/minsq);
+            *dpenalty_ddistsq = weight*(-1. / minsq);
+            return;
         }
+
+        *penalty = *dpenalty_ddistsq = 0.0;
+    };
+
+
+    if(icam_extrinsics < 0)
+    {
+        double distsq =
+            point_ref.x*point_ref.x +
+            point_ref.y*point_ref.y +
+            point_ref.z*point_ref.z;
+        double penalty, dpenalty_ddistsq;
+        if(model_supports_projection_behind_camera(&ctx->lensmodel) ||
+           point_ref.z > 0.0)
+            get_penalty(&penalty, &dpenalty_ddistsq, distsq);
         else
         {
-            // I need to transform the point. I already computed
-            // this stuff in project()...
-            double Rc[3*3];
-            double d_Rc_rc[9*3];
-
-            mrcal_R_from_r(Rc,
-                           d_Rc_rc,
-                           camera_rt[icam_extrinsics].r.xyz);
-
-            mrcal_point3_t pcam;
-            mul_vec3_gen33t_vout(point_ref.xyz, Rc, pcam.xyz);
-            add_vec(3, pcam.xyz, camera_rt[icam_extrinsics].t.xyz);
-
-            double distsq =
-                pcam.x*pcam.x +
-                pcam.y*pcam.y +
-                pcam.z*pcam.z;
-            double penalty, dpenalty_ddistsq;
-            if(model_supports_projection_behind_camera(&ctx->lensmodel) ||
-               pcam.z > 0.0)
-                get_penalty(&penalty, &dpenalty_ddistsq, distsq);
-            else
+            get_penalty(&penalty, &dpenalty_ddistsq, -distsq);
+            dpenalty_ddistsq *= -1.;
+        }
+
+        if(Jt) Jrowptr[iMeasurement] = iJacobian;
+        x[iMeasurement] = penalty;
+        norm2_error += penalty*penalty;
+
+        if( use_position_from_state )
+        {
+            double scale = 2.0 * dpenalty_ddistsq * SCALE_POSITION_POINT;
+            STORE_JACOBIAN3( i_var_point,
+                             scale*point_ref.x,
+                             scale*point_ref.y,
+                             scale*point_ref.z );
+        }
+
+        iMeasurement++;
+    }
+    else
+    {
+        // I need to transform the point. I already computed
+        // this stuff in project()...
+        double Rc[3*3];
+        double d_Rc_rc[9*3];
+
+        mrcal_R_from_r(Rc,
+                       d_Rc_rc,
+                       camera_rt[icam_extrinsics].r.xyz);
+
+        mrcal_point3_t pcam;
+        mul_vec3_gen33t_vout(point_ref.xyz, Rc, pcam.xyz);
+        add_vec(3, pcam.xyz, camera_rt[icam_extrinsics].t.xyz);
+
+        double distsq =
+            pcam.x*pcam.x +
+            pcam.y*pcam.y +
+            pcam.z*pcam.z;
+        double penalty, dpenalty_ddistsq;
+        if(model_supports_projection_behind_camera(&ctx->lensmodel) ||
+           pcam.z > 0.0)
+            get_penalty(&penalty, &dpenalty_ddistsq, distsq);
+        else
+        {
+            get_penalty(&penalty, &dpenalty_ddistsq, -distsq);
+            dpenalty_ddistsq *= -1.;
+        }
+
+        if(Jt) Jrowptr[iMeasurement] = iJacobian;
+        x[iMeasurement] = penalty;
+        norm2_error += penalty*penalty;
+
+        if( ctx->problem_selections.do_optimize_extrinsics )
+        {
+            // pcam.x       = Rc[row0]*point*SCALE + tc
+            // d(pcam.x)/dr = d(Rc[row0])/drc*point*SCALE
+            // d(Rc[row0])/drc is 3x3 matrix at &d_Rc_rc[0]
+            double d_ptcamx_dr[3];
+            double d_ptcamy_dr[3];
+            double d_ptcamz_dr[3];
+            mul_vec3_gen33_vout( point_ref.xyz, &d_Rc_rc[9*0], d_ptcamx_dr );
+            mul_vec3_gen33_vout( point_ref.xyz, &d_Rc_rc[9*1], d_ptcamy_dr );
+            mul_vec3_gen33_vout( point_ref.xyz, &d_Rc_rc[9*2], d_ptcamz_dr );
+
+            STORE_JACOBIAN3( i_var_camera_rt + 0,
+                             SCALE_ROTATION_CAMERA*
+                             2.0*dpenalty_ddistsq*( pcam.x*d_ptcamx_dr[0] +
+                                                    pcam.y*d_ptcamy_dr[0] +
+                                                    pcam.z*d_ptcamz_dr[0] ),
+                             SCALE_ROTATION_CAMERA*
+                             2.0*dpenalty_ddistsq*( pcam.x*d_ptcamx_dr[1] +
+                                                    pcam.y*d_ptcamy_dr[1] +
+                                                    pcam.z*d_ptcamz_dr[1] ),
+                             SCALE_ROTATION_CAMERA*
+                             2.0*dpenalty_ddistsq*( pcam.x*d_ptcamx_dr[2] +
+                                                    pcam.y*d_ptcamy_dr[2] +
+                                                    pcam.z*d_ptcamz_dr[2] ) );
+            STORE_JACOBIAN3( i_var_camera_rt + 3,
+                             SCALE_TRANSLATION_CAMERA*
+                             2.0*dpenalty_ddistsq*pcam.x,
+                             SCALE_TRANSLATION_CAMERA*
+                             2.0*dpenalty_ddistsq*pcam.y,
+                             SCALE_TRANSLATION_CAMERA*
+                             2.0*dpenalty_ddistsq*pcam.z );
+        }
+
+        if( use_position_from_state )
+            STORE_JACOBIAN3( i_var_point,
+                             SCALE_POSITION_POINT*
+                             2.0*dpenalty_ddistsq*(pcam.x*Rc[0] + pcam.y*Rc[3] + pcam.z*Rc[6]),
+                             SCALE_POSITION_POINT*
+                             2.0*dpenalty_ddistsq*(pcam.x*Rc[1] + pcam.y*Rc[4] + pcam.z*Rc[7]),
+                             SCALE_POSITION_POINT*
+                             2.0*dpenalty_ddistsq*(pcam.x*Rc[2] + pcam.y*Rc[5] + pcam.z*Rc[8]) );
+        iMeasurement++;
+    }
+
+    return norm2_error;
+}
+
+static
+void optimizer_callback(// input state
+                       const double*   packed_state,
+
+                       // output measurements
+                       double*         x,
+
+                       // Jacobian
+                       cholmod_sparse* Jt,
+
+                       const callback_context_t* ctx)
+{
+    double norm2_error = 0.0;
+
+    int Ncore = modelHasCore_fxfycxcy(&ctx->lensmodel) ? 4 : 0;
+    int Ncore_state = (modelHasCore_fxfycxcy(&ctx->lensmodel) &&
+                       ctx->problem_selections.do_optimize_intrinsics_core) ? 4 : 0;
+
+    const auto time0 = std::chrono::steady_clock::now();
+    callback_workspace_t* workspace = ctx->workspace;
+
+    // If I'm locking down some parameters, then the state vector contains a
+    // subset of my data. I reconstitute the intrinsics and extrinsics here.
+    // I do the frame poses later. This is a good way to do it if I have few
+    // cameras. With many cameras (this will be slow)
+    double**      intrinsics_all = workspace->intrinsics_all.data();
+    mrcal_pose_t* camera_rt      = workspace->camera_rt;
+
+    mrcal_calobject_warp_t calobject_warp_local = {};
+    const int i_var_calobject_warp =
+        mrcal_state_index_calobject_warp(ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                         ctx->Nframes,
+                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                         ctx->problem_selections, &ctx->lensmodel);
+    if(has_calobject_warp(ctx->problem_selections,ctx->Nobservations_board))
+        unpack_solver_state_calobject_warp(&calobject_warp_local, &packed_state[i_var_calobject_warp]);
+    else if(ctx->calobject_warp != NULL)
+        calobject_warp_local = *ctx->calobject_warp;
+
+    for(int icam_intrinsics=0;
+        icam_intrinsics<ctx->Ncameras_intrinsics;
+        icam_intrinsics++)
+    {
+        // Construct the FULL intrinsics vector, based on either the
+        // optimization vector or the inputs, depending on what we're optimizing
+        double* intrinsics_here  = &intrinsics_all[icam_intrinsics][0];
+        double* distortions_here = &intrinsics_all[icam_intrinsics][Ncore];
+
+        int i_var_intrinsics =
+            mrcal_state_index_intrinsics(icam_intrinsics,
+                                         ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                         ctx->Nframes,
+                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                         ctx->problem_selections, &ctx->lensmodel);
+        if(Ncore)
+        {
+            if( ctx->problem_selections.do_optimize_intrinsics_core )
             {
-                get_penalty(&penalty, &dpenalty_ddistsq, -distsq);
-                dpenalty_ddistsq *= -1.;
+                intrinsics_here[0] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_FOCAL_LENGTH;
+                intrinsics_here[1] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_FOCAL_LENGTH;
+                intrinsics_here[2] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_CENTER_PIXEL;
+                intrinsics_here[3] = packed_state[i_var_intrinsics++] * SCALE_INTRINSICS_CENTER_PIXEL;
             }
+            else
+                memcpy( intrinsics_here,
+                        &ctx->intrinsics[ctx->Nintrinsics*icam_intrinsics],
+                        Ncore*sizeof(double) );
+        }
+        if( ctx->problem_selections.do_optimize_intrinsics_distortions )
+        {
+            for(int i = 0; i<ctx->Nintrinsics-Ncore; i++)
+                distortions_here[i] = packed_state[i_var_intrinsics++] * SCALE_DISTORTION;
+        }
+        else
+            memcpy( distortions_here,
+                    &ctx->intrinsics[ctx->Nintrinsics*icam_intrinsics + Ncore],
+                    (ctx->Nintrinsics-Ncore)*sizeof(double) );
+    }
+    for(int icam_extrinsics=0;
+        icam_extrinsics<ctx->Ncameras_extrinsics;
+        icam_extrinsics++)
+    {
+        if( icam_extrinsics < 0 ) continue;
 
-            if(Jt) Jrowptr[iMeasurement] = iJacobian;
-            x[iMeasurement] = penalty;
-            norm2_error += penalty*penalty;
+        const int i_var_camera_rt =
+            mrcal_state_index_extrinsics(icam_extrinsics,
+                                         ctx->Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                         ctx->Nframes,
+                                         ctx->Npoints, ctx->Npoints_fixed, ctx->Nobservations_board,
+                                         ctx->problem_selections, &ctx->lensmodel);
+        if(ctx->problem_selections.do_optimize_extrinsics)
+            unpack_solver_state_extrinsics_one(&camera_rt[icam_extrinsics], &packed_state[i_var_camera_rt]);
+        else
+            memcpy(&camera_rt[icam_extrinsics], &ctx->extrinsics_fromref[icam_extrinsics], sizeof(mrcal_pose_t));
+    }
 
-            if( ctx->problem_selections.do_optimize_extrinsics )
-            {
-                // pcam.x       = Rc[row0]*point*SCALE + tc
-                // d(pcam.x)/dr = d(Rc[row0])/drc*point*SCALE
-                // d(Rc[row0])/drc is 3x3 matrix at &d_Rc_rc[0]
-                double d_ptcamx_dr[3];
-                double d_ptcamy_dr[3];
-                double d_ptcamz_dr[3];
-                mul_vec3_gen33_vout( point_ref.xyz, &d_Rc_rc[9*0], d_ptcamx_dr );
-                mul_vec3_gen33_vout( point_ref.xyz, &d_Rc_rc[9*1], d_ptcamy_dr );
-                mul_vec3_gen33_vout( point_ref.xyz, &d_Rc_rc[9*2], d_ptcamz_dr );
+    // The board and point observations are independent of each other: each
+    // one writes to its own section of x and Jt, at offsets computed ahead of
+    // time by jacobian_offsets_observations(). I evaluate them in parallel, if
+    // requested, in blocks of CALLBACK_NOBSERVATIONS_PER_BLOCK. Each block
+    // accumulates its own norm2_error, and these are added together in block
+    // order, so the result depends neither on the thread scheduling nor on the
+    // number of threads. reportFitMsg doesn't write anything, and produces a
+    // serial log, so I don't parallelize it
+    const int Nmeasurements_board =
+        ctx->Nobservations_board *
+        ctx->calibration_object_width_n*ctx->calibration_object_height_n*2;
+    const int Nobservations = ctx->Nobservations_board + ctx->Nobservations_point;
+    const int Nblocks =
+        (Nobservations + CALLBACK_NOBSERVATIONS_PER_BLOCK-1) / CALLBACK_NOBSERVATIONS_PER_BLOCK;
+    double* norm2_error_blocks = workspace->norm2_error_blocks.data();
+
+    auto evaluate_observations = [&](int iblock0, int iblock1, int ichunk)
+    {
+        callback_workspace_thread_t* workspace_thread = &workspace->threads[ichunk];
 
-                STORE_JACOBIAN3( i_var_camera_rt + 0,
-                                 SCALE_ROTATION_CAMERA*
-                                 2.0*dpenalty_ddistsq*( pcam.x*d_ptcamx_dr[0] +
-                                                        pcam.y*d_ptcamy_dr[0] +
-                                                        pcam.z*d_ptcamz_dr[0] ),
-                                 SCALE_ROTATION_CAMERA*
-                                 2.0*dpenalty_ddistsq*( pcam.x*d_ptcamx_dr[1] +
-                                                        pcam.y*d_ptcamy_dr[1] +
-                                                        pcam.z*d_ptcamz_dr[1] ),
-                                 SCALE_ROTATION_CAMERA*
-                                 2.0*dpenalty_ddistsq*( pcam.x*d_ptcamx_dr[2] +
-                                                        pcam.y*d_ptcamy_dr[2] +
-                                                        pcam.z*d_ptcamz_dr[2] ) );
-                STORE_JACOBIAN3( i_var_camera_rt + 3,
-                                 SCALE_TRANSLATION_CAMERA*
-                                 2.0*dpenalty_ddistsq*pcam.x,
-                                 SCALE_TRANSLATION_CAMERA*
-                                 2.0*dpenalty_ddistsq*pcam.y,
-                                 SCALE_TRANSLATION_CAMERA*
-                                 2.0*dpenalty_ddistsq*pcam.z );
-            }
+        for(int iblock=iblock0; iblock<iblock1; iblock++)
+        {
+            const int i0 = iblock*CALLBACK_NOBSERVATIONS_PER_BLOCK;
+            const int i1 = std::min(i0 + CALLBACK_NOBSERVATIONS_PER_BLOCK, Nobservations);
 
-            if( use_position_from_state )
-                STORE_JACOBIAN3( i_var_point,
-                                 SCALE_POSITION_POINT*
-                                 2.0*dpenalty_ddistsq*(pcam.x*Rc[0] + pcam.y*Rc[3] + pcam.z*Rc[6]),
-                                 SCALE_POSITION_POINT*
-                                 2.0*dpenalty_ddistsq*(pcam.x*Rc[1] + pcam.y*Rc[4] + pcam.z*Rc[7]),
-                                 SCALE_POSITION_POINT*
-                                 2.0*dpenalty_ddistsq*(pcam.x*Rc[2] + pcam.y*Rc[5] + pcam.z*Rc[8]) );
-            iMeasurement++;
+            double norm2_error_block = 0.0;
+            for(int i=i0; i<i1; i++)
+            {
+                if(i < ctx->Nobservations_board)
+                    norm2_error_block +=
+                        optimizer_callback_board_observation(x, Jt,
+                                                             i,
+                                                             i*ctx->calibration_object_width_n*ctx->calibration_object_height_n*2,
+                                                             ctx->ijacobian0_board[i],
+                                                             workspace_thread,
+                                                             packed_state,
+                                                             intrinsics_all, camera_rt,
+                                                             &calobject_warp_local, i_var_calobject_warp,
+                                                             ctx);
+                else
+                {
+                    const int i_observation_point = i - ctx->Nobservations_board;
+                    norm2_error_block +=
+                        optimizer_callback_point_observation(x, Jt,
+                                                             i_observation_point,
+                                                             Nmeasurements_board + i_observation_point*3,
+                                                             ctx->ijacobian0_point[i_observation_point],
+                                                             workspace_thread,
+                                                             packed_state,
+                                                             intrinsics_all, camera_rt,
+                                                             ctx);
+                }
+            }
+            norm2_error_blocks[iblock] = norm2_error_block;
         }
-    }
+    };
+
+    if(ctx->reportFitMsg)
+        evaluate_observations(0, Nblocks, 0);
+    else
+        _mrcal_thread_pool_run(workspace->pool, Nblocks,
+                               evaluate_observations);
+    for(int iblock=0; iblock<Nblocks; iblock++)
+        norm2_error += norm2_error_blocks[iblock];
+
+    // The regularization terms follow all the observations
+    int iMeasurement = Nmeasurements_board + ctx->Nobservations_point*3;
+    int iJacobian    = ctx->ijacobian0_point[ctx->Nobservations_point];
+
+    int*    Jrowptr = Jt ? (int*)   Jt->p : NULL;
+    int*    Jcolidx = Jt ? (int*)   Jt->i : NULL;
+    double* Jval    = Jt ? (double*)Jt->x : NULL;
 
 
     ///////////////// Regularization
@@ -4758,8 +5687,6 @@ void optimizer_callback(// input state
        (ctx->problem_selections.do_optimize_intrinsics_distortions ||
         ctx->problem_selections.do_optimize_intrinsics_core))
     {
-        const bool dump_regularizaton_details = false;
-
         // I want the total regularization cost to be low relative to the
         // other contributions to the cost. And I want each set of
         // regularization terms to weigh roughly the same. Let's say I want
@@ -4799,8 +5726,7 @@ void optimizer_callback(// input state
             (double)Nmeasurements_nonregularization *
             normal_pixel_error *
             normal_pixel_error;
-        if(dump_regularizaton_details)
-            MSG("expected_total_pixel_error_sq: %f", expected_total_pixel_error_sq);
+        MRCAL_TRACE(MRCAL_TRACE_REGULARIZATION, "expected_total_pixel_error_sq: %f", expected_total_pixel_error_sq);
 
         double scale_regularization_distortion     = 0.0;
         double scale_regularization_centerpixel    = 0.0;
@@ -4827,8 +5753,7 @@ void optimizer_callback(// input state
                 double scale_sq =
                     expected_total_pixel_error_sq * 0.005/(double)Nregularization_types / expected_regularization_distortion_error_sq_noscale;
 
-                if(dump_regularizaton_details)
-                    MSG("expected_regularization_distortion_error_sq: %f", expected_regularization_distortion_error_sq_noscale*scale_sq);
+                MRCAL_TRACE(MRCAL_TRACE_REGULARIZATION, "expected_regularization_distortion_error_sq: %f", expected_regularization_distortion_error_sq_noscale*scale_sq);
 
                 scale_regularization_distortion = sqrt(scale_sq);
             }
@@ -4846,8 +5771,7 @@ void optimizer_callback(// input state
                 double scale_sq =
                     expected_total_pixel_error_sq * 0.005/(double)Nregularization_types / expected_regularization_centerpixel_error_sq_noscale;
 
-                if(dump_regularizaton_details)
-                    MSG("expected_regularization_centerpixel_error_sq: %f", expected_regularization_centerpixel_error_sq_noscale*scale_sq);
+                MRCAL_TRACE(MRCAL_TRACE_REGULARIZATION, "expected_regularization_centerpixel_error_sq: %f", expected_regularization_centerpixel_error_sq_noscale*scale_sq);
 
                 scale_regularization_centerpixel = sqrt(scale_sq);
             }
@@ -4877,6 +5801,10 @@ void optimizer_callback(// input state
                         const int Nx = ctx->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.Nx;
                         const int Ny = ctx->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.Ny;
 
+                        // Computed in callback_workspace_init()
+                        const double* directions =
+                            workspace->regularization_splined_directions.data();
+
                         for(int iy=0; iy<Ny; iy++)
                             for(int ix=0; ix<Nx; ix++)
                             {
@@ -4887,22 +5815,7 @@ void optimizer_callback(// input state
                                     { intrinsics_all[icam_intrinsics][Ncore + ivar + 0],
                                       intrinsics_all[icam_intrinsics][Ncore + ivar + 1] };
 
-                                // WARNING: "Precompute uxy. This is lots of unnecessary computation in the inner loop"
-                                double uxy[] = { (double)(2*ix - Nx + 1),
-                                                 (double)(2*iy - Ny + 1) };
-                                bool anisotropic = true;
-                                if(2*ix == Nx - 1 &&
-                                   2*iy == Ny - 1 )
-                                {
-                                    uxy[0] = 1.0;
-                                    anisotropic = false;
-                                }
-                                else
-                                {
-                                    double mag = sqrt(uxy[0]*uxy[0] + uxy[1]*uxy[1]);
-                                    uxy[0] /= mag;
-                                    uxy[1] /= mag;
-                                }
+                                const double* uxy = &directions[3*( iy*Nx + ix )];
 
                                 double err;
 
@@ -4919,7 +5832,7 @@ void optimizer_callback(// input state
                                 iMeasurement++;
 
                                 // I REALLY penalize tangential corrections
-                                if(anisotropic) scale *= 10.;
+                                scale *= uxy[2];
                                 if(Jt) Jrowptr[iMeasurement] = iJacobian;
                                 err              = scale*(deltauxy[0]*uxy[1] - deltauxy[1]*uxy[0]);
                                 x[iMeasurement]  = err;
@@ -4975,9 +5888,7 @@ void optimizer_callback(// input state
                                             scale * SCALE_DISTORTION );
 
                             iMeasurement++;
-                            if(dump_regularizaton_details)
-                                MSG("regularization distortion: %g; norm2: %g", err, err*err);
-
+                            MRCAL_TRACE(MRCAL_TRACE_REGULARIZATION, "regularization distortion: %g; norm2: %g", err, err*err);
                         }
                     }
                 }
@@ -5009,8 +5920,7 @@ void optimizer_callback(// input state
                     STORE_JACOBIAN( i_var_intrinsics + 2,
                                     scale_regularization_centerpixel * SCALE_INTRINSICS_CENTER_PIXEL );
                     iMeasurement++;
-                    if(dump_regularizaton_details)
-                        MSG("regularization center pixel off-center: %g; norm2: %g", err, err*err);
+                    MRCAL_TRACE(MRCAL_TRACE_REGULARIZATION, "regularization center pixel off-center: %g; norm2: %g", err, err*err);
 
                     if(Jt) Jrowptr[iMeasurement] = iJacobian;
                     err = scale_regularization_centerpixel *
@@ -5020,8 +5930,7 @@ void optimizer_callback(// input state
                     STORE_JACOBIAN( i_var_intrinsics + 3,
                                     scale_regularization_centerpixel * SCALE_INTRINSICS_CENTER_PIXEL );
                     iMeasurement++;
-                    if(dump_regularizaton_details)
-                        MSG("regularization center pixel off-center: %g; norm2: %g", err, err*err);
+                    MRCAL_TRACE(MRCAL_TRACE_REGULARIZATION, "regularization center pixel off-center: %g; norm2: %g", err, err*err);
                 }
         }
     }
@@ -5046,6 +5955,10 @@ void optimizer_callback(// input state
 
         // MSG_IF_VERBOSE("RMS: %g", sqrt(norm2_error / (double)ctx>Nmeasurements));
     }
+
+    workspace->Ncallbacks++;
+    workspace->time_callback__s +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - time0).count();
 }
 
 bool mrcal_optimizer_callback(// out
@@ -5188,6 +6101,20 @@ bool mrcal_optimizer_callback(// out
         Nobservations_board *
         calibration_object_width_n*calibration_object_height_n;
 
+    std::vector<int> ijacobian0_board(Nobservations_board+1);
+    std::vector<int> ijacobian0_point(Nobservations_point+1);
+    jacobian_offsets_observations(ijacobian0_board.data(), ijacobian0_point.data(),
+                                  Nobservations_board,
+                                  Nobservations_point,
+                                  calibration_object_width_n  > 0 ? calibration_object_width_n  : 0,
+                                  calibration_object_height_n > 0 ? calibration_object_height_n : 0,
+                                  Npoints, Npoints_fixed,
+                                  observations_board,
+                                  observations_point,
+                                  problem_selections,
+                                  lensmodel);
+
+    callback_workspace_t workspace = {};
     const callback_context_t ctx = {
         .intrinsics                 = intrinsics,
         .extrinsics_fromref         = extrinsics_fromref,
@@ -5214,27 +6141,473 @@ bool mrcal_optimizer_callback(// out
         .calibration_object_height_n= calibration_object_height_n > 0 ? calibration_object_height_n : 0,
         .Nmeasurements              = Nmeasurements,
         .N_j_nonzero                = N_j_nonzero,
-        .Nintrinsics                = Nintrinsics};
+        .Nintrinsics                = Nintrinsics,
+        .ijacobian0_board           = ijacobian0_board.data(),
+        .ijacobian0_point           = ijacobian0_point.data(),
+        .Nthreads                   = 0,
+        .workspace                  = &workspace};
     _mrcal_precompute_lensmodel_data((mrcal_projection_precomputed_t*)&ctx.precomputed, lensmodel);
+    if(!callback_workspace_init(&workspace, &ctx))
+        return result;
+
+    pack_solver_state(b_packed,
+                      lensmodel, intrinsics,
+                      extrinsics_fromref,
+                      frames_toref,
+                      points,
+                      calobject_warp,
+                      problem_selections,
+                      Ncameras_intrinsics, Ncameras_extrinsics,
+                      Nframes, Npoints-Npoints_fixed,
+                      Nobservations_board,
+                      Nstate);
+
+    optimizer_callback(b_packed, x, Jt, &ctx);
+    callback_workspace_free(&workspace);
+
+    result = true;
+
+done:
+    return result;
+}
+
+static void report_workspace_stats(// out
+                                   mrcal_stats_t* stats,
+
+                                   // in
+                                   const callback_workspace_t* workspace)
+{
+    stats->Ncallbacks             = workspace->Ncallbacks;
+    stats->Nallocations_workspace = workspace->Nallocations_workspace;
+    stats->Nallocations_callback  = 0;
+    for(const callback_workspace_thread_t& t : workspace->threads)
+        stats->Nallocations_callback += t.Nallocations;
+    stats->time_callback__s       = workspace->time_callback__s;
+}
+
+mrcal_solver_options_t mrcal_solver_options_preset(mrcal_solver_preset_t preset)
+{
+    // The default convergence criteria were derived empirically, seeking high
+    // accuracy, fast convergence and without serious concern for performance. I
+    // looked only at a single frame. Tweak them please
+    mrcal_solver_options_t options =
+        { .solver                = MRCAL_SOLVER_SPARSE_CHOLMOD,
+          .Nthreads              = 0,
+          .max_iterations        = 300,
+          .update_threshold      = 1e-6,
+          .Jt_x_threshold        = 0,
+          .trustregion_threshold = 0,
+          .outlier_k0            = 4.0,
+          .outlier_k1            = 5.0,
+          .max_outlier_passes    = -1 };
+
+    switch(preset)
+    {
+    case MRCAL_SOLVER_PRESET_DEFAULT:
+        break;
+
+    case MRCAL_SOLVER_PRESET_FAST:
+        // Starting from a good seed, the bulk of the improvement comes in the
+        // first few iterations. The rest is polishing the last fraction of a
+        // pixel
+        options.max_iterations        = 50;
+        options.update_threshold      = 1e-4;
+        options.trustregion_threshold = 1e-4;
+        options.max_outlier_passes    = 1;
+        break;
+
+    case MRCAL_SOLVER_PRESET_PRECISE:
+        options.max_iterations        = 1000;
+        options.update_threshold      = 1e-8;
+        break;
+
+    default:
+        MSG("Unknown solver preset %d. Using the default", (int)preset);
+    }
+    return options;
+}
+
+static void get_dogleg_parameters(// out
+                                  dogleg_parameters2_t* dogleg_parameters,
+
+                                  // in
+                                  const mrcal_solver_options_t* solver_options,
+                                  bool verbose)
+{
+    dogleg_getDefaultParameters(dogleg_parameters);
+    dogleg_parameters->dogleg_debug = verbose ? DOGLEG_DEBUG_VNLOG : 0;
+
+    dogleg_parameters->Jt_x_threshold                    = solver_options->Jt_x_threshold;
+    dogleg_parameters->update_threshold                  = solver_options->update_threshold;
+    dogleg_parameters->trustregion_threshold             = solver_options->trustregion_threshold;
+    dogleg_parameters->max_iterations                    = solver_options->max_iterations;
+    // dogleg_parameters->trustregion_decrease_factor    = 0.1;
+    // dogleg_parameters->trustregion_decrease_threshold = 0.15;
+    // dogleg_parameters->trustregion_increase_factor    = 4.0
+    // dogleg_parameters->trustregion_increase_threshold = 0.75;
+}
+
+// Reports each iteration of the solver to the user. Called by the solvers at the
+// seed and after each accepted step. Returns false to stop the solve
+static bool report_iteration(const _mrcal_solver_iteration_t* iteration,
+                             void* cookie)
+{
+    optimizer_progress_t*       progress = (optimizer_progress_t*)cookie;
+    mrcal_optimizer_progress_t* report   = &progress->report;
+
+    report->iteration    = iteration->iteration;
+    report->Nevaluations = iteration->Nevaluations;
+    report->pass_done    = false;
+    report->more_passes  = false;
+    report->norm2_error  = iteration->norm2_x;
+    report->step_norm    = iteration->step_norm;
+    report->trustregion  = iteration->trustregion;
+    report->elapsed__s   =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - progress->time0).count();
+
+    if(!progress->callback(report, progress->cookie))
+        progress->stopped = true;
+    return !progress->stopped;
+}
+
+// Reports the end of a pass of the solver. Returns true if we should run
+// another pass, if one is needed
+static bool report_pass_done(optimizer_progress_t* progress,
+                             double norm2_error,
+                             int Noutliers,
+                             bool more_passes)
+{
+    if(progress == NULL)
+        return true;
+
+    mrcal_optimizer_progress_t* report = &progress->report;
+    report->pass_done   = true;
+    report->more_passes = more_passes;
+    report->norm2_error = norm2_error;
+    report->step_norm   = -1.0;
+    report->trustregion = -1.0;
+    report->Noutliers   = Noutliers;
+    report->elapsed__s  =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - progress->time0).count();
+
+    if(!progress->callback(report, progress->cookie))
+        progress->stopped = true;
+
+    report->ipass++;
+    return !progress->stopped;
+}
+
+// Sets up the progress reporting for a solve
+static void progress_init(optimizer_progress_t* progress,
+                          mrcal_optimizer_progress_callback_t* callback,
+                          void* cookie)
+{
+    progress->callback = callback;
+    progress->cookie   = cookie;
+    progress->time0    = std::chrono::steady_clock::now();
+    progress->report   = {};
+    progress->stopped  = false;
+}
+
+// Runs the solver, starting at the seed in packed_state. If outlier rejection
+// is requested, we re-solve after each round of outlier rejection, until no new
+// outliers are found. On success:
+//
+// - packed_state contains the optimum
+// - *x_final points to the measurement vector at the optimum. This lives in
+//   the solver, and is valid until the solver is freed or reused
+// - if using MRCAL_SOLVER_SPARSE_CHOLMOD with a non-NULL solver_context,
+//   libdogleg does the solve, and *solver_context describes the final solve. If
+//   it was non-NULL on entry, the old context is freed. libdogleg's symbolic
+//   analysis is stored in the CHOLMOD cache. libdogleg can't report its
+//   iterations, so if ctx->progress is non-NULL, *dogleg_solver is used instead
+// - if using MRCAL_SOLVER_SPARSE_CHOLMOD with a NULL solver_context (or with a
+//   progress report), *dogleg_solver is used for the solve. It is created if it
+//   was NULL on entry. An existing solver refactors its factorization in place
+//   if the sparsity pattern hasn't changed
+// - if using MRCAL_SOLVER_SCHUR, *schur_solver is used for the solve. It is
+//   created if it was NULL on entry. If the reduced system would be bigger than
+//   _MRCAL_SCHUR_NREDUCED_MAX, we use MRCAL_SOLVER_SPARSE_CHOLMOD instead
+// - new outliers are marked in observations_board_pool, and *Noutliers
+//   contains the total count
+//
+// If ctx->progress is non-NULL, each solver iteration and each pass is reported
+// to the user, and they may stop the solve early. The solver then returns the
+// state in the last report, and we set ctx->progress->stopped
+//
+// Returns the norm2 of the final residuals, or <0 on error
+static double optimize_packed_state(// out, in
+                                    double* packed_state,
+                                    dogleg_solverContext_t** solver_context,
+                                    _mrcal_dogleg_solver_t** dogleg_solver,
+                                    _mrcal_schur_solver_t**  schur_solver,
+                                    mrcal_point3_t* observations_board_pool,
+
+                                    // out
+                                    int* Noutliers,
+                                    const double** x_final,
+
+                                    // in
+                                    const callback_context_t* ctx,
+                                    int Nstate,
+                                    const mrcal_solver_options_t* solver_options,
+                                    const dogleg_parameters2_t* dogleg_parameters)
+{
+    mrcal_solver_t solver = solver_options->solver;
+    *Noutliers = 0;
+
+    const int Nfeatures_board =
+        ctx->Nobservations_board *
+        ctx->calibration_object_width_n *
+        ctx->calibration_object_height_n;
+    for(int i=0; i<Nfeatures_board; i++)
+        if(observations_board_pool[i].z < 0.0)
+            (*Noutliers)++;
+    if(ctx->progress != NULL)
+        ctx->progress->report.Noutliers = *Noutliers;
+
+    const int Nmeasurements_board = Nfeatures_board*2;
+
+    double norm2_error      = -1.0;
+    double outliernessScale = -1.0;
+    bool   more_passes;
+    int    Noutlier_passes  = 0;
+
+    void (*f)(const double*, double*, cholmod_sparse*, void*) =
+        [](const double*   packed_state,
+           double*         x,
+           cholmod_sparse* Jt,
+           void*           ctx)
+        {
+            optimizer_callback(packed_state, x, Jt,
+                               (const callback_context_t*)ctx);
+        };
+
+    // The frames and points are eliminated by the Schur solver. They're
+    // contiguous in the state vector, with the frames first
+    const int istate_frames0 =
+        mrcal_num_states_intrinsics(ctx->Ncameras_intrinsics,
+                                    ctx->problem_selections,
+                                    &ctx->lensmodel) +
+        mrcal_num_states_extrinsics(ctx->Ncameras_extrinsics,
+                                    ctx->problem_selections);
+    const int Nblocks6 = mrcal_num_states_frames(ctx->Nframes,
+                                                 ctx->problem_selections) / 6;
+    const int Nblocks3 = mrcal_num_states_points(ctx->Npoints, ctx->Npoints_fixed,
+                                                 ctx->problem_selections) / 3;
+    if(solver == MRCAL_SOLVER_SCHUR &&
+       Nstate - 6*Nblocks6 - 3*Nblocks3 > _MRCAL_SCHUR_NREDUCED_MAX)
+    {
+        if(ctx->verbose)
+            MSG("The Schur-complement solver would have a dense %dx%d system. Using the sparse solver instead",
+                Nstate - 6*Nblocks6 - 3*Nblocks3,
+                Nstate - 6*Nblocks6 - 3*Nblocks3);
+        solver = MRCAL_SOLVER_SPARSE_CHOLMOD;
+    }
+
+    const bool use_libdogleg =
+        solver == MRCAL_SOLVER_SPARSE_CHOLMOD &&
+        solver_context != NULL &&
+        ctx->progress  == NULL;
+
+    do
+    {
+        if(solver == MRCAL_SOLVER_SCHUR)
+        {
+            if(*schur_solver == NULL &&
+               NULL == (*schur_solver = _mrcal_schur_solver_create()))
+            {
+                MSG("Couldn't create the Schur-complement solver");
+                return -1.0;
+            }
+
+            norm2_error =
+                _mrcal_schur_optimize(packed_state, *schur_solver,
+                                      Nstate, ctx->Nmeasurements, ctx->N_j_nonzero,
+                                      istate_frames0, Nblocks6, Nblocks3,
+                                      f, (void*)ctx,
+                                      dogleg_parameters,
+                                      ctx->progress != NULL ? report_iteration : NULL,
+                                      ctx->progress);
+            if(norm2_error < 0)
+                return norm2_error;
+            *x_final = _mrcal_schur_solver_x(*schur_solver);
+        }
+        else if(use_libdogleg)
+        {
+            if(*solver_context != NULL)
+                dogleg_freeContext(solver_context);
+
+            dogleg_callback_t dlcb = f;
+            norm2_error = dogleg_optimize2(packed_state,
+                                           Nstate, ctx->Nmeasurements, ctx->N_j_nonzero,
+                                           &dlcb, (void*)ctx,
+                                           dogleg_parameters,
+                                           solver_context);
+            if(norm2_error < 0)
+                // libdogleg barfed. I quit out
+                return norm2_error;
+            *x_final = (*solver_context)->beforeStep->x;
+        }
+        else
+        {
+            if(*dogleg_solver == NULL &&
+               NULL == (*dogleg_solver = _mrcal_dogleg_solver_create()))
+            {
+                MSG("Couldn't create the dogleg solver");
+                return -1.0;
+            }
+
+            norm2_error = _mrcal_dogleg_optimize(packed_state, *dogleg_solver,
+                                                 Nstate, ctx->Nmeasurements, ctx->N_j_nonzero,
+                                                 f, (void*)ctx,
+                                                 dogleg_parameters,
+                                                 ctx->progress != NULL ? report_iteration : NULL,
+                                                 ctx->progress);
+            if(norm2_error < 0)
+                // The solver barfed. I quit out
+                return norm2_error;
+            *x_final = _mrcal_dogleg_solver_x(*dogleg_solver);
+        }
+
+#if 0
+        // Not using dogleg_markOutliers() (yet...)
+
+        if(outliernessScale < 0.0 && ctx->verbose)
+            // These are for debug reporting
+            dogleg_reportOutliers(getConfidence,
+                                  &outliernessScale,
+                                  2, Nfeatures_board,
+                                  *Noutliers,
+                                  (*solver_context)->beforeStep, *solver_context);
+#endif
+
+        more_passes =
+            ctx->problem_selections.do_apply_outlier_rejection &&
+            !(ctx->progress != NULL && ctx->progress->stopped) &&
+            (solver_options->max_outlier_passes < 0 ||
+             Noutlier_passes < solver_options->max_outlier_passes) &&
+            markOutliers(observations_board_pool,
+                         Noutliers,
+                         ctx->observations_board,
+                         ctx->Nobservations_board,
+                         ctx->calibration_object_width_n,
+                         ctx->calibration_object_height_n,
+                         *x_final,
+                         solver_options->outlier_k0,
+                         solver_options->outlier_k1,
+                         ctx->verbose)
+            // TODO
+            //    &&
+            //  ({MSG("Threw out some outliers. New count = %d/%d (%.1f%%). Going again",
+            //        *Noutliers,
+            //        Nmeasurements_board,
+            //        (double)(*Noutliers * 100) / (double)Nmeasurements_board); true;})
+            ;
+
+        Noutlier_passes++;
+
+    } while( report_pass_done(ctx->progress, norm2_error, *Noutliers, more_passes) &&
+             more_passes );
+
+    // libdogleg did its own symbolic analysis of this problem. I keep it, so
+    // that later factorizations of a problem with this structure can skip it
+    if(use_libdogleg)
+        _mrcal_cholmod_cache_store((*solver_context)->beforeStep->Jt,
+                                   (*solver_context)->factorization,
+                                   &(*solver_context)->common);
+
+    return norm2_error;
+}
+
+// Reports how much of the total cost comes from the regularization terms. x is
+// the final residual vector, and norm2_error is its norm2
+static void report_regularization(const callback_context_t* ctx,
+                                  const double* x,
+                                  double norm2_error)
+{
+    const mrcal_problem_selections_t problem_selections = ctx->problem_selections;
+    const mrcal_lensmodel_t*         lensmodel          = &ctx->lensmodel;
+    const int                        Ncameras_intrinsics= ctx->Ncameras_intrinsics;
+
+    double regularization_ratio_distortion  = 0.0;
+    double regularization_ratio_centerpixel = 0.0;
+
+    int imeas_reg0 =
+        mrcal_measurement_index_regularization(ctx->calibration_object_width_n,
+                                               ctx->calibration_object_height_n,
+                                               Ncameras_intrinsics, ctx->Ncameras_extrinsics,
+                                               ctx->Nframes,
+                                               ctx->Npoints, ctx->Npoints_fixed,
+                                               ctx->Nobservations_board, ctx->Nobservations_point,
+                                               problem_selections,
+                                               lensmodel);
+    if(problem_selections.do_apply_regularization && imeas_reg0 >= 0)
+    {
+        int Ncore = modelHasCore_fxfycxcy(lensmodel) ? 4 : 0;
+
+        int Nmeasurements_regularization_distortion  = 0;
+        if(problem_selections.do_optimize_intrinsics_distortions)
+            Nmeasurements_regularization_distortion =
+                Ncameras_intrinsics*(ctx->Nintrinsics-Ncore);
+
+        int Nmeasurements_regularization_centerpixel = 0;
+        if(problem_selections.do_optimize_intrinsics_core)
+            Nmeasurements_regularization_centerpixel =
+                Ncameras_intrinsics*2;
 
-    pack_solver_state(b_packed,
-                      lensmodel, intrinsics,
-                      extrinsics_fromref,
-                      frames_toref,
-                      points,
-                      calobject_warp,
-                      problem_selections,
-                      Ncameras_intrinsics, Ncameras_extrinsics,
-                      Nframes, Npoints-Npoints_fixed,
-                      Nobservations_board,
-                      Nstate);
+        double norm2_err_regularization_distortion     = 0;
+        double norm2_err_regularization_centerpixel    = 0;
 
-    optimizer_callback(b_packed, x, Jt, &ctx);
+        const double* xreg = &x[imeas_reg0];
 
-    result = true;
+        for(int i=0; i<Nmeasurements_regularization_distortion; i++)
+        {
+            double x = *(xreg++);
+            norm2_err_regularization_distortion += x*x;
+        }
+        for(int i=0; i<Nmeasurements_regularization_centerpixel; i++)
+        {
+            double x = *(xreg++);
+            norm2_err_regularization_centerpixel += x*x;
+        }
+        assert(xreg == &x[ctx->Nmeasurements]);
 
-done:
-    return result;
+        regularization_ratio_distortion  = norm2_err_regularization_distortion      / norm2_error;
+        regularization_ratio_centerpixel = norm2_err_regularization_centerpixel     / norm2_error;
+
+        // These are important to the dev, but not to the end user. So I
+        // disable these by default
+
+        // if(regularization_ratio_distortion > 0.01)
+        //     MSG("WARNING: regularization ratio for lens distortion exceeds 1%%. Is the scale factor too high? Ratio = %.3g/%.3g = %.3g",
+        //         norm2_err_regularization_distortion,  norm2_error, regularization_ratio_distortion);
+        // if(regularization_ratio_centerpixel > 0.01)
+        //     MSG("WARNING: regularization ratio for the projection centerpixel exceeds 1%%. Is the scale factor too high? Ratio = %.3g/%.3g = %.3g",
+        //         norm2_err_regularization_centerpixel, norm2_error, regularization_ratio_centerpixel);
+
+    }
+
+
+    if(ctx->verbose)
+    {
+        if(problem_selections.do_apply_regularization)
+        {
+            // Disable this by default. Splined models have LOTS of
+            // parameters, and I don't want to print them. Usually.
+            //
+            // for(int i=0; i<Nmeasurements_regularization; i++)
+            // {
+            //     double x = solver_context->beforeStep->x[ctx.Nmeasurements - Nmeasurements_regularization + i];
+            //     MSG("regularization %d: %f (squared: %f)", i, x, x*x);
+            // }
+
+            MSG("Regularization stats:");
+            MSG("reg err ratio (distortion,centerpixel): %.3g %.3g",
+                regularization_ratio_distortion,
+                regularization_ratio_centerpixel);
+        }
+    }
 }
 
 mrcal_stats_t
@@ -5298,6 +6671,12 @@ mrcal_optimize( // out
                 int calibration_object_width_n,
                 int calibration_object_height_n,
                 bool verbose,
+                // May be NULL to use MRCAL_SOLVER_PRESET_DEFAULT
+                const mrcal_solver_options_t* solver_options,
+                // Called after each solver iteration and after each
+                // outlier-rejection pass. May be NULL
+                mrcal_optimizer_progress_callback_t* progress_callback,
+                void* progress_cookie,
 
                 bool check_gradient)
 {
@@ -5325,25 +6704,26 @@ mrcal_optimize( // out
     }
 
     dogleg_parameters2_t dogleg_parameters;
-    dogleg_getDefaultParameters(&dogleg_parameters);
-    dogleg_parameters.dogleg_debug = verbose ? DOGLEG_DEBUG_VNLOG : 0;
-
-    // These were derived empirically, seeking high accuracy, fast convergence
-    // and without serious concern for performance. I looked only at a single
-    // frame. Tweak them please
-    dogleg_parameters.Jt_x_threshold                    = 0;
-    dogleg_parameters.update_threshold                  = 1e-6;
-    dogleg_parameters.trustregion_threshold             = 0;
-    dogleg_parameters.max_iterations                    = 300;
-    // dogleg_parameters.trustregion_decrease_factor    = 0.1;
-    // dogleg_parameters.trustregion_decrease_threshold = 0.15;
-    // dogleg_parameters.trustregion_increase_factor    = 4.0
-    // dogleg_parameters.trustregion_increase_threshold = 0.75;
-
-    const int Npoints_fromBoards =
-        Nobservations_board *
-        calibration_object_width_n*calibration_object_height_n;
-
+    const mrcal_solver_options_t solver_options_default =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    if(solver_options == NULL)
+        solver_options = &solver_options_default;
+    get_dogleg_parameters(&dogleg_parameters, solver_options, verbose);
+
+    std::vector<int> ijacobian0_board(Nobservations_board+1);
+    std::vector<int> ijacobian0_point(Nobservations_point+1);
+    jacobian_offsets_observations(ijacobian0_board.data(), ijacobian0_point.data(),
+                                  Nobservations_board,
+                                  Nobservations_point,
+                                  calibration_object_width_n  > 0 ? calibration_object_width_n  : 0,
+                                  calibration_object_height_n > 0 ? calibration_object_height_n : 0,
+                                  Npoints, Npoints_fixed,
+                                  observations_board,
+                                  observations_point,
+                                  problem_selections,
+                                  lensmodel);
+
+    callback_workspace_t workspace = {};
     callback_context_t ctx = {
         .intrinsics                 = intrinsics,
         .extrinsics_fromref         = extrinsics_fromref,
@@ -5388,7 +6768,12 @@ mrcal_optimize( // out
                                                            observations_point,
                                                            problem_selections,
                                                            lensmodel),
-        .Nintrinsics                = mrcal_lensmodel_num_params(lensmodel)};
+        .Nintrinsics                = mrcal_lensmodel_num_params(lensmodel),
+        .ijacobian0_board           = ijacobian0_board.data(),
+        .ijacobian0_point           = ijacobian0_point.data(),
+        .Nthreads                   = solver_options->Nthreads,
+        .workspace                  = &workspace};
+    optimizer_progress_t progress;
     _mrcal_precompute_lensmodel_data((mrcal_projection_precomputed_t*)&ctx.precomputed, lensmodel);
 
     const int Nstate = mrcal_num_states(Ncameras_intrinsics, Ncameras_extrinsics,
@@ -5412,8 +6797,15 @@ mrcal_optimize( // out
         return {.rms_reproj_error__pixels = -1.0};
     }
 
+    // All the memory the callback needs is allocated here, once. The callback
+    // itself doesn't allocate anything
+    if(!callback_workspace_init(&workspace, &ctx))
+        return {.rms_reproj_error__pixels = -1.0};
 
     dogleg_solverContext_t* solver_context = NULL;
+    _mrcal_dogleg_solver_t* dogleg_solver  = NULL;
+    _mrcal_schur_solver_t*  schur_solver   = NULL;
+    const double*           x_solution     = NULL;
 
     if(verbose)
         MSG("## Nmeasurements=%d, Nstate=%d", ctx.Nmeasurements, Nstate);
@@ -5443,18 +6835,6 @@ mrcal_optimize( // out
 
     if( !check_gradient )
     {
-        stats.Noutliers = 0;
-
-        const int Nfeatures_board =
-            Nobservations_board *
-            calibration_object_width_n *
-            calibration_object_height_n;
-        for(int i=0; i<Nfeatures_board; i++)
-            if(observations_board_pool[i].z < 0.0)
-                stats.Noutliers++;
-
-        const int Nmeasurements_board = Nfeatures_board*2;
-
         if(verbose)
         {
             // WARNING: I will never hook these up. Get rid of reportFitMsg?
@@ -5463,64 +6843,26 @@ mrcal_optimize( // out
         }
         ctx.reportFitMsg = NULL;
 
-        double outliernessScale = -1.0;
-        do
+        if(progress_callback != NULL)
         {
-            dogleg_callback_t dlcb = [](
-
-                       const double*   packed_state,
-                       double*         x,
-                       cholmod_sparse* Jt,
-                       void* ctx
-
-            ) { return optimizer_callback(
-                       packed_state,
-                       x,
-                       Jt,
-                        (const callback_context_t*)ctx
-            ); };
-
-            if(solver_context != NULL)
-                dogleg_freeContext(&solver_context);
-
-            norm2_error = dogleg_optimize2(packed_state,
-                                           Nstate, ctx.Nmeasurements, ctx.N_j_nonzero,
-                                           &dlcb, &ctx,
-                                           &dogleg_parameters,
-                                           &solver_context);
-
-            if(norm2_error < 0)
-                // libdogleg barfed. I quit out
-                goto done;
-
-#if 0
-            // Not using dogleg_markOutliers() (yet...)
-
-            if(outliernessScale < 0.0 && verbose)
-                // These are for debug reporting
-                dogleg_reportOutliers(getConfidence,
-                                      &outliernessScale,
-                                      2, Npoints_fromBoards,
-                                      stats.Noutliers,
-                                      solver_context->beforeStep, solver_context);
-#endif
+            progress_init(&progress, progress_callback, progress_cookie);
+            ctx.progress = &progress;
+        }
 
-        } while( problem_selections.do_apply_outlier_rejection &&
-                 markOutliers(observations_board_pool,
-                              &stats.Noutliers,
-                              observations_board,
-                              Nobservations_board,
-                              calibration_object_width_n,
-                              calibration_object_height_n,
-                              solver_context->beforeStep->x,
-                              verbose)
-                // TODO
-                //    &&
-                //  ({MSG("Threw out some outliers. New count = %d/%d (%.1f%%). Going again",
-                //        stats.Noutliers,
-                //        Nmeasurements_board,
-                //        (double)(stats.Noutliers * 100) / (double)Nmeasurements_board); true;})
-                       );
+        norm2_error = optimize_packed_state(packed_state,
+                                            &solver_context,
+                                            &dogleg_solver,
+                                            &schur_solver,
+                                            observations_board_pool,
+                                            &stats.Noutliers,
+                                            &x_solution,
+                                            &ctx, Nstate,
+                                            solver_options,
+                                            &dogleg_parameters);
+        if(norm2_error < 0)
+            // The solver barfed. I quit out
+            goto done;
+        stats.stopped_early = ctx.progress != NULL && progress.stopped;
 
         // Done. I have the final state. I spit it back out
         unpack_solver_state( intrinsics,         // Ncameras_intrinsics of these
@@ -5536,105 +6878,548 @@ mrcal_optimize( // out
                              Nobservations_board,
                              Nstate);
 
-        double regularization_ratio_distortion  = 0.0;
-        double regularization_ratio_centerpixel = 0.0;
-
-        int imeas_reg0 =
-            mrcal_measurement_index_regularization(calibration_object_width_n,
-                                                   calibration_object_height_n,
-                                                   Ncameras_intrinsics, Ncameras_extrinsics,
-                                                   Nframes,
-                                                   Npoints, Npoints_fixed, Nobservations_board, Nobservations_point,
-                                                   problem_selections,
-                                                   lensmodel);
-        if(problem_selections.do_apply_regularization && imeas_reg0 >= 0)
-        {
-            int Ncore = modelHasCore_fxfycxcy(lensmodel) ? 4 : 0;
-
-            int Nmeasurements_regularization_distortion  = 0;
-            if(problem_selections.do_optimize_intrinsics_distortions)
-                Nmeasurements_regularization_distortion =
-                    Ncameras_intrinsics*(ctx.Nintrinsics-Ncore);
+        report_regularization(&ctx, x_solution, norm2_error);
+    }
+    else
+        for(int ivar=0; ivar<Nstate; ivar++)
+            dogleg_testGradient(ivar, packed_state,
+                                Nstate, ctx.Nmeasurements, ctx.N_j_nonzero,
+                                (dogleg_callback_t*)&optimizer_callback, &ctx);
 
-            int Nmeasurements_regularization_centerpixel = 0;
-            if(problem_selections.do_optimize_intrinsics_core)
-                Nmeasurements_regularization_centerpixel =
-                    Ncameras_intrinsics*2;
+    stats.rms_reproj_error__pixels =
+        sqrt(norm2_error / (double)ctx.Nmeasurements);
 
-            double norm2_err_regularization_distortion     = 0;
-            double norm2_err_regularization_centerpixel    = 0;
+    if(b_packed_final)
+        memcpy(b_packed_final, packed_state, Nstate*sizeof(double));
+    if(x_final && x_solution)
+        memcpy(x_final, x_solution, ctx.Nmeasurements*sizeof(double));
 
-            const double* xreg = &solver_context->beforeStep->x[imeas_reg0];
+ done:
+    report_workspace_stats(&stats, &workspace);
 
-            for(int i=0; i<Nmeasurements_regularization_distortion; i++)
-            {
-                double x = *(xreg++);
-                norm2_err_regularization_distortion += x*x;
-            }
-            for(int i=0; i<Nmeasurements_regularization_centerpixel; i++)
-            {
-                double x = *(xreg++);
-                norm2_err_regularization_centerpixel += x*x;
-            }
-            assert(xreg == &solver_context->beforeStep->x[ctx.Nmeasurements]);
+    callback_workspace_free(&workspace);
+    if(solver_context != NULL)
+        dogleg_freeContext(&solver_context);
+    _mrcal_dogleg_solver_free(dogleg_solver);
+    _mrcal_schur_solver_free(schur_solver);
 
-            regularization_ratio_distortion  = norm2_err_regularization_distortion      / norm2_error;
-            regularization_ratio_centerpixel = norm2_err_regularization_centerpixel     / norm2_error;
+    return stats;
+}
 
-            // These are important to the dev, but not to the end user. So I
-            // disable these by default
+struct mrcal_calibration_session_t
+{
+    // The problem definition. Fixed for the lifetime of the session
+    mrcal_lensmodel_t              lensmodel;
+    mrcal_projection_precomputed_t precomputed;
+    std::vector<int>               imagersizes;
+    mrcal_problem_selections_t     problem_selections;
+    mrcal_problem_constants_t      problem_constants;
+    bool                           have_problem_constants;
+    double calibration_object_spacing;
+    int    calibration_object_width_n;
+    int    calibration_object_height_n;
+    int    Ncameras_intrinsics, Ncameras_extrinsics;
+    int    Npoints, Npoints_fixed;
+    int    Nintrinsics;
+    bool   verbose;
+    mrcal_solver_options_t solver_options;
+
+    // The current state: the seed before the first solve, and the latest
+    // optimum after
+    std::vector<double>         intrinsics;
+    std::vector<mrcal_pose_t>   extrinsics_fromref;
+    std::vector<mrcal_pose_t>   frames_toref;
+    std::vector<mrcal_point3_t> points;
+    mrcal_calobject_warp_t      calobject_warp;
+    bool                        have_calobject_warp;
+
+    // The observations. Appended to as new data comes in
+    std::vector<mrcal_observation_board_t> observations_board;
+    std::vector<mrcal_point3_t>            observations_board_pool;
+    std::vector<mrcal_observation_point_t> observations_point;
+
+    // Computed by jacobian_offsets_observations() at creation time, and
+    // extended incrementally as board observations are appended
+    std::vector<int> ijacobian0_board;
+    std::vector<int> ijacobian0_point;
+
+    std::vector<double>     packed_state;
+    callback_workspace_t    workspace;
+    // The solvers, or NULL if we haven't solved yet. They persist across
+    // solves: dogleg_solver keeps the factorization of JtJ, and refactors it in
+    // place if the sparsity pattern hasn't changed since the previous solve
+    _mrcal_dogleg_solver_t* dogleg_solver;
+    _mrcal_schur_solver_t*  schur_solver;
+    dogleg_parameters2_t    dogleg_parameters;
+
+    // The measurement vector of the latest solve. Lives in dogleg_solver or
+    // schur_solver
+    const double*           x_solution;
+};
 
-            // if(regularization_ratio_distortion > 0.01)
-            //     MSG("WARNING: regularization ratio for lens distortion exceeds 1%%. Is the scale factor too high? Ratio = %.3g/%.3g = %.3g",
-            //         norm2_err_regularization_distortion,  norm2_error, regularization_ratio_distortion);
-            // if(regularization_ratio_centerpixel > 0.01)
-            //     MSG("WARNING: regularization ratio for the projection centerpixel exceeds 1%%. Is the scale factor too high? Ratio = %.3g/%.3g = %.3g",
-            //         norm2_err_regularization_centerpixel, norm2_error, regularization_ratio_centerpixel);
+static int session_Npoints_board(const mrcal_calibration_session_t* session)
+{
+    return session->calibration_object_width_n*session->calibration_object_height_n;
+}
 
+static bool session_validate_observations_board(const mrcal_calibration_session_t* session,
+                                                const mrcal_observation_board_t* observations_board,
+                                                int Nobservations_board)
+{
+    for(int i=0; i<Nobservations_board; i++)
+    {
+        const mrcal_observation_board_t* o = &observations_board[i];
+        if(o->iframe < 0 || o->iframe >= (int)session->frames_toref.size())
+        {
+            MSG("Board observation %d refers to iframe=%d, but we have %d frames",
+                i, o->iframe, (int)session->frames_toref.size());
+            return false;
         }
+        if(o->icam.intrinsics < 0 || o->icam.intrinsics >= session->Ncameras_intrinsics)
+        {
+            MSG("Board observation %d refers to icam_intrinsics=%d, but we have %d cameras",
+                i, o->icam.intrinsics, session->Ncameras_intrinsics);
+            return false;
+        }
+        if(o->icam.extrinsics < -1 || o->icam.extrinsics >= session->Ncameras_extrinsics)
+        {
+            MSG("Board observation %d refers to icam_extrinsics=%d, but we have %d cameras",
+                i, o->icam.extrinsics, session->Ncameras_extrinsics);
+            return false;
+        }
+    }
+    return true;
+}
 
-
-        if(verbose)
+mrcal_calibration_session_t*
+mrcal_calibration_session_create( // in
+                                  const double*                 intrinsics,
+                                  const mrcal_pose_t*           extrinsics_fromref,
+                                  const mrcal_pose_t*           frames_toref,
+                                  const mrcal_point3_t*         points,
+                                  const mrcal_calobject_warp_t* calobject_warp,
+
+                                  int Ncameras_intrinsics, int Ncameras_extrinsics, int Nframes,
+                                  int Npoints, int Npoints_fixed,
+
+                                  const mrcal_observation_board_t* observations_board,
+                                  const mrcal_observation_point_t* observations_point,
+                                  int Nobservations_board,
+                                  int Nobservations_point,
+
+                                  const mrcal_point3_t* observations_board_pool,
+
+                                  const mrcal_lensmodel_t* lensmodel,
+                                  const int* imagersizes,
+                                  mrcal_problem_selections_t       problem_selections,
+                                  const mrcal_problem_constants_t* problem_constants,
+                                  double calibration_object_spacing,
+                                  int calibration_object_width_n,
+                                  int calibration_object_height_n,
+                                  bool verbose,
+                                  const mrcal_solver_options_t* solver_options)
+{
+    if( Nobservations_board > 0 )
+    {
+        if( problem_selections.do_optimize_calobject_warp && calobject_warp == NULL )
         {
-            if(problem_selections.do_apply_regularization)
-            {
-                // Disable this by default. Splined models have LOTS of
-                // parameters, and I don't want to print them. Usually.
-                //
-                // for(int i=0; i<Nmeasurements_regularization; i++)
-                // {
-                //     double x = solver_context->beforeStep->x[ctx.Nmeasurements - Nmeasurements_regularization + i];
-                //     MSG("regularization %d: %f (squared: %f)", i, x, x*x);
-                // }
-
-                MSG("Regularization stats:");
-                MSG("reg err ratio (distortion,centerpixel): %.3g %.3g",
-                    regularization_ratio_distortion,
-                    regularization_ratio_centerpixel);
-            }
+            MSG("ERROR: We're optimizing the calibration object warp, so a buffer with a seed MUST be passed in.");
+            return NULL;
         }
     }
     else
-        for(int ivar=0; ivar<Nstate; ivar++)
-            dogleg_testGradient(ivar, packed_state,
-                                Nstate, ctx.Nmeasurements, ctx.N_j_nonzero,
-                                (dogleg_callback_t*)&optimizer_callback, &ctx);
+        problem_selections.do_optimize_calobject_warp = false;
+
+    if(!modelHasCore_fxfycxcy(lensmodel))
+        problem_selections.do_optimize_intrinsics_core = false;
+
+    mrcal_calibration_session_t* session =
+        new(std::nothrow) mrcal_calibration_session_t{};
+    if(session == NULL)
+    {
+        MSG("Couldn't allocate the calibration session");
+        return NULL;
+    }
+
+    session->lensmodel                   = *lensmodel;
+    _mrcal_precompute_lensmodel_data(&session->precomputed, lensmodel);
+    session->problem_selections          = problem_selections;
+    session->have_problem_constants      = problem_constants != NULL;
+    if(problem_constants != NULL)
+        session->problem_constants       = *problem_constants;
+    session->calibration_object_spacing  = calibration_object_spacing;
+    session->calibration_object_width_n  = calibration_object_width_n  > 0 ? calibration_object_width_n  : 0;
+    session->calibration_object_height_n = calibration_object_height_n > 0 ? calibration_object_height_n : 0;
+    session->Ncameras_intrinsics         = Ncameras_intrinsics;
+    session->Ncameras_extrinsics         = Ncameras_extrinsics;
+    session->Npoints                     = Npoints;
+    session->Npoints_fixed               = Npoints_fixed;
+    session->Nintrinsics                 = mrcal_lensmodel_num_params(lensmodel);
+    session->verbose                     = verbose;
+    session->solver_options              = solver_options != NULL ?
+        *solver_options :
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    session->have_calobject_warp         = calobject_warp != NULL;
+    if(calobject_warp != NULL)
+        session->calobject_warp          = *calobject_warp;
+
+    const int Npoints_board = session_Npoints_board(session);
+
+    try
+    {
+        session->imagersizes       .assign(imagersizes,        imagersizes        + Ncameras_intrinsics*2);
+        session->intrinsics        .assign(intrinsics,         intrinsics         + Ncameras_intrinsics*session->Nintrinsics);
+        session->extrinsics_fromref.assign(extrinsics_fromref, extrinsics_fromref + Ncameras_extrinsics);
+        session->frames_toref      .assign(frames_toref,       frames_toref       + Nframes);
+        session->points            .assign(points,             points             + Npoints);
+        session->observations_board.assign(observations_board, observations_board + Nobservations_board);
+        session->observations_point.assign(observations_point, observations_point + Nobservations_point);
+        session->observations_board_pool.assign(observations_board_pool,
+                                                observations_board_pool + Nobservations_board*Npoints_board);
+        session->ijacobian0_board.resize(Nobservations_board+1);
+        session->ijacobian0_point.resize(Nobservations_point+1);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the calibration session");
+        mrcal_calibration_session_free(session);
+        return NULL;
+    }
+
+    jacobian_offsets_observations(session->ijacobian0_board.data(),
+                                  session->ijacobian0_point.data(),
+                                  Nobservations_board,
+                                  Nobservations_point,
+                                  session->calibration_object_width_n,
+                                  session->calibration_object_height_n,
+                                  Npoints, Npoints_fixed,
+                                  observations_board,
+                                  observations_point,
+                                  problem_selections,
+                                  lensmodel);
+
+    get_dogleg_parameters(&session->dogleg_parameters, &session->solver_options, verbose);
+    return session;
+}
+
+void mrcal_calibration_session_free(mrcal_calibration_session_t* session)
+{
+    if(session == NULL)
+        return;
+    callback_workspace_free(&session->workspace);
+    _mrcal_dogleg_solver_free(session->dogleg_solver);
+    _mrcal_schur_solver_free(session->schur_solver);
+    delete session;
+}
+
+bool mrcal_calibration_session_add_frames(mrcal_calibration_session_t* session,
+                                          const mrcal_pose_t* frames_toref,
+                                          int Nframes)
+{
+    if(Nframes < 0)
+    {
+        MSG("Nframes must be >= 0; got %d", Nframes);
+        return false;
+    }
+    try
+    {
+        session->frames_toref.insert(session->frames_toref.end(),
+                                     frames_toref, frames_toref + Nframes);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate memory for %d new frames", Nframes);
+        return false;
+    }
+    return true;
+}
+
+bool mrcal_calibration_session_add_observations_board(mrcal_calibration_session_t* session,
+                                                      const mrcal_observation_board_t* observations_board,
+                                                      const mrcal_point3_t* observations_board_pool,
+                                                      int Nobservations_board)
+{
+    if(Nobservations_board < 0)
+    {
+        MSG("Nobservations_board must be >= 0; got %d", Nobservations_board);
+        return false;
+    }
+    if(Nobservations_board > 0 && session_Npoints_board(session) == 0)
+    {
+        MSG("This session was created without a calibration object, so it can't take board observations");
+        return false;
+    }
+    if(!session_validate_observations_board(session,
+                                            observations_board, Nobservations_board))
+        return false;
+
+    const int Npoints_board              = session_Npoints_board(session);
+    const int Nobservations_board_before = (int)session->observations_board.size();
+    const int Nobservations_board_after  = Nobservations_board_before + Nobservations_board;
+    try
+    {
+        session->observations_board.insert(session->observations_board.end(),
+                                           observations_board,
+                                           observations_board + Nobservations_board);
+        session->observations_board_pool.insert(session->observations_board_pool.end(),
+                                                observations_board_pool,
+                                                observations_board_pool + Nobservations_board*Npoints_board);
+        session->ijacobian0_board.resize(Nobservations_board_after+1);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate memory for %d new board observations", Nobservations_board);
+        session->observations_board     .resize(Nobservations_board_before);
+        session->observations_board_pool.resize(Nobservations_board_before*Npoints_board);
+        session->ijacobian0_board       .resize(Nobservations_board_before+1);
+        return false;
+    }
+
+    // The board observations come before the point observations in the
+    // jacobian, so the new board observations go at the end of the existing
+    // ones, and the point observations shift back. The sparsity of the
+    // existing observations doesn't change: the calobject_warp selection was
+    // fixed when the session was created
+    const int Nintrinsics_per_measurement =
+        num_intrinsics_per_measurement(session->problem_selections, &session->lensmodel);
+    int N = session->ijacobian0_board[Nobservations_board_before];
+    for(int i=Nobservations_board_before; i<Nobservations_board_after; i++)
+    {
+        session->ijacobian0_board[i] = N;
+        N += num_j_nonzero_board_observation(&session->observations_board[i],
+                                             Nobservations_board_after,
+                                             session->calibration_object_width_n,
+                                             session->calibration_object_height_n,
+                                             Nintrinsics_per_measurement,
+                                             session->problem_selections);
+    }
+    session->ijacobian0_board[Nobservations_board_after] = N;
+
+    const int dN = N - session->ijacobian0_point[0];
+    for(int& i : session->ijacobian0_point)
+        i += dN;
+
+    return true;
+}
+
+mrcal_stats_t
+mrcal_calibration_session_solve(mrcal_calibration_session_t* session,
+
+                                // in
+                                mrcal_optimizer_progress_callback_t* progress_callback,
+                                void* progress_cookie,
+
+                                // out
+                                double* b_packed_final,
+                                int buffer_size_b_packed_final,
+                                double* x_final,
+                                int buffer_size_x_final)
+{
+    const int Nframes             = (int)session->frames_toref.size();
+    const int Nobservations_board = (int)session->observations_board.size();
+    const int Nobservations_point = (int)session->observations_point.size();
+
+    mrcal_calobject_warp_t* calobject_warp =
+        session->have_calobject_warp ? &session->calobject_warp : NULL;
+
+    callback_context_t ctx = {
+        .intrinsics                 = session->intrinsics.data(),
+        .extrinsics_fromref         = session->extrinsics_fromref.data(),
+        .frames_toref               = session->frames_toref.data(),
+        .points                     = session->points.data(),
+        .calobject_warp             = calobject_warp,
+        .Ncameras_intrinsics        = session->Ncameras_intrinsics,
+        .Ncameras_extrinsics        = session->Ncameras_extrinsics,
+        .Nframes                    = Nframes,
+        .Npoints                    = session->Npoints,
+        .Npoints_fixed              = session->Npoints_fixed,
+        .observations_board         = session->observations_board.data(),
+        .observations_board_pool    = session->observations_board_pool.data(),
+        .Nobservations_board        = Nobservations_board,
+        .observations_point         = session->observations_point.data(),
+        .Nobservations_point        = Nobservations_point,
+        .verbose                    = session->verbose,
+        .lensmodel                  = session->lensmodel,
+        .precomputed                = session->precomputed,
+        .imagersizes                = session->imagersizes.data(),
+        .problem_selections         = session->problem_selections,
+        .problem_constants          = session->have_problem_constants ? &session->problem_constants : NULL,
+        .calibration_object_spacing = session->calibration_object_spacing,
+        .calibration_object_width_n = session->calibration_object_width_n,
+        .calibration_object_height_n= session->calibration_object_height_n,
+        .Nmeasurements              = mrcal_num_measurements(Nobservations_board,
+                                                             Nobservations_point,
+                                                             session->calibration_object_width_n,
+                                                             session->calibration_object_height_n,
+                                                             session->Ncameras_intrinsics, session->Ncameras_extrinsics,
+                                                             Nframes,
+                                                             session->Npoints, session->Npoints_fixed,
+                                                             session->problem_selections,
+                                                             &session->lensmodel),
+        .N_j_nonzero                = session->ijacobian0_point[Nobservations_point] +
+                                      num_j_nonzero_regularization(session->Ncameras_intrinsics,
+                                                                   session->problem_selections,
+                                                                   &session->lensmodel),
+        .Nintrinsics                = session->Nintrinsics,
+        .ijacobian0_board           = session->ijacobian0_board.data(),
+        .ijacobian0_point           = session->ijacobian0_point.data(),
+        .Nthreads                   = session->solver_options.Nthreads,
+        .workspace                  = &session->workspace};
+    optimizer_progress_t progress;
+
+    const int Nstate = mrcal_num_states(session->Ncameras_intrinsics, session->Ncameras_extrinsics,
+                                        Nframes,
+                                        session->Npoints, session->Npoints_fixed, Nobservations_board,
+                                        session->problem_selections,
+                                        &session->lensmodel);
+
+    if( b_packed_final != NULL &&
+        buffer_size_b_packed_final != Nstate*(int)sizeof(double) )
+    {
+        MSG("The buffer passed to fill-in b_packed_final has the wrong size. Needed exactly %d bytes, but got %d bytes",
+            Nstate*(int)sizeof(double),buffer_size_b_packed_final);
+        return {.rms_reproj_error__pixels = -1.0};
+    }
+    if( x_final != NULL &&
+        buffer_size_x_final != ctx.Nmeasurements*(int)sizeof(double) )
+    {
+        MSG("The buffer passed to fill-in x_final has the wrong size. Needed exactly %d bytes, but got %d bytes",
+            ctx.Nmeasurements*(int)sizeof(double),buffer_size_x_final);
+        return {.rms_reproj_error__pixels = -1.0};
+    }
+
+    // Grows the workspace to fit any newly-appended data. Usually nothing needs
+    // to be allocated
+    if(!callback_workspace_init(&session->workspace, &ctx))
+        return {.rms_reproj_error__pixels = -1.0};
+
+    if(session->verbose)
+        MSG("## Nmeasurements=%d, Nstate=%d", ctx.Nmeasurements, Nstate);
+    if(ctx.Nmeasurements <= Nstate)
+    {
+        MSG("WARNING: problem isn't overdetermined: Nmeasurements=%d, Nstate=%d. Solver may not converge, and if it does, the results aren't reliable. Add more constraints and/or regularization",
+            ctx.Nmeasurements, Nstate);
+    }
+
+    try
+    {
+        session->packed_state.resize(Nstate);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the state vector");
+        return {.rms_reproj_error__pixels = -1.0};
+    }
+
+    // The seed is the previous optimum, with any new frames at their
+    // passed-in seeds
+    double* packed_state = session->packed_state.data();
+    pack_solver_state(packed_state,
+                      &session->lensmodel, session->intrinsics.data(),
+                      session->extrinsics_fromref.data(),
+                      session->frames_toref.data(),
+                      session->points.data(),
+                      calobject_warp,
+                      session->problem_selections,
+                      session->Ncameras_intrinsics, session->Ncameras_extrinsics,
+                      Nframes, session->Npoints-session->Npoints_fixed,
+                      Nobservations_board,
+                      Nstate);
+
+    mrcal_stats_t stats = {.rms_reproj_error__pixels = -1.0 };
+
+    if(progress_callback != NULL)
+    {
+        progress_init(&progress, progress_callback, progress_cookie);
+        ctx.progress = &progress;
+    }
+
+    double norm2_error =
+        optimize_packed_state(packed_state,
+                              NULL,
+                              &session->dogleg_solver,
+                              &session->schur_solver,
+                              session->observations_board_pool.data(),
+                              &stats.Noutliers,
+                              &session->x_solution,
+                              &ctx, Nstate,
+                              &session->solver_options,
+                              &session->dogleg_parameters);
+    if(norm2_error < 0)
+    {
+        // The solver barfed. The session state is left at the previous optimum
+        report_workspace_stats(&stats, &session->workspace);
+        return stats;
+    }
+    stats.stopped_early = ctx.progress != NULL && progress.stopped;
+
+    unpack_solver_state( session->intrinsics.data(),
+                         session->extrinsics_fromref.data(),
+                         session->frames_toref.data(),
+                         session->points.data(),
+                         calobject_warp,
+                         packed_state,
+                         &session->lensmodel,
+                         session->problem_selections,
+                         session->Ncameras_intrinsics, session->Ncameras_extrinsics,
+                         Nframes, session->Npoints-session->Npoints_fixed,
+                         Nobservations_board,
+                         Nstate);
+
+    report_regularization(&ctx, session->x_solution, norm2_error);
 
     stats.rms_reproj_error__pixels =
         sqrt(norm2_error / (double)ctx.Nmeasurements);
 
     if(b_packed_final)
-        memcpy(b_packed_final, solver_context->beforeStep->p, Nstate*sizeof(double));
+        memcpy(b_packed_final, packed_state, Nstate*sizeof(double));
     if(x_final)
-        memcpy(x_final, solver_context->beforeStep->x, ctx.Nmeasurements*sizeof(double));
-
- done:
-    if(solver_context != NULL)
-        dogleg_freeContext(&solver_context);
+        memcpy(x_final, session->x_solution, ctx.Nmeasurements*sizeof(double));
 
+    report_workspace_stats(&stats, &session->workspace);
     return stats;
 }
 
+void mrcal_calibration_session_get_state(const mrcal_calibration_session_t* session,
+                                         // out
+                                         double*                 intrinsics,
+                                         mrcal_pose_t*           extrinsics_fromref,
+                                         mrcal_pose_t*           frames_toref,
+                                         mrcal_point3_t*         points,
+                                         mrcal_calobject_warp_t* calobject_warp)
+{
+    if(intrinsics != NULL)
+        memcpy(intrinsics,         session->intrinsics.data(),
+               session->intrinsics.size()*sizeof(session->intrinsics[0]));
+    if(extrinsics_fromref != NULL)
+        memcpy(extrinsics_fromref, session->extrinsics_fromref.data(),
+               session->extrinsics_fromref.size()*sizeof(session->extrinsics_fromref[0]));
+    if(frames_toref != NULL)
+        memcpy(frames_toref,       session->frames_toref.data(),
+               session->frames_toref.size()*sizeof(session->frames_toref[0]));
+    if(points != NULL)
+        memcpy(points,             session->points.data(),
+               session->points.size()*sizeof(session->points[0]));
+    if(calobject_warp != NULL && session->have_calobject_warp)
+        *calobject_warp = session->calobject_warp;
+}
+
+int mrcal_calibration_session_num_frames(const mrcal_calibration_session_t* session)
+{
+    return (int)session->frames_toref.size();
+}
+
+int mrcal_calibration_session_num_observations_board(const mrcal_calibration_session_t* session)
+{
+    return (int)session->observations_board.size();
+}
+
+const mrcal_point3_t*
+mrcal_calibration_session_observations_board_pool(const mrcal_calibration_session_t* session)
+{
+    return session->observations_board_pool.data();
+}
+
 bool mrcal_write_cameramodel_file(const char* filename,
                                   const mrcal_cameramodel_t* cameramodel)
 {
@@ -5646,6 +7431,7 @@ bool mrcal_write_cameramodel_file(const char* filename,
         return false;
     }
 
+    numeric_locale_C_t numeric_locale_C;
     int Nparams;
 
     char lensmodel_string[1024];
@@ -5667,14 +7453,15 @@ bool mrcal_write_cameramodel_file(const char* filename,
 
     fprintf(fp, "{\n");
     fprintf(fp, "  'lensmodel':  '%s',\n", lensmodel_string);
+    // %.17g, so the values survive the round trip exactly
     fprintf(fp, "  'intrinsics': [ ");
     for(int i=0; i<Nparams; i++)
-        fprintf(fp, "%f, ", cameramodel->intrinsics[i]);
+        fprintf(fp, "%.17g, ", cameramodel->intrinsics[i]);
     fprintf(fp, "],\n");
     fprintf(fp, "  'imagersize': [ %u, %u ],\n",
             cameramodel->imagersize[0],
             cameramodel->imagersize[1]);
-    fprintf(fp, "  'extrinsics': [ %f, %f, %f, %f, %f, %f ]\n",
+    fprintf(fp, "  'extrinsics': [ %.17g, %.17g, %.17g, %.17g, %.17g, %.17g ]\n",
             cameramodel->rt_cam_ref[0],
             cameramodel->rt_cam_ref[1],
             cameramodel->rt_cam_ref[2],
@@ -5690,3 +7477,23 @@ bool mrcal_write_cameramodel_file(const char* filename,
         fclose(fp);
     return result;
 }
+
+void mrcal_cholmod_analysis_cache_clear(void)
+{
+    _mrcal_cholmod_cache_clear();
+}
+
+#ifdef MRCAL_ENABLE_TRACE
+unsigned int _mrcal_trace_categories = 0;
+#endif
+
+bool mrcal_trace_set_categories(unsigned int categories)
+{
+#ifdef MRCAL_ENABLE_TRACE
+    _mrcal_trace_categories = categories;
+    return true;
+#else
+    (void)categories;
+    return false;
+#endif
+}
@@ -148,7 +148,8 @@ bool mrcal_knots_for_splined_models( double* ux, double* uy,
 // if (dq_dintrinsics != NULL) we report the gradient dq/dintrinsics in a dense
 // (N,2,Nintrinsics) array. Note that splined models have very high Nintrinsics
 // and very sparse gradients. THIS function reports the gradients densely,
-// however, so it is inefficient for splined models.
+// however, so it is inefficient for splined models. Use
+// mrcal_project_sparse_intrinsics_gradients() for those.
 //
 // This function supports CAHVORE distortions only if we don't ask for any
 // gradients
@@ -172,6 +173,50 @@ bool mrcal_project( // out
                    const double* intrinsics);
 
 
+// Project the given camera-coordinate-system points, reporting the intrinsics
+// gradients sparsely
+//
+// Splined models have very many intrinsics, but each projected point depends
+// on only a small patch of control points. mrcal_project() reports the
+// intrinsics gradients densely, in an array that is mostly zeros. This function
+// reports only the nonzero parts. Only MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC is
+// supported.
+//
+// With meta = mrcal_gradient_sparse_meta() and len = meta.run_side_length, for
+// point i, i_xy in {0,1} and ix,iy in [0,len):
+//
+//   dq[i][i_xy] / dintrinsics[ ivar0[i] + meta.ivar_stridey*iy + 2*ix + i_xy ] =
+//     pool[i*2*len + ix] * pool[i*2*len + len + iy] * fxy[i_xy]
+//
+// dqx/dfx and dqy/dfy are reported in dq_dfxy[i].x and dq_dfxy[i].y. dq/dcxy is
+// the identity. All the other intrinsics gradients are 0.
+//
+// dq_dp (shape (N,2) mrcal_point3_t) and dq_dfxy (shape (N,)) may be NULL if
+// those gradients aren't wanted. ivar0 (shape (N,)) and pool (shape
+// (N,2*meta.run_side_length)) are required
+bool mrcal_project_sparse_intrinsics_gradients( // out
+                                               mrcal_point2_t* q,
+                                               mrcal_point3_t* dq_dp,
+                                               mrcal_point2_t* dq_dfxy,
+                                               int*            ivar0,
+                                               double*         pool,
+
+                                               // in
+                                               const mrcal_point3_t* p,
+                                               int N,
+                                               const mrcal_lensmodel_t* lensmodel,
+                                               // core, distortions concatenated
+                                               const double* intrinsics);
+
+// Reports the layout of the sparse gradients returned by
+// mrcal_project_sparse_intrinsics_gradients(). Returns false if this lensmodel
+// doesn't have sparse intrinsics gradients
+bool mrcal_gradient_sparse_meta( // out
+                                 mrcal_gradient_sparse_meta_t* meta,
+                                 // in
+                                 const mrcal_lensmodel_t* lensmodel);
+
+
 // Unproject the given pixel coordinates
 //
 // Compute an "unprojection", a mapping of pixel coordinates to the camera
@@ -199,6 +244,84 @@ bool mrcal_unproject( // out
                      const double* intrinsics);
 
 
+// Precomputed unprojection lookup tables
+//
+// mrcal_unproject() solves an optimization problem for each point. If the same
+// pixels are unprojected over and over (every pixel of every frame, for
+// instance), it is much faster to solve once, and to look up the results
+// afterwards. mrcal_unproject_lut_create() builds such a table for a given
+// lensmodel, intrinsics and imager size. mrcal_unproject_lut() then unprojects
+// in O(1) per point.
+//
+// The table stores the exact unprojection at every "spacing"-th pixel, in the
+// stereographic representation used internally by mrcal_unproject(). It is
+// bilinearly interpolated in between. This representation is smooth over the
+// whole imager, even for very wide lenses, so the interpolation error is small,
+// and it shrinks quadratically with the spacing. While building the table, we
+// compare it against the exact solution at the center of each cell (where the
+// interpolation is usually least accurate). mrcal_unproject_lut_max_error()
+// returns the worst reprojection error seen there, in pixels. This is an
+// ESTIMATE of the interpolation error, not a bound: only the cell centers are
+// measured, and other points in a cell may be slightly worse. Points outside the
+// imager are unprojected exactly with mrcal_unproject(), so they're slow, but
+// correct.
+//
+// Near the edges of a very wide lens, the exact unprojection may fail at some
+// nodes. We can't interpolate in the cells around those nodes, so points in
+// those cells are unprojected exactly too. They are measured like any other
+// cell: they contribute to mrcal_unproject_lut_max_error() wherever the exact
+// solve succeeds. mrcal_unproject_lut_num_cells_exact() says how many such
+// cells there are: if there are many, the table isn't buying much.
+//
+// spacing = 1 has an entry for every integer pixel: integer pixel coordinates
+// are then looked up with no interpolation error.
+//
+// The tables can be written to disk and read back, so services can start with
+// a warm table. The file stores the lensmodel and intrinsics it was built with,
+// and mrcal_read_unproject_lut_file() refuses to return a table that doesn't
+// match the given camera. The format is binary, in the native byte order
+//
+// Returns NULL on error. Must be freed with mrcal_unproject_lut_free()
+typedef struct mrcal_unproject_lut_t mrcal_unproject_lut_t;
+
+mrcal_unproject_lut_t*
+mrcal_unproject_lut_create( // in
+                            const mrcal_lensmodel_t* lensmodel,
+                            // core, distortions concatenated
+                            const double* intrinsics,
+                            int width, int height,
+                            int spacing);
+void mrcal_unproject_lut_free(mrcal_unproject_lut_t* lut);
+
+// Same results as mrcal_unproject(), up to the interpolation error
+bool mrcal_unproject_lut( // out
+                          mrcal_point3_t* v,
+
+                          // in
+                          const mrcal_point2_t* q,
+                          int N,
+                          const mrcal_unproject_lut_t* lut);
+
+// The worst reprojection error of the table at the cell centers, as described
+// above. An estimate of the interpolation error, not a bound
+double mrcal_unproject_lut_max_error(const mrcal_unproject_lut_t* lut);
+
+// How many cells of the table can't be interpolated, and are unprojected
+// exactly, as described above
+int mrcal_unproject_lut_num_cells_exact(const mrcal_unproject_lut_t* lut);
+
+bool mrcal_write_unproject_lut_file(const char* filename,
+                                    const mrcal_unproject_lut_t* lut);
+// Returns NULL on error, or if the table in the file was built for a different
+// lensmodel or intrinsics
+mrcal_unproject_lut_t*
+mrcal_read_unproject_lut_file( // in
+                               const char* filename,
+                               const mrcal_lensmodel_t* lensmodel,
+                               // core, distortions concatenated
+                               const double* intrinsics);
+
+
 // Project the given camera-coordinate-system points using a pinhole
 // model. See the docs for projection details:
 // http://mrcal.secretsauce.net/lensmodels.html#lensmodel-pinhole
@@ -447,6 +570,10 @@ bool mrcal_corresponding_icam_extrinsics(// out
                                          int Nobservations_point,
                                          const mrcal_observation_point_t* observations_point);
 
+// Returns the solver options for the given preset. These can then be tweaked,
+// and passed to mrcal_optimize()
+mrcal_solver_options_t mrcal_solver_options_preset(mrcal_solver_preset_t preset);
+
 // Solve the given optimization problem
 //
 // This is the entry point to the mrcal optimization routine. The argument list
@@ -513,10 +640,155 @@ mrcal_optimize( // out
                 int calibration_object_width_n,
                 int calibration_object_height_n,
                 bool verbose,
+                // Which solver to use, and how. May be NULL to use
+                // mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT)
+                const mrcal_solver_options_t* solver_options,
+                // Called after each solver iteration and after each
+                // outlier-rejection pass, to report progress. Returning false
+                // from it stops the solve early, with the state in the last
+                // report. May be NULL. libdogleg can't report its iterations,
+                // so if this is given, MRCAL_SOLVER_SPARSE_CHOLMOD uses mrcal's
+                // own dogleg implementation
+                mrcal_optimizer_progress_callback_t* progress_callback,
+                void* progress_cookie,
 
                 bool check_gradient);
 
 
+// An incremental calibration session
+//
+// mrcal_optimize() solves each problem from scratch. Applications that
+// recalibrate the same rig repeatedly, as new chessboard observations arrive,
+// can create a session instead. The session owns a copy of the problem. New
+// frames and board observations may be appended to it, and each
+// mrcal_calibration_session_solve() starts at the optimum of the previous solve,
+// so an update usually converges in a few iterations. Outliers marked by
+// previous solves stay marked. The sparsity bookkeeping, the thread pool and the
+// callback scratch memory persist across solves, and are extended as data is
+// appended. So does the CHOLMOD factorization: if nothing was appended since the
+// previous solve, the sparsity pattern is the same, and the factorization is
+// computed in place, without a new symbolic analysis.
+//
+// A session is created with the arguments of mrcal_optimize(), minus the output
+// buffers and the progress callback. Everything is copied: the caller's buffers may be freed as soon as
+// this returns. The problem_selections are fixed for the lifetime of the
+// session. If there are no board observations at creation time, the
+// calibration-object warp is not optimized, even if board observations are
+// appended later. Returns NULL on error. The result must be freed with
+// mrcal_calibration_session_free()
+typedef struct mrcal_calibration_session_t mrcal_calibration_session_t;
+
+mrcal_calibration_session_t*
+mrcal_calibration_session_create( // in
+
+                                  // The seed. The arguments have the same
+                                  // meaning as in mrcal_optimize()
+                                  const double*                 intrinsics,         // Ncameras_intrinsics * NlensParams
+                                  const mrcal_pose_t*           extrinsics_fromref, // Ncameras_extrinsics of these
+                                  const mrcal_pose_t*           frames_toref,       // Nframes of these
+                                  const mrcal_point3_t*         points,             // Npoints of these
+                                  const mrcal_calobject_warp_t* calobject_warp,     // 1 of these. May be NULL if !problem_selections.do_optimize_calobject_warp
+
+                                  int Ncameras_intrinsics, int Ncameras_extrinsics, int Nframes,
+                                  int Npoints, int Npoints_fixed, // at the end of points[]
+
+                                  const mrcal_observation_board_t* observations_board,
+                                  const mrcal_observation_point_t* observations_point,
+                                  int Nobservations_board,
+                                  int Nobservations_point,
+
+                                  // Shape (Nobservations_board,
+                                  //        calibration_object_height_n,
+                                  //        calibration_object_width_n)
+                                  const mrcal_point3_t* observations_board_pool,
+
+                                  const mrcal_lensmodel_t* lensmodel,
+                                  const int* imagersizes, // Ncameras_intrinsics*2 of these
+                                  mrcal_problem_selections_t       problem_selections,
+                                  const mrcal_problem_constants_t* problem_constants,
+                                  double calibration_object_spacing,
+                                  int calibration_object_width_n,
+                                  int calibration_object_height_n,
+                                  bool verbose,
+                                  const mrcal_solver_options_t* solver_options);
+
+void mrcal_calibration_session_free(mrcal_calibration_session_t* session);
+
+// Appends Nframes new frames to the session, seeded with frames_toref. The new
+// frames are indexed after the existing ones, starting at
+// mrcal_calibration_session_num_frames()
+bool mrcal_calibration_session_add_frames(mrcal_calibration_session_t* session,
+                                          const mrcal_pose_t* frames_toref, // Nframes of these
+                                          int Nframes);
+
+// Appends Nobservations_board new board observations to the session.
+// observations_board[i].iframe may refer to any frame in the session, including
+// ones just added with mrcal_calibration_session_add_frames()
+bool mrcal_calibration_session_add_observations_board(mrcal_calibration_session_t* session,
+                                                      const mrcal_observation_board_t* observations_board,
+                                                      // Shape (Nobservations_board,
+                                                      //        calibration_object_height_n,
+                                                      //        calibration_object_width_n)
+                                                      const mrcal_point3_t* observations_board_pool,
+                                                      int Nobservations_board);
+
+// Solves the session's problem, starting from the previous optimum (or the
+// seed, on the first call). The outputs are optional, and have the same meaning
+// as in mrcal_optimize(). The solution stays in the session, and is available
+// through mrcal_calibration_session_get_state()
+mrcal_stats_t
+mrcal_calibration_session_solve(mrcal_calibration_session_t* session,
+
+                                // in
+                                // As in mrcal_optimize(). May be NULL
+                                mrcal_optimizer_progress_callback_t* progress_callback,
+                                void* progress_cookie,
+
+                                // out
+                                // Each one of these output pointers may be NULL
+                                // Shape (Nstate,)
+                                double* b_packed,
+                                // used only to confirm that the user passed-in the buffer they
+                                // should have passed-in. The size must match exactly
+                                int buffer_size_b_packed,
+
+                                // Shape (Nmeasurements,)
+                                double* x,
+                                // used only to confirm that the user passed-in the buffer they
+                                // should have passed-in. The size must match exactly
+                                int buffer_size_x);
+
+// Copies out the session's current state: the latest optimum, or the seed if we
+// haven't solved yet. Each output pointer may be NULL. The sizes are those
+// passed to mrcal_calibration_session_create(), except frames_toref, which has
+// mrcal_calibration_session_num_frames() entries
+void mrcal_calibration_session_get_state(const mrcal_calibration_session_t* session,
+                                         // out
+                                         double*                 intrinsics,
+                                         mrcal_pose_t*           extrinsics_fromref,
+                                         mrcal_pose_t*           frames_toref,
+                                         mrcal_point3_t*         points,
+                                         mrcal_calobject_warp_t* calobject_warp);
+
+int mrcal_calibration_session_num_frames             (const mrcal_calibration_session_t* session);
+int mrcal_calibration_session_num_observations_board (const mrcal_calibration_session_t* session);
+
+// The session's board observations, with the outliers marked with .z<0.
+// mrcal_calibration_session_num_observations_board() *
+// calibration_object_height_n * calibration_object_width_n of these. The
+// pointer is valid until the next mrcal_calibration_session_...() call
+const mrcal_point3_t*
+mrcal_calibration_session_observations_board_pool(const mrcal_calibration_session_t* session);
+
+
+// The fill-reducing ordering and symbolic factorization computed by CHOLMOD
+// depend only on the sparsity pattern of the Jacobian, which is a function of
+// the problem structure: the observation lists, the lens model and the problem
+// selections. mrcal caches the analysis of a few recently-seen patterns, and
+// reuses it whenever it factors a problem with the same structure (and the same
+// CHOLMOD settings) again. This frees that cache
+void mrcal_cholmod_analysis_cache_clear(void);
+
 // These are cholmod_sparse, cholmod_factor, cholmod_common. I don't want to
 // include the full header that defines these in mrcal.h, and I don't need to:
 // mrcal.h just needs to know that these are a structure
@@ -781,6 +1053,69 @@ void                 mrcal_free_cameramodel(mrcal_cameramodel_t** cameramodel);
 bool mrcal_write_cameramodel_file(const char* filename,
                                   const mrcal_cameramodel_t* cameramodel);
 
+// Binary .cameramodel files. These contain the same data as the text files, but
+// the intrinsics are stored as raw doubles, so they can be used straight out of
+// an mmap() of the file, with no parsing. This is useful for models with large
+// intrinsics vectors, such as LENSMODEL_SPLINED_STEREOGRAPHIC. The layout, all
+// in the host byte order:
+//
+//   offset  0: char     magic[8]: MRCAL_CAMERAMODEL_BINARY_MAGIC
+//   offset  8: uint32_t version: MRCAL_CAMERAMODEL_BINARY_VERSION
+//   offset 12: uint32_t byte-order mark: 0x01020304
+//   offset 16: uint32_t Nintrinsics
+//   offset 20: uint32_t imagersize[2]
+//   offset 28: uint32_t offset of the intrinsics from the start of the file
+//   offset 32: double   rt_cam_ref[6]
+//   offset 80: char     lensmodel[176]: the full lensmodel string, including
+//                       the configuration. '\0'-terminated and '\0'-padded
+//   then, at the intrinsics offset: double intrinsics[Nintrinsics]
+//
+// The intrinsics offset is a multiple of MRCAL_CAMERAMODEL_BINARY_ALIGNMENT.
+// mrcal_read_cameramodel_file() detects binary files, and reads them too
+#define MRCAL_CAMERAMODEL_BINARY_MAGIC     "MRCALCMB"
+#define MRCAL_CAMERAMODEL_BINARY_VERSION   1
+#define MRCAL_CAMERAMODEL_BINARY_ALIGNMENT 64
+
+bool mrcal_write_cameramodel_binary_file(const char* filename,
+                                         const mrcal_cameramodel_t* cameramodel);
+
+// Returns a malloc()-ed copy, like mrcal_read_cameramodel_file(). Free with
+// mrcal_free_cameramodel()
+mrcal_cameramodel_t* mrcal_read_cameramodel_binary_file(const char* filename);
+
+// Zero-copy: cameramodel->intrinsics points into the mapped file. Release with
+// mrcal_unmap_cameramodel_binary_file()
+bool mrcal_map_cameramodel_binary_file(// output
+                                       mrcal_cameramodel_mmapped_t* cameramodel,
+                                       // input
+                                       const char* filename);
+void mrcal_unmap_cameramodel_binary_file(mrcal_cameramodel_mmapped_t* cameramodel);
+
+// Reads N cameramodels in parallel, in either format. cameramodels[i] is a
+// malloc()-ed copy, like what mrcal_read_cameramodel_file() returns: free each
+// one with mrcal_free_cameramodel(). If any model couldn't be read, its
+// cameramodels[i] is NULL and false is returned; the others are still valid.
+//
+// The parsed models are cached, keyed on the contents of the files. So
+// re-reading a file that hasn't changed (when reloading the configuration, for
+// instance) only costs the read and a hash of its bytes. The cache is
+// process-global and thread-safe, and it keeps a few hundred of the most
+// recently used models
+bool mrcal_read_cameramodel_files(// output
+                                  mrcal_cameramodel_t** cameramodels,
+                                  // input
+                                  const char* const* filenames,
+                                  int N);
+
+// Frees everything in the cameramodel cache used by mrcal_read_cameramodel_files()
+void mrcal_cameramodel_cache_clear(void);
+
+// Turns on diagnostic output from the internals. "categories" is a bitmask of
+// mrcal_trace_category_t values; 0 turns everything off. The output goes to
+// stderr. This is only available if the library was built with
+// MRCAL_ENABLE_TRACE; if it wasn't, this does nothing and returns false
+bool mrcal_trace_set_categories(unsigned int categories);
+
 // Public ABI stuff, that's not for end-user consumption
 #include "mrcal-internal.h"
 
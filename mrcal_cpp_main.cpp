@@ -268,7 +268,8 @@ std::unique_ptr<mrcal_result> mrcal_main(
         Nobservations_point, c_observations_board_pool, &mrcal_lensmodel,
         c_imagersizes, problem_selections, &problem_constants,
         calibration_object_spacing, calibration_object_width_n,
-        calibration_object_height_n, verbose, false);
+        calibration_object_height_n, verbose, NULL,
+        NULL, NULL, false);
 
     // and for fun, evaluate the jacobian
     // cholmod_sparse* Jt = NULL;
@@ -0,0 +1,191 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+
+#include "parallel.h"
+
+int _mrcal_num_threads(int Nthreads)
+{
+    if(Nthreads > 0)
+        return Nthreads;
+
+    // hardware_concurrency() may return 0 if it doesn't know
+    int N = (int)std::thread::hardware_concurrency();
+    return N > 0 ? N : 1;
+}
+
+static int num_chunks(int N, int Nthreads)
+{
+    int Nchunks = _mrcal_num_threads(Nthreads);
+    if(Nchunks > N)
+        Nchunks = N;
+    return Nchunks;
+}
+
+// chunk i covers [i*N/Nchunks, (i+1)*N/Nchunks). Computed in 64 bits to avoid
+// overflow with large N
+static int chunk_boundary(int i, int N, int Nchunks)
+{
+    return (int)( (long long)i * (long long)N / (long long)Nchunks );
+}
+
+void _mrcal_parallel_for(int N, int Nthreads,
+                         void (*f)(int i0, int i1, int ichunk, void* cookie),
+                         void* cookie)
+{
+    if(N <= 0)
+        return;
+
+    const int Nchunks = num_chunks(N, Nthreads);
+    if(Nchunks == 1)
+    {
+        f(0, N, 0, cookie);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(Nchunks-1);
+    for(int i=1; i<Nchunks; i++)
+        threads.emplace_back(f,
+                             chunk_boundary(i,   N, Nchunks),
+                             chunk_boundary(i+1, N, Nchunks),
+                             i, cookie);
+
+    f(0, chunk_boundary(1, N, Nchunks), 0, cookie);
+
+    for(auto& t : threads)
+        t.join();
+}
+
+struct _mrcal_thread_pool_t
+{
+    int Nthreads;
+    std::vector<std::thread> workers; // Nthreads-1 of these
+
+    std::mutex              mutex;
+    std::condition_variable cv_start, cv_done;
+
+    // Incremented every time we have new work for the workers
+    unsigned long generation = 0;
+    // How many workers haven't yet finished the current generation
+    int  Npending = 0;
+    bool quit     = false;
+
+    // The current work
+    int N = 0, Nchunks = 0;
+    void (*f)(int i0, int i1, int ichunk, void* cookie) = NULL;
+    void* cookie = NULL;
+};
+
+static void thread_pool_worker(_mrcal_thread_pool_t* pool, int ichunk)
+{
+    unsigned long generation_done = 0;
+    while(true)
+    {
+        int N, Nchunks;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->cv_start.wait(lock,
+                                [&]{ return pool->quit ||
+                                            pool->generation != generation_done; });
+            if(pool->quit)
+                return;
+            generation_done = pool->generation;
+            N               = pool->N;
+            Nchunks         = pool->Nchunks;
+        }
+
+        if(ichunk < Nchunks)
+            pool->f(chunk_boundary(ichunk,   N, Nchunks),
+                    chunk_boundary(ichunk+1, N, Nchunks),
+                    ichunk, pool->cookie);
+
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            if(--pool->Npending == 0)
+                pool->cv_done.notify_one();
+        }
+    }
+}
+
+_mrcal_thread_pool_t* _mrcal_thread_pool_create(int Nthreads)
+{
+    _mrcal_thread_pool_t* pool = new(std::nothrow) _mrcal_thread_pool_t;
+    if(pool == NULL)
+        return NULL;
+
+    pool->Nthreads = _mrcal_num_threads(Nthreads);
+    try
+    {
+        pool->workers.reserve(pool->Nthreads-1);
+        for(int i=1; i<pool->Nthreads; i++)
+            pool->workers.emplace_back(thread_pool_worker, pool, i);
+    }
+    catch(...)
+    {
+        _mrcal_thread_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void _mrcal_thread_pool_free(_mrcal_thread_pool_t* pool)
+{
+    if(pool == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->quit = true;
+    }
+    pool->cv_start.notify_all();
+    for(auto& t : pool->workers)
+        t.join();
+    delete pool;
+}
+
+int _mrcal_thread_pool_num_threads(const _mrcal_thread_pool_t* pool)
+{
+    return pool->Nthreads;
+}
+
+void _mrcal_thread_pool_run(_mrcal_thread_pool_t* pool,
+                            int N,
+                            void (*f)(int i0, int i1, int ichunk, void* cookie),
+                            void* cookie)
+{
+    if(N <= 0)
+        return;
+
+    const int Nchunks = num_chunks(N, pool->Nthreads);
+    if(Nchunks == 1)
+    {
+        f(0, N, 0, cookie);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->N        = N;
+        pool->Nchunks  = Nchunks;
+        pool->f        = f;
+        pool->cookie   = cookie;
+        pool->Npending = (int)pool->workers.size();
+        pool->generation++;
+    }
+    pool->cv_start.notify_all();
+
+    f(0, chunk_boundary(1, N, Nchunks), 0, cookie);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->cv_done.wait(lock, [&]{ return pool->Npending == 0; });
+}
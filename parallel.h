@@ -0,0 +1,91 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#pragma once
+
+// This is an internal header to split loops across multiple threads. Not to be
+// seen by the end-users or installed
+//
+// The functions are implemented in C++, and called from both C and C++, so they
+// have C linkage
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the number of threads we would actually use, given the number
+// requested. Nthreads <= 0 means "use all the available cores"
+int _mrcal_num_threads(int Nthreads);
+
+// Evaluates f(i0,i1, ichunk, cookie) for a set of contiguous chunks [i0,i1)
+// that together cover [0,N). Each chunk runs in its own thread; chunk 0 runs in
+// the calling thread. This function returns when all the chunks are done.
+//
+// The chunk boundaries are a function of ONLY N and Nthreads. So any per-chunk
+// accumulations, reduced in chunk order afterwards, are reproducible run-to-run.
+// No more than _mrcal_num_threads(Nthreads) chunks are used, and ichunk is
+// always < _mrcal_num_threads(Nthreads). Callers may use ichunk to index
+// per-thread scratch space.
+//
+// Nthreads == 1 evaluates everything serially, in the calling thread, in a
+// single chunk
+void _mrcal_parallel_for(int N, int Nthreads,
+                         void (*f)(int i0, int i1, int ichunk, void* cookie),
+                         void* cookie);
+
+// A persistent set of worker threads. _mrcal_parallel_for() starts and joins
+// new threads every time it is called. This is fine for one-off work, but an
+// optimization calls its callback hundreds of times, and we don't want to pay
+// for the thread creation (and its heap allocations) each time. A thread pool
+// is created once, and then _mrcal_thread_pool_run() can be called any number
+// of times, with no allocations
+typedef struct _mrcal_thread_pool_t _mrcal_thread_pool_t;
+
+// Nthreads has the same meaning as in _mrcal_parallel_for(). Returns NULL on
+// error
+_mrcal_thread_pool_t* _mrcal_thread_pool_create(int Nthreads);
+void _mrcal_thread_pool_free(_mrcal_thread_pool_t* pool);
+
+// How many chunks _mrcal_thread_pool_run() may use. ichunk is always less than
+// this
+int _mrcal_thread_pool_num_threads(const _mrcal_thread_pool_t* pool);
+
+// Same semantics as _mrcal_parallel_for(), with the same chunk boundaries. The
+// pool must not be used from multiple threads at the same time
+void _mrcal_thread_pool_run(_mrcal_thread_pool_t* pool,
+                            int N,
+                            void (*f)(int i0, int i1, int ichunk, void* cookie),
+                            void* cookie);
+
+#ifdef __cplusplus
+}
+
+// Convenience wrappers to use lambdas with captures
+template<typename F>
+static inline
+void _mrcal_parallel_for(int N, int Nthreads, const F& f)
+{
+    _mrcal_parallel_for(N, Nthreads,
+                        [](int i0, int i1, int ichunk, void* cookie)
+                        {
+                            (*(const F*)cookie)(i0, i1, ichunk);
+                        },
+                        (void*)&f);
+}
+template<typename F>
+static inline
+void _mrcal_thread_pool_run(_mrcal_thread_pool_t* pool, int N, const F& f)
+{
+    _mrcal_thread_pool_run(pool, N,
+                           [](int i0, int i1, int ichunk, void* cookie)
+                           {
+                               (*(const F*)cookie)(i0, i1, ichunk);
+                           },
+                           (void*)&f);
+}
+#endif
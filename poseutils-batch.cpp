@@ -0,0 +1,426 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <string.h>
+#include <algorithm>
+
+#include "poseutils.h"
+#include "strides.h"
+#include "parallel.h"
+
+// The batched point transformations. The same rotation or transformation is
+// applied to N points. Unlike the single-point functions, these compute the
+// rotation matrix once, and then the points are just a matrix-vector product.
+// The points are processed in blocks: each block is transposed into separate
+// x,y,z arrays, so the arithmetic is a set of simple loops that the compiler
+// vectorizes
+
+// Points are processed in blocks of this many
+#define POSEUTILS_BATCH_BLOCK                  64
+
+// Don't bother with threads unless each one gets at least this many points
+#define POSEUTILS_BATCH_NPOINTS_PER_THREAD_MIN 65536
+
+// The operation, with everything that's shared by all the points
+typedef struct
+{
+    // The rotation we apply: R or transpose(R)
+    double M[3*3];
+
+    // Not inverted: y = M x + t
+    // Inverted:     y = M (x - t)
+    // No t:         y = M x
+    double t[3];
+    bool   have_t;
+    bool   inverted;
+
+    // dM[i][j]/dr[k] in a (3,3,3) array. Set only if reporting J_r
+    double dM_dr[3*3*3];
+} batch_op_t;
+
+// The arrays. Any of the gradients may be NULL
+typedef struct
+{
+    double* x_out;
+    int     x_out_stride0, x_out_stride1;
+
+    // (N,3,3,3): dy/dR, where R is the input rotation matrix
+    double* J_R;
+    int     J_R_stride0, J_R_stride1, J_R_stride2, J_R_stride3;
+    // (N,3,3): dy/dr, where r is the input rodrigues rotation
+    double* J_r;
+    int     J_r_stride0, J_r_stride1, J_r_stride2;
+    // (N,3,3): dy/dt
+    double* J_t;
+    int     J_t_stride0, J_t_stride1, J_t_stride2;
+    // (N,3,3): dy/dx
+    double* J_x;
+    int     J_x_stride0, J_x_stride1, J_x_stride2;
+
+    const double* x_in;
+    int     x_in_stride0, x_in_stride1;
+} batch_arrays_t;
+
+static void
+transform_block(const batch_op_t*     op,
+                const batch_arrays_t* a,
+                int i0, int N)
+{
+    const double* M = op->M;
+    const double* t = op->t;
+
+    double u[3][POSEUTILS_BATCH_BLOCK];
+    double y[3][POSEUTILS_BATCH_BLOCK];
+
+    for(int i=0; i<N; i++)
+        for(int j=0; j<3; j++)
+            u[j][i] = _P2(a->x_in, a->x_in_stride0, a->x_in_stride1, (size_t)(i0+i), j);
+
+    if(op->have_t && op->inverted)
+        for(int j=0; j<3; j++)
+            for(int i=0; i<N; i++)
+                u[j][i] = u[j][i] - t[j];
+
+    for(int j=0; j<3; j++)
+        for(int i=0; i<N; i++)
+            y[j][i] =
+                M[3*j + 0]*u[0][i] +
+                M[3*j + 1]*u[1][i] +
+                M[3*j + 2]*u[2][i];
+
+    if(op->have_t && !op->inverted)
+        for(int j=0; j<3; j++)
+            for(int i=0; i<N; i++)
+                y[j][i] += t[j];
+
+    // x_in has been read, so in-place operation is safe
+    for(int i=0; i<N; i++)
+        for(int j=0; j<3; j++)
+            _P2(a->x_out, a->x_out_stride0, a->x_out_stride1, (size_t)(i0+i), j) = y[j][i];
+
+    if(a->J_x != NULL)
+        for(int i=0; i<N; i++)
+            for(int j=0; j<3; j++)
+                for(int k=0; k<3; k++)
+                    _P3(a->J_x, a->J_x_stride0, a->J_x_stride1, a->J_x_stride2,
+                        (size_t)(i0+i), j, k) = M[3*j + k];
+
+    if(a->J_t != NULL)
+        // Not inverted: dy/dt = I
+        // Inverted:     dy/dt = -M
+        for(int i=0; i<N; i++)
+            for(int j=0; j<3; j++)
+                for(int k=0; k<3; k++)
+                    _P3(a->J_t, a->J_t_stride0, a->J_t_stride1, a->J_t_stride2,
+                        (size_t)(i0+i), j, k) =
+                        op->inverted ? -M[3*j + k] : (j == k ? 1.0 : 0.0);
+
+    if(a->J_R != NULL)
+        // y[j] = inner(M[j,:], u). If not inverted, M = R, and
+        //   dy[j]/dR[k,l] = (j==k) u[l]
+        // If inverted, M = transpose(R), and
+        //   dy[j]/dR[k,l] = (j==l) u[k]
+        for(int i=0; i<N; i++)
+            for(int j=0; j<3; j++)
+                for(int k=0; k<3; k++)
+                    for(int l=0; l<3; l++)
+                    {
+                        double g;
+                        if(!op->inverted) g = (j == k) ? u[l][i] : 0.0;
+                        else              g = (j == l) ? u[k][i] : 0.0;
+                        _P4(a->J_R, a->J_R_stride0, a->J_R_stride1, a->J_R_stride2, a->J_R_stride3,
+                            (size_t)(i0+i), j, k, l) = g;
+                    }
+
+    if(a->J_r != NULL)
+    {
+        // dy[j]/dr[k] = sum(dM[j][l]/dr[k] u[l])
+        const double* dM_dr = op->dM_dr;
+        for(int j=0; j<3; j++)
+            for(int k=0; k<3; k++)
+            {
+                const double d0 = dM_dr[9*j + 3*0 + k];
+                const double d1 = dM_dr[9*j + 3*1 + k];
+                const double d2 = dM_dr[9*j + 3*2 + k];
+                for(int i=0; i<N; i++)
+                    _P3(a->J_r, a->J_r_stride0, a->J_r_stride1, a->J_r_stride2,
+                        (size_t)(i0+i), j, k) =
+                        d0*u[0][i] +
+                        d1*u[1][i] +
+                        d2*u[2][i];
+            }
+    }
+}
+
+static void
+transform_batch(const batch_op_t*     op,
+                const batch_arrays_t* a,
+                int N)
+{
+    if(N <= 0)
+        return;
+
+    const int Nblocks  = (N + POSEUTILS_BATCH_BLOCK-1) / POSEUTILS_BATCH_BLOCK;
+    const int Nthreads =
+        std::min(_mrcal_num_threads(0),
+                 std::max(1, N / POSEUTILS_BATCH_NPOINTS_PER_THREAD_MIN));
+
+    _mrcal_parallel_for(Nblocks, Nthreads,
+                        [&](int iblock0, int iblock1, int)
+                        {
+                            for(int iblock=iblock0; iblock<iblock1; iblock++)
+                            {
+                                const int i0 = iblock*POSEUTILS_BATCH_BLOCK;
+                                transform_block(op, a, i0,
+                                                std::min(POSEUTILS_BATCH_BLOCK, N - i0));
+                            }
+                        });
+}
+
+// Fills in op->M from the given R. Transposes it if inverted
+static void
+set_M(batch_op_t* op,
+      const double* R, int R_stride0, int R_stride1)
+{
+    for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+            op->M[3*i + j] =
+                op->inverted ?
+                _P2(R, R_stride0, R_stride1, j, i) :
+                _P2(R, R_stride0, R_stride1, i, j);
+}
+
+// Fills in op->M and, if needed, op->dM_dr from the given r
+static void
+set_M_from_r(batch_op_t* op,
+             const double* r, int r_stride0,
+             bool need_dM_dr)
+{
+    double R[3*3];
+    double dR_dr[3*3*3];
+    mrcal_R_from_r_full(R,     0,0,
+                        need_dM_dr ? dR_dr : NULL, 0,0,0,
+                        r, r_stride0);
+    set_M(op, R, 3*sizeof(double), sizeof(double));
+
+    if(need_dM_dr)
+        for(int i=0; i<3; i++)
+            for(int j=0; j<3; j++)
+                memcpy(&op->dM_dr[9*i + 3*j],
+                       op->inverted ? &dR_dr[9*j + 3*i] : &dR_dr[9*i + 3*j],
+                       3*sizeof(double));
+}
+
+void mrcal_rotate_point_R_batch_full( // output
+                                     double* x_out,      // (N,3) array
+                                     int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                     int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                     double* J_R,        // (N,3,3,3) array. May be NULL
+                                     int J_R_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_R_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_R_stride2,    // in bytes. <= 0 means "contiguous"
+                                     int J_R_stride3,    // in bytes. <= 0 means "contiguous"
+                                     double* J_x,        // (N,3,3) array. May be NULL
+                                     int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                     // input
+                                     const double* R,    // (3,3) array
+                                     int R_stride0,      // in bytes. <= 0 means "contiguous"
+                                     int R_stride1,      // in bytes. <= 0 means "contiguous"
+                                     const double* x_in, // (N,3) array
+                                     int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                     int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                     int N,
+
+                                     bool inverted       // if true, I apply a
+                                                         // rotation in the opposite
+                                                         // direction. J_R corresponds
+                                                         // to the input R
+                                      )
+{
+    init_stride_2D(x_out, N,3);
+    init_stride_4D(J_R,   N,3,3,3);
+    init_stride_3D(J_x,   N,3,3);
+    init_stride_2D(R,     3,3);
+    init_stride_2D(x_in,  N,3);
+
+    batch_op_t op = {};
+    op.inverted = inverted;
+    set_M(&op, R, R_stride0, R_stride1);
+
+    const batch_arrays_t a =
+        { .x_out = x_out, .x_out_stride0 = x_out_stride0, .x_out_stride1 = x_out_stride1,
+          .J_R   = J_R,   .J_R_stride0   = J_R_stride0,   .J_R_stride1   = J_R_stride1,
+                          .J_R_stride2   = J_R_stride2,   .J_R_stride3   = J_R_stride3,
+          .J_x   = J_x,   .J_x_stride0   = J_x_stride0,   .J_x_stride1   = J_x_stride1,
+                          .J_x_stride2   = J_x_stride2,
+          .x_in  = x_in,  .x_in_stride0  = x_in_stride0,  .x_in_stride1  = x_in_stride1 };
+    transform_batch(&op, &a, N);
+}
+
+void mrcal_rotate_point_r_batch_full( // output
+                                     double* x_out,      // (N,3) array
+                                     int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                     int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                     double* J_r,        // (N,3,3) array. May be NULL
+                                     int J_r_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_r_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_r_stride2,    // in bytes. <= 0 means "contiguous"
+                                     double* J_x,        // (N,3,3) array. May be NULL
+                                     int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                     // input
+                                     const double* r,    // (3,) array
+                                     int r_stride0,      // in bytes. <= 0 means "contiguous"
+                                     const double* x_in, // (N,3) array
+                                     int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                     int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                     int N,
+
+                                     bool inverted       // if true, I apply a
+                                                         // rotation in the opposite
+                                                         // direction. J_r corresponds
+                                                         // to the input r
+                                      )
+{
+    init_stride_2D(x_out, N,3);
+    init_stride_3D(J_r,   N,3,3);
+    init_stride_3D(J_x,   N,3,3);
+    init_stride_1D(r,     3);
+    init_stride_2D(x_in,  N,3);
+
+    batch_op_t op = {};
+    op.inverted = inverted;
+    set_M_from_r(&op, r, r_stride0, J_r != NULL);
+
+    const batch_arrays_t a =
+        { .x_out = x_out, .x_out_stride0 = x_out_stride0, .x_out_stride1 = x_out_stride1,
+          .J_r   = J_r,   .J_r_stride0   = J_r_stride0,   .J_r_stride1   = J_r_stride1,
+                          .J_r_stride2   = J_r_stride2,
+          .J_x   = J_x,   .J_x_stride0   = J_x_stride0,   .J_x_stride1   = J_x_stride1,
+                          .J_x_stride2   = J_x_stride2,
+          .x_in  = x_in,  .x_in_stride0  = x_in_stride0,  .x_in_stride1  = x_in_stride1 };
+    transform_batch(&op, &a, N);
+}
+
+void mrcal_transform_point_Rt_batch_full( // output
+                                         double* x_out,      // (N,3) array
+                                         int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                         int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                         double* J_Rt,       // (N,3,4,3) array. May be NULL
+                                         int J_Rt_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int J_Rt_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int J_Rt_stride2,   // in bytes. <= 0 means "contiguous"
+                                         int J_Rt_stride3,   // in bytes. <= 0 means "contiguous"
+                                         double* J_x,        // (N,3,3) array. May be NULL
+                                         int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                         // input
+                                         const double* Rt,   // (4,3) array
+                                         int Rt_stride0,     // in bytes. <= 0 means "contiguous"
+                                         int Rt_stride1,     // in bytes. <= 0 means "contiguous"
+                                         const double* x_in, // (N,3) array
+                                         int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int N,
+
+                                         bool inverted       // if true, I apply a
+                                                             // transformation in the opposite
+                                                             // direction. J_Rt corresponds
+                                                             // to the input Rt
+                                          )
+{
+    init_stride_2D(x_out, N,3);
+    init_stride_4D(J_Rt,  N,3,4,3);
+    init_stride_3D(J_x,   N,3,3);
+    init_stride_2D(Rt,    4,3);
+    init_stride_2D(x_in,  N,3);
+
+    batch_op_t op = {};
+    op.inverted = inverted;
+    op.have_t   = true;
+    set_M(&op, Rt, Rt_stride0, Rt_stride1);
+    for(int i=0; i<3; i++)
+        op.t[i] = P2(Rt, 3,i);
+
+    // J_Rt is (N,3,4,3): the R gradient is J_Rt[:,:,:3,:], and the t
+    // gradient is J_Rt[:,:,3,:]
+    const batch_arrays_t a =
+        { .x_out = x_out, .x_out_stride0 = x_out_stride0, .x_out_stride1 = x_out_stride1,
+          .J_R   = J_Rt,  .J_R_stride0   = J_Rt_stride0,  .J_R_stride1   = J_Rt_stride1,
+                          .J_R_stride2   = J_Rt_stride2,  .J_R_stride3   = J_Rt_stride3,
+          .J_t   = J_Rt == NULL ? NULL : (double*)&((char*)J_Rt)[3*J_Rt_stride2],
+                          .J_t_stride0   = J_Rt_stride0,  .J_t_stride1   = J_Rt_stride1,
+                          .J_t_stride2   = J_Rt_stride3,
+          .J_x   = J_x,   .J_x_stride0   = J_x_stride0,   .J_x_stride1   = J_x_stride1,
+                          .J_x_stride2   = J_x_stride2,
+          .x_in  = x_in,  .x_in_stride0  = x_in_stride0,  .x_in_stride1  = x_in_stride1 };
+    transform_batch(&op, &a, N);
+}
+
+void mrcal_transform_point_rt_batch_full( // output
+                                         double* x_out,      // (N,3) array
+                                         int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                         int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                         double* J_rt,       // (N,3,6) array. May be NULL
+                                         int J_rt_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int J_rt_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int J_rt_stride2,   // in bytes. <= 0 means "contiguous"
+                                         double* J_x,        // (N,3,3) array. May be NULL
+                                         int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                         // input
+                                         const double* rt,   // (6,) array
+                                         int rt_stride0,     // in bytes. <= 0 means "contiguous"
+                                         const double* x_in, // (N,3) array
+                                         int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int N,
+
+                                         bool inverted       // if true, I apply the
+                                                             // transformation in the
+                                                             // opposite direction.
+                                                             // J_rt corresponds to
+                                                             // the input rt
+                                          )
+{
+    init_stride_2D(x_out, N,3);
+    init_stride_3D(J_rt,  N,3,6);
+    init_stride_3D(J_x,   N,3,3);
+    init_stride_1D(rt,    6);
+    init_stride_2D(x_in,  N,3);
+
+    batch_op_t op = {};
+    op.inverted = inverted;
+    op.have_t   = true;
+    set_M_from_r(&op, rt, rt_stride0, J_rt != NULL);
+    for(int i=0; i<3; i++)
+        op.t[i] = P1(rt, i+3);
+
+    // J_rt is (N,3,6): the r gradient is J_rt[:,:,:3], and the t gradient is
+    // J_rt[:,:,3:]
+    const batch_arrays_t a =
+        { .x_out = x_out, .x_out_stride0 = x_out_stride0, .x_out_stride1 = x_out_stride1,
+          .J_r   = J_rt,  .J_r_stride0   = J_rt_stride0,  .J_r_stride1   = J_rt_stride1,
+                          .J_r_stride2   = J_rt_stride2,
+          .J_t   = J_rt == NULL ? NULL : (double*)&((char*)J_rt)[3*J_rt_stride2],
+                          .J_t_stride0   = J_rt_stride0,  .J_t_stride1   = J_rt_stride1,
+                          .J_t_stride2   = J_rt_stride2,
+          .J_x   = J_x,   .J_x_stride0   = J_x_stride0,   .J_x_stride1   = J_x_stride1,
+                          .J_x_stride2   = J_x_stride2,
+          .x_in  = x_in,  .x_in_stride0  = x_in_stride0,  .x_in_stride1  = x_in_stride1 };
+    transform_batch(&op, &a, N);
+}
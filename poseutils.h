@@ -221,6 +221,142 @@ void mrcal_transform_point_rt_full( // output
                                                        // the input rt
                                    );
 
+// Batched versions of the 4 functions above: apply the same rotation or
+// transformation to N points. The rotation matrix (and its gradient, if
+// needed) is computed once, and the points are then processed in blocks, in
+// simple loops that the compiler vectorizes. Large batches are split across
+// threads
+//
+// x_in and x_out are (N,3) arrays. The gradients have the same meaning as in
+// the single-point functions, with a leading N dimension: J_R is a (N,3,3,3)
+// array, J_r is (N,3,3), J_Rt is (N,3,4,3), J_rt is (N,3,6) and J_x is
+// (N,3,3). Each may be NULL if it is not wanted
+//
+// The results match the single-point functions to within floating-point
+// roundoff. The R and Rt forms produce identical results
+//
+// In-place operation is supported; x_out may be the same as x_in
+#define mrcal_rotate_point_R_batch(         x_out,J_R,J_x,R,x_in,N) mrcal_rotate_point_R_batch_full(x_out,0,0,J_R,0,0,0,0,J_x,0,0,0,R,0,0,x_in,0,0,N, false)
+#define mrcal_rotate_point_R_batch_inverted(x_out,J_R,J_x,R,x_in,N) mrcal_rotate_point_R_batch_full(x_out,0,0,J_R,0,0,0,0,J_x,0,0,0,R,0,0,x_in,0,0,N, true)
+void mrcal_rotate_point_R_batch_full( // output
+                                     double* x_out,      // (N,3) array
+                                     int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                     int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                     double* J_R,        // (N,3,3,3) array. May be NULL
+                                     int J_R_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_R_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_R_stride2,    // in bytes. <= 0 means "contiguous"
+                                     int J_R_stride3,    // in bytes. <= 0 means "contiguous"
+                                     double* J_x,        // (N,3,3) array. May be NULL
+                                     int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                     // input
+                                     const double* R,    // (3,3) array
+                                     int R_stride0,      // in bytes. <= 0 means "contiguous"
+                                     int R_stride1,      // in bytes. <= 0 means "contiguous"
+                                     const double* x_in, // (N,3) array
+                                     int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                     int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                     int N,
+
+                                     bool inverted       // if true, I apply a
+                                                         // rotation in the opposite
+                                                         // direction. J_R corresponds
+                                                         // to the input R
+                                     );
+
+#define mrcal_rotate_point_r_batch(         x_out,J_r,J_x,r,x_in,N) mrcal_rotate_point_r_batch_full(x_out,0,0,J_r,0,0,0,J_x,0,0,0,r,0,x_in,0,0,N, false)
+#define mrcal_rotate_point_r_batch_inverted(x_out,J_r,J_x,r,x_in,N) mrcal_rotate_point_r_batch_full(x_out,0,0,J_r,0,0,0,J_x,0,0,0,r,0,x_in,0,0,N, true)
+void mrcal_rotate_point_r_batch_full( // output
+                                     double* x_out,      // (N,3) array
+                                     int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                     int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                     double* J_r,        // (N,3,3) array. May be NULL
+                                     int J_r_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_r_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_r_stride2,    // in bytes. <= 0 means "contiguous"
+                                     double* J_x,        // (N,3,3) array. May be NULL
+                                     int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                     int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                     // input
+                                     const double* r,    // (3,) array
+                                     int r_stride0,      // in bytes. <= 0 means "contiguous"
+                                     const double* x_in, // (N,3) array
+                                     int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                     int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                     int N,
+
+                                     bool inverted       // if true, I apply a
+                                                         // rotation in the opposite
+                                                         // direction. J_r corresponds
+                                                         // to the input r
+                                     );
+
+#define mrcal_transform_point_Rt_batch(         x_out,J_Rt,J_x,Rt,x_in,N) mrcal_transform_point_Rt_batch_full(x_out,0,0,J_Rt,0,0,0,0,J_x,0,0,0,Rt,0,0,x_in,0,0,N, false)
+#define mrcal_transform_point_Rt_batch_inverted(x_out,J_Rt,J_x,Rt,x_in,N) mrcal_transform_point_Rt_batch_full(x_out,0,0,J_Rt,0,0,0,0,J_x,0,0,0,Rt,0,0,x_in,0,0,N, true)
+void mrcal_transform_point_Rt_batch_full( // output
+                                         double* x_out,      // (N,3) array
+                                         int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                         int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                         double* J_Rt,       // (N,3,4,3) array. May be NULL
+                                         int J_Rt_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int J_Rt_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int J_Rt_stride2,   // in bytes. <= 0 means "contiguous"
+                                         int J_Rt_stride3,   // in bytes. <= 0 means "contiguous"
+                                         double* J_x,        // (N,3,3) array. May be NULL
+                                         int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                         // input
+                                         const double* Rt,   // (4,3) array
+                                         int Rt_stride0,     // in bytes. <= 0 means "contiguous"
+                                         int Rt_stride1,     // in bytes. <= 0 means "contiguous"
+                                         const double* x_in, // (N,3) array
+                                         int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int N,
+
+                                         bool inverted       // if true, I apply a
+                                                             // transformation in the opposite
+                                                             // direction. J_Rt corresponds
+                                                             // to the input Rt
+                                         );
+
+#define mrcal_transform_point_rt_batch(         x_out,J_rt,J_x,rt,x_in,N) mrcal_transform_point_rt_batch_full(x_out,0,0,J_rt,0,0,0,J_x,0,0,0,rt,0,x_in,0,0,N, false)
+#define mrcal_transform_point_rt_batch_inverted(x_out,J_rt,J_x,rt,x_in,N) mrcal_transform_point_rt_batch_full(x_out,0,0,J_rt,0,0,0,J_x,0,0,0,rt,0,x_in,0,0,N, true)
+void mrcal_transform_point_rt_batch_full( // output
+                                         double* x_out,      // (N,3) array
+                                         int x_out_stride0,  // in bytes. <= 0 means "contiguous"
+                                         int x_out_stride1,  // in bytes. <= 0 means "contiguous"
+                                         double* J_rt,       // (N,3,6) array. May be NULL
+                                         int J_rt_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int J_rt_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int J_rt_stride2,   // in bytes. <= 0 means "contiguous"
+                                         double* J_x,        // (N,3,3) array. May be NULL
+                                         int J_x_stride0,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride1,    // in bytes. <= 0 means "contiguous"
+                                         int J_x_stride2,    // in bytes. <= 0 means "contiguous"
+
+                                         // input
+                                         const double* rt,   // (6,) array
+                                         int rt_stride0,     // in bytes. <= 0 means "contiguous"
+                                         const double* x_in, // (N,3) array
+                                         int x_in_stride0,   // in bytes. <= 0 means "contiguous"
+                                         int x_in_stride1,   // in bytes. <= 0 means "contiguous"
+                                         int N,
+
+                                         bool inverted       // if true, I apply the
+                                                             // transformation in the
+                                                             // opposite direction.
+                                                             // J_rt corresponds to
+                                                             // the input rt
+                                         );
+
 // Convert a rotation matrix in a (3,3) array to a rodrigues vector in a (3,)
 // array
 //
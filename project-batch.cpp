@@ -0,0 +1,234 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "project-batch.h"
+#include "parallel.h"
+#include "util.h"
+
+// Don't bother with threads unless each one gets at least this many points.
+// Starting a thread costs about as much as projecting this many points with a
+// simple model
+#define NPOINTS_PER_THREAD_MIN 16384
+
+// The kernels below work on blocks of this many points at a time. Small enough
+// for the structure-of-arrays scratch to live on the stack, in L1
+#define NPOINTS_PER_BLOCK      64
+
+typedef void (project_kernel_t)(mrcal_point2_t*       q,
+                                const mrcal_point3_t* p,
+                                int N,
+                                const double* intrinsics);
+
+// PINHOLE and OPENCV*. Ndistortions is 0 for PINHOLE. This is the same math as
+// _mrcal_project_internal_opencv(), with the same operation order, so the
+// results are identical. The terms that don't exist in the smaller models are
+// compiled out
+template<int Ndistortions>
+static void project_opencv_soa(mrcal_point2_t*       q,
+                               const mrcal_point3_t* p,
+                               int N,
+                               const double* intrinsics)
+{
+    const double fx = intrinsics[0];
+    const double fy = intrinsics[1];
+    const double cx = intrinsics[2];
+    const double cy = intrinsics[3];
+
+    double k[12] = {};
+    for(int i=0; i<Ndistortions; i++)
+        k[i] = intrinsics[i+4];
+
+    double x[NPOINTS_PER_BLOCK];
+    double y[NPOINTS_PER_BLOCK];
+
+    for(int i0=0; i0<N; i0 += NPOINTS_PER_BLOCK)
+    {
+        const int n = std::min(NPOINTS_PER_BLOCK, N-i0);
+
+        for(int i=0; i<n; i++)
+        {
+            const double z_recip = 1./p[i0+i].z;
+            x[i] = p[i0+i].x * z_recip;
+            y[i] = p[i0+i].y * z_recip;
+        }
+
+        if constexpr(Ndistortions > 0)
+            for(int i=0; i<n; i++)
+            {
+                const double r2 = x[i]*x[i] + y[i]*y[i];
+                const double r4 = r2*r2;
+                const double r6 = r4*r2;
+                const double a1 = 2*x[i]*y[i];
+                const double a2 = r2 + 2*x[i]*x[i];
+                const double a3 = r2 + 2*y[i]*y[i];
+
+                double cdist = 1 + k[0]*r2 + k[1]*r4;
+                if constexpr(Ndistortions >= 5)
+                    cdist += k[4]*r6;
+
+                double xd, yd;
+                if constexpr(Ndistortions >= 8)
+                {
+                    const double icdist2 = 1./(1 + k[5]*r2 + k[6]*r4 + k[7]*r6);
+                    xd = x[i]*cdist*icdist2 + k[2]*a1 + k[3]*a2;
+                    yd = y[i]*cdist*icdist2 + k[2]*a3 + k[3]*a1;
+                }
+                else
+                {
+                    xd = x[i]*cdist + k[2]*a1 + k[3]*a2;
+                    yd = y[i]*cdist + k[2]*a3 + k[3]*a1;
+                }
+                if constexpr(Ndistortions >= 12)
+                {
+                    xd = xd + k[8] *r2 + k[9] *r4;
+                    yd = yd + k[10]*r2 + k[11]*r4;
+                }
+                x[i] = xd;
+                y[i] = yd;
+            }
+
+        for(int i=0; i<n; i++)
+        {
+            q[i0+i].x = x[i]*fx + cx;
+            q[i0+i].y = y[i]*fy + cy;
+        }
+    }
+}
+
+// STEREOGRAPHIC. The same math as mrcal_project_stereographic()
+static void project_stereographic_soa(mrcal_point2_t*       q,
+                                      const mrcal_point3_t* p,
+                                      int N,
+                                      const double* intrinsics)
+{
+    const double fx = intrinsics[0];
+    const double fy = intrinsics[1];
+    const double cx = intrinsics[2];
+    const double cy = intrinsics[3];
+
+    double x    [NPOINTS_PER_BLOCK];
+    double y    [NPOINTS_PER_BLOCK];
+    double z    [NPOINTS_PER_BLOCK];
+    double scale[NPOINTS_PER_BLOCK];
+
+    for(int i0=0; i0<N; i0 += NPOINTS_PER_BLOCK)
+    {
+        const int n = std::min(NPOINTS_PER_BLOCK, N-i0);
+
+        for(int i=0; i<n; i++)
+        {
+            x[i] = p[i0+i].x;
+            y[i] = p[i0+i].y;
+            z[i] = p[i0+i].z;
+        }
+
+        // u = xy / (mag_xyz + z) * 2
+        for(int i=0; i<n; i++)
+        {
+            const double mag_xyz = sqrt( x[i]*x[i] +
+                                         y[i]*y[i] +
+                                         z[i]*z[i] );
+            scale[i] = 2.0 / (mag_xyz + z[i]);
+        }
+
+        for(int i=0; i<n; i++)
+        {
+            q[i0+i].x = x[i] * scale[i] * fx + cx;
+            q[i0+i].y = y[i] * scale[i] * fy + cy;
+        }
+    }
+}
+
+static project_kernel_t* get_kernel(const mrcal_lensmodel_t* lensmodel)
+{
+    switch(lensmodel->type)
+    {
+    case MRCAL_LENSMODEL_PINHOLE:       return project_opencv_soa<0>;
+    case MRCAL_LENSMODEL_OPENCV4:       return project_opencv_soa<4>;
+    case MRCAL_LENSMODEL_OPENCV5:       return project_opencv_soa<5>;
+    case MRCAL_LENSMODEL_OPENCV8:       return project_opencv_soa<8>;
+    case MRCAL_LENSMODEL_OPENCV12:      return project_opencv_soa<12>;
+    case MRCAL_LENSMODEL_STEREOGRAPHIC: return project_stereographic_soa;
+    default:                            return NULL;
+    }
+}
+
+bool _mrcal_project_batch( // out
+                          mrcal_point2_t* q,
+                          mrcal_point3_t* dq_dp,
+                          double*         dq_dintrinsics,
+
+                          // in
+                          const mrcal_point3_t* p,
+                          int N,
+                          const mrcal_lensmodel_t* lensmodel,
+                          const double* intrinsics,
+                          const mrcal_projection_precomputed_t* precomputed,
+                          int Nthreads)
+{
+    if(N <= 0)
+        return true;
+
+    Nthreads = std::min(_mrcal_num_threads(Nthreads),
+                        std::max(1, N / NPOINTS_PER_THREAD_MIN));
+
+    if(dq_dp == NULL && dq_dintrinsics == NULL)
+    {
+        project_kernel_t* kernel = get_kernel(lensmodel);
+        if(kernel != NULL)
+        {
+            _mrcal_parallel_for(N, Nthreads,
+                                [&](int i0, int i1, int)
+                                {
+                                    kernel(&q[i0], &p[i0], i1-i0, intrinsics);
+                                });
+            return true;
+        }
+    }
+
+    const int Nintrinsics = mrcal_lensmodel_num_params(lensmodel);
+
+    mrcal_projection_precomputed_t precomputed_here;
+    if(precomputed == NULL)
+    {
+        _mrcal_precompute_lensmodel_data(&precomputed_here, lensmodel);
+        precomputed = &precomputed_here;
+    }
+
+    std::vector<char> result_chunk;
+    try
+    {
+        result_chunk.resize(Nthreads, 1);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the per-thread results");
+        return false;
+    }
+
+    _mrcal_parallel_for(N, Nthreads,
+                        [&](int i0, int i1, int ichunk)
+                        {
+                            result_chunk[ichunk] =
+                                _mrcal_project_internal(&q[i0],
+                                                        dq_dp          == NULL ? NULL : &dq_dp[2*i0],
+                                                        dq_dintrinsics == NULL ? NULL : &dq_dintrinsics[(size_t)2*Nintrinsics*i0],
+                                                        &p[i0], i1-i0,
+                                                        lensmodel, intrinsics,
+                                                        Nintrinsics, precomputed);
+                        });
+
+    for(char r : result_chunk)
+        if(!r)
+            return false;
+    return true;
+}
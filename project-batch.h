@@ -0,0 +1,55 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#pragma once
+
+// This is an internal header for the batch projection engine. Not to be seen by
+// the end-users or installed
+//
+// This is the implementation of mrcal_project(). Large batches are split across
+// threads. The most common case (no gradients; a PINHOLE, OPENCV* or
+// STEREOGRAPHIC model) uses dedicated kernels: the points are processed in
+// small blocks, transposed into a structure-of-arrays layout, and evaluated in
+// branch-free loops that the compiler can vectorize. Everything else is
+// evaluated by _mrcal_project_internal(), one chunk per thread. That function
+// uses a similar block-based kernel for SPLINED_STEREOGRAPHIC models, if no
+// gradients are requested
+//
+// This is implemented in C++, and called from both C (stereo.c) and C++, so it
+// has C linkage
+
+#include "mrcal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same arguments and semantics as mrcal_project(), except the gradient support
+// isn't checked here. Nthreads <= 0 means "use all the available cores". Small
+// batches are evaluated serially regardless, since they wouldn't benefit from
+// more threads
+//
+// precomputed is the output of _mrcal_precompute_lensmodel_data() for this
+// lensmodel. Callers that project many batches with the same model should pass
+// it in. If NULL, we compute it here if we need it
+bool _mrcal_project_batch( // out
+                          mrcal_point2_t* q,
+                          mrcal_point3_t* dq_dp,
+                          double*         dq_dintrinsics,
+
+                          // in
+                          const mrcal_point3_t* p,
+                          int N,
+                          const mrcal_lensmodel_t* lensmodel,
+                          const double* intrinsics,
+                          const mrcal_projection_precomputed_t* precomputed,
+                          int Nthreads);
+
+#ifdef __cplusplus
+}
+#endif
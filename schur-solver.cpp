@@ -0,0 +1,686 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <math.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include "schur-solver.h"
+#include "util.h"
+
+typedef struct
+{
+    std::vector<double> p, x;
+    std::vector<int>    Jt_p, Jt_i;
+    std::vector<double> Jt_values;
+    cholmod_sparse      Jt;
+    double              norm2_x;
+} operating_point_t;
+
+struct _mrcal_schur_solver_t
+{
+    // The current operating point, and the one we're trying. Swapped when a
+    // step is accepted
+    operating_point_t  points[2];
+    operating_point_t* current;
+    operating_point_t* trial;
+
+    // The layout. This is computed from the sparsity pattern of the Jacobian
+    // at the start of each solve
+    int Nstate, Nmeasurements;
+    int istate_eliminated0, Nstate_eliminated;
+    int Nblocks6, Nblocks3;
+    int Nreduced;
+    // For each state variable: its index in the reduced system, or -1 if it is
+    // eliminated
+    std::vector<int> ireduced;
+    // For each measurement: the eliminated block it touches, or -1 if none
+    std::vector<int> row_block;
+    // The reduced variables coupled to each block, sorted. Block b couples to
+    // block_cols[block_cols0[b] ... block_cols0[b+1]-1]
+    std::vector<int> block_cols0, block_cols;
+    // For each jacobian non-zero: if it's a reduced variable in a row that
+    // touches a block, its index in that block's block_cols list. If it's an
+    // eliminated variable, its index inside its block. -1 otherwise
+    std::vector<int> nz_slot;
+
+    // The normal equations at the current operating point. A is the dense
+    // reduced-reduced part (lower triangle only), B the diagonal
+    // eliminated-eliminated blocks, W the reduced-eliminated coupling: for
+    // block b a dense (Ncols_b, blocksize_b) matrix
+    std::vector<double> A, g_reduced;
+    std::vector<double> B, g_eliminated;
+    std::vector<double> W;
+    std::vector<int>    W0;
+
+    // Scratch for computing a step
+    std::vector<double> S, Binv, T, step;
+};
+
+static int block_size(const _mrcal_schur_solver_t* s, int b)
+{
+    return b < s->Nblocks6 ? 6 : 3;
+}
+// Index of the first variable of block b, relative to istate_eliminated0
+static int block_state0(const _mrcal_schur_solver_t* s, int b)
+{
+    return b < s->Nblocks6 ? 6*b : 6*s->Nblocks6 + 3*(b-s->Nblocks6);
+}
+// Where block b lives in B and Binv
+static int block_B0(const _mrcal_schur_solver_t* s, int b)
+{
+    return b < s->Nblocks6 ? 36*b : 36*s->Nblocks6 + 9*(b-s->Nblocks6);
+}
+// Which block eliminated variable e (relative to istate_eliminated0) lives in
+static int block_of(const _mrcal_schur_solver_t* s, int e)
+{
+    return e < 6*s->Nblocks6 ? e/6 : s->Nblocks6 + (e - 6*s->Nblocks6)/3;
+}
+
+// In-place Cholesky factorization of the symmetric NxN matrix A. Only the lower
+// triangle is used. On output the lower triangle holds L, with A = L L^T.
+// Returns false if A isn't positive-definite
+static bool cholesky(double* A, int N)
+{
+    for(int j=0; j<N; j++)
+    {
+        double d = A[j*N+j];
+        for(int k=0; k<j; k++)
+            d -= A[j*N+k]*A[j*N+k];
+        if(!(d > 0.0))
+            return false;
+        d = sqrt(d);
+        A[j*N+j] = d;
+        for(int i=j+1; i<N; i++)
+        {
+            double v = A[i*N+j];
+            for(int k=0; k<j; k++)
+                v -= A[i*N+k]*A[j*N+k];
+            A[i*N+j] = v / d;
+        }
+    }
+    return true;
+}
+
+// Solves L L^T x = b in-place, with L from cholesky()
+static void cholesky_solve(const double* L, int N, double* b)
+{
+    for(int i=0; i<N; i++)
+    {
+        double v = b[i];
+        for(int k=0; k<i; k++)
+            v -= L[i*N+k]*b[k];
+        b[i] = v / L[i*N+i];
+    }
+    for(int i=N-1; i>=0; i--)
+    {
+        double v = b[i];
+        for(int k=i+1; k<N; k++)
+            v -= L[k*N+i]*b[k];
+        b[i] = v / L[i*N+i];
+    }
+}
+
+static bool operating_point_init(operating_point_t* pt,
+                                 int Nstate, int Nmeasurements, int N_j_nonzero)
+{
+    try
+    {
+        pt->p        .resize(Nstate);
+        pt->x        .resize(Nmeasurements);
+        pt->Jt_p     .resize(Nmeasurements+1);
+        pt->Jt_i     .resize(N_j_nonzero);
+        pt->Jt_values.resize(N_j_nonzero);
+    }
+    catch(...)
+    {
+        return false;
+    }
+
+    pt->Jt = cholmod_sparse{};
+    pt->Jt.nrow   = Nstate;
+    pt->Jt.ncol   = Nmeasurements;
+    pt->Jt.nzmax  = N_j_nonzero;
+    pt->Jt.p      = pt->Jt_p.data();
+    pt->Jt.i      = pt->Jt_i.data();
+    pt->Jt.x      = pt->Jt_values.data();
+    pt->Jt.stype  = 0;
+    pt->Jt.itype  = CHOLMOD_INT;
+    pt->Jt.xtype  = CHOLMOD_REAL;
+    pt->Jt.dtype  = CHOLMOD_DOUBLE;
+    pt->Jt.sorted = 0;
+    pt->Jt.packed = 1;
+    return true;
+}
+
+static void evaluate(operating_point_t* pt, int Nmeasurements,
+                     void (*f)(const double*, double*, cholmod_sparse*, void*),
+                     void* cookie)
+{
+    f(pt->p.data(), pt->x.data(), &pt->Jt, cookie);
+    double norm2 = 0.0;
+    for(int i=0; i<Nmeasurements; i++)
+        norm2 += pt->x[i]*pt->x[i];
+    pt->norm2_x = norm2;
+}
+
+// Computes the layout from the sparsity pattern of the Jacobian in pt. The
+// pattern is fixed for the duration of a solve
+static bool compute_layout(_mrcal_schur_solver_t* s, const operating_point_t* pt)
+{
+    const int* Jt_p = pt->Jt_p.data();
+    const int* Jt_i = pt->Jt_i.data();
+    const int  Nblocks = s->Nblocks6 + s->Nblocks3;
+    const int  N_j_nonzero = Jt_p[s->Nmeasurements];
+
+    try
+    {
+        s->ireduced.resize(s->Nstate);
+        s->row_block.resize(s->Nmeasurements);
+        s->nz_slot.resize(N_j_nonzero);
+        s->block_cols0.assign(Nblocks+1, 0);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the Schur-complement layout");
+        return false;
+    }
+
+    s->Nreduced = 0;
+    for(int i=0; i<s->Nstate; i++)
+        if(i >= s->istate_eliminated0 &&
+           i <  s->istate_eliminated0 + s->Nstate_eliminated)
+            s->ireduced[i] = -1;
+        else
+            s->ireduced[i] = s->Nreduced++;
+
+    // Each row may touch at most one eliminated block. I find it, and I collect
+    // the (block, reduced variable) couplings
+    std::vector<std::pair<int,int>> couplings;
+    try
+    {
+        for(int irow=0; irow<s->Nmeasurements; irow++)
+        {
+            int b = -1;
+            for(int k=Jt_p[irow]; k<Jt_p[irow+1]; k++)
+            {
+                if(s->ireduced[Jt_i[k]] >= 0)
+                    continue;
+                const int bthis = block_of(s, Jt_i[k] - s->istate_eliminated0);
+                if(b >= 0 && b != bthis)
+                {
+                    MSG("Measurement %d touches more than one eliminated block (%d and %d). The Schur-complement solver can't handle this problem",
+                        irow, b, bthis);
+                    return false;
+                }
+                b = bthis;
+            }
+            s->row_block[irow] = b;
+            if(b < 0)
+                continue;
+            for(int k=Jt_p[irow]; k<Jt_p[irow+1]; k++)
+                if(s->ireduced[Jt_i[k]] >= 0)
+                    couplings.push_back(std::make_pair(b, s->ireduced[Jt_i[k]]));
+        }
+        std::sort(couplings.begin(), couplings.end());
+        couplings.erase(std::unique(couplings.begin(), couplings.end()),
+                        couplings.end());
+
+        s->block_cols.resize(couplings.size());
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the Schur-complement layout");
+        return false;
+    }
+
+    for(size_t k=0; k<couplings.size(); k++)
+    {
+        s->block_cols0[couplings[k].first+1]++;
+        s->block_cols[k] = couplings[k].second;
+    }
+    for(int b=0; b<Nblocks; b++)
+        s->block_cols0[b+1] += s->block_cols0[b];
+
+    for(int irow=0; irow<s->Nmeasurements; irow++)
+    {
+        const int b = s->row_block[irow];
+        for(int k=Jt_p[irow]; k<Jt_p[irow+1]; k++)
+        {
+            const int ir = s->ireduced[Jt_i[k]];
+            if(b < 0)
+                s->nz_slot[k] = -1;
+            else if(ir < 0)
+                s->nz_slot[k] =
+                    Jt_i[k] - s->istate_eliminated0 - block_state0(s, b);
+            else
+            {
+                const int* c0 = &s->block_cols[s->block_cols0[b  ]];
+                const int* c1 = &s->block_cols[s->block_cols0[b+1]];
+                s->nz_slot[k] = (int)(std::lower_bound(c0, c1, ir) - c0);
+            }
+        }
+    }
+
+    // Everything else is sized by the layout
+    try
+    {
+        s->W0.resize(Nblocks+1);
+        s->W0[0] = 0;
+        for(int b=0; b<Nblocks; b++)
+            s->W0[b+1] = s->W0[b] +
+                (s->block_cols0[b+1]-s->block_cols0[b]) * block_size(s,b);
+
+        const int NB = 36*s->Nblocks6 + 9*s->Nblocks3;
+        s->A           .resize((size_t)s->Nreduced*s->Nreduced);
+        s->S           .resize((size_t)s->Nreduced*s->Nreduced);
+        s->g_reduced   .resize(s->Nreduced);
+        s->B           .resize(NB);
+        s->Binv        .resize(NB);
+        s->g_eliminated.resize(s->Nstate_eliminated);
+        s->W           .resize(s->W0[Nblocks]);
+        s->step        .resize(s->Nstate);
+        int Ncols_max = 0;
+        for(int b=0; b<Nblocks; b++)
+            Ncols_max = std::max(Ncols_max, s->block_cols0[b+1]-s->block_cols0[b]);
+        s->T           .resize(Ncols_max*6);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the Schur-complement normal equations");
+        return false;
+    }
+    return true;
+}
+
+// Accumulates the normal equations JtJ, Jt x at the current operating point
+static void accumulate_normal_equations(_mrcal_schur_solver_t* s)
+{
+    const operating_point_t* pt = s->current;
+    const int*    Jt_p      = pt->Jt_p.data();
+    const int*    Jt_i      = pt->Jt_i.data();
+    const double* Jt_values = pt->Jt_values.data();
+    const int     Nr        = s->Nreduced;
+
+    std::fill(s->A.begin(),            s->A.end(),            0.0);
+    std::fill(s->g_reduced.begin(),    s->g_reduced.end(),    0.0);
+    std::fill(s->B.begin(),            s->B.end(),            0.0);
+    std::fill(s->g_eliminated.begin(), s->g_eliminated.end(), 0.0);
+    std::fill(s->W.begin(),            s->W.end(),            0.0);
+
+    for(int irow=0; irow<s->Nmeasurements; irow++)
+    {
+        const int    k0 = Jt_p[irow];
+        const int    k1 = Jt_p[irow+1];
+        const double x  = pt->x[irow];
+        const int    b  = s->row_block[irow];
+
+        for(int k=k0; k<k1; k++)
+        {
+            const double v  = Jt_values[k];
+            const int    ir = s->ireduced[Jt_i[k]];
+            if(ir >= 0)
+            {
+                s->g_reduced[ir] += v*x;
+                for(int k2=k0; k2<k1; k2++)
+                {
+                    const int ir2 = s->ireduced[Jt_i[k2]];
+                    if(ir2 >= 0 && ir2 <= ir)
+                        s->A[ir*Nr + ir2] += v*Jt_values[k2];
+                }
+            }
+            else
+                s->g_eliminated[Jt_i[k] - s->istate_eliminated0] += v*x;
+        }
+
+        if(b < 0)
+            continue;
+
+        const int m  = block_size(s,b);
+        double*   Bb = &s->B[block_B0(s,b)];
+        double*   Wb = &s->W[s->W0[b]];
+        for(int k=k0; k<k1; k++)
+        {
+            if(s->ireduced[Jt_i[k]] >= 0)
+                continue;
+            const int    j = s->nz_slot[k];
+            const double v = Jt_values[k];
+            for(int k2=k0; k2<k1; k2++)
+            {
+                const int slot2 = s->nz_slot[k2];
+                if(s->ireduced[Jt_i[k2]] < 0)
+                    Bb[j*m + slot2] += v*Jt_values[k2];
+                else
+                    Wb[slot2*m + j] += v*Jt_values[k2];
+            }
+        }
+    }
+}
+
+// Computes the Levenberg-Marquardt step (JtJ + lambda I) step = -Jt x into
+// s->step, using the Schur complement. Returns false if the damped system
+// isn't positive-definite
+static bool compute_step(_mrcal_schur_solver_t* s, double lambda)
+{
+    const int Nr      = s->Nreduced;
+    const int Nblocks = s->Nblocks6 + s->Nblocks3;
+    double*   S       = s->S.data();
+
+    // The reduced system: S = A - sum(W Binv Wt), rhs = -g + sum(W Binv g)
+    memcpy(S, s->A.data(), (size_t)Nr*Nr*sizeof(double));
+    for(int i=0; i<Nr; i++)
+        S[i*Nr+i] += lambda;
+
+    std::vector<double>& step = s->step;
+    double* dr = &step[0]; // I use the start of step[] for the reduced rhs
+    for(int i=0; i<Nr; i++)
+        dr[i] = -s->g_reduced[i];
+
+    for(int b=0; b<Nblocks; b++)
+    {
+        const int     m    = block_size(s,b);
+        const int     Nc   = s->block_cols0[b+1] - s->block_cols0[b];
+        const int*    cols = &s->block_cols[s->block_cols0[b]];
+        const double* Wb   = &s->W[s->W0[b]];
+        const double* ge   = &s->g_eliminated[block_state0(s,b)];
+        double*       Binv = &s->Binv[block_B0(s,b)];
+
+        double L[36];
+        memcpy(L, &s->B[block_B0(s,b)], m*m*sizeof(double));
+        for(int j=0; j<m; j++)
+            L[j*m+j] += lambda;
+        if(!cholesky(L, m))
+            return false;
+        for(int j=0; j<m; j++)
+        {
+            double* col = &Binv[j*m];
+            for(int i=0; i<m; i++) col[i] = (i==j) ? 1.0 : 0.0;
+            cholesky_solve(L, m, col);
+        }
+
+        // T = W Binv
+        double* T = s->T.data();
+        for(int i=0; i<Nc; i++)
+            for(int j=0; j<m; j++)
+            {
+                double v = 0.0;
+                for(int k=0; k<m; k++)
+                    v += Wb[i*m+k]*Binv[k*m+j];
+                T[i*m+j] = v;
+            }
+
+        for(int i=0; i<Nc; i++)
+        {
+            double v = 0.0;
+            for(int j=0; j<m; j++)
+                v += T[i*m+j]*ge[j];
+            dr[cols[i]] += v;
+
+            // cols is sorted, so cols[i2] <= cols[i] for i2 <= i: this is the
+            // lower triangle
+            for(int i2=0; i2<=i; i2++)
+            {
+                double u = 0.0;
+                for(int j=0; j<m; j++)
+                    u += T[i*m+j]*Wb[i2*m+j];
+                S[cols[i]*Nr + cols[i2]] -= u;
+            }
+        }
+    }
+
+    if(!cholesky(S, Nr))
+        return false;
+    cholesky_solve(S, Nr, dr);
+
+    // Back-substitution: de = Binv (-ge - Wt dr). These go at the end of
+    // step[], which has room for them: Nr + Nstate_eliminated = Nstate. I
+    // rearrange into the state order at the end
+    double* de = &step[Nr];
+    for(int b=0; b<Nblocks; b++)
+    {
+        const int     m    = block_size(s,b);
+        const int     Nc   = s->block_cols0[b+1] - s->block_cols0[b];
+        const int*    cols = &s->block_cols[s->block_cols0[b]];
+        const double* Wb   = &s->W[s->W0[b]];
+        const double* ge   = &s->g_eliminated[block_state0(s,b)];
+        const double* Binv = &s->Binv[block_B0(s,b)];
+
+        double r[6];
+        for(int j=0; j<m; j++)
+        {
+            r[j] = -ge[j];
+            for(int i=0; i<Nc; i++)
+                r[j] -= Wb[i*m+j]*dr[cols[i]];
+        }
+        for(int j=0; j<m; j++)
+        {
+            double v = 0.0;
+            for(int k=0; k<m; k++)
+                v += Binv[j*m+k]*r[k];
+            de[block_state0(s,b) + j] = v;
+        }
+    }
+
+    // step[] is now [dr, de]. The state order is [reduced0, eliminated,
+    // reduced1], with dr covering reduced0 and reduced1 concatenated. So I
+    // rotate the de chunk into place
+    const int Nreduced0 = s->istate_eliminated0;
+    std::rotate(step.begin() + Nreduced0,
+                step.begin() + Nr,
+                step.begin() + s->Nstate);
+    return true;
+}
+
+_mrcal_schur_solver_t* _mrcal_schur_solver_create(void)
+{
+    return new(std::nothrow) _mrcal_schur_solver_t{};
+}
+
+void _mrcal_schur_solver_free(_mrcal_schur_solver_t* solver)
+{
+    delete solver;
+}
+
+const double* _mrcal_schur_solver_x(const _mrcal_schur_solver_t* solver)
+{
+    return solver->current->x.data();
+}
+
+double _mrcal_schur_optimize(// out, in
+                             double* p,
+                             _mrcal_schur_solver_t* s,
+
+                             // in
+                             int Nstate, int Nmeasurements, int N_j_nonzero,
+                             int istate_eliminated0, int Nblocks6, int Nblocks3,
+                             void (*f)(const double*   p,
+                                       double*         x,
+                                       cholmod_sparse* Jt,
+                                       void*           cookie),
+                             void* cookie,
+                             const dogleg_parameters2_t* parameters,
+                             _mrcal_solver_iteration_callback_t* iteration_callback,
+                             void* iteration_cookie)
+{
+    const bool verbose = parameters->dogleg_debug != 0;
+
+    if(Nblocks6 == 0 && Nblocks3 == 0)
+        istate_eliminated0 = 0;
+    if(istate_eliminated0 < 0 ||
+       istate_eliminated0 + 6*Nblocks6 + 3*Nblocks3 > Nstate)
+    {
+        MSG("The eliminated blocks don't fit in the state vector");
+        return -1.0;
+    }
+
+    s->Nstate             = Nstate;
+    s->Nmeasurements      = Nmeasurements;
+    s->istate_eliminated0 = istate_eliminated0;
+    s->Nstate_eliminated  = 6*Nblocks6 + 3*Nblocks3;
+    s->Nblocks6           = Nblocks6;
+    s->Nblocks3           = Nblocks3;
+    s->current            = &s->points[0];
+    s->trial              = &s->points[1];
+
+    if(!operating_point_init(s->current, Nstate, Nmeasurements, N_j_nonzero) ||
+       !operating_point_init(s->trial,   Nstate, Nmeasurements, N_j_nonzero))
+    {
+        MSG("Couldn't allocate the operating points");
+        return -1.0;
+    }
+
+    memcpy(s->current->p.data(), p, Nstate*sizeof(double));
+    evaluate(s->current, Nmeasurements, f, cookie);
+    int Nevaluations = 1;
+    if(!compute_layout(s, s->current))
+        return -1.0;
+    accumulate_normal_equations(s);
+
+    // The initial damping is scaled to the problem, as suggested by Madsen,
+    // Nielsen, Tingleff: "Methods for non-linear least squares problems"
+    double diag_max = 0.0;
+    for(int i=0; i<s->Nreduced; i++)
+        diag_max = std::max(diag_max, s->A[i*s->Nreduced+i]);
+    for(int b=0; b<Nblocks6+Nblocks3; b++)
+    {
+        const int m = block_size(s,b);
+        for(int j=0; j<m; j++)
+            diag_max = std::max(diag_max, s->B[block_B0(s,b) + j*m+j]);
+    }
+    double lambda = 1e-3 * (diag_max > 0.0 ? diag_max : 1.0);
+    double nu     = 2.0;
+
+    int Naccepted = 0;
+    _mrcal_solver_iteration_t report = { .iteration    = 0,
+                                         .Nevaluations = Nevaluations,
+                                         .norm2_x      = s->current->norm2_x,
+                                         .step_norm    = -1.0,
+                                         .trustregion  = -1.0 };
+    bool stopped = iteration_callback != NULL &&
+                   !iteration_callback(&report, iteration_cookie);
+    if(stopped && verbose)
+        MSG("Schur solver: stopped by the caller");
+
+    for(int iteration=0;
+        !stopped && iteration<parameters->max_iterations;
+        iteration++)
+    {
+        double g_max = 0.0;
+        for(double g : s->g_reduced)    g_max = std::max(g_max, fabs(g));
+        for(double g : s->g_eliminated) g_max = std::max(g_max, fabs(g));
+        if(g_max < parameters->Jt_x_threshold)
+        {
+            if(verbose)
+                MSG("Schur solver: converged. Jt x is small: %g", g_max);
+            break;
+        }
+
+        // Not positive-definite. More damping will fix that. These retries
+        // evaluate nothing, so they don't count towards max_iterations
+        while(!compute_step(s, lambda))
+        {
+            lambda *= nu;
+            nu     *= 2.0;
+            if(lambda > 1e20)
+            {
+                MSG("Schur solver: the system is singular; giving up");
+                return -1.0;
+            }
+        }
+
+        // The gradient is [g_reduced0, g_eliminated, g_reduced1] in the state
+        // order
+        double step_norm2 = 0.0;
+        double step_dot_g = 0.0;
+        for(int i=0; i<Nstate; i++)
+        {
+            const double d = s->step[i];
+            const int    ir = s->ireduced[i];
+            const double g  = ir >= 0 ?
+                s->g_reduced[ir] :
+                s->g_eliminated[i - istate_eliminated0];
+            step_norm2 += d*d;
+            step_dot_g += d*g;
+        }
+
+        if(step_norm2 < parameters->update_threshold*parameters->update_threshold)
+        {
+            if(verbose)
+                MSG("Schur solver: converged. The step is small: %g", sqrt(step_norm2));
+            break;
+        }
+
+        for(int i=0; i<Nstate; i++)
+            s->trial->p[i] = s->current->p[i] + s->step[i];
+        evaluate(s->trial, Nmeasurements, f, cookie);
+        Nevaluations++;
+
+        // The cost is norm2(x)/2
+        const double reduction_predicted = 0.5*(lambda*step_norm2 - step_dot_g);
+        const double reduction_actual    = 0.5*(s->current->norm2_x - s->trial->norm2_x);
+        const double rho                 = reduction_actual / reduction_predicted;
+
+        if(verbose)
+            MSG("Schur solver: iteration %d: norm2(x)=%.10g, trial norm2(x)=%.10g, lambda=%g, step=%g, rho=%g",
+                iteration, s->current->norm2_x, s->trial->norm2_x,
+                lambda, sqrt(step_norm2), rho);
+
+        if(reduction_predicted > 0.0 && rho > 0.0)
+        {
+            std::swap(s->current, s->trial);
+            accumulate_normal_equations(s);
+
+            const double r = 2.0*rho - 1.0;
+            lambda *= std::max(1.0/3.0, 1.0 - r*r*r);
+            nu      = 2.0;
+
+            Naccepted++;
+            if(iteration_callback != NULL)
+            {
+                report = _mrcal_solver_iteration_t{ .iteration    = Naccepted,
+                                                    .Nevaluations = Nevaluations,
+                                                    .norm2_x      = s->current->norm2_x,
+                                                    .step_norm    = sqrt(step_norm2),
+                                                    .trustregion  = sqrt(step_norm2) };
+                if(!iteration_callback(&report, iteration_cookie))
+                {
+                    if(verbose)
+                        MSG("Schur solver: stopped by the caller");
+                    stopped = true;
+                }
+            }
+        }
+        else
+        {
+            // The damping is our trust region: each rejection makes it
+            // tighter, and the next step shorter. Once the rejected steps are
+            // shorter than trustregion_threshold, we're done
+            if(sqrt(step_norm2) < parameters->trustregion_threshold)
+            {
+                if(verbose)
+                    MSG("Schur solver: converged. The rejected step is small: %g", sqrt(step_norm2));
+                break;
+            }
+
+            lambda *= nu;
+            nu     *= 2.0;
+            if(lambda > 1e20)
+            {
+                if(verbose)
+                    MSG("Schur solver: can't make any more progress");
+                break;
+            }
+        }
+    }
+
+    memcpy(p, s->current->p.data(), Nstate*sizeof(double));
+    return s->current->norm2_x;
+}
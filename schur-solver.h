@@ -0,0 +1,83 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#pragma once
+
+// This is an internal header for the Schur-complement solver. Not to be seen by
+// the end-users or installed
+//
+// A least-squares solver for problems with a block-arrowhead JtJ, such as
+// board-heavy calibrations. The state vector is split into
+//
+// - the "reduced" variables: everything not listed below. In a calibration
+//   problem these are the intrinsics, extrinsics and calobject_warp: a few
+//   hundred variables, coupled to each other
+//
+// - the "eliminated" variables: a contiguous run of Nblocks6 6-variable
+//   blocks followed by Nblocks3 3-variable blocks. In a calibration problem
+//   these are the frame poses and the discrete points. Each measurement touches
+//   at most one of these blocks
+//
+// Each Levenberg-Marquardt step eliminates the small blocks of the normal
+// equations with the Schur complement, solves the dense reduced system, and
+// back-substitutes. The full JtJ is never formed, and no sparse factorization
+// is needed: the cost and memory scale linearly with the number of blocks
+//
+// The interface mirrors dogleg_optimize2(): the same callback, and the same
+// max_iterations, update_threshold, Jt_x_threshold, trustregion_threshold and
+// dogleg_debug parameters. Levenberg-Marquardt has no explicit trust region:
+// the damping plays that role. So trustregion_threshold applies to the length
+// of the rejected steps: once the damping has shrunk them below the threshold,
+// we're done, as libdogleg is when its trust region shrinks below it
+//
+// The caller may be told about each iteration, as with the solver in
+// dogleg-solver.h. The reported trust region is the length of the accepted
+// step: the region the damping limited it to
+
+#include <stdbool.h>
+#include <dogleg.h>
+
+#include "dogleg-solver.h"
+
+// The reduced system is dense, so its size is limited: a (Nreduced,Nreduced)
+// factorization at each step is fine for the intrinsics of a few cameras with
+// lean models, but not for splined models, with ~1000 intrinsics per camera.
+// Bigger problems should use the sparse solver instead
+#define _MRCAL_SCHUR_NREDUCED_MAX 1000
+
+typedef struct _mrcal_schur_solver_t _mrcal_schur_solver_t;
+
+// Returns NULL on error. Must be freed with _mrcal_schur_solver_free(). A solver
+// may be used for any number of _mrcal_schur_optimize() calls. The scratch
+// memory is reused, and grown as needed
+_mrcal_schur_solver_t* _mrcal_schur_solver_create(void);
+void _mrcal_schur_solver_free(_mrcal_schur_solver_t* solver);
+
+// Solves the problem, starting at the seed in p. On success p contains the
+// optimum, and we return norm2(x) at the optimum. On error we return <0
+double _mrcal_schur_optimize(// out, in
+                             double* p,
+                             _mrcal_schur_solver_t* solver,
+
+                             // in
+                             int Nstate, int Nmeasurements, int N_j_nonzero,
+                             int istate_eliminated0, int Nblocks6, int Nblocks3,
+                             void (*f)(const double*   p,
+                                       double*         x,
+                                       cholmod_sparse* Jt,
+                                       void*           cookie),
+                             void* cookie,
+                             const dogleg_parameters2_t* parameters,
+                             // May be NULL
+                             _mrcal_solver_iteration_callback_t* iteration_callback,
+                             void* iteration_cookie);
+
+// The measurement vector x at the optimum found by the latest
+// _mrcal_schur_optimize(). Nmeasurements of these. Valid until the next
+// _mrcal_schur_optimize() or _mrcal_schur_solver_free()
+const double* _mrcal_schur_solver_x(const _mrcal_schur_solver_t* solver);
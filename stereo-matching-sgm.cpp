@@ -0,0 +1,432 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <bit>
+
+#include "mrcal.h"
+#include "parallel.h"
+#include "util.h"
+
+// Semi-global matching. See the description of mrcal_stereo_matching_sgm() in
+// stereo.h. The path aggregation is written as simple loops over the
+// disparities, on uint16_t arrays, which the compiler vectorizes
+
+// The census window. The center pixel is excluded, so each descriptor has
+// CENSUS_W*CENSUS_H-1 = 62 bits, and the matching costs are in [0,62]
+#define CENSUS_W     9
+#define CENSUS_H     7
+#define CENSUS_NBITS (CENSUS_W*CENSUS_H - 1)
+
+// The rows are processed in strips of this many, independently. Each strip
+// starts aggregating NROWS_WARMUP rows above its first output row, so the paths
+// coming from above have settled by the time we report anything. The strips
+// don't depend on the number of threads, so neither do the results
+#define NROWS_PER_STRIP 64
+#define NROWS_WARMUP    16
+
+// The path costs have this sentinel at each end of the disparity range, so the
+// d-1 and d+1 neighbors always exist. It's larger than any real path cost, and
+// doesn't overflow a uint16_t when we add P1 to it
+#define COST_BIG        0x3FFF
+#define P2_MAX          4096
+
+// The three paths coming from the row above: straight down, and the two
+// diagonals
+enum { PATH_T, PATH_TL, PATH_TR, NPATHS_VERTICAL };
+
+mrcal_stereo_matching_sgm_parameters_t mrcal_stereo_matching_sgm_defaults(void)
+{
+    // P1,P2 are what's usually used with 9x7 census costs
+    return (mrcal_stereo_matching_sgm_parameters_t)
+        { .disparity_min      = 0,
+          .Ndisparities       = 128,
+          .P1                 = 10,
+          .P2                 = 120,
+          .uniqueness_percent = 5,
+          .lr_max_diff        = 1 };
+}
+
+static void census_rows(// out
+                        uint64_t* census,
+                        // in
+                        const mrcal_image_uint8_t* image,
+                        int y0, int y1)
+{
+    const int W = image->w;
+    const int H = image->h;
+
+    for(int y=y0; y<y1; y++)
+    {
+        // The image is extended past its edges by repeating the edge pixels
+        const uint8_t* rows[CENSUS_H];
+        for(int dy=0; dy<CENSUS_H; dy++)
+        {
+            const int yy = std::clamp(y + dy - CENSUS_H/2, 0, H-1);
+            rows[dy] = &image->data[(size_t)yy*image->stride];
+        }
+
+        const uint8_t* center = rows[CENSUS_H/2];
+        for(int x=0; x<W; x++)
+        {
+            const uint8_t c    = center[x];
+            uint64_t      bits = 0;
+            for(int dy=0; dy<CENSUS_H; dy++)
+                for(int dx=0; dx<CENSUS_W; dx++)
+                {
+                    if(dy == CENSUS_H/2 && dx == CENSUS_W/2)
+                        continue;
+                    const int xx = std::clamp(x + dx - CENSUS_W/2, 0, W-1);
+                    bits = (bits << 1) | (uint64_t)(rows[dy][xx] < c);
+                }
+            census[(size_t)y*W + x] = bits;
+        }
+    }
+}
+
+// One step of the path recursion, for all the disparities at one pixel:
+//
+//   L(p,d) = C(p,d) + min( L(p-r,d),
+//                          L(p-r,d-1) + P1,
+//                          L(p-r,d+1) + P1,
+//                          min_k L(p-r,k) + P2 )
+//                   - min_k L(p-r,k)
+//
+// Lprev, Lcur have the COST_BIG sentinel at [0] and [D+1]. A path starts with
+// Lprev = 0, minprev = 0. The result is accumulated into S. Returns min_k
+// L(p,k)
+static inline uint16_t aggregate(// out
+                                 uint16_t* __restrict Lcur,
+                                 uint16_t* __restrict S,
+                                 // in
+                                 const uint16_t* __restrict Lprev,
+                                 uint16_t                   minprev,
+                                 const uint16_t* __restrict C,
+                                 int D,
+                                 uint16_t P1, uint16_t P2)
+{
+    const uint16_t jump = (uint16_t)(minprev + P2);
+    uint16_t m = COST_BIG;
+    for(int d=0; d<D; d++)
+    {
+        const uint16_t step = (uint16_t)(std::min(Lprev[d], Lprev[d+2]) + P1);
+        const uint16_t l    = (uint16_t)(C[d] - minprev +
+                                         std::min(std::min(Lprev[d+1], jump), step));
+        Lcur[d+1] = l;
+        S[d]      = (uint16_t)(S[d] + l);
+        m         = std::min(m, l);
+    }
+    return m;
+}
+
+// Path costs for one pixel, at all the disparities, with the sentinels
+static void path_reset(uint16_t* L, int N, int D)
+{
+    for(int i=0; i<N; i++)
+    {
+        L[i*(D+2)]   = COST_BIG;
+        memset(&L[i*(D+2) + 1], 0, D*sizeof(L[0]));
+        L[i*(D+2) + D+1] = COST_BIG;
+    }
+}
+
+bool mrcal_stereo_matching_sgm(// output
+                               mrcal_image_uint16_t* disparity,
+
+                               // input
+                               const mrcal_image_uint8_t* image0,
+                               const mrcal_image_uint8_t* image1,
+                               const mrcal_stereo_matching_sgm_parameters_t* parameters)
+{
+    const mrcal_stereo_matching_sgm_parameters_t parameters_default =
+        mrcal_stereo_matching_sgm_defaults();
+    if(parameters == NULL)
+        parameters = &parameters_default;
+
+    const int W = image0->w;
+    const int H = image0->h;
+    if(image1->w != W || image1->h != H ||
+       disparity->w != W || disparity->h != H)
+    {
+        MSG("The images and the disparity map must have the same dimensions. Got image0: (%d,%d), image1: (%d,%d), disparity: (%d,%d)",
+            image0->w, image0->h, image1->w, image1->h, disparity->w, disparity->h);
+        return false;
+    }
+    if(parameters->disparity_min < 0 || parameters->Ndisparities <= 0)
+    {
+        MSG("Need disparity_min >= 0 and Ndisparities > 0. Got disparity_min=%d, Ndisparities=%d",
+            parameters->disparity_min, parameters->Ndisparities);
+        return false;
+    }
+    if(!(0 <= parameters->P1 && parameters->P1 <= parameters->P2 && parameters->P2 <= P2_MAX))
+    {
+        MSG("Need 0 <= P1 <= P2 <= %d. Got P1=%d, P2=%d",
+            P2_MAX, parameters->P1, parameters->P2);
+        return false;
+    }
+    if(parameters->uniqueness_percent < 0 || parameters->uniqueness_percent >= 100)
+    {
+        MSG("Need 0 <= uniqueness_percent < 100. Got %d",
+            parameters->uniqueness_percent);
+        return false;
+    }
+    if(W <= 0 || H <= 0)
+        return true;
+
+    const int      D    = parameters->Ndisparities;
+    const int      dmin = parameters->disparity_min;
+    const uint16_t P1   = (uint16_t)parameters->P1;
+    const uint16_t P2   = (uint16_t)parameters->P2;
+
+    bool result = false;
+
+    uint64_t* census0 = (uint64_t*)malloc((size_t)W*H*sizeof(uint64_t));
+    uint64_t* census1 = (uint64_t*)malloc((size_t)W*H*sizeof(uint64_t));
+
+    const int Nstrips  = (H + NROWS_PER_STRIP-1) / NROWS_PER_STRIP;
+    const int Nthreads = std::min(_mrcal_num_threads(0), Nstrips);
+    bool* result_chunk = (bool*)malloc(Nthreads*sizeof(bool));
+    if(census0 == NULL || census1 == NULL || result_chunk == NULL)
+    {
+        MSG("Couldn't allocate the census descriptors");
+        goto done;
+    }
+
+    _mrcal_parallel_for(Nstrips, Nthreads,
+                        [&](int istrip0, int istrip1, int)
+                        {
+                            const int y0 = istrip0*NROWS_PER_STRIP;
+                            const int y1 = std::min(istrip1*NROWS_PER_STRIP, H);
+                            census_rows(census0, image0, y0, y1);
+                            census_rows(census1, image1, y0, y1);
+                        });
+
+    for(int i=0; i<Nthreads; i++)
+        result_chunk[i] = true;
+
+    _mrcal_parallel_for(Nstrips, Nthreads,
+                        [&](int istrip0, int istrip1, int ichunk)
+    {
+        // Per-thread scratch: the costs C and their sums over the paths S for
+        // one row, the two horizontal paths, and the previous and current rows
+        // of each path from above. Those are padded by one pixel on each side,
+        // which is never written, so the diagonal paths start fresh at the
+        // image edges
+        const size_t Nrow    = (size_t)W*D;
+        const size_t Npixel  = (size_t)(D+2);
+        const size_t Nvrow   = (size_t)(W+2)*Npixel;
+
+        uint16_t* C       = (uint16_t*)malloc(( 2*Nrow + 2*2*Npixel +
+                                                NPATHS_VERTICAL*2*Nvrow +
+                                                NPATHS_VERTICAL*2*(W+2) ) * sizeof(uint16_t));
+        int*      dispR   = (int*)     malloc(W*sizeof(int));
+        uint16_t* costR   = (uint16_t*)malloc(W*sizeof(uint16_t));
+        if(C == NULL || dispR == NULL || costR == NULL)
+        {
+            MSG("Couldn't allocate the per-thread scratch");
+            result_chunk[ichunk] = false;
+            free(C);
+            free(dispR);
+            free(costR);
+            return;
+        }
+
+        uint16_t* S = &C[Nrow];
+        uint16_t* Lh[2][2];
+        Lh[0][0] = &S[Nrow];
+        Lh[0][1] = &Lh[0][0][Npixel];
+        Lh[1][0] = &Lh[0][1][Npixel];
+        Lh[1][1] = &Lh[1][0][Npixel];
+        uint16_t* Lv   [NPATHS_VERTICAL][2];
+        uint16_t* minLv[NPATHS_VERTICAL][2];
+        uint16_t* p = &Lh[1][1][Npixel];
+        for(int ipath=0; ipath<NPATHS_VERTICAL; ipath++)
+            for(int k=0; k<2; k++)
+            {
+                Lv[ipath][k] = p;
+                p += Nvrow;
+            }
+        for(int ipath=0; ipath<NPATHS_VERTICAL; ipath++)
+            for(int k=0; k<2; k++)
+            {
+                minLv[ipath][k] = p;
+                p += W+2;
+            }
+
+        for(int istrip=istrip0; istrip<istrip1; istrip++)
+        {
+            const int yout0 = istrip*NROWS_PER_STRIP;
+            const int yout1 = std::min(yout0 + NROWS_PER_STRIP, H);
+            const int ystart = std::max(0, yout0 - NROWS_WARMUP);
+
+            // The paths from above start fresh at the top of the strip
+            for(int ipath=0; ipath<NPATHS_VERTICAL; ipath++)
+                for(int k=0; k<2; k++)
+                {
+                    path_reset(Lv[ipath][k], W+2, D);
+                    memset(minLv[ipath][k], 0, (W+2)*sizeof(uint16_t));
+                }
+            int iprev = 0;
+
+            for(int y=ystart; y<yout1; y++)
+            {
+                const uint64_t* c0 = &census0[(size_t)y*W];
+                const uint64_t* c1 = &census1[(size_t)y*W];
+
+                // The costs. Matches that fall off the left edge of image1
+                // get the worst cost
+                for(int x=0; x<W; x++)
+                {
+                    uint16_t* Cx = &C[(size_t)x*D];
+                    const int dvalid = std::clamp(x - dmin + 1, 0, D);
+                    for(int d=0; d<dvalid; d++)
+                        Cx[d] = (uint16_t)std::popcount(c0[x] ^ c1[x - dmin - d]);
+                    for(int d=dvalid; d<D; d++)
+                        Cx[d] = CENSUS_NBITS;
+                }
+                memset(S, 0, Nrow*sizeof(S[0]));
+
+                // Left-to-right, and the paths from above
+                const int icur = 1-iprev;
+                path_reset(Lh[0][0], 2, D);
+                uint16_t minLh = 0;
+                for(int x=0; x<W; x++)
+                {
+                    const uint16_t* Cx = &C[(size_t)x*D];
+                    uint16_t*       Sx = &S[(size_t)x*D];
+
+                    const int k = x & 1;
+                    minLh = aggregate(Lh[0][1-k], Sx,
+                                      Lh[0][k], minLh,
+                                      Cx, D, P1, P2);
+
+                    // x+1 is this pixel in the padded arrays. The paths
+                    // come from x (straight down), x-1 (from the top-left)
+                    // and x+1 (from the top-right) in the row above
+                    const int xprev[NPATHS_VERTICAL] = { x+1, x, x+2 };
+                    for(int ipath=0; ipath<NPATHS_VERTICAL; ipath++)
+                        minLv[ipath][icur][x+1] =
+                            aggregate(&Lv[ipath][icur][(size_t)(x+1)*Npixel], Sx,
+                                      &Lv[ipath][iprev][(size_t)xprev[ipath]*Npixel],
+                                      minLv[ipath][iprev][xprev[ipath]],
+                                      Cx, D, P1, P2);
+                }
+                iprev = icur;
+
+                // Right-to-left
+                path_reset(Lh[1][0], 2, D);
+                uint16_t minLhR = 0;
+                for(int x=W-1; x>=0; x--)
+                {
+                    const int k = (W-1-x) & 1;
+                    minLhR = aggregate(Lh[1][1-k], &S[(size_t)x*D],
+                                       Lh[1][k], minLhR,
+                                       &C[(size_t)x*D], D, P1, P2);
+                }
+
+                if(y < yout0)
+                    // warming up
+                    continue;
+
+                // The best disparity for each pixel in image1, for the
+                // left-right consistency check. Pixel x in image0 at disparity
+                // index d is pixel x - dmin - d in image1
+                if(parameters->lr_max_diff >= 0)
+                {
+                    for(int x=0; x<W; x++)
+                    {
+                        costR[x] = COST_BIG;
+                        dispR[x] = -1;
+                    }
+                    for(int x=0; x<W; x++)
+                    {
+                        const uint16_t* Sx = &S[(size_t)x*D];
+                        const int dvalid = std::clamp(x - dmin + 1, 0, D);
+                        for(int d=0; d<dvalid; d++)
+                        {
+                            const int xr = x - dmin - d;
+                            if(Sx[d] < costR[xr])
+                            {
+                                costR[xr] = Sx[d];
+                                dispR[xr] = d;
+                            }
+                        }
+                    }
+                }
+
+                uint16_t* out =
+                    (uint16_t*)&((uint8_t*)disparity->data)[(size_t)y*disparity->stride];
+                for(int x=0; x<W; x++)
+                {
+                    out[x] = 0;
+
+                    const uint16_t* Sx = &S[(size_t)x*D];
+                    const int dvalid = std::clamp(x - dmin + 1, 0, D);
+                    if(dvalid <= 0)
+                        continue;
+
+                    int      dbest = 0;
+                    uint16_t Sbest = Sx[0];
+                    for(int d=1; d<dvalid; d++)
+                        if(Sx[d] < Sbest)
+                        {
+                            Sbest = Sx[d];
+                            dbest = d;
+                        }
+
+                    bool unique = true;
+                    for(int d=0; d<dvalid; d++)
+                        if(abs(d - dbest) > 1 &&
+                           (int)Sx[d]*(100 - parameters->uniqueness_percent) < (int)Sbest*100)
+                        {
+                            unique = false;
+                            break;
+                        }
+                    if(!unique)
+                        continue;
+
+                    if(parameters->lr_max_diff >= 0 &&
+                       abs(dispR[x - dmin - dbest] - dbest) > parameters->lr_max_diff)
+                        continue;
+
+                    // Subpixel refinement: fit a parabola to the costs at the
+                    // best disparity and its neighbors
+                    double delta = 0.;
+                    if(dbest > 0 && dbest < dvalid-1)
+                    {
+                        const int denom = (int)Sx[dbest-1] + (int)Sx[dbest+1] - 2*(int)Sbest;
+                        if(denom > 0)
+                            delta = (double)((int)Sx[dbest-1] - (int)Sx[dbest+1]) / (double)(2*denom);
+                    }
+
+                    const long v = lround(((double)(dmin + dbest) + delta) *
+                                          MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE);
+                    out[x] = (uint16_t)std::clamp(v, 0L, 65535L);
+                }
+            }
+        }
+
+        free(C);
+        free(dispR);
+        free(costR);
+    });
+
+    result = true;
+    for(int i=0; i<Nthreads; i++)
+        if(!result_chunk[i])
+            result = false;
+
+ done:
+    free(census0);
+    free(census1);
+    free(result_chunk);
+    return result;
+}
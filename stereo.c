@@ -7,10 +7,22 @@
 //     http://www.apache.org/licenses/LICENSE-2.0
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "mrcal.h"
 #include "minimath/minimath.h"
 #include "util.h"
+#include "parallel.h"
+#include "project-batch.h"
+#include "image-remap.h"
+#include "strides.h"
+
+// mrcal_rectification_maps() works in tiles of this many rows. Each tile seeds
+// its incremental sin/cos recurrence exactly, so the accumulated error is
+// bounded by the tile size. The tiles are split across threads, and since their
+// boundaries don't depend on the number of threads, neither do the results
+#define RECTIFICATION_MAPS_ROWS_PER_TILE 32
 
 // The equivalent function in Python is _rectified_resolution_python() in
 // stereo.py
@@ -438,50 +450,251 @@ bool mrcal_rectified_system(// output
     return true;
 }
 
-bool mrcal_rectification_maps(// output
-                              // Dense array of shape (Ncameras=2, Nel, Naz, Nxy=2)
-                              float* rectification_maps,
+typedef struct
+{
+    // Dense arrays of shape (Nel, Naz, Nxy=2). One per camera
+    float*                         rectification_map[2];
 
-                              // input
-                              const mrcal_lensmodel_t* lensmodel0,
-                              const double*            intrinsics0,
-                              const double*            r_cam0_ref,
+    // If remap_row != NULL, the maps aren't stored: each row of the map is used
+    // immediately to remap images[icam] into images_rectified[icam], and
+    // rectification_map[] is unused. Only with x0 = y0 = 0 and spacing = 1
+    _mrcal_image_remap_row_t* remap_row;
+    void*                     images_rectified[2];
+    const void*               images[2];
 
-                              const mrcal_lensmodel_t* lensmodel1,
-                              const double*            intrinsics1,
-                              const double*            r_cam1_ref,
+    // Map entry (i,j) is for rectified pixel (x0 + j*spacing, y0 + i*spacing).
+    // The full-resolution maps have x0 = y0 = 0 and spacing = 1
+    double       x0, y0;
+    unsigned int spacing;
 
-                              const mrcal_lensmodel_type_t rectification_model_type,
-                              const double*                fxycxy_rectified,
-                              const unsigned int*          imagersize_rectified,
-                              const double*                r_rect0_ref)
+    const mrcal_lensmodel_t*       lensmodel [2];
+    const double*                  intrinsics[2];
+    mrcal_projection_precomputed_t precomputed[2];
+    double                         R_cam_rect[2][3*3];
+
+    unsigned int Naz, Nel;
+
+    mrcal_lensmodel_type_t rectification_model_type;
+    const double*          fxycxy_rectified;
+
+    // LENSMODEL_LATLON only. The latitude doesn't depend on the row, so these
+    // are computed once: sin(lat), cos(lat) for each column
+    const double* slat;
+    const double* clat;
+
+    double lon0, dlon, sdlon, cdlon;
+
+    // One per chunk
+    bool* result_chunk;
+} rectification_maps_ctx_t;
+
+static void rectification_maps_tiles(int itile0, int itile1, int ichunk,
+                                     void* cookie)
 {
-    ///// TODAY this C implementation supports MRCAL_LENSMODEL_LATLON only. This
-    ///// isn't a design choice, I just don't want to do the extra work yet. The
-    ///// API already is general enough to support both rectification schemes.
-    if( rectification_model_type != MRCAL_LENSMODEL_LATLON )
+    rectification_maps_ctx_t* ctx = (rectification_maps_ctx_t*)cookie;
+    const unsigned int Naz = ctx->Naz;
+
+    // Scratch for one row. qrect is the row of rectified pixels we're
+    // unprojecting; not used with LENSMODEL_LATLON
+    mrcal_point3_t* v     = (mrcal_point3_t*)malloc(Naz*sizeof(v[0]));
+    mrcal_point3_t* vcam  = (mrcal_point3_t*)malloc(Naz*sizeof(vcam[0]));
+    mrcal_point2_t* q     = (mrcal_point2_t*)malloc(Naz*sizeof(q[0]));
+    mrcal_point2_t* qrect = (mrcal_point2_t*)malloc(Naz*sizeof(qrect[0]));
+    // When remapping on the fly, the one row of the map we need right now
+    float*          maprow = NULL;
+    if(ctx->remap_row != NULL)
+        maprow = (float*)malloc(Naz*2*sizeof(float));
+    if(v == NULL || vcam == NULL || q == NULL || qrect == NULL ||
+       (ctx->remap_row != NULL && maprow == NULL))
     {
-        MSG("Today this C implementation supports MRCAL_LENSMODEL_LATLON only.");
+        MSG("Couldn't allocate the per-row scratch");
+        ctx->result_chunk[ichunk] = false;
+        goto done;
+    }
+
+    for(unsigned int j=0; j<Naz; j++)
+        qrect[j].x = ctx->x0 + (double)(j*ctx->spacing);
+
+    for(int itile=itile0; itile<itile1; itile++)
+    {
+        const unsigned int i0 = itile * RECTIFICATION_MAPS_ROWS_PER_TILE;
+        unsigned int       i1 = i0    + RECTIFICATION_MAPS_ROWS_PER_TILE;
+        if(i1 > ctx->Nel) i1 = ctx->Nel;
+
+        const double lon = ctx->lon0 + (double)i0 * ctx->dlon;
+        double slon = sin(lon);
+        double clon = cos(lon);
+
+        for(unsigned int i=i0; i<i1; i++)
+        {
+            // The closed-form unprojections are evaluated a whole row at a time
+            switch(ctx->rectification_model_type)
+            {
+            case MRCAL_LENSMODEL_LATLON:
+                for(unsigned int j=0; j<Naz; j++)
+                    v[j] = (mrcal_point3_t){.x = ctx->slat[j],
+                                            .y = ctx->clat[j] * slon,
+                                            .z = ctx->clat[j] * clon};
+                break;
+
+            case MRCAL_LENSMODEL_PINHOLE:
+                for(unsigned int j=0; j<Naz; j++)
+                    qrect[j].y = ctx->y0 + (double)(i*ctx->spacing);
+                mrcal_unproject_pinhole(v, NULL, qrect, (int)Naz,
+                                        ctx->fxycxy_rectified);
+                break;
+
+            case MRCAL_LENSMODEL_STEREOGRAPHIC:
+                for(unsigned int j=0; j<Naz; j++)
+                    qrect[j].y = ctx->y0 + (double)(i*ctx->spacing);
+                mrcal_unproject_stereographic(v, NULL, qrect, (int)Naz,
+                                              ctx->fxycxy_rectified);
+                break;
+
+            default:
+                // checked in mrcal_rectification_maps()
+                ctx->result_chunk[ichunk] = false;
+                goto done;
+            }
+
+            for(int icam=0; icam<2; icam++)
+            {
+                for(unsigned int j=0; j<Naz; j++)
+                    mrcal_rotate_point_R(vcam[j].xyz, NULL, NULL,
+                                         ctx->R_cam_rect[icam], v[j].xyz);
+
+                // Already split across threads, so no more threads in here
+                if(!_mrcal_project_batch(q, NULL, NULL,
+                                         vcam, (int)Naz,
+                                         ctx->lensmodel[icam], ctx->intrinsics[icam],
+                                         &ctx->precomputed[icam],
+                                         1))
+                {
+                    ctx->result_chunk[ichunk] = false;
+                    goto done;
+                }
+
+                float* map =
+                    ctx->remap_row != NULL ?
+                    maprow :
+                    &ctx->rectification_map[icam][i*Naz*2];
+                for(unsigned int j=0; j<Naz; j++)
+                {
+                    map[j*2 + 0] = (float)q[j].x;
+                    map[j*2 + 1] = (float)q[j].y;
+                }
+
+                if(ctx->remap_row != NULL)
+                    ctx->remap_row(ctx->images_rectified[icam], ctx->images[icam],
+                                   maprow, (int)i);
+            }
+
+            double _slon = slon;
+            slon = _slon*ctx->cdlon +  clon*ctx->sdlon;
+            clon =  clon*ctx->cdlon - _slon*ctx->sdlon;
+        }
+    }
+
+ done:
+    free(v);
+    free(vcam);
+    free(q);
+    free(qrect);
+    free(maprow);
+}
+
+// Computes the rectification maps at the rectified pixels (x0 + j*spacing, y0 +
+// i*spacing) for i,j in [0,gridsize[1]) x [0,gridsize[0])
+//
+// If remap_row != NULL, the maps are not stored, and rectification_maps is
+// ignored. Instead each row of the map is applied to the images as soon as it is
+// computed, writing to images_rectified. This requires x0 = y0 = 0 and spacing
+// = 1, with the images_rectified of size gridsize
+static bool rectification_maps_grid(// output
+                                    // Dense array of shape (Ncameras=2, gridsize[1], gridsize[0], Nxy=2)
+                                    float* rectification_maps,
+                                    // Ncameras=2 mrcal_image_..._t*. Used only
+                                    // if remap_row != NULL
+                                    void* const* images_rectified,
+
+                                    // input
+                                    const mrcal_lensmodel_t* lensmodel0,
+                                    const double*            intrinsics0,
+                                    const double*            r_cam0_ref,
+
+                                    const mrcal_lensmodel_t* lensmodel1,
+                                    const double*            intrinsics1,
+                                    const double*            r_cam1_ref,
+
+                                    const mrcal_lensmodel_type_t rectification_model_type,
+                                    const double*                fxycxy_rectified,
+                                    const double*                r_rect0_ref,
+
+                                    const unsigned int* gridsize,
+                                    double x0, double y0,
+                                    unsigned int spacing,
+
+                                    // Ncameras=2 mrcal_image_..._t*. Used only
+                                    // if remap_row != NULL
+                                    const void* const*        images,
+                                    _mrcal_image_remap_row_t* remap_row)
+{
+    if( !(rectification_model_type == MRCAL_LENSMODEL_LATLON  ||
+          rectification_model_type == MRCAL_LENSMODEL_PINHOLE ||
+          rectification_model_type == MRCAL_LENSMODEL_STEREOGRAPHIC) )
+    {
+        MSG("Unsupported rectification model '%s'. Only LENSMODEL_LATLON, LENSMODEL_PINHOLE and LENSMODEL_STEREOGRAPHIC are supported",
+            mrcal_lensmodel_name_unconfigured( &(mrcal_lensmodel_t){.type = rectification_model_type}));
         return false;
     }
 
+    bool result = false;
+
+    rectification_maps_ctx_t ctx = {.remap_row                = remap_row,
+                                    .x0                       = x0,
+                                    .y0                       = y0,
+                                    .spacing                  = spacing,
+                                    .lensmodel                = {lensmodel0,  lensmodel1},
+                                    .intrinsics               = {intrinsics0, intrinsics1},
+                                    .Naz                      = gridsize[0],
+                                    .Nel                      = gridsize[1],
+                                    .rectification_model_type = rectification_model_type,
+                                    .fxycxy_rectified         = fxycxy_rectified};
+
     double R_cam0_ref[3*3];
     double R_cam1_ref[3*3];
     mrcal_R_from_r(R_cam0_ref, NULL, r_cam0_ref);
     mrcal_R_from_r(R_cam1_ref, NULL, r_cam1_ref);
 
-    double R_cam0_rect[3*3];
-    double R_cam1_rect[3*3];
-
     double R_rect0_ref[3*3];
     mrcal_R_from_r(R_rect0_ref, NULL, r_rect0_ref);
 
-    mul_genN3_gen33t_vout(3, R_cam0_ref, R_rect0_ref, R_cam0_rect);
-    mul_genN3_gen33t_vout(3, R_cam1_ref, R_rect0_ref, R_cam1_rect);
+    mul_genN3_gen33t_vout(3, R_cam0_ref, R_rect0_ref, ctx.R_cam_rect[0]);
+    mul_genN3_gen33t_vout(3, R_cam1_ref, R_rect0_ref, ctx.R_cam_rect[1]);
+
+    if(remap_row == NULL)
+    {
+        ctx.rectification_map[0] = &(rectification_maps[0]);
+        ctx.rectification_map[1] = &(rectification_maps[gridsize[0]*gridsize[1]*2]);
+    }
+    else
+    {
+        for(int icam=0; icam<2; icam++)
+        {
+            ctx.images_rectified[icam] = images_rectified[icam];
+            ctx.images          [icam] = images          [icam];
+        }
+    }
 
-    float* rectification_map0 = &(rectification_maps[0]);
-    float* rectification_map1 = &(rectification_maps[imagersize_rectified[0]*imagersize_rectified[1]*2]);
+    // The lensmodel precomputation is the same for every pixel, so we do it
+    // once here, instead of in each mrcal_project() call
+    _mrcal_precompute_lensmodel_data(&ctx.precomputed[0], lensmodel0);
+    _mrcal_precompute_lensmodel_data(&ctx.precomputed[1], lensmodel1);
 
+    // With LENSMODEL_PINHOLE and LENSMODEL_STEREOGRAPHIC the unprojection is
+    // cheap, and is computed directly, a row at a time. With LENSMODEL_LATLON
+    // it's a bunch of sin/cos, so I do more work here.
+    //
     // I had this:
     //   for(int i=0; i<imagersize_rectified[1]; i++)
     //       for(int j=0; j<imagersize_rectified[0]; j++)
@@ -504,7 +717,10 @@ bool mrcal_rectification_maps(// output
     // Since dx is constant here I can compute the sin/cos sequence very
     // quickly. One concern about this is that each computation would accumulate
     // floating-point error, which could add up. The test-rectification-maps.py
-    // test explicitly checks for this, and determines that this isn't an issue
+    // test explicitly checks for this, and determines that this isn't an issue.
+    // The rows are processed in tiles (see rectification_maps_tiles()), and the
+    // row recurrence is re-seeded at the start of each one. The column sequence
+    // is the same for every row, so it is computed once, here
     const double fx         = fxycxy_rectified[0];
     const double fy         = fxycxy_rectified[1];
     const double fx_recip   = 1./fx;
@@ -512,59 +728,579 @@ bool mrcal_rectification_maps(// output
     const double c_over_f_x = fxycxy_rectified[2] * fx_recip;
     const double c_over_f_y = fxycxy_rectified[3] * fy_recip;
 
-    double sdlon = sin(fy_recip);
-    double cdlon = cos(fy_recip);
-    double sdlat = sin(fx_recip);
-    double cdlat = cos(fx_recip);
+    ctx.dlon  = (double)spacing * fy_recip;
+    ctx.sdlon = sin(ctx.dlon);
+    ctx.cdlon = cos(ctx.dlon);
+    ctx.lon0  = y0 * fy_recip - c_over_f_y;
 
-    double lon0 = -c_over_f_y;
-    double slon0 = sin(lon0);
-    double clon0 = cos(lon0);
+    const double dlat = (double)spacing * fx_recip;
+    double sdlat = sin(dlat);
+    double cdlat = cos(dlat);
 
-    double lat0 = -c_over_f_x;
-    double slat0 = sin(lat0);
-    double clat0 = cos(lat0);
+    double lat0 = x0 * fx_recip - c_over_f_x;
 
-    double slon = slon0, clon = clon0;
-    for(unsigned int i=0; i<imagersize_rectified[1]; i++)
+    const int Ntiles =
+        (int)((ctx.Nel + RECTIFICATION_MAPS_ROWS_PER_TILE-1) / RECTIFICATION_MAPS_ROWS_PER_TILE);
+    const int Nthreads = _mrcal_num_threads(0);
+
+    double* slat      = NULL;
+    double* clat      = NULL;
+    ctx.result_chunk  = (bool*)  malloc(Nthreads*sizeof(bool));
+    if(ctx.result_chunk == NULL)
     {
-        double slat = slat0, clat = clat0;
-        for(unsigned int j=0; j<imagersize_rectified[0]; j++)
+        MSG("Couldn't allocate the scratch");
+        goto done;
+    }
+
+    if(rectification_model_type == MRCAL_LENSMODEL_LATLON)
+    {
+        slat = (double*)malloc(ctx.Naz*sizeof(double));
+        clat = (double*)malloc(ctx.Naz*sizeof(double));
+        if(slat == NULL || clat == NULL)
+        {
+            MSG("Couldn't allocate the scratch");
+            goto done;
+        }
+
+        double s = sin(lat0), c = cos(lat0);
+        for(unsigned int j=0; j<ctx.Naz; j++)
         {
-            mrcal_point3_t v =
-                (mrcal_point3_t){.x = slat,
-                                 .y = clat * slon,
-                                 .z = clat * clon};
-
-            mrcal_point3_t vcam;
-            mrcal_point2_t q;
-
-            vcam = v;
-            mrcal_rotate_point_R(vcam.xyz, NULL, NULL,
-                                 R_cam0_rect, v.xyz);
-            mrcal_project(&q, NULL, NULL,
-                          &vcam, 1,
-                          lensmodel0, intrinsics0);
-            rectification_map0[(i*imagersize_rectified[0] + j)*2 + 0] = (float)q.x;
-            rectification_map0[(i*imagersize_rectified[0] + j)*2 + 1] = (float)q.y;
-
-            vcam = v;
-            mrcal_rotate_point_R(vcam.xyz, NULL, NULL,
-                                 R_cam1_rect, v.xyz);
-            mrcal_project(&q, NULL, NULL,
-                          &vcam, 1,
-                          lensmodel1, intrinsics1);
-            rectification_map1[(i*imagersize_rectified[0] + j)*2 + 0] = (float)q.x;
-            rectification_map1[(i*imagersize_rectified[0] + j)*2 + 1] = (float)q.y;
-
-            double _slat = slat;
-            slat = _slat*cdlat +  clat*sdlat;
-            clat =  clat*cdlat - _slat*sdlat;
+            slat[j] = s;
+            clat[j] = c;
+
+            double _s = s;
+            s = _s*cdlat +  c*sdlat;
+            c =  c*cdlat - _s*sdlat;
         }
-        double _slon = slon;
-        slon = _slon*cdlon +  clon*sdlon;
-        clon =  clon*cdlon - _slon*sdlon;
+    }
+    ctx.slat = slat;
+    ctx.clat = clat;
+
+    for(int i=0; i<Nthreads; i++)
+        ctx.result_chunk[i] = true;
+
+    _mrcal_parallel_for(Ntiles, Nthreads,
+                        rectification_maps_tiles, &ctx);
+
+    result = true;
+    for(int i=0; i<Nthreads; i++)
+        if(!ctx.result_chunk[i])
+            result = false;
+
+ done:
+    free(slat);
+    free(clat);
+    free(ctx.result_chunk);
+    return result;
+}
+
+bool mrcal_rectification_maps(// output
+                              // Dense array of shape (Ncameras=2, Nel, Naz, Nxy=2)
+                              float* rectification_maps,
+
+                              // input
+                              const mrcal_lensmodel_t* lensmodel0,
+                              const double*            intrinsics0,
+                              const double*            r_cam0_ref,
+
+                              const mrcal_lensmodel_t* lensmodel1,
+                              const double*            intrinsics1,
+                              const double*            r_cam1_ref,
+
+                              const mrcal_lensmodel_type_t rectification_model_type,
+                              const double*                fxycxy_rectified,
+                              const unsigned int*          imagersize_rectified,
+                              const double*                r_rect0_ref)
+{
+    return rectification_maps_grid(rectification_maps,
+                                   NULL,
+                                   lensmodel0, intrinsics0, r_cam0_ref,
+                                   lensmodel1, intrinsics1, r_cam1_ref,
+                                   rectification_model_type,
+                                   fxycxy_rectified,
+                                   r_rect0_ref,
+                                   imagersize_rectified,
+                                   0., 0., 1,
+                                   NULL, NULL);
+}
+
+bool mrcal_rectification_maps_sparse_gridsize(// output
+                                              unsigned int* gridsize,
+
+                                              // input
+                                              const unsigned int* imagersize_rectified,
+                                              int spacing)
+{
+    if(spacing <= 0)
+    {
+        MSG("spacing must be > 0. Got %d", spacing);
+        return false;
+    }
+    for(int i=0; i<2; i++)
+        gridsize[i] = (imagersize_rectified[i] - 1 + spacing-1) / spacing + 1;
+    return true;
+}
+
+bool mrcal_rectification_maps_sparse(// output
+                                     // Dense array of shape (Ncameras=2, Nel_grid, Naz_grid, Nxy=2)
+                                     float* rectification_maps_sparse,
+                                     // May be NULL
+                                     double* max_interpolation_error,
+
+                                     // input
+                                     const mrcal_lensmodel_t* lensmodel0,
+                                     const double*            intrinsics0,
+                                     const double*            r_cam0_ref,
+
+                                     const mrcal_lensmodel_t* lensmodel1,
+                                     const double*            intrinsics1,
+                                     const double*            r_cam1_ref,
+
+                                     const mrcal_lensmodel_type_t rectification_model_type,
+                                     const double*                fxycxy_rectified,
+                                     const unsigned int*          imagersize_rectified,
+                                     const double*                r_rect0_ref,
+                                     int spacing)
+{
+    if(imagersize_rectified[0] == 0 || imagersize_rectified[1] == 0)
+    {
+        MSG("The rectified image must not be empty");
+        return false;
+    }
+
+    unsigned int gridsize[2];
+    if(!mrcal_rectification_maps_sparse_gridsize(gridsize, imagersize_rectified, spacing))
+        return false;
+
+    if(!rectification_maps_grid(rectification_maps_sparse,
+                                NULL,
+                                lensmodel0, intrinsics0, r_cam0_ref,
+                                lensmodel1, intrinsics1, r_cam1_ref,
+                                rectification_model_type,
+                                fxycxy_rectified,
+                                r_rect0_ref,
+                                gridsize,
+                                0., 0., (unsigned int)spacing,
+                                NULL, NULL))
+        return false;
+
+    if(max_interpolation_error == NULL)
+        return true;
+    *max_interpolation_error = 0.;
+
+    // Bilinear interpolation is least accurate in the middle of each cell. I
+    // compute the exact maps at the rectified pixel nearest the middle, and
+    // compare them against the interpolated ones. With spacing=1 every pixel
+    // is a grid node, and the error is 0. A grid with a single row or column
+    // has no cells in that direction, so there's nothing to interpolate there
+    unsigned int gridsize_centers[2];
+    for(int i=0; i<2; i++)
+        gridsize_centers[i] = gridsize[i] > 1 ? gridsize[i]-1 : 1;
+
+    const unsigned int half = (unsigned int)spacing / 2;
+    const unsigned int x0   = gridsize[0] > 1 ? half : 0;
+    const unsigned int y0   = gridsize[1] > 1 ? half : 0;
+    const double       fx   = (double)x0 / (double)spacing;
+    const double       fy   = (double)y0 / (double)spacing;
+    const unsigned int dx   = gridsize[0] > 1 ? 1 : 0;
+    const unsigned int dy   = gridsize[1] > 1 ? 1 : 0;
+
+    const int Ncenters = (int)(gridsize_centers[0]*gridsize_centers[1]);
+    float* centers = (float*)malloc(2*Ncenters*2*sizeof(float));
+    if(centers == NULL)
+    {
+        MSG("Couldn't allocate the error-checking maps");
+        return false;
     }
 
+    if(!rectification_maps_grid(centers,
+                                NULL,
+                                lensmodel0, intrinsics0, r_cam0_ref,
+                                lensmodel1, intrinsics1, r_cam1_ref,
+                                rectification_model_type,
+                                fxycxy_rectified,
+                                r_rect0_ref,
+                                gridsize_centers,
+                                (double)x0, (double)y0, (unsigned int)spacing,
+                                NULL, NULL))
+    {
+        free(centers);
+        return false;
+    }
+
+    double max_error = 0.;
+    for(int icam=0; icam<2; icam++)
+    {
+        const float* map   = &rectification_maps_sparse[icam*gridsize[0]*gridsize[1]*2];
+        const float* exact = &centers[icam*Ncenters*2];
+        for(unsigned int i=0; i<gridsize_centers[1]; i++)
+            for(unsigned int j=0; j<gridsize_centers[0]; j++)
+            {
+                const float* m00 = &map[((i   )*gridsize[0] + j   )*2];
+                const float* m01 = &map[((i   )*gridsize[0] + j+dx)*2];
+                const float* m10 = &map[((i+dy)*gridsize[0] + j   )*2];
+                const float* m11 = &map[((i+dy)*gridsize[0] + j+dx)*2];
+                const float* e   = &exact[(i*gridsize_centers[0] + j)*2];
+
+                double d2 = 0.;
+                for(int k=0; k<2; k++)
+                {
+                    const double interpolated =
+                        ((double)m00[k]*(1.-fx) + (double)m01[k]*fx)*(1.-fy) +
+                        ((double)m10[k]*(1.-fx) + (double)m11[k]*fx)*fy;
+                    const double d = interpolated - (double)e[k];
+                    d2 += d*d;
+                }
+                // NaN (a failed projection) fails this test, and is ignored
+                if(d2 > max_error*max_error)
+                    max_error = sqrt(d2);
+            }
+    }
+    free(centers);
+
+    *max_interpolation_error = max_error;
     return true;
 }
+
+// mrcal_stereo_range() and mrcal_stereo_unproject() split the rows across
+// threads only if each thread gets at least this many pixels
+#define STEREO_UNPROJECT_NPIXELS_PER_THREAD_MIN 65536
+
+typedef struct
+{
+    // Either may be NULL
+    double* p;
+    int     p_stride0, p_stride1, p_stride2;
+    double* range;
+    int     range_stride0, range_stride1;
+
+    const mrcal_image_uint16_t* disparity;
+
+    mrcal_lensmodel_type_t rectification_model_type;
+    double                 fy, cy;
+    double                 baseline;
+
+    // The azimuth of each column. LENSMODEL_LATLON: sin(az0), cos(az0).
+    // LENSMODEL_PINHOLE: tan(az0), and az_b is unused
+    const double* az_a;
+    const double* az_b;
+
+    // Indexed by the disparity value. lut_valid is 1 for valid disparities and
+    // 0 otherwise. lut is 0 for invalid disparities. Otherwise it is
+    // baseline/tan(disparity) for LENSMODEL_LATLON and the z coordinate of the
+    // point for LENSMODEL_PINHOLE. Everything then evaluates to 0 for invalid
+    // disparities without any branching
+    const double* lut;
+    const double* lut_valid;
+
+    // The transformation to apply to the points. Identity if we're reporting
+    // the points in the rectified camera-0 coordinates
+    double Rt_out_rect0[4*3];
+} stereo_unproject_ctx_t;
+
+static void stereo_unproject_rows(int i0, int i1, int ichunk,
+                                  void* cookie)
+{
+    (void)ichunk;
+    const stereo_unproject_ctx_t* ctx = (const stereo_unproject_ctx_t*)cookie;
+
+    // The names the P2(), P3() macros expect
+    double*   p             = ctx->p;
+    const int p_stride0     = ctx->p_stride0;
+    const int p_stride1     = ctx->p_stride1;
+    const int p_stride2     = ctx->p_stride2;
+    double*   range         = ctx->range;
+    const int range_stride0 = ctx->range_stride0;
+    const int range_stride1 = ctx->range_stride1;
+
+    const int     W  = ctx->disparity->w;
+    const double* R  = &ctx->Rt_out_rect0[0];
+    const double* t  = &ctx->Rt_out_rect0[9];
+
+    for(int i=i0; i<i1; i++)
+    {
+        const uint16_t* d =
+            (const uint16_t*)&((const uint8_t*)ctx->disparity->data)[(size_t)i*ctx->disparity->stride];
+        // LENSMODEL_LATLON: el is an angle. LENSMODEL_PINHOLE: el is tan(el),
+        // and we don't need its sin/cos
+        const double el  = ((double)i - ctx->cy) / ctx->fy;
+        double       sel = 0., cel = 0.;
+        if(ctx->rectification_model_type == MRCAL_LENSMODEL_LATLON)
+        {
+            sel = sin(el);
+            cel = cos(el);
+        }
+
+        for(int j=0; j<W; j++)
+        {
+            const double valid = ctx->lut_valid[d[j]];
+            double r;
+            double v[3];
+
+            if(ctx->rectification_model_type == MRCAL_LENSMODEL_LATLON)
+            {
+                // r = baseline cos(az0 - disparity) / sin(disparity)
+                const double saz = ctx->az_a[j];
+                const double caz = ctx->az_b[j];
+                r    = ctx->lut[d[j]]*caz + valid*ctx->baseline*saz;
+                v[0] = r*saz;
+                v[1] = r*caz*sel;
+                v[2] = r*caz*cel;
+            }
+            else
+            {
+                // The point is z*(tan(az0), tan(el), 1)
+                const double tanaz = ctx->az_a[j];
+                const double z     = ctx->lut[d[j]];
+                r    = z*sqrt(1. + tanaz*tanaz + el*el);
+                v[0] = z*tanaz;
+                v[1] = z*el;
+                v[2] = z;
+            }
+
+            if(range != NULL)
+                P2(range, i,j) = r;
+            if(p != NULL)
+                for(int k=0; k<3; k++)
+                    P3(p, i,j,k) =
+                        R[3*k+0]*v[0] + R[3*k+1]*v[1] + R[3*k+2]*v[2] +
+                        valid*t[k];
+        }
+    }
+}
+
+static bool stereo_unproject(// output
+                             double* p,
+                             int p_stride0, int p_stride1, int p_stride2,
+                             double* range,
+                             int range_stride0, int range_stride1,
+
+                             // input
+                             const mrcal_image_uint16_t* disparity,
+                             double disparity_scale,
+                             double disparity_min,
+                             const mrcal_lensmodel_type_t rectification_model_type,
+                             const double*                fxycxy_rectified,
+                             const double*                rt_rect0_ref,
+                             double                       baseline)
+{
+    if( !(rectification_model_type == MRCAL_LENSMODEL_LATLON ||
+          rectification_model_type == MRCAL_LENSMODEL_PINHOLE) )
+    {
+        MSG("Unsupported rectification model '%s'. Only LENSMODEL_LATLON and LENSMODEL_PINHOLE are supported",
+            mrcal_lensmodel_name_unconfigured( &(mrcal_lensmodel_t){.type = rectification_model_type}));
+        return false;
+    }
+    if(!(disparity_scale > 0.))
+    {
+        MSG("disparity_scale must be > 0. Got %f", disparity_scale);
+        return false;
+    }
+
+    const int W = disparity->w;
+    const int H = disparity->h;
+    if(W <= 0 || H <= 0)
+        return true;
+
+    init_stride_3D(p,     H, W, 3);
+    init_stride_2D(range, H, W);
+
+    const double fx = fxycxy_rectified[0];
+    const double cx = fxycxy_rectified[2];
+
+    stereo_unproject_ctx_t ctx = {.p                        = p,
+                                  .p_stride0                = p_stride0,
+                                  .p_stride1                = p_stride1,
+                                  .p_stride2                = p_stride2,
+                                  .range                    = range,
+                                  .range_stride0            = range_stride0,
+                                  .range_stride1            = range_stride1,
+                                  .disparity                = disparity,
+                                  .rectification_model_type = rectification_model_type,
+                                  .fy                       = fxycxy_rectified[1],
+                                  .cy                       = fxycxy_rectified[3],
+                                  .baseline                 = baseline};
+
+    if(rt_rect0_ref != NULL)
+    {
+        double Rt_rect0_ref[4*3];
+        mrcal_Rt_from_rt(Rt_rect0_ref, NULL, rt_rect0_ref);
+        mrcal_invert_Rt(ctx.Rt_out_rect0, Rt_rect0_ref);
+    }
+    else
+    {
+        memset(ctx.Rt_out_rect0, 0, sizeof(ctx.Rt_out_rect0));
+        ctx.Rt_out_rect0[0] = ctx.Rt_out_rect0[4] = ctx.Rt_out_rect0[8] = 1.;
+    }
+
+    // The lookup table only needs to cover the disparities that we actually
+    // have
+    int dmax = 0;
+    for(int i=0; i<H; i++)
+    {
+        const uint16_t* d =
+            (const uint16_t*)&((const uint8_t*)disparity->data)[(size_t)i*disparity->stride];
+        for(int j=0; j<W; j++)
+            if(d[j] > dmax) dmax = d[j];
+    }
+
+    int Nthreads = (int)(((size_t)W*H) / STEREO_UNPROJECT_NPIXELS_PER_THREAD_MIN);
+    if(Nthreads < 1) Nthreads = 1;
+    if(Nthreads > _mrcal_num_threads(0)) Nthreads = _mrcal_num_threads(0);
+
+    bool    result    = false;
+    double* az_a      = (double*)malloc(W*sizeof(double));
+    double* az_b      = (double*)malloc(W*sizeof(double));
+    double* lut       = (double*)malloc((dmax+1)*sizeof(double));
+    double* lut_valid = (double*)malloc((dmax+1)*sizeof(double));
+    if(az_a == NULL || az_b == NULL || lut == NULL || lut_valid == NULL)
+    {
+        MSG("Couldn't allocate the scratch");
+        goto done;
+    }
+
+    for(int j=0; j<W; j++)
+    {
+        const double az0 = ((double)j - cx) / fx;
+        if(rectification_model_type == MRCAL_LENSMODEL_LATLON)
+        {
+            az_a[j] = sin(az0);
+            az_b[j] = cos(az0);
+        }
+        else
+            az_a[j] = az0;
+    }
+
+    for(int k=0; k<=dmax; k++)
+    {
+        if((double)k <= disparity_min*disparity_scale)
+        {
+            lut[k]       = 0.;
+            lut_valid[k] = 0.;
+            continue;
+        }
+
+        // The disparity is an angle with LENSMODEL_LATLON, and a difference
+        // of tangents with LENSMODEL_PINHOLE
+        const double disparity_normalized = (double)k / (fx * disparity_scale);
+        if(rectification_model_type == MRCAL_LENSMODEL_LATLON)
+            lut[k] = baseline / tan(disparity_normalized);
+        else
+            lut[k] = baseline / disparity_normalized;
+        lut_valid[k] = 1.;
+    }
+
+    ctx.az_a      = az_a;
+    ctx.az_b      = az_b;
+    ctx.lut       = lut;
+    ctx.lut_valid = lut_valid;
+
+    _mrcal_parallel_for(H, Nthreads,
+                        stereo_unproject_rows, &ctx);
+    result = true;
+
+ done:
+    free(az_a);
+    free(az_b);
+    free(lut);
+    free(lut_valid);
+    return result;
+}
+
+bool mrcal_stereo_range(// output
+                        double* range,
+                        int range_stride0,
+                        int range_stride1,
+
+                        // input
+                        const mrcal_image_uint16_t* disparity,
+                        double disparity_scale,
+                        double disparity_min,
+                        const mrcal_lensmodel_type_t rectification_model_type,
+                        const double*                fxycxy_rectified,
+                        double                       baseline)
+{
+    return stereo_unproject(NULL, 0, 0, 0,
+                            range, range_stride0, range_stride1,
+                            disparity, disparity_scale, disparity_min,
+                            rectification_model_type, fxycxy_rectified,
+                            NULL, baseline);
+}
+
+bool mrcal_stereo_unproject(// output
+                            double* p,
+                            int p_stride0,
+                            int p_stride1,
+                            int p_stride2,
+                            double* range,
+                            int range_stride0,
+                            int range_stride1,
+
+                            // input
+                            const mrcal_image_uint16_t* disparity,
+                            double disparity_scale,
+                            double disparity_min,
+                            const mrcal_lensmodel_type_t rectification_model_type,
+                            const double*                fxycxy_rectified,
+                            const double*                rt_rect0_ref,
+                            double                       baseline)
+{
+    return stereo_unproject(p, p_stride0, p_stride1, p_stride2,
+                            range, range_stride0, range_stride1,
+                            disparity, disparity_scale, disparity_min,
+                            rectification_model_type, fxycxy_rectified,
+                            rt_rect0_ref, baseline);
+}
+
+#define RECTIFY_DEFINE(T, Tname)                                        \
+bool mrcal_image_ ## Tname ## _rectify(/* output */                     \
+                                       mrcal_image_ ## Tname ## _t* images_rectified, \
+                                                                        \
+                                       /* input */                      \
+                                       const mrcal_image_ ## Tname ## _t* images, \
+                                                                        \
+                                       const mrcal_lensmodel_t* lensmodel0, \
+                                       const double*            intrinsics0, \
+                                       const double*            r_cam0_ref, \
+                                                                        \
+                                       const mrcal_lensmodel_t* lensmodel1, \
+                                       const double*            intrinsics1, \
+                                       const double*            r_cam1_ref, \
+                                                                        \
+                                       const mrcal_lensmodel_type_t rectification_model_type, \
+                                       const double*                fxycxy_rectified, \
+                                       const double*                r_rect0_ref) \
+{                                                                       \
+    if(images_rectified[0].w != images_rectified[1].w ||                \
+       images_rectified[0].h != images_rectified[1].h)                  \
+    {                                                                   \
+        MSG("Both rectified images must have the same dimensions. Got (%d,%d) and (%d,%d)", \
+            images_rectified[0].w, images_rectified[0].h,               \
+            images_rectified[1].w, images_rectified[1].h);              \
+        return false;                                                   \
+    }                                                                   \
+    if(images_rectified[0].w <= 0 || images_rectified[0].h <= 0)        \
+        return true;                                                    \
+                                                                        \
+    const unsigned int imagersize_rectified[] =                         \
+        { (unsigned int)images_rectified[0].w,                          \
+          (unsigned int)images_rectified[0].h };                        \
+    void* const       out[] = { &images_rectified[0], &images_rectified[1] }; \
+    const void* const in [] = { &images          [0], &images          [1] }; \
+                                                                        \
+    return rectification_maps_grid(NULL,                                \
+                                   out,                                 \
+                                   lensmodel0, intrinsics0, r_cam0_ref, \
+                                   lensmodel1, intrinsics1, r_cam1_ref, \
+                                   rectification_model_type,            \
+                                   fxycxy_rectified,                    \
+                                   r_rect0_ref,                         \
+                                   imagersize_rectified,                \
+                                   0., 0., 1,                           \
+                                   in,                                  \
+                                   _mrcal_image_ ## Tname ## _remap_row); \
+}
+
+RECTIFY_DEFINE(uint8_t,  uint8)
+RECTIFY_DEFINE(uint16_t, uint16)
+RECTIFY_DEFINE(bgr_t,    bgr)
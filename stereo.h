@@ -9,6 +9,7 @@
 #pragma once
 
 #include "mrcal-types.h"
+#include "mrcal-image.h"
 
 // The reference implementation in Python is _rectified_resolution_python() in
 // stereo.py
@@ -70,6 +71,9 @@ bool mrcal_rectified_system(// output
 //
 // The Python wrapper is mrcal.rectification_maps(), and the documentation is in
 // the docstring of that function
+//
+// rectification_model_type may be MRCAL_LENSMODEL_LATLON, MRCAL_LENSMODEL_PINHOLE
+// or MRCAL_LENSMODEL_STEREOGRAPHIC
 bool mrcal_rectification_maps(// output
                               // Dense array of shape (Ncameras=2, Nel, Naz, Nxy=2)
                               float* rectification_maps,
@@ -87,3 +91,182 @@ bool mrcal_rectification_maps(// output
                               const double*                fxycxy_rectified,
                               const unsigned int*          imagersize_rectified,
                               const double*                r_rect0_ref);
+
+// Sparse rectification maps
+//
+// The same maps as mrcal_rectification_maps(), but sampled only every "spacing"
+// rectified pixels in each direction: map entry (i,j) is for the rectified pixel
+// (j*spacing, i*spacing). The map is bilinearly interpolated in between; the
+// mrcal_image_..._remap_sparse() functions in mrcal-image.h do that while
+// remapping. The grid covers the whole rectified image, so its last row and
+// column may extend past the edge. The grid size is given by
+// mrcal_rectification_maps_sparse_gridsize(), which fails if spacing <= 0. With
+// spacing=8 or 16 these maps are ~100x smaller than the full-resolution ones
+//
+// If max_interpolation_error != NULL, we report an estimate of the worst error
+// of the interpolated map, in pixels in the input images. We compute this by
+// evaluating the exact maps at the center of each grid cell, where bilinear
+// interpolation is usually least accurate. It is an estimate, not a bound: the
+// error is only sampled at the cell centers, and cells whose exact map is NaN
+// (the projection failed) are skipped. This includes the parts of the map that
+// fall outside the input images, where the map is usually the most curved
+bool mrcal_rectification_maps_sparse_gridsize(// output
+                                              // (Naz_grid, Nel_grid)
+                                              unsigned int* gridsize,
+
+                                              // input
+                                              const unsigned int* imagersize_rectified,
+                                              int spacing);
+
+bool mrcal_rectification_maps_sparse(// output
+                                     // Dense array of shape (Ncameras=2, Nel_grid, Naz_grid, Nxy=2)
+                                     float* rectification_maps_sparse,
+                                     // May be NULL
+                                     double* max_interpolation_error,
+
+                                     // input
+                                     const mrcal_lensmodel_t* lensmodel0,
+                                     const double*            intrinsics0,
+                                     const double*            r_cam0_ref,
+
+                                     const mrcal_lensmodel_t* lensmodel1,
+                                     const double*            intrinsics1,
+                                     const double*            r_cam1_ref,
+
+                                     const mrcal_lensmodel_type_t rectification_model_type,
+                                     const double*                fxycxy_rectified,
+                                     const unsigned int*          imagersize_rectified,
+                                     const double*                r_rect0_ref,
+                                     int spacing);
+
+// Convert a disparity image to ranges and to a point cloud
+//
+// The Python equivalents are mrcal.stereo_range() and mrcal.stereo_unproject().
+// The documentation is in the docstrings of those functions. These work with a
+// full disparity image, from a stereo pair rectified with
+// MRCAL_LENSMODEL_LATLON or MRCAL_LENSMODEL_PINHOLE. fxycxy_rectified,
+// rt_rect0_ref and baseline are the outputs of mrcal_rectified_system()
+//
+// The disparities are in units of 1/disparity_scale pixels, as returned by
+// mrcal_stereo_matching_sgm() with disparity_scale =
+// MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE. Disparities <= disparity_min (in
+// pixels) are invalid, and produce a range of 0 and a point of (0,0,0)
+//
+// The output arrays are strided, like the mrcal_..._full() functions in
+// poseutils.h: each array is followed by its strides, in bytes. A stride <= 0
+// means "contiguous". So these can write directly into a slice of a larger
+// array. The rows are processed in parallel
+bool mrcal_stereo_range(// output
+                        // shape (Nel, Naz)
+                        double* range,
+                        int range_stride0, // in bytes. <= 0 means "contiguous"
+                        int range_stride1, // in bytes. <= 0 means "contiguous"
+
+                        // input
+                        // shape (Nel, Naz)
+                        const mrcal_image_uint16_t* disparity,
+                        double disparity_scale,
+                        double disparity_min,
+                        const mrcal_lensmodel_type_t rectification_model_type,
+                        const double*                fxycxy_rectified,
+                        double                       baseline);
+
+// Computes the points, in the reference coordinate system. If rt_rect0_ref is
+// NULL, the points are reported in the rectified camera-0 coordinate system
+// instead, like mrcal.stereo_unproject() does. If range != NULL, the ranges are
+// reported also, as they would be from mrcal_stereo_range()
+bool mrcal_stereo_unproject(// output
+                            // shape (Nel, Naz, 3)
+                            double* p,
+                            int p_stride0,     // in bytes. <= 0 means "contiguous"
+                            int p_stride1,     // in bytes. <= 0 means "contiguous"
+                            int p_stride2,     // in bytes. <= 0 means "contiguous"
+                            // shape (Nel, Naz). May be NULL
+                            double* range,
+                            int range_stride0, // in bytes. <= 0 means "contiguous"
+                            int range_stride1, // in bytes. <= 0 means "contiguous"
+
+                            // input
+                            // shape (Nel, Naz)
+                            const mrcal_image_uint16_t* disparity,
+                            double disparity_scale,
+                            double disparity_min,
+                            const mrcal_lensmodel_type_t rectification_model_type,
+                            const double*                fxycxy_rectified,
+                            // May be NULL
+                            const double*                rt_rect0_ref,
+                            double                       baseline);
+
+// Rectify a stereo pair of images, without computing the rectification maps
+//
+// This is equivalent to calling mrcal_rectification_maps(), and then
+// mrcal_image_..._remap() for each camera, but the full maps are never stored:
+// each row of the map is computed, and immediately used to remap that row of
+// the image. The output sizes are taken from images_rectified[], which must be
+// allocated by the caller, with identical dimensions in both cameras. These are
+// the imagersize_rectified that would be passed to mrcal_rectification_maps().
+// The same rectification models are supported
+#define MRCAL_IMAGE_RECTIFY_DECLARE(T, Tname)                           \
+bool mrcal_image_ ## Tname ## _rectify(/* output */                     \
+                                       /* Ncameras=2 images */          \
+                                       mrcal_image_ ## Tname ## _t* images_rectified, \
+                                                                        \
+                                       /* input */                      \
+                                       /* Ncameras=2 images */          \
+                                       const mrcal_image_ ## Tname ## _t* images, \
+                                                                        \
+                                       const mrcal_lensmodel_t* lensmodel0, \
+                                       const double*            intrinsics0, \
+                                       const double*            r_cam0_ref, \
+                                                                        \
+                                       const mrcal_lensmodel_t* lensmodel1, \
+                                       const double*            intrinsics1, \
+                                       const double*            r_cam1_ref, \
+                                                                        \
+                                       const mrcal_lensmodel_type_t rectification_model_type, \
+                                       const double*                fxycxy_rectified, \
+                                       const double*                r_rect0_ref);
+
+MRCAL_IMAGE_RECTIFY_DECLARE(uint8_t,  uint8);
+MRCAL_IMAGE_RECTIFY_DECLARE(uint16_t, uint16);
+MRCAL_IMAGE_RECTIFY_DECLARE(bgr_t,    bgr);
+
+// The disparities reported by mrcal_stereo_matching_sgm() are in units of
+// 1/MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE pixels. This is the
+// disparity_scale argument in mrcal.stereo_range() and friends
+#define MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE 16
+
+// Returns the default configuration of mrcal_stereo_matching_sgm(). These can
+// then be tweaked, and passed to mrcal_stereo_matching_sgm()
+mrcal_stereo_matching_sgm_parameters_t mrcal_stereo_matching_sgm_defaults(void);
+
+// Compute a dense disparity map from a rectified stereo pair
+//
+// This is a semi-global matcher (Hirschmuller, 2008), built into mrcal, with no
+// external dependencies. It is an alternative to
+// mrcal_stereo_matching_libelas(). The matching cost is the Hamming distance
+// between 9x7 census descriptors, which is insensitive to exposure
+// differences between the two cameras. The costs are aggregated along 5 paths:
+// left-to-right, right-to-left, and from above at 0 and +-45 degrees. This is
+// done in a single top-down pass, in strips of rows that are processed in
+// parallel. Each strip starts aggregating a few rows above its first output
+// row. The strips have a fixed size, so the results don't depend on the number
+// of threads
+//
+// image0 is the left image and image1 is the right image. A pixel x in image0
+// corresponds to x - disparity in image1. The output disparity image has the
+// same dimensions as the inputs, and contains disparities in units of
+// 1/MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE pixels, with subpixel
+// interpolation. Invalid matches are reported as 0: these are the pixels whose
+// match fell outside image1, or that failed the uniqueness or the left-right
+// consistency checks. mrcal.stereo_range() treats 0 as invalid, so these
+// disparity images can be passed to it directly
+bool mrcal_stereo_matching_sgm(// output
+                               mrcal_image_uint16_t* disparity,
+
+                               // input
+                               const mrcal_image_uint8_t* image0,
+                               const mrcal_image_uint8_t* image1,
+                               // May be NULL to use
+                               // mrcal_stereo_matching_sgm_defaults()
+                               const mrcal_stereo_matching_sgm_parameters_t* parameters);
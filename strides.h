@@ -24,10 +24,17 @@
     (i0) * (stride0) +                                  \
     (i1) * (stride1) +                                  \
     (i2) * (stride2)))
+#define _P4(x, stride0, stride1, stride2, stride3, i0, i1, i2, i3) \
+    (*(double*)( (char*)(x) +                                   \
+    (i0) * (stride0) +                                          \
+    (i1) * (stride1) +                                          \
+    (i2) * (stride2) +                                          \
+    (i3) * (stride3)))
 
 #define P1(x, i0)       _P1(x, x##_stride0,                           i0)
 #define P2(x, i0,i1)    _P2(x, x##_stride0, x##_stride1,              i0,i1)
 #define P3(x, i0,i1,i2) _P3(x, x##_stride0, x##_stride1, x##_stride2, i0,i1,i2)
+#define P4(x, i0,i1,i2,i3) _P4(x, x##_stride0, x##_stride1, x##_stride2, x##_stride3, i0,i1,i2,i3)
 
 // Init strides. If a given stride is <= 0, set the default, as we would have if
 // the data was contiguous
@@ -40,3 +47,8 @@
     if( x ## _stride2 <= 0) x ## _stride2 = sizeof(*x); \
     if( x ## _stride1 <= 0) x ## _stride1 = d2 * x ## _stride2; \
     if( x ## _stride0 <= 0) x ## _stride0 = d1 * x ## _stride1
+#define init_stride_4D(x, d0, d1, d2, d3)               \
+    if( x ## _stride3 <= 0) x ## _stride3 = sizeof(*x); \
+    if( x ## _stride2 <= 0) x ## _stride2 = d3 * x ## _stride3; \
+    if( x ## _stride1 <= 0) x ## _stride1 = d2 * x ## _stride2; \
+    if( x ## _stride0 <= 0) x ## _stride0 = d1 * x ## _stride1
@@ -0,0 +1,172 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Benchmark of the .cameramodel parser on synthetic models of increasing size.
+// Each model is written with mrcal_write_cameramodel_file(), and then parsed
+// from memory with mrcal_read_cameramodel_string(). Reports the parse
+// throughput, and checks that the values survive the round trip exactly. For
+// comparison, the same model is also read from the binary format
+//
+// Usage: bench-cameramodel-parser [NITERATIONS]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "mrcal.h"
+
+static bool read_file(std::string& out, const char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    if(fp == NULL)
+        return false;
+    char buf[65536];
+    size_t n;
+    out.clear();
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    fclose(fp);
+    return true;
+}
+
+template<typename F>
+static double best_of(int Niterations, const F& f)
+{
+    double best = 1e10;
+    for(int i=0; i<Niterations; i++)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        if(!f())
+            return -1.;
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(t1-t0).count());
+    }
+    return best;
+}
+
+static bool bench(const char* lensmodel_name, int Niterations)
+{
+    mrcal_lensmodel_t lensmodel;
+    if(!mrcal_lensmodel_from_name(&lensmodel, lensmodel_name))
+    {
+        fprintf(stderr, "Couldn't parse lensmodel '%s'\n", lensmodel_name);
+        return false;
+    }
+    const int Nintrinsics = mrcal_lensmodel_num_params(&lensmodel);
+
+    // Realistic magnitudes: a pixel-scale core, and small spline/distortion
+    // values with all their digits significant
+    std::vector<uint8_t> buf(sizeof(mrcal_cameramodel_t) + Nintrinsics*sizeof(double));
+    mrcal_cameramodel_t* model = (mrcal_cameramodel_t*)buf.data();
+    model->lensmodel     = lensmodel;
+    model->imagersize[0] = 6000;
+    model->imagersize[1] = 4000;
+    for(int i=0; i<6; i++)
+        model->rt_cam_ref[i] = drand48() - 0.5;
+    for(int i=0; i<Nintrinsics; i++)
+        model->intrinsics[i] =
+            i < 4 ?
+            1000. + 3000.*drand48() :
+            (drand48() - 0.5) * 1e-3;
+
+    char filename_text  [] = "/tmp/bench-cameramodel-parser.XXXXXX";
+    char filename_binary[] = "/tmp/bench-cameramodel-parser-binary.XXXXXX";
+    int fd;
+    if((fd = mkstemp(filename_text  )) < 0) return false;
+    close(fd);
+    if((fd = mkstemp(filename_binary)) < 0) return false;
+    close(fd);
+
+    std::string text;
+    bool result = false;
+    if(!mrcal_write_cameramodel_file       (filename_text,   model) ||
+       !mrcal_write_cameramodel_binary_file(filename_binary, model) ||
+       !read_file(text, filename_text))
+    {
+        fprintf(stderr, "Couldn't write the model\n");
+        goto done;
+    }
+
+    {
+        mrcal_cameramodel_t* parsed = NULL;
+        const double t_text =
+            best_of(Niterations,
+                    [&]()
+                    {
+                        if(parsed != NULL)
+                            mrcal_free_cameramodel(&parsed);
+                        parsed = mrcal_read_cameramodel_string(text.data(), (int)text.size());
+                        return parsed != NULL;
+                    });
+        if(t_text < 0)
+        {
+            fprintf(stderr, "Couldn't parse the model\n");
+            goto done;
+        }
+
+        const bool exact =
+            0 == memcmp(parsed->intrinsics, model->intrinsics, Nintrinsics*sizeof(double)) &&
+            0 == memcmp(parsed->rt_cam_ref, model->rt_cam_ref, sizeof(model->rt_cam_ref));
+        mrcal_free_cameramodel(&parsed);
+
+        const double t_binary =
+            best_of(Niterations,
+                    [&]()
+                    {
+                        mrcal_cameramodel_t* m =
+                            mrcal_read_cameramodel_binary_file(filename_binary);
+                        if(m == NULL)
+                            return false;
+                        mrcal_free_cameramodel(&m);
+                        return true;
+                    });
+
+        printf("%-70s %6d values %8.1f kB   text: %8.3f ms %7.1f MB/s %6.1f Mvalues/s%s   binary file: %7.3f ms\n",
+               lensmodel_name, Nintrinsics, text.size()/1e3,
+               t_text*1e3, text.size()/t_text/1e6, (Nintrinsics+6)/t_text/1e6,
+               exact ? "" : " NOT EXACT",
+               t_binary*1e3);
+        result = exact;
+    }
+
+ done:
+    unlink(filename_text);
+    unlink(filename_binary);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    int Niterations = 10;
+    if(argc >= 2)
+        Niterations = atoi(argv[1]);
+    if(Niterations <= 0)
+    {
+        fprintf(stderr, "Usage: %s [NITERATIONS]\n", argv[0]);
+        return 1;
+    }
+
+    printf("Best of %d runs\n", Niterations);
+    srand48(0);
+
+    const char* lensmodels[] =
+        { "LENSMODEL_OPENCV8",
+          "LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=30_Ny=20_fov_x_deg=170",
+          "LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=60_Ny=40_fov_x_deg=170",
+          "LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=120_Ny=80_fov_x_deg=170",
+          "LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=240_Ny=160_fov_x_deg=170" };
+
+    bool result = true;
+    for(const char* lensmodel : lensmodels)
+        result = bench(lensmodel, Niterations) && result;
+    return result ? 0 : 1;
+}
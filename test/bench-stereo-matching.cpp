@@ -0,0 +1,217 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Benchmark of the dense stereo matchers on a synthetic rectified pair with
+// known disparities. Reports the runtime and the accuracy of
+// mrcal_stereo_matching_sgm() and, if the library was built with libelas, of
+// mrcal_stereo_matching_libelas() on the same data
+//
+// Usage: bench-stereo-matching [WIDTH HEIGHT [NITERATIONS]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#include "mrcal.h"
+
+#if defined MRCAL_HAVE_LIBELAS
+extern "C"
+{
+#include "stereo-matching-libelas.h"
+};
+#endif
+
+// A smooth random texture, continuous in u: the matchers see it at subpixel
+// offsets
+struct texture_t
+{
+    int W, H;
+    std::vector<float> grid;
+
+    texture_t(int _W, int _H) : W(_W), H(_H), grid((size_t)_W*_H)
+    {
+        srand(0);
+        for(auto& g : grid)
+            g = (float)(rand() % 256);
+    }
+
+    uint8_t at(double u, int v) const
+    {
+        // The texture has features every 2 pixels
+        u /= 2.;
+        const int    iu = (int)floor(u);
+        const double fu = u - (double)iu;
+        const float* row = &grid[(size_t)(v/2 % H)*W];
+        const float  a  = row[((iu  ) % W + W) % W];
+        const float  b  = row[((iu+1) % W + W) % W];
+        return (uint8_t)(a + (b-a)*fu + 0.5);
+    }
+};
+
+// The scene: a plane sloping away from the camera (the disparity decreases from
+// the bottom of the image to the top), with a fronto-parallel box in front of it
+static double disparity_background(int y, int H) { return 20. + 30.*(double)y/(double)H; }
+static const double disparity_box = 70.5;
+static bool in_box(double x, int y, int W, int H)
+{
+    return x >= W/3 && x < 2*W/3 && y >= H/3 && y < 2*H/3;
+}
+
+static void make_pair(// out
+                      std::vector<uint8_t>& image0,
+                      std::vector<uint8_t>& image1,
+                      std::vector<double>&  disparity_true,
+                      // in
+                      int W, int H)
+{
+    texture_t background(4*W, 4*H), box(4*W, 4*H);
+    image0.resize((size_t)W*H);
+    image1.resize((size_t)W*H);
+    disparity_true.resize((size_t)W*H);
+
+    for(int y=0; y<H; y++)
+        for(int x=0; x<W; x++)
+        {
+            const size_t i = (size_t)y*W + x;
+
+            // Left camera
+            if(in_box(x, y, W, H))
+            {
+                image0[i]         = box.at(x, y);
+                disparity_true[i] = disparity_box;
+            }
+            else
+            {
+                image0[i]         = background.at(x, y);
+                disparity_true[i] = disparity_background(y, H);
+            }
+
+            // Right camera: pixel x corresponds to x + disparity in the left
+            // camera
+            const double xbox = x + disparity_box;
+            if(in_box(xbox, y, W, H))
+                image1[i] = box.at(xbox, y);
+            else
+                image1[i] = background.at(x + disparity_background(y, H), y);
+        }
+}
+
+static void report(const char* what,
+                   double seconds,
+                   const float* disparity, // in pixels. <= 0 is invalid
+                   const std::vector<double>& disparity_true,
+                   int W, int H, int Ndisparities)
+{
+    int    Nvalid = 0, Ngood = 0;
+    double sum_abs_error = 0.;
+    int    Nconsidered   = 0;
+    for(int y=0; y<H; y++)
+        // The left edge can't be matched
+        for(int x=Ndisparities; x<W; x++)
+        {
+            const size_t i = (size_t)y*W + x;
+            Nconsidered++;
+            if(!(disparity[i] > 0.f))
+                continue;
+            Nvalid++;
+            const double e = fabs(disparity[i] - disparity_true[i]);
+            if(e < 1.)
+            {
+                Ngood++;
+                sum_abs_error += e;
+            }
+        }
+
+    printf("%-8s %8.1f ms   valid: %5.1f%%   within 1px: %5.1f%% of the valid   mean |error| of those: %.3f px\n",
+           what, seconds*1e3,
+           100.*Nvalid/Nconsidered,
+           Nvalid > 0 ? 100.*Ngood/Nvalid : 0.,
+           Ngood  > 0 ? sum_abs_error/Ngood : 0.);
+}
+
+int main(int argc, char* argv[])
+{
+    int W = 1280, H = 960, Niterations = 3;
+    if(argc >= 3)
+    {
+        W = atoi(argv[1]);
+        H = atoi(argv[2]);
+    }
+    if(argc >= 4)
+        Niterations = atoi(argv[3]);
+    if(W <= 0 || H <= 0 || Niterations <= 0)
+    {
+        fprintf(stderr, "Usage: %s [WIDTH HEIGHT [NITERATIONS]]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> image0, image1;
+    std::vector<double>  disparity_true;
+    make_pair(image0, image1, disparity_true, W, H);
+
+    mrcal_image_uint8_t im0 = {.w = W, .h = H, .stride = W, .data = image0.data()};
+    mrcal_image_uint8_t im1 = {.w = W, .h = H, .stride = W, .data = image1.data()};
+
+    mrcal_stereo_matching_sgm_parameters_t parameters =
+        mrcal_stereo_matching_sgm_defaults();
+    parameters.Ndisparities = 96;
+
+    printf("%dx%d synthetic pair; disparities [0,%d); best of %d runs\n",
+           W, H, parameters.Ndisparities, Niterations);
+
+    {
+        std::vector<uint16_t> disparity((size_t)W*H);
+        mrcal_image_uint16_t d = {.w = W, .h = H, .stride = (int)(W*sizeof(uint16_t)),
+                                  .data = disparity.data()};
+        double best = 1e10;
+        for(int i=0; i<Niterations; i++)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            if(!mrcal_stereo_matching_sgm(&d, &im0, &im1, &parameters))
+            {
+                fprintf(stderr, "mrcal_stereo_matching_sgm() failed\n");
+                return 1;
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(t1-t0).count());
+        }
+
+        std::vector<float> disparity_px((size_t)W*H);
+        for(size_t i=0; i<disparity_px.size(); i++)
+            disparity_px[i] = (float)disparity[i] / MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE;
+        report("sgm", best, disparity_px.data(), disparity_true, W, H, parameters.Ndisparities);
+    }
+
+#if defined MRCAL_HAVE_LIBELAS
+    {
+        std::vector<float> disparity0((size_t)W*H), disparity1((size_t)W*H);
+        double best = 1e10;
+        for(int i=0; i<Niterations; i++)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            // The "ROBOTICS" settings, as in elas-genpywrap.py
+            mrcal_stereo_matching_libelas(disparity0.data(), disparity1.data(),
+                                          image0.data(), image1.data(),
+                                          W, H, W,
+                                          0, parameters.Ndisparities-1,
+                                          0.85f, 10, 5, 5, 5, 5, false, 20,
+                                          0.02f, 3.f, 1.f, 2.f, 1, 2, 1.f, 200, 3,
+                                          false, true, true, false);
+            auto t1 = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(t1-t0).count());
+        }
+        report("libelas", best, disparity0.data(), disparity_true, W, H, parameters.Ndisparities);
+    }
+#else
+    printf("libelas: not available in this build\n");
+#endif
+
+    return 0;
+}
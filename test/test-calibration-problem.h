@@ -0,0 +1,212 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#pragma once
+
+// A small synthetic chessboard calibration, for the tests of the solvers. Two
+// cameras look at a board in a number of poses. The observations are the
+// projections of the board through the true geometry, plus a bit of
+// deterministic noise, so the problem is well-posed and has a unique optimum.
+// The seed is the truth, perturbed
+
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+
+#define TEST_PROBLEM_NCAMERAS  2
+#define TEST_PROBLEM_NFRAMES_MAX 8
+#define TEST_PROBLEM_BOARD_W   10
+#define TEST_PROBLEM_BOARD_H   9
+#define TEST_PROBLEM_SPACING   0.1
+#define TEST_PROBLEM_NINTRINSICS_MAX 1024
+
+typedef struct
+{
+    mrcal_lensmodel_t lensmodel;
+    int               Nintrinsics;
+    int               imagersizes[TEST_PROBLEM_NCAMERAS*2];
+
+    // The seed. The solvers overwrite these
+    double                 intrinsics[TEST_PROBLEM_NCAMERAS*TEST_PROBLEM_NINTRINSICS_MAX];
+    mrcal_pose_t           extrinsics[TEST_PROBLEM_NCAMERAS-1];
+    mrcal_pose_t           frames    [TEST_PROBLEM_NFRAMES_MAX];
+    mrcal_calobject_warp_t calobject_warp;
+
+    // Each frame is observed by each camera
+    int                       Nframes;
+    int                       Nobservations_board;
+    mrcal_observation_board_t observations_board[TEST_PROBLEM_NFRAMES_MAX*TEST_PROBLEM_NCAMERAS];
+    mrcal_point3_t            observations_board_pool[TEST_PROBLEM_NFRAMES_MAX*TEST_PROBLEM_NCAMERAS *
+                                                      TEST_PROBLEM_BOARD_W*TEST_PROBLEM_BOARD_H];
+
+    mrcal_problem_selections_t problem_selections;
+    mrcal_problem_constants_t  problem_constants;
+} test_problem_t;
+
+// Deterministic noise in [-1,1]
+static double test_problem_noise(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)((*seed >> 8) & 0xffff) / 32767.5 - 1.0;
+}
+
+// Fills in the problem. lensmodel_name is anything with a core, and with at
+// most TEST_PROBLEM_NINTRINSICS_MAX parameters: OPENCV4, a small splined
+// model, ... Returns false on error
+static bool test_problem_init(test_problem_t* problem,
+                              const char* lensmodel_name,
+                              int Nframes)
+{
+    memset(problem, 0, sizeof(*problem));
+    if(Nframes > TEST_PROBLEM_NFRAMES_MAX ||
+       !mrcal_lensmodel_from_name(&problem->lensmodel, lensmodel_name))
+        return false;
+    problem->Nintrinsics = mrcal_lensmodel_num_params(&problem->lensmodel);
+    if(problem->Nintrinsics > TEST_PROBLEM_NINTRINSICS_MAX)
+        return false;
+
+    const int Nintrinsics = problem->Nintrinsics;
+    unsigned int seed = 1;
+
+    // The truth
+    double       intrinsics[TEST_PROBLEM_NCAMERAS*TEST_PROBLEM_NINTRINSICS_MAX];
+    mrcal_pose_t extrinsics[TEST_PROBLEM_NCAMERAS-1];
+    mrcal_pose_t frames    [TEST_PROBLEM_NFRAMES_MAX];
+    for(int icam=0; icam<TEST_PROBLEM_NCAMERAS; icam++)
+    {
+        double* x = &intrinsics[icam*Nintrinsics];
+        x[0] = 1800. + 50.*icam;
+        x[1] = 1810. + 50.*icam;
+        x[2] = 1999.5 + 10.*icam;
+        x[3] = 1499.5 - 10.*icam;
+        for(int i=4; i<Nintrinsics; i++)
+            x[i] = 0.02 * test_problem_noise(&seed) / (double)(i-3);
+
+        problem->imagersizes[2*icam + 0] = 4000;
+        problem->imagersizes[2*icam + 1] = 3000;
+    }
+    extrinsics[0] = (mrcal_pose_t){ .r = {.xyz = { 0.01, -0.05, 0.02}},
+                                    .t = {.xyz = {-0.5,   0.01, 0.02}} };
+    for(int i=0; i<Nframes; i++)
+    {
+        // The board is ~1m across, a few meters away, tilted in various ways,
+        // and roughly in view of both cameras
+        const double th = 2.*M_PI*(double)i/(double)Nframes;
+        frames[i] = (mrcal_pose_t){ .r = {.xyz = { 0.4*cos(th), 0.4*sin(th), 0.1*(double)(i%3) - 0.1}},
+                                    .t = {.xyz = {-0.7 + 0.2*cos(th), -0.5 + 0.2*sin(th), 2.5 + 0.15*(double)i}} };
+    }
+
+    problem->Nframes             = Nframes;
+    problem->Nobservations_board = Nframes*TEST_PROBLEM_NCAMERAS;
+
+    const int Npoints_board = TEST_PROBLEM_BOARD_W*TEST_PROBLEM_BOARD_H;
+    for(int iframe=0; iframe<Nframes; iframe++)
+        for(int icam=0; icam<TEST_PROBLEM_NCAMERAS; icam++)
+        {
+            const int iobservation = iframe*TEST_PROBLEM_NCAMERAS + icam;
+            problem->observations_board[iobservation] =
+                (mrcal_observation_board_t){ .icam   = { .intrinsics = icam,
+                                                         .extrinsics = icam-1 },
+                                             .iframe = iframe };
+
+            for(int j=0; j<TEST_PROBLEM_BOARD_H; j++)
+                for(int k=0; k<TEST_PROBLEM_BOARD_W; k++)
+                {
+                    mrcal_point3_t p = {.xyz = { (double)k*TEST_PROBLEM_SPACING,
+                                                 (double)j*TEST_PROBLEM_SPACING,
+                                                 0. }};
+                    mrcal_transform_point_rt(p.xyz, NULL, NULL,
+                                             frames[iframe].r.xyz, p.xyz);
+                    if(icam > 0)
+                        mrcal_transform_point_rt(p.xyz, NULL, NULL,
+                                                 extrinsics[icam-1].r.xyz, p.xyz);
+
+                    mrcal_point2_t q;
+                    if(!mrcal_project(&q, NULL, NULL, &p, 1,
+                                      &problem->lensmodel,
+                                      &intrinsics[icam*Nintrinsics]))
+                        return false;
+
+                    mrcal_point3_t* observation =
+                        &problem->observations_board_pool[iobservation*Npoints_board +
+                                                          j*TEST_PROBLEM_BOARD_W + k];
+                    observation->x = q.x + 0.3*test_problem_noise(&seed);
+                    observation->y = q.y + 0.3*test_problem_noise(&seed);
+                    observation->z = 1.0;
+                }
+        }
+
+    // The seed: the truth, perturbed
+    memcpy(problem->intrinsics, intrinsics, TEST_PROBLEM_NCAMERAS*Nintrinsics*sizeof(double));
+    for(int icam=0; icam<TEST_PROBLEM_NCAMERAS; icam++)
+    {
+        double* x = &problem->intrinsics[icam*Nintrinsics];
+        for(int i=0; i<4; i++)
+            x[i] += 10.*test_problem_noise(&seed);
+        for(int i=4; i<Nintrinsics; i++)
+            x[i] = 0.;
+    }
+    memcpy(problem->extrinsics, extrinsics, sizeof(extrinsics));
+    memcpy(problem->frames,     frames,     Nframes*sizeof(frames[0]));
+    for(int i=0; i<3; i++)
+    {
+        problem->extrinsics[0].r.xyz[i] += 0.01*test_problem_noise(&seed);
+        problem->extrinsics[0].t.xyz[i] += 0.02*test_problem_noise(&seed);
+        for(int iframe=0; iframe<Nframes; iframe++)
+        {
+            problem->frames[iframe].r.xyz[i] += 0.02*test_problem_noise(&seed);
+            problem->frames[iframe].t.xyz[i] += 0.05*test_problem_noise(&seed);
+        }
+    }
+
+    problem->problem_selections =
+        (mrcal_problem_selections_t){ .do_optimize_intrinsics_core        = true,
+                                      .do_optimize_intrinsics_distortions = true,
+                                      .do_optimize_extrinsics             = true,
+                                      .do_optimize_frames                 = true,
+                                      .do_optimize_calobject_warp         = true,
+                                      .do_apply_regularization            = true,
+                                      .do_apply_outlier_rejection         = false };
+    problem->problem_constants =
+        (mrcal_problem_constants_t){ .point_min_range = 1.0,
+                                     .point_max_range = 1000.0 };
+    return true;
+}
+
+// Solves the problem from its seed with mrcal_optimize(), using the first
+// Nframes frames and Nobservations_board observations. The solution is written
+// back into the problem. progress_callback may be NULL
+static mrcal_stats_t test_problem_optimize(test_problem_t* problem,
+                                           int Nframes, int Nobservations_board,
+                                           const mrcal_solver_options_t* solver_options,
+                                           mrcal_optimizer_progress_callback_t* progress_callback,
+                                           void* progress_cookie)
+{
+    return mrcal_optimize(NULL, 0, NULL, 0,
+                          problem->intrinsics,
+                          problem->extrinsics,
+                          problem->frames,
+                          NULL,
+                          &problem->calobject_warp,
+                          TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                          Nframes, 0, 0,
+                          problem->observations_board, NULL,
+                          Nobservations_board, 0,
+                          problem->observations_board_pool,
+                          &problem->lensmodel,
+                          problem->imagersizes,
+                          problem->problem_selections,
+                          &problem->problem_constants,
+                          TEST_PROBLEM_SPACING,
+                          TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                          false,
+                          solver_options,
+                          progress_callback, progress_cookie,
+                          false);
+}
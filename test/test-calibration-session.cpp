@@ -0,0 +1,142 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of mrcal_calibration_session_...(). A session that is solved, extended
+// and re-solved must land at the same optimum as a fresh mrcal_optimize() of
+// the whole problem. The sessions use mrcal's own dogleg solver, while
+// mrcal_optimize() uses libdogleg, so this compares the two as well
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test-harness.h"
+#include "test-calibration-problem.h"
+
+#define NFRAMES  6
+#define NFRAMES0 4
+
+static void confirm_same_optimum(const test_problem_t* ref,
+                                 const double*                 intrinsics,
+                                 const mrcal_pose_t*           extrinsics,
+                                 const mrcal_pose_t*           frames,
+                                 const mrcal_calobject_warp_t* calobject_warp)
+{
+    const int Nintrinsics = ref->Nintrinsics;
+    for(int icam=0; icam<TEST_PROBLEM_NCAMERAS; icam++)
+    {
+        // The core in pixels, the distortions unitless
+        confirm_eq_double_max_array(&intrinsics[icam*Nintrinsics],
+                                    &ref->intrinsics[icam*Nintrinsics],
+                                    4, 1e-3);
+        confirm_eq_double_max_array(&intrinsics[icam*Nintrinsics + 4],
+                                    &ref->intrinsics[icam*Nintrinsics + 4],
+                                    Nintrinsics-4, 1e-6);
+    }
+    confirm_eq_double_max_array(extrinsics[0].r.xyz, ref->extrinsics[0].r.xyz, 6, 1e-6);
+    for(int i=0; i<NFRAMES; i++)
+        confirm_eq_double_max_array(frames[i].r.xyz, ref->frames[i].r.xyz, 6, 1e-6);
+    confirm_eq_double_max_array(calobject_warp->values, ref->calobject_warp.values, 2, 1e-6);
+}
+
+static void test_session(mrcal_solver_t solver)
+{
+    test_problem_t problem;
+    confirm(test_problem_init(&problem, "LENSMODEL_OPENCV4", NFRAMES));
+
+    mrcal_solver_options_t solver_options =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    solver_options.solver = solver;
+
+    // The reference: a fresh solve of everything, from the seed
+    test_problem_t* ref = (test_problem_t*)malloc(sizeof(test_problem_t));
+    *ref = problem;
+    const mrcal_stats_t stats_ref =
+        test_problem_optimize(ref, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                              &solver_options, NULL, NULL);
+    confirm(stats_ref.rms_reproj_error__pixels >= 0);
+    // The noise is uniform in [-0.3,0.3]: rms ~ 0.17
+    confirm(stats_ref.rms_reproj_error__pixels < 0.3);
+
+    // The session sees the first NFRAMES0 frames first
+    mrcal_calibration_session_t* session =
+        mrcal_calibration_session_create(problem.intrinsics,
+                                         problem.extrinsics,
+                                         problem.frames,
+                                         NULL,
+                                         &problem.calobject_warp,
+                                         TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                                         NFRAMES0, 0, 0,
+                                         problem.observations_board, NULL,
+                                         NFRAMES0*TEST_PROBLEM_NCAMERAS, 0,
+                                         problem.observations_board_pool,
+                                         &problem.lensmodel,
+                                         problem.imagersizes,
+                                         problem.problem_selections,
+                                         &problem.problem_constants,
+                                         TEST_PROBLEM_SPACING,
+                                         TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                                         false,
+                                         &solver_options);
+    confirm(session != NULL);
+    if(session == NULL)
+    {
+        free(ref);
+        return;
+    }
+
+    mrcal_stats_t stats =
+        mrcal_calibration_session_solve(session, NULL, NULL, NULL, 0, NULL, 0);
+    confirm(stats.rms_reproj_error__pixels >= 0);
+
+    const int Npoints_board = TEST_PROBLEM_BOARD_W*TEST_PROBLEM_BOARD_H;
+    confirm(mrcal_calibration_session_add_frames(session,
+                                                 &problem.frames[NFRAMES0],
+                                                 NFRAMES-NFRAMES0));
+    confirm(mrcal_calibration_session_add_observations_board(session,
+                                                             &problem.observations_board[NFRAMES0*TEST_PROBLEM_NCAMERAS],
+                                                             &problem.observations_board_pool[NFRAMES0*TEST_PROBLEM_NCAMERAS*Npoints_board],
+                                                             (NFRAMES-NFRAMES0)*TEST_PROBLEM_NCAMERAS));
+    confirm_eq_int(mrcal_calibration_session_num_frames(session), NFRAMES);
+    confirm_eq_int(mrcal_calibration_session_num_observations_board(session),
+                   NFRAMES*TEST_PROBLEM_NCAMERAS);
+
+    stats = mrcal_calibration_session_solve(session, NULL, NULL, NULL, 0, NULL, 0);
+    confirm_eq_double(stats.rms_reproj_error__pixels,
+                      stats_ref.rms_reproj_error__pixels, 1e-6);
+
+    double                 intrinsics[TEST_PROBLEM_NCAMERAS*TEST_PROBLEM_NINTRINSICS_MAX];
+    mrcal_pose_t           extrinsics[TEST_PROBLEM_NCAMERAS-1];
+    mrcal_pose_t           frames    [NFRAMES];
+    mrcal_calobject_warp_t calobject_warp;
+    mrcal_calibration_session_get_state(session,
+                                        intrinsics, extrinsics, frames, NULL,
+                                        &calobject_warp);
+    confirm_same_optimum(ref, intrinsics, extrinsics, frames, &calobject_warp);
+
+    // Solving again, with nothing appended, reuses the factorization. We're
+    // already at the optimum, so we stay there
+    stats = mrcal_calibration_session_solve(session, NULL, NULL, NULL, 0, NULL, 0);
+    confirm_eq_double(stats.rms_reproj_error__pixels,
+                      stats_ref.rms_reproj_error__pixels, 1e-6);
+    mrcal_calibration_session_get_state(session,
+                                        intrinsics, extrinsics, frames, NULL,
+                                        &calobject_warp);
+    confirm_same_optimum(ref, intrinsics, extrinsics, frames, &calobject_warp);
+
+    mrcal_calibration_session_free(session);
+    free(ref);
+}
+
+int main(int argc, char* argv[])
+{
+    test_session(MRCAL_SOLVER_SPARSE_CHOLMOD);
+
+    TEST_FOOTER();
+}
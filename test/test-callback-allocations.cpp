@@ -0,0 +1,92 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the callback workspace. All the scratch memory used by the optimizer
+// callback is allocated once, before the solve. So a solve that is stopped
+// after its first callback, and a full solve with many callbacks must report
+// the same Nallocations_workspace, and the callbacks themselves must never
+// allocate: Nallocations_callback is 0. For each solver, thread count, and with
+// a splined model, which uses the per-point gradient pools
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test-harness.h"
+#include "test-calibration-problem.h"
+
+#define NFRAMES TEST_PROBLEM_NFRAMES_MAX
+
+// Stops after the first callback if the cookie is non-NULL. Otherwise never
+// stops
+static bool progress(const mrcal_optimizer_progress_t* p,
+                     void* cookie)
+{
+    return cookie == NULL;
+}
+
+static void test_allocations(const char* lensmodel_name,
+                             mrcal_solver_t solver,
+                             int Nthreads,
+                             bool do_apply_outlier_rejection,
+                             bool report_progress)
+{
+    test_problem_t* seed    = (test_problem_t*)malloc(sizeof(test_problem_t));
+    test_problem_t* problem = (test_problem_t*)malloc(sizeof(test_problem_t));
+    confirm(test_problem_init(seed, lensmodel_name, NFRAMES));
+    seed->problem_selections.do_apply_outlier_rejection = do_apply_outlier_rejection;
+
+    mrcal_solver_options_t solver_options =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    solver_options.solver   = solver;
+    solver_options.Nthreads = Nthreads;
+
+    // Stopped right after the first callback: this is the workspace setup,
+    // and one callback
+    *problem = *seed;
+    int stop = 1;
+    const mrcal_stats_t stats_one =
+        test_problem_optimize(problem, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                              &solver_options, progress, &stop);
+    confirm(stats_one.stopped_early);
+    confirm_eq_int(stats_one.Ncallbacks, 1);
+    confirm(stats_one.Nallocations_workspace > 0);
+    confirm_eq_int(stats_one.Nallocations_callback, 0);
+
+    // The full solve
+    *problem = *seed;
+    const mrcal_stats_t stats_full =
+        test_problem_optimize(problem, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                              &solver_options,
+                              report_progress ? progress : NULL, NULL);
+    confirm(stats_full.rms_reproj_error__pixels >= 0);
+    confirm(!stats_full.stopped_early);
+    confirm(stats_full.Ncallbacks > 3);
+    confirm_eq_int(stats_full.Nallocations_workspace, stats_one.Nallocations_workspace);
+    confirm_eq_int(stats_full.Nallocations_callback,  0);
+
+    free(seed);
+    free(problem);
+}
+
+int main(int argc, char* argv[])
+{
+    const int Nthreads_all[] = { 1, 3 };
+    for(int Nthreads : Nthreads_all)
+    {
+        test_allocations("LENSMODEL_OPENCV4", MRCAL_SOLVER_SPARSE_CHOLMOD, Nthreads, false, true);
+        test_allocations("LENSMODEL_OPENCV4", MRCAL_SOLVER_SPARSE_CHOLMOD, Nthreads, false, false);
+        test_allocations("LENSMODEL_OPENCV4", MRCAL_SOLVER_SPARSE_CHOLMOD, Nthreads, true,  true);
+        test_allocations("LENSMODEL_OPENCV4", MRCAL_SOLVER_SCHUR,          Nthreads, false, true);
+        test_allocations("LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=8_Ny=6_fov_x_deg=120",
+                         MRCAL_SOLVER_SPARSE_CHOLMOD, Nthreads, false, true);
+    }
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,221 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the cameramodel cache used by mrcal_read_cameramodel_files(). A file
+// that hasn't changed is a hit, and returns what a fresh parse would. A file
+// that was edited is parsed again. A file that can't be read gives NULL. And
+// when the cache is full, the least-recently-used model is evicted
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+#define NINTRINSICS 8
+
+typedef struct
+{
+    mrcal_cameramodel_t cameramodel;
+    double              intrinsics[NINTRINSICS];
+} cameramodel_opencv4_t;
+
+// A model whose intrinsics depend on i, so each i gives different file contents
+static cameramodel_opencv4_t make_model(int i)
+{
+    cameramodel_opencv4_t m = {};
+    m.cameramodel.rt_cam_ref[0] =  0.01;
+    m.cameramodel.rt_cam_ref[1] = -0.02;
+    m.cameramodel.rt_cam_ref[3] =  1.5;
+    m.cameramodel.imagersize[0] = 3000;
+    m.cameramodel.imagersize[1] = 2000;
+    m.cameramodel.lensmodel.type = MRCAL_LENSMODEL_OPENCV4;
+    const double intrinsics[NINTRINSICS] = { 2000., 2010., 1499.5, 999.5,
+                                             -0.1, 0.05, 0.001, -0.002 };
+    memcpy(m.intrinsics, intrinsics, sizeof(intrinsics));
+    m.intrinsics[4] += 1e-3*i;
+    return m;
+}
+
+static void confirm_model(const mrcal_cameramodel_t* m, const cameramodel_opencv4_t* ref)
+{
+    confirm(m != NULL);
+    if(m == NULL)
+        return;
+    confirm_eq_int(m->lensmodel.type, ref->cameramodel.lensmodel.type);
+    confirm_eq_int(m->imagersize[0],  ref->cameramodel.imagersize[0]);
+    confirm_eq_int(m->imagersize[1],  ref->cameramodel.imagersize[1]);
+    confirm_eq_double_max_array(m->rt_cam_ref, ref->cameramodel.rt_cam_ref, 6,           1e-12);
+    confirm_eq_double_max_array(m->intrinsics, ref->intrinsics,             NINTRINSICS, 1e-12);
+}
+
+static void confirm_stats(unsigned long Nhits_ref, unsigned long Nmisses_ref)
+{
+    unsigned long Nhits, Nmisses;
+    _mrcal_cameramodel_cache_stats(&Nhits, &Nmisses);
+    confirm_eq_int((int)Nhits,   (int)Nhits_ref);
+    confirm_eq_int((int)Nmisses, (int)Nmisses_ref);
+}
+
+// Reads one file through the cache, and checks it against ref. The cache must
+// be used once: a hit or a miss
+static void read_one(const char* filename, const cameramodel_opencv4_t* ref)
+{
+    mrcal_cameramodel_t* m = NULL;
+    confirm(mrcal_read_cameramodel_files(&m, &filename, 1));
+    confirm_model(m, ref);
+    mrcal_free_cameramodel(&m);
+}
+
+// A model read twice is parsed once. An edited model is parsed again. In both
+// formats
+static void test_hit_and_edit(bool binary)
+{
+    const char* filename = binary ?
+        "/tmp/test-cameramodel-cache.cameramodel.bin" :
+        "/tmp/test-cameramodel-cache.cameramodel";
+    bool (*write)(const char*, const mrcal_cameramodel_t*) =
+        binary ? mrcal_write_cameramodel_binary_file : mrcal_write_cameramodel_file;
+
+    mrcal_cameramodel_cache_clear();
+    confirm_stats(0,0);
+
+    const cameramodel_opencv4_t m0 = make_model(0);
+    const cameramodel_opencv4_t m1 = make_model(1);
+
+    confirm(write(filename, &m0.cameramodel));
+    read_one(filename, &m0);
+    confirm_stats(0,1);
+
+    // A hit, with the same results
+    read_one(filename, &m0);
+    confirm_stats(1,1);
+
+    // Both copies are ours to free
+    {
+        const char* filenames[] = {filename, filename};
+        mrcal_cameramodel_t* m[2] = {};
+        confirm(mrcal_read_cameramodel_files(m, filenames, 2));
+        confirm(m[0] != m[1]);
+        confirm_model(m[0], &m0);
+        confirm_model(m[1], &m0);
+        mrcal_free_cameramodel(&m[0]);
+        mrcal_free_cameramodel(&m[1]);
+        confirm_stats(3,1);
+    }
+
+    // Edited: the new contents are parsed
+    confirm(write(filename, &m1.cameramodel));
+    read_one(filename, &m1);
+    confirm_stats(3,2);
+
+    // And edited back: the old entry is still there
+    confirm(write(filename, &m0.cameramodel));
+    read_one(filename, &m0);
+    confirm_stats(4,2);
+
+    remove(filename);
+}
+
+// A missing file gives NULL and false. The others are still read
+static void test_missing(void)
+{
+    const char* filename = "/tmp/test-cameramodel-cache-present.cameramodel.bin";
+    const cameramodel_opencv4_t m0 = make_model(0);
+    confirm(mrcal_write_cameramodel_binary_file(filename, &m0.cameramodel));
+
+    const char* filenames[] = { filename,
+                                "/tmp/test-cameramodel-cache-this-file-does-not-exist" };
+    mrcal_cameramodel_t* m[2] = {};
+    confirm(!mrcal_read_cameramodel_files(m, filenames, 2));
+    confirm_model(m[0], &m0);
+    confirm(m[1] == NULL);
+    mrcal_free_cameramodel(&m[0]);
+    mrcal_free_cameramodel(&m[1]);
+
+    // A file that isn't a model at all gives NULL too
+    FILE* fp = fopen(filename, "w");
+    confirm(fp != NULL);
+    if(fp != NULL)
+    {
+        fprintf(fp, "this is not a cameramodel\n");
+        fclose(fp);
+    }
+    m[0] = (mrcal_cameramodel_t*)&m0;
+    confirm(!mrcal_read_cameramodel_files(m, filenames, 1));
+    confirm(m[0] == NULL);
+
+    remove(filename);
+}
+
+// Fill the cache, touch every model in reverse order, and then read one more.
+// The least-recently-used model is evicted: the newest one, not the oldest
+static void test_eviction(void)
+{
+    const int N = MRCAL_CAMERAMODEL_CACHE_NENTRIES + 1;
+    char (*filenames)[64] = (char(*)[64])malloc(N*sizeof(filenames[0]));
+    for(int i=0; i<N; i++)
+    {
+        snprintf(filenames[i], sizeof(filenames[0]),
+                 "/tmp/test-cameramodel-cache-%d.cameramodel.bin", i);
+        const cameramodel_opencv4_t m = make_model(i);
+        confirm(mrcal_write_cameramodel_binary_file(filenames[i], &m.cameramodel));
+    }
+
+    mrcal_cameramodel_cache_clear();
+
+    // One at a time, so the order is known
+    for(int i=0; i<N-1; i++)
+    {
+        const cameramodel_opencv4_t m = make_model(i);
+        read_one(filenames[i], &m);
+    }
+    confirm_stats(0, N-1);
+
+    // Everything is cached
+    for(int i=N-2; i>=0; i--)
+    {
+        const cameramodel_opencv4_t m = make_model(i);
+        read_one(filenames[i], &m);
+    }
+    confirm_stats(N-1, N-1);
+
+    // Now model N-2 is the least recently used. Reading a new model evicts it
+    {
+        const cameramodel_opencv4_t m = make_model(N-1);
+        read_one(filenames[N-1], &m);
+        confirm_stats(N-1, N);
+    }
+    {
+        const cameramodel_opencv4_t m = make_model(0);
+        read_one(filenames[0], &m);
+        confirm_stats(N, N);
+    }
+    {
+        const cameramodel_opencv4_t m = make_model(N-2);
+        read_one(filenames[N-2], &m);
+        confirm_stats(N, N+1);
+    }
+
+    for(int i=0; i<N; i++)
+        remove(filenames[i]);
+    free(filenames);
+    mrcal_cameramodel_cache_clear();
+}
+
+int main(int argc, char* argv[])
+{
+    test_hit_and_edit(true);
+    test_hit_and_edit(false);
+    test_missing();
+    test_eviction();
+
+    TEST_FOOTER();
+}
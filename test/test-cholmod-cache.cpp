@@ -0,0 +1,287 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the cache of CHOLMOD symbolic analyses in cholmod-cache.h. A hit
+// must happen only for the same sparsity pattern AND the same CHOLMOD
+// configuration, the cached analysis must keep its type, and a factorization
+// made from a cached analysis must solve exactly like one made from a fresh
+// analysis. And the analysis libdogleg made in mrcal_optimize() must be reused
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../cholmod-cache.h"
+
+#include "test-harness.h"
+#include "test-calibration-problem.h"
+
+#define NSTATE        8
+#define NMEASUREMENTS 24
+
+// A Jt with NSTATE rows and NMEASUREMENTS columns. Each measurement depends on
+// a few states; "shift" moves the pattern around, to make a different one
+typedef struct
+{
+    int            p[NMEASUREMENTS+1];
+    int            i[NMEASUREMENTS*3];
+    double         x[NMEASUREMENTS*3];
+    cholmod_sparse Jt;
+} test_Jt_t;
+
+static void make_Jt(test_Jt_t* J, int shift)
+{
+    int k = 0;
+    for(int imeas=0; imeas<NMEASUREMENTS; imeas++)
+    {
+        J->p[imeas] = k;
+        const int istate = (imeas + shift) % NSTATE;
+        J->i[k] = istate;                   J->x[k++] = 1.0 + 0.1*imeas;
+        if(istate+1 < NSTATE)
+        {
+            J->i[k] = istate+1;             J->x[k++] = 0.5 - 0.03*imeas;
+        }
+        if(imeas % 3 == 0 && istate+3 < NSTATE)
+        {
+            J->i[k] = istate+3;             J->x[k++] = 0.2;
+        }
+    }
+    J->p[NMEASUREMENTS] = k;
+
+    J->Jt = (cholmod_sparse){};
+    J->Jt.nrow   = NSTATE;
+    J->Jt.ncol   = NMEASUREMENTS;
+    J->Jt.nzmax  = k;
+    J->Jt.p      = J->p;
+    J->Jt.i      = J->i;
+    J->Jt.x      = J->x;
+    J->Jt.stype  = 0;
+    J->Jt.itype  = CHOLMOD_INT;
+    J->Jt.xtype  = CHOLMOD_REAL;
+    J->Jt.dtype  = CHOLMOD_DOUBLE;
+    J->Jt.sorted = 1;
+    J->Jt.packed = 1;
+}
+
+static void confirm_stats(int Nhits_ref, int Nmisses_ref)
+{
+    int Nhits, Nmisses;
+    _mrcal_cholmod_cache_stats(&Nhits, &Nmisses);
+    confirm_eq_int(Nhits,   Nhits_ref);
+    confirm_eq_int(Nmisses, Nmisses_ref);
+}
+
+// Factors Jt Jt' using the analysis L, and solves Jt Jt' x = b
+static bool factor_solve(double* x,
+                         test_Jt_t* J, cholmod_factor* L, cholmod_common* common)
+{
+    double b[NSTATE];
+    for(int i=0; i<NSTATE; i++)
+        b[i] = 1.0 + (double)i;
+    cholmod_dense bd = {
+        .nrow  = NSTATE,
+        .ncol  = 1,
+        .nzmax = NSTATE,
+        .d     = NSTATE,
+        .x     = b,
+        .xtype = CHOLMOD_REAL,
+        .dtype = CHOLMOD_DOUBLE };
+
+    if(!cholmod_factorize(&J->Jt, L, common) ||
+       L->minor != L->n)
+        return false;
+    cholmod_dense* xd = cholmod_solve(CHOLMOD_A, L, &bd, common);
+    if(xd == NULL)
+        return false;
+    memcpy(x, xd->x, NSTATE*sizeof(double));
+    cholmod_free_dense(&xd, common);
+    return true;
+}
+
+static void test_hits_misses(void)
+{
+    cholmod_common common;
+    confirm(cholmod_start(&common));
+    common.supernodal = CHOLMOD_SIMPLICIAL;
+
+    test_Jt_t J0, J1;
+    make_Jt(&J0, 0);
+    make_Jt(&J1, 3);
+
+    _mrcal_cholmod_cache_clear();
+    confirm_stats(0,0);
+
+    cholmod_factor* L;
+
+    L = _mrcal_cholmod_analyze_cached(&J0.Jt, &common);
+    confirm(L != NULL);
+    confirm_stats(0,1);
+    cholmod_free_factor(&L, &common);
+
+    // Same pattern, same config: a hit
+    L = _mrcal_cholmod_analyze_cached(&J0.Jt, &common);
+    confirm(L != NULL);
+    confirm(L != NULL && !L->is_super);
+    confirm_stats(1,1);
+    cholmod_free_factor(&L, &common);
+
+    // Different pattern: a miss
+    L = _mrcal_cholmod_analyze_cached(&J1.Jt, &common);
+    confirm(L != NULL);
+    confirm_stats(1,2);
+    cholmod_free_factor(&L, &common);
+
+    // Same pattern, different ordering: a miss
+    common.nmethods           = 1;
+    common.method[0].ordering = CHOLMOD_NATURAL;
+    L = _mrcal_cholmod_analyze_cached(&J0.Jt, &common);
+    confirm(L != NULL);
+    confirm_stats(1,3);
+    cholmod_free_factor(&L, &common);
+    common.nmethods = 0;
+
+    // Same pattern, supernodal: a miss. And the hit that follows must still be
+    // supernodal
+    common.supernodal = CHOLMOD_SUPERNODAL;
+    L = _mrcal_cholmod_analyze_cached(&J0.Jt, &common);
+    confirm(L != NULL);
+    confirm_stats(1,4);
+    const bool is_super = L != NULL && L->is_super;
+    cholmod_free_factor(&L, &common);
+
+    L = _mrcal_cholmod_analyze_cached(&J0.Jt, &common);
+    confirm(L != NULL);
+    confirm_stats(2,4);
+    confirm(L != NULL && (bool)L->is_super == is_super);
+    cholmod_free_factor(&L, &common);
+
+    // And the simplicial one is still there
+    common.supernodal = CHOLMOD_SIMPLICIAL;
+    L = _mrcal_cholmod_analyze_cached(&J0.Jt, &common);
+    confirm(L != NULL);
+    confirm_stats(3,4);
+    confirm(L != NULL && !L->is_super);
+    cholmod_free_factor(&L, &common);
+
+    cholmod_finish(&common);
+}
+
+static void test_same_solution(int supernodal)
+{
+    cholmod_common common;
+    confirm(cholmod_start(&common));
+    common.supernodal = supernodal;
+
+    test_Jt_t J;
+    make_Jt(&J, 0);
+
+    _mrcal_cholmod_cache_clear();
+
+    // A fresh analysis, not involving the cache at all
+    double x_ref[NSTATE];
+    cholmod_factor* L = cholmod_analyze(&J.Jt, &common);
+    confirm(L != NULL && factor_solve(x_ref, &J, L, &common));
+    cholmod_free_factor(&L, &common);
+
+    // A miss, then a hit
+    for(int i=0; i<2; i++)
+    {
+        double x[NSTATE];
+        L = _mrcal_cholmod_analyze_cached(&J.Jt, &common);
+        confirm(L != NULL && factor_solve(x, &J, L, &common));
+        confirm_eq_double_max_array(x, x_ref, NSTATE, 1e-12);
+        cholmod_free_factor(&L, &common);
+    }
+    confirm_stats(1,1);
+
+    cholmod_finish(&common);
+}
+
+// mrcal_optimize() keeps the analysis libdogleg did. A session solving the same
+// problem then gets it from the cache, and lands at the same optimum
+static void test_same_optimum(void)
+{
+    const int NFRAMES = 5;
+    test_problem_t* problem0 = (test_problem_t*)malloc(sizeof(test_problem_t));
+    test_problem_t* problem1 = (test_problem_t*)malloc(sizeof(test_problem_t));
+    confirm(test_problem_init(problem0, "LENSMODEL_OPENCV4", NFRAMES));
+    *problem1 = *problem0;
+
+    mrcal_solver_options_t solver_options =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    solver_options.solver = MRCAL_SOLVER_SPARSE_CHOLMOD;
+
+    mrcal_cholmod_analysis_cache_clear();
+    const mrcal_stats_t stats0 =
+        test_problem_optimize(problem0, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                              &solver_options, NULL, NULL);
+    confirm_stats(0,0);
+
+    mrcal_calibration_session_t* session =
+        mrcal_calibration_session_create(problem1->intrinsics,
+                                         problem1->extrinsics,
+                                         problem1->frames,
+                                         NULL,
+                                         &problem1->calobject_warp,
+                                         TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                                         NFRAMES, 0, 0,
+                                         problem1->observations_board, NULL,
+                                         NFRAMES*TEST_PROBLEM_NCAMERAS, 0,
+                                         problem1->observations_board_pool,
+                                         &problem1->lensmodel,
+                                         problem1->imagersizes,
+                                         problem1->problem_selections,
+                                         &problem1->problem_constants,
+                                         TEST_PROBLEM_SPACING,
+                                         TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                                         false,
+                                         &solver_options);
+    confirm(session != NULL);
+    if(session != NULL)
+    {
+        const mrcal_stats_t stats1 =
+            mrcal_calibration_session_solve(session, NULL, NULL, NULL, 0, NULL, 0);
+        int Nhits, Nmisses;
+        _mrcal_cholmod_cache_stats(&Nhits, &Nmisses);
+        confirm(Nhits >= 1);
+        confirm_eq_int(Nmisses, 0);
+
+        // libdogleg and the session's solver converge to the same optimum,
+        // but not bit-identically
+        confirm(stats0.rms_reproj_error__pixels >= 0);
+        confirm_eq_double(stats1.rms_reproj_error__pixels,
+                          stats0.rms_reproj_error__pixels, 1e-6);
+        mrcal_calibration_session_get_state(session,
+                                            problem1->intrinsics,
+                                            problem1->extrinsics,
+                                            problem1->frames,
+                                            NULL,
+                                            &problem1->calobject_warp);
+        for(int icam=0; icam<TEST_PROBLEM_NCAMERAS; icam++)
+            confirm_eq_double_max_array(&problem1->intrinsics[icam*problem0->Nintrinsics],
+                                        &problem0->intrinsics[icam*problem0->Nintrinsics],
+                                        4, 1e-3);
+        confirm_eq_double_max_array(problem1->frames[0].r.xyz, problem0->frames[0].r.xyz,
+                                    NFRAMES*6, 1e-6);
+        mrcal_calibration_session_free(session);
+    }
+
+    free(problem0);
+    free(problem1);
+}
+
+int main(int argc, char* argv[])
+{
+    test_hits_misses();
+    test_same_solution(CHOLMOD_SIMPLICIAL);
+    test_same_solution(CHOLMOD_SUPERNODAL);
+    test_same_optimum();
+
+    TEST_FOOTER();
+}
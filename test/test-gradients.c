@@ -452,6 +452,8 @@ int main(int argc, char* argv[] )
                         calibration_object_height_n,
 
                         false,
+                        NULL,
+                        NULL, NULL,
                         true);
 
     if(stats.rms_reproj_error__pixels < 0)
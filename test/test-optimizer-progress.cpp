@@ -0,0 +1,203 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the progress callback of mrcal_optimize(). It must be called once per
+// solver iteration, with the state the solver is at. And when it asks to stop,
+// the solve must stop right there, returning the state in the last report
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test-harness.h"
+#include "test-calibration-problem.h"
+
+#define NFRAMES     6
+#define NREPORTS_MAX 200
+
+typedef struct
+{
+    // Stop after this iteration. <0 to never stop
+    int iteration_stop;
+
+    int                        Nreports;
+    mrcal_optimizer_progress_t reports[NREPORTS_MAX];
+} progress_log_t;
+
+static bool log_progress(const mrcal_optimizer_progress_t* progress,
+                         void* cookie)
+{
+    progress_log_t* log = (progress_log_t*)cookie;
+    if(log->Nreports < NREPORTS_MAX)
+        log->reports[log->Nreports] = *progress;
+    log->Nreports++;
+
+    return !(!progress->pass_done &&
+             log->iteration_stop >= 0 &&
+             progress->iteration >= log->iteration_stop);
+}
+
+// The per-iteration reports of a single pass, followed by the one pass_done
+// report. Returns the last per-iteration report
+static const mrcal_optimizer_progress_t*
+confirm_iteration_reports(const progress_log_t* log, mrcal_solver_t solver)
+{
+    confirm(log->Nreports >= 2 && log->Nreports <= NREPORTS_MAX);
+    if(!(log->Nreports >= 2 && log->Nreports <= NREPORTS_MAX))
+        return NULL;
+
+    for(int i=0; i<log->Nreports-1; i++)
+    {
+        const mrcal_optimizer_progress_t* r = &log->reports[i];
+        confirm(!r->pass_done);
+        confirm_eq_int(r->ipass,     0);
+        confirm_eq_int(r->iteration, i);
+        confirm(r->Nevaluations >= i+1);
+        if(i == 0)
+        {
+            confirm_eq_int(r->Nevaluations, 1);
+            confirm(r->step_norm < 0);
+        }
+        else
+        {
+            const mrcal_optimizer_progress_t* r_prev = &log->reports[i-1];
+            // Each accepted step reduces the error, and costs at least one
+            // evaluation
+            confirm(r->norm2_error < r_prev->norm2_error);
+            confirm(r->Nevaluations > r_prev->Nevaluations);
+            confirm(r->step_norm > 0);
+            confirm(r->elapsed__s >= r_prev->elapsed__s);
+        }
+
+        if(solver == MRCAL_SOLVER_SPARSE_CHOLMOD)
+            confirm(r->trustregion > 0);
+        else if(i > 0)
+            confirm_eq_double(r->trustregion, r->step_norm, 1e-12);
+    }
+
+    const mrcal_optimizer_progress_t* last = &log->reports[log->Nreports-2];
+    const mrcal_optimizer_progress_t* done = &log->reports[log->Nreports-1];
+    confirm(done->pass_done);
+    confirm(!done->more_passes);
+    confirm(done->step_norm   < 0);
+    confirm(done->trustregion < 0);
+    confirm(done->norm2_error == last->norm2_error);
+    return last;
+}
+
+static void test_progress(mrcal_solver_t solver)
+{
+    test_problem_t* problem      = (test_problem_t*)malloc(sizeof(test_problem_t));
+    test_problem_t* problem_stop = (test_problem_t*)malloc(sizeof(test_problem_t));
+    test_problem_t* problem_ref  = (test_problem_t*)malloc(sizeof(test_problem_t));
+    progress_log_t* log          = (progress_log_t*)malloc(sizeof(progress_log_t));
+    confirm(test_problem_init(problem, "LENSMODEL_OPENCV4", NFRAMES));
+    *problem_stop = *problem;
+    *problem_ref  = *problem;
+
+    mrcal_solver_options_t solver_options =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    solver_options.solver = solver;
+
+    // A full solve. Every iteration is reported
+    *log = (progress_log_t){ .iteration_stop = -1 };
+    const mrcal_stats_t stats =
+        test_problem_optimize(problem, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                              &solver_options, log_progress, log);
+    confirm(stats.rms_reproj_error__pixels >= 0);
+    confirm(!stats.stopped_early);
+    const mrcal_optimizer_progress_t* last = confirm_iteration_reports(log, solver);
+    if(last == NULL)
+        goto done;
+    confirm(last->iteration > 3);
+    // The solver may try a few more steps after the last accepted one, before
+    // deciding it has converged
+    confirm(stats.Ncallbacks >= last->Nevaluations);
+    {
+        const double norm2_error_full = last->norm2_error;
+
+        // Stop after 3 iterations. Nothing is evaluated after that, and we get
+        // the state from the last report
+        *log = (progress_log_t){ .iteration_stop = 3 };
+        const mrcal_stats_t stats_stop =
+            test_problem_optimize(problem_stop, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                                  &solver_options, log_progress, log);
+        confirm(stats_stop.rms_reproj_error__pixels >= 0);
+        confirm(stats_stop.stopped_early);
+        last = confirm_iteration_reports(log, solver);
+        if(last == NULL)
+            goto done;
+        confirm_eq_int(last->iteration, 3);
+        confirm_eq_int(stats_stop.Ncallbacks, last->Nevaluations);
+        confirm(last->norm2_error > norm2_error_full);
+
+        // rms^2 is norm2_error/Nmeasurements
+        confirm_eq_double(stats_stop.rms_reproj_error__pixels*stats_stop.rms_reproj_error__pixels /
+                          (stats.rms_reproj_error__pixels*stats.rms_reproj_error__pixels),
+                          last->norm2_error / norm2_error_full,
+                          1e-12);
+
+        // Each dogleg iteration ends with an accepted step, so the stopped
+        // solve is exactly the one limited to 3 iterations. This one reports
+        // its progress too, but never stops: without a progress callback,
+        // mrcal_optimize() would use libdogleg, not the same solver
+        if(solver == MRCAL_SOLVER_SPARSE_CHOLMOD)
+        {
+            solver_options.max_iterations = 3;
+            *log = (progress_log_t){ .iteration_stop = -1 };
+            const mrcal_stats_t stats_ref =
+                test_problem_optimize(problem_ref, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                                      &solver_options, log_progress, log);
+            confirm(!stats_ref.stopped_early);
+            confirm_eq_int(stats_ref.Ncallbacks, stats_stop.Ncallbacks);
+            confirm(0 == memcmp(problem_stop->intrinsics, problem_ref->intrinsics,
+                                TEST_PROBLEM_NCAMERAS*problem->Nintrinsics*sizeof(double)));
+            confirm(0 == memcmp(problem_stop->frames, problem_ref->frames,
+                                NFRAMES*sizeof(mrcal_pose_t)));
+        }
+    }
+
+ done:
+    free(problem);
+    free(problem_stop);
+    free(problem_ref);
+    free(log);
+}
+
+// Stopping at the seed returns the seed
+static void test_stop_at_seed(void)
+{
+    test_problem_t* problem = (test_problem_t*)malloc(sizeof(test_problem_t));
+    progress_log_t* log     = (progress_log_t*)malloc(sizeof(progress_log_t));
+    confirm(test_problem_init(problem, "LENSMODEL_OPENCV4", NFRAMES));
+    double intrinsics_seed[TEST_PROBLEM_NCAMERAS*TEST_PROBLEM_NINTRINSICS_MAX];
+    memcpy(intrinsics_seed, problem->intrinsics, sizeof(intrinsics_seed));
+
+    *log = (progress_log_t){ .iteration_stop = 0 };
+    const mrcal_stats_t stats =
+        test_problem_optimize(problem, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                              NULL, log_progress, log);
+    confirm(stats.stopped_early);
+    confirm_eq_int(stats.Ncallbacks, 1);
+    confirm_eq_int(log->Nreports, 2);
+    confirm_eq_double_max_array(problem->intrinsics, intrinsics_seed,
+                                TEST_PROBLEM_NCAMERAS*problem->Nintrinsics, 1e-12);
+
+    free(problem);
+    free(log);
+}
+
+int main(int argc, char* argv[])
+{
+    test_progress(MRCAL_SOLVER_SPARSE_CHOLMOD);
+    test_progress(MRCAL_SOLVER_SCHUR);
+    test_stop_at_seed();
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,155 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of mrcal_solver_options_t.Nthreads. The optimizer callback evaluates the
+// observations in parallel, and the results must not depend on how many threads
+// do that. A solve with 1 thread and a solve with N threads must be
+// bit-identical: the same x and state at the optimum, the same number of
+// callbacks, and the same norm2 at every iteration. Since the solver takes the
+// same path each time, x and J were identical at every step too
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test-harness.h"
+#include "test-calibration-problem.h"
+
+#define NFRAMES      TEST_PROBLEM_NFRAMES_MAX
+#define NREPORTS_MAX 200
+
+typedef struct
+{
+    int    Nreports;
+    double norm2_error[NREPORTS_MAX];
+} progress_log_t;
+
+static bool log_progress(const mrcal_optimizer_progress_t* progress,
+                         void* cookie)
+{
+    progress_log_t* log = (progress_log_t*)cookie;
+    if(log->Nreports < NREPORTS_MAX)
+        log->norm2_error[log->Nreports] = progress->norm2_error;
+    log->Nreports++;
+    return true;
+}
+
+typedef struct
+{
+    mrcal_stats_t  stats;
+    int            Nstate, Nmeasurements;
+    double*        b_packed;
+    double*        x;
+    progress_log_t log;
+} solve_t;
+
+static void solve(solve_t* result,
+                  const test_problem_t* seed,
+                  mrcal_solver_t solver,
+                  bool report_progress,
+                  int Nthreads)
+{
+    test_problem_t* problem = (test_problem_t*)malloc(sizeof(test_problem_t));
+    *problem = *seed;
+
+    mrcal_solver_options_t solver_options =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    solver_options.solver   = solver;
+    solver_options.Nthreads = Nthreads;
+
+    const int Nobservations_board = NFRAMES*TEST_PROBLEM_NCAMERAS;
+    mrcal_problem_selections_t problem_selections = problem->problem_selections;
+    result->Nstate =
+        mrcal_num_states(TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                         NFRAMES, 0, 0, Nobservations_board,
+                         problem_selections, &problem->lensmodel);
+    result->Nmeasurements =
+        mrcal_num_measurements(Nobservations_board, 0,
+                               TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                               TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                               NFRAMES, 0, 0,
+                               problem_selections, &problem->lensmodel);
+    result->b_packed = (double*)malloc(result->Nstate       *sizeof(double));
+    result->x        = (double*)malloc(result->Nmeasurements*sizeof(double));
+    result->log      = (progress_log_t){};
+
+    result->stats =
+        mrcal_optimize(result->b_packed, result->Nstate       *(int)sizeof(double),
+                       result->x,        result->Nmeasurements*(int)sizeof(double),
+                       problem->intrinsics,
+                       problem->extrinsics,
+                       problem->frames,
+                       NULL,
+                       &problem->calobject_warp,
+                       TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                       NFRAMES, 0, 0,
+                       problem->observations_board, NULL,
+                       Nobservations_board, 0,
+                       problem->observations_board_pool,
+                       &problem->lensmodel,
+                       problem->imagersizes,
+                       problem_selections,
+                       &problem->problem_constants,
+                       TEST_PROBLEM_SPACING,
+                       TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                       false,
+                       &solver_options,
+                       report_progress ? log_progress : NULL, &result->log,
+                       false);
+    free(problem);
+}
+
+static void solve_free(solve_t* result)
+{
+    free(result->b_packed);
+    free(result->x);
+}
+
+static void test_threads(mrcal_solver_t solver, bool report_progress)
+{
+    test_problem_t* seed = (test_problem_t*)malloc(sizeof(test_problem_t));
+    confirm(test_problem_init(seed, "LENSMODEL_OPENCV4", NFRAMES));
+
+    solve_t ref;
+    solve(&ref, seed, solver, report_progress, 1);
+    confirm(ref.stats.rms_reproj_error__pixels >= 0);
+    if(report_progress)
+        confirm(ref.log.Nreports > 3 && ref.log.Nreports <= NREPORTS_MAX);
+
+    const int Nthreads_all[] = { 2, 3, 5 };
+    for(int Nthreads : Nthreads_all)
+    {
+        solve_t s;
+        solve(&s, seed, solver, report_progress, Nthreads);
+
+        confirm(s.stats.rms_reproj_error__pixels == ref.stats.rms_reproj_error__pixels);
+        confirm_eq_int(s.stats.Ncallbacks, ref.stats.Ncallbacks);
+        confirm(0 == memcmp(s.b_packed, ref.b_packed, ref.Nstate       *sizeof(double)));
+        confirm(0 == memcmp(s.x,        ref.x,        ref.Nmeasurements*sizeof(double)));
+        confirm_eq_int(s.log.Nreports, ref.log.Nreports);
+        if(s.log.Nreports == ref.log.Nreports &&
+           ref.log.Nreports <= NREPORTS_MAX)
+            confirm(0 == memcmp(s.log.norm2_error, ref.log.norm2_error,
+                                ref.log.Nreports*sizeof(double)));
+
+        solve_free(&s);
+    }
+
+    solve_free(&ref);
+    free(seed);
+}
+
+int main(int argc, char* argv[])
+{
+    test_threads(MRCAL_SOLVER_SPARSE_CHOLMOD, false);
+    test_threads(MRCAL_SOLVER_SPARSE_CHOLMOD, true);
+    test_threads(MRCAL_SOLVER_SCHUR,          true);
+
+    TEST_FOOTER();
+}
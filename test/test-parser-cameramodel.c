@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <locale.h>
+#include <float.h>
 
 #include "../mrcal.h"
 
@@ -17,6 +19,10 @@ struct                                     \
 #define Nintrinsics_CAHVORE (4+5+3)
 typedef CAMERAMODEL_T(Nintrinsics_CAHVORE) cameramodel_cahvore_t;
 
+// LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=30_Ny=20_fov_x_deg=170
+#define Nintrinsics_SPLINED (4 + 2*30*20)
+typedef CAMERAMODEL_T(Nintrinsics_SPLINED) cameramodel_splined_t;
+
 #define check(string, ref, len) do {                                    \
     mrcal_cameramodel_t* m = mrcal_read_cameramodel_string(string, len);\
     confirm(m != NULL);                                                 \
@@ -46,6 +52,94 @@ typedef CAMERAMODEL_T(Nintrinsics_CAHVORE) cameramodel_cahvore_t;
       mrcal_free_cameramodel(&m);                                       \
 } while(0)
 
+// Switches LC_NUMERIC to a locale that uses ',' as the decimal point. Returns
+// false if none is installed
+static bool set_locale_decimal_comma(void)
+{
+    const char* names[] = { "de_DE.UTF-8", "de_DE.utf8", "de_DE",
+                            "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR",
+                            "ru_RU.UTF-8", "ru_RU.utf8",
+                            "es_ES.UTF-8", "es_ES.utf8",
+                            "it_IT.UTF-8", "it_IT.utf8" };
+    for(int i=0; i<(int)(sizeof(names)/sizeof(names[0])); i++)
+        if(setlocale(LC_NUMERIC, names[i]) != NULL &&
+           0 == strcmp(localeconv()->decimal_point, ","))
+            return true;
+    setlocale(LC_NUMERIC, "C");
+    return false;
+}
+
+// Deterministic doubles with full 53-bit mantissas, in [-1e20,1e20]
+static double random_double(unsigned long long* seed)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const double mantissa = (double)(*seed >> 11) / 9007199254740992.;
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const int    exponent = (int)((*seed >> 33) % 41) - 20;
+    double x = mantissa;
+    for(int i=0; i<exponent;  i++) x *= 10.;
+    for(int i=0; i<-exponent; i++) x /= 10.;
+    return ((*seed >> 32) & 1) ? -x : x;
+}
+
+// A large splined model, written with %.17g and read back, must be bit-exact
+static void check_splined_roundtrip(void)
+{
+    static cameramodel_splined_t cameramodel_ref;
+    memset(&cameramodel_ref, 0, sizeof(cameramodel_ref));
+    confirm(mrcal_lensmodel_from_name(&cameramodel_ref.cameramodel.lensmodel,
+                                      "LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=30_Ny=20_fov_x_deg=170"));
+    confirm_eq_int(mrcal_lensmodel_num_params(&cameramodel_ref.cameramodel.lensmodel),
+                   Nintrinsics_SPLINED);
+    cameramodel_ref.cameramodel.imagersize[0] = 6000;
+    cameramodel_ref.cameramodel.imagersize[1] = 3376;
+
+    unsigned long long seed = 1;
+    for(int i=0; i<6; i++)
+        cameramodel_ref.cameramodel.rt_cam_ref[i] = random_double(&seed);
+    for(int i=0; i<Nintrinsics_SPLINED; i++)
+        cameramodel_ref.intrinsics[i] = random_double(&seed);
+
+    // And the values that are hard to convert: ties, values that aren't exact
+    // in binary, the extremes, subnormals and negative 0
+    const double special[] = { 0.1, 1./3., 2./3., 1e23, 9007199254740993.,
+                               DBL_MAX, -DBL_MAX, DBL_MIN, DBL_MIN/3., 5e-324,
+                               -0.0, 0.0, 1.0, -1.0, 123456789012345678. };
+    for(int i=0; i<(int)(sizeof(special)/sizeof(special[0])); i++)
+        cameramodel_ref.intrinsics[4+i] = special[i];
+
+    const char* filename = "/tmp/test-parser-cameramodel-splined.cameramodel";
+    bool write_succeeded =
+        mrcal_write_cameramodel_file(filename,
+                                     (mrcal_cameramodel_t*)&cameramodel_ref);
+    confirm(write_succeeded);
+    if(!write_succeeded)
+        return;
+
+    mrcal_cameramodel_t* m = mrcal_read_cameramodel_file(filename);
+    confirm(m != NULL);
+    if(m != NULL)
+    {
+        confirm_eq_int(m->lensmodel.type, MRCAL_LENSMODEL_SPLINED_STEREOGRAPHIC);
+        confirm_eq_int(m->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.order,     3);
+        confirm_eq_int(m->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.Nx,        30);
+        confirm_eq_int(m->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.Ny,        20);
+        confirm_eq_int(m->lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.fov_x_deg, 170);
+        confirm_eq_int_max_array((int*)m->imagersize,
+                                 (int*)cameramodel_ref.cameramodel.imagersize,
+                                 2);
+        confirm(0 == memcmp(m->rt_cam_ref, cameramodel_ref.cameramodel.rt_cam_ref,
+                            sizeof(cameramodel_ref.cameramodel.rt_cam_ref)));
+        int Nmismatched = 0;
+        for(int i=0; i<Nintrinsics_SPLINED; i++)
+            if(0 != memcmp(&m->intrinsics[i], &cameramodel_ref.intrinsics[i], sizeof(double)))
+                Nmismatched++;
+        confirm_eq_int(Nmismatched, 0);
+        mrcal_free_cameramodel(&m);
+    }
+    remove(filename);
+}
+
 int main(int argc, char* argv[])
 {
     mrcal_cameramodel_t cameramodel;
@@ -220,6 +314,98 @@ int main(int argc, char* argv[])
         }
     }
 
+    // Roundtrip write/read of the binary format. This is exact
+    bool write_cameramodel_binary_succeeded =
+        mrcal_write_cameramodel_binary_file("/tmp/test-parser-cameramodel.cameramodel-binary",
+                                            (mrcal_cameramodel_t*)&cameramodel_ref);
+    confirm(write_cameramodel_binary_succeeded);
+    if(write_cameramodel_binary_succeeded)
+    {
+        // mrcal_read_cameramodel_file() detects the binary format
+        mrcal_cameramodel_t* m =
+            mrcal_read_cameramodel_file("/tmp/test-parser-cameramodel.cameramodel-binary");
+        confirm(m != NULL);
+        if(m != NULL)
+        {
+            confirm_eq_int(m->lensmodel.type, MRCAL_LENSMODEL_CAHVORE);
+            confirm(m->lensmodel.LENSMODEL_CAHVORE__config.linearity ==
+                    cameramodel_ref.cameramodel.lensmodel.LENSMODEL_CAHVORE__config.linearity);
+            confirm(0 == memcmp(m->intrinsics, cameramodel_ref.intrinsics,
+                                sizeof(cameramodel_ref.intrinsics)));
+            confirm(0 == memcmp(m->rt_cam_ref, cameramodel_ref.cameramodel.rt_cam_ref,
+                                sizeof(cameramodel_ref.cameramodel.rt_cam_ref)));
+            confirm_eq_int_max_array((int*)m->imagersize,
+                                     (int*)cameramodel_ref.cameramodel.imagersize,
+                                     2);
+            mrcal_free_cameramodel(&m);
+        }
+
+        mrcal_cameramodel_mmapped_t mapped;
+        bool map_succeeded =
+            mrcal_map_cameramodel_binary_file(&mapped,
+                                              "/tmp/test-parser-cameramodel.cameramodel-binary");
+        confirm(map_succeeded);
+        if(map_succeeded)
+        {
+            confirm_eq_int(mapped.Nintrinsics, Nintrinsics_CAHVORE);
+            confirm_eq_int((int)((size_t)mapped.intrinsics % MRCAL_CAMERAMODEL_BINARY_ALIGNMENT), 0);
+            confirm(0 == memcmp(mapped.intrinsics, cameramodel_ref.intrinsics,
+                                sizeof(cameramodel_ref.intrinsics)));
+            mrcal_unmap_cameramodel_binary_file(&mapped);
+        }
+    }
+
+    // A text file isn't a binary one
+    {
+        mrcal_cameramodel_mmapped_t mapped;
+        confirm(!mrcal_map_cameramodel_binary_file(&mapped,
+                                                   "/tmp/test-parser-cameramodel.cameramodel"));
+    }
+
+    check_splined_roundtrip();
+
+    // The same, with a locale that uses ',' as the decimal point. The files
+    // use '.' regardless: both the parser and the writer must ignore the
+    // locale
+    if(!set_locale_decimal_comma())
+        printf("No locale with a ',' decimal point is installed. Not testing that\n");
+    else
+    {
+        check("{\n"
+              "    'lensmodel':  \"LENSMODEL_CAHVORE_linearity=0.34\",\n"
+              "    'extrinsics': [ 0., 1, 2, 33, 44e4, -55.3E-3, ],\n"
+              "    'intrinsics': [ 4, 3, 4, 5, 0, 1, 3, 5, 4, 10, 11, 12 ],\n"
+              "    'imagersize': [110, 400],\n"
+              "}\n",
+              (mrcal_cameramodel_t*)&cameramodel_ref,
+              0);
+        // A ',' is a separator, not a decimal point
+        check_fail("{\n"
+                   "    'lensmodel':  \"LENSMODEL_CAHVORE_linearity=0,34\",\n"
+                   "    'extrinsics': [ 0., 1, 2, 33, 44e4, -55.3E-3, ],\n"
+                   "    'intrinsics': [ 4, 3, 4, 5, 0, 1, 3, 5, 4, 10, 11, 12 ],\n"
+                   "    'imagersize': [110, 400],\n"
+                   "}\n",
+                   0);
+
+        confirm(mrcal_write_cameramodel_file("/tmp/test-parser-cameramodel-comma.cameramodel",
+                                             (mrcal_cameramodel_t*)&cameramodel_ref));
+        mrcal_cameramodel_t* m =
+            mrcal_read_cameramodel_file("/tmp/test-parser-cameramodel-comma.cameramodel");
+        confirm(m != NULL);
+        if(m != NULL)
+        {
+            confirm(m->lensmodel.LENSMODEL_CAHVORE__config.linearity ==
+                    cameramodel_ref.cameramodel.lensmodel.LENSMODEL_CAHVORE__config.linearity);
+            confirm(0 == memcmp(m->rt_cam_ref, cameramodel_ref.cameramodel.rt_cam_ref,
+                                sizeof(cameramodel_ref.cameramodel.rt_cam_ref)));
+            mrcal_free_cameramodel(&m);
+        }
+        remove("/tmp/test-parser-cameramodel-comma.cameramodel");
+
+        check_splined_roundtrip();
+        setlocale(LC_NUMERIC, "C");
+    }
+
     TEST_FOOTER();
 }
-
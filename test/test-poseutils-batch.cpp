@@ -0,0 +1,304 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the batched point rotations and transformations. Each must produce
+// the same results as the corresponding single-point function, with the same
+// gradients, for every point. Forward and inverted. With strided and contiguous
+// arrays, in place, in a single thread and in many, with partial blocks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../poseutils.h"
+
+#include "test-harness.h"
+
+typedef enum { OP_ROTATE_R, OP_ROTATE_r, OP_TRANSFORM_Rt, OP_TRANSFORM_rt } op_t;
+
+static const char* const op_names[] = { "rotate_point_R",    "rotate_point_r",
+                                        "transform_point_Rt", "transform_point_rt" };
+
+// The gradient of each output point is a (3,Nstate) array: J_R is (3,3,3),
+// J_r is (3,3), J_Rt is (3,4,3) and J_rt is (3,6)
+static const int Nstate[] = { 9, 3, 12, 6 };
+
+// Strides, in bytes, of each array. All 0 means "contiguous". The gradients
+// of a point are laid out row by row; within each row the elements are
+// contiguous
+typedef struct
+{
+    int x_out_stride0, x_out_stride1;
+    int J_stride0,     J_stride1;
+    int J_x_stride0,   J_x_stride1;
+    int x_in_stride0,  x_in_stride1;
+} layout_t;
+
+static const layout_t layout_contiguous = {};
+
+// Every array is padded, and the points are stored transposed: as (3,N)
+static layout_t layout_strided(op_t op, int N)
+{
+    const int d = (int)sizeof(double);
+    return (layout_t){ .x_out_stride0 = 4*d,                 .x_out_stride1 = d,
+                       .J_stride0     = (3*(Nstate[op]+1)+2)*d, .J_stride1   = (Nstate[op]+1)*d,
+                       .J_x_stride0   = 13*d,                .J_x_stride1   = 4*d,
+                       .x_in_stride0  = d,                   .x_in_stride1  = (N+3)*d };
+}
+
+// The size of each array in this layout, in doubles
+static size_t size_x_out(const layout_t* l, op_t op, int N) { return l->x_out_stride0 ? (size_t)N*l->x_out_stride0/sizeof(double) : (size_t)N*3; }
+static size_t size_J    (const layout_t* l, op_t op, int N) { return l->J_stride0     ? (size_t)N*l->J_stride0    /sizeof(double) : (size_t)N*3*Nstate[op]; }
+static size_t size_J_x  (const layout_t* l, op_t op, int N) { return l->J_x_stride0   ? (size_t)N*l->J_x_stride0  /sizeof(double) : (size_t)N*3*3; }
+static size_t size_x_in (const layout_t* l, op_t op, int N) { return l->x_in_stride1  ? (size_t)3*l->x_in_stride1 /sizeof(double) : (size_t)N*3; }
+
+// Element pointers. These mirror the contiguous layout when the strides are 0
+static double* el_x_out(double* x, const layout_t* l, int i, int j)
+{
+    return l->x_out_stride0 ?
+        (double*)&((char*)x)[(size_t)i*l->x_out_stride0 + j*l->x_out_stride1] :
+        &x[3*i + j];
+}
+static double* el_J(double* J, const layout_t* l, op_t op, int i, int j, int k)
+{
+    return l->J_stride0 ?
+        (double*)&((char*)J)[(size_t)i*l->J_stride0 + j*l->J_stride1 + k*sizeof(double)] :
+        &J[((size_t)i*3 + j)*Nstate[op] + k];
+}
+static double* el_J_x(double* J_x, const layout_t* l, int i, int j, int k)
+{
+    return l->J_x_stride0 ?
+        (double*)&((char*)J_x)[(size_t)i*l->J_x_stride0 + j*l->J_x_stride1 + k*sizeof(double)] :
+        &J_x[9*i + 3*j + k];
+}
+static double* el_x_in(double* x, const layout_t* l, int i, int j)
+{
+    return l->x_in_stride0 ?
+        (double*)&((char*)x)[(size_t)i*l->x_in_stride0 + (size_t)j*l->x_in_stride1] :
+        &x[3*i + j];
+}
+
+static void call_batch(op_t op, const double* state, bool inverted,
+                       double* x_out, double* J, double* J_x, const double* x_in,
+                       const layout_t* l, int N)
+{
+    // The innermost strides. 0 if the layout is contiguous
+    const int d = l->J_stride0 ? (int)sizeof(double) : 0;
+
+    switch(op)
+    {
+    case OP_ROTATE_R:
+        mrcal_rotate_point_R_batch_full(x_out, l->x_out_stride0, l->x_out_stride1,
+                                        J,     l->J_stride0, l->J_stride1, 3*d, d,
+                                        J_x,   l->J_x_stride0, l->J_x_stride1, d,
+                                        state, 0,0,
+                                        x_in,  l->x_in_stride0, l->x_in_stride1,
+                                        N, inverted);
+        break;
+    case OP_ROTATE_r:
+        mrcal_rotate_point_r_batch_full(x_out, l->x_out_stride0, l->x_out_stride1,
+                                        J,     l->J_stride0, l->J_stride1, d,
+                                        J_x,   l->J_x_stride0, l->J_x_stride1, d,
+                                        state, 0,
+                                        x_in,  l->x_in_stride0, l->x_in_stride1,
+                                        N, inverted);
+        break;
+    case OP_TRANSFORM_Rt:
+        mrcal_transform_point_Rt_batch_full(x_out, l->x_out_stride0, l->x_out_stride1,
+                                            J,     l->J_stride0, l->J_stride1, 3*d, d,
+                                            J_x,   l->J_x_stride0, l->J_x_stride1, d,
+                                            state, 0,0,
+                                            x_in,  l->x_in_stride0, l->x_in_stride1,
+                                            N, inverted);
+        break;
+    case OP_TRANSFORM_rt:
+        mrcal_transform_point_rt_batch_full(x_out, l->x_out_stride0, l->x_out_stride1,
+                                            J,     l->J_stride0, l->J_stride1, d,
+                                            J_x,   l->J_x_stride0, l->J_x_stride1, d,
+                                            state, 0,
+                                            x_in,  l->x_in_stride0, l->x_in_stride1,
+                                            N, inverted);
+        break;
+    }
+}
+
+// The reference: the single-point functions, through their convenience macros
+static void call_single(op_t op, const double* state, bool inverted,
+                        double* x_out, double* J, double* J_x, const double* x_in)
+{
+    switch(op)
+    {
+    case OP_ROTATE_R:
+        if(inverted) mrcal_rotate_point_R_inverted(x_out, J, J_x, state, x_in);
+        else         mrcal_rotate_point_R         (x_out, J, J_x, state, x_in);
+        break;
+    case OP_ROTATE_r:
+        if(inverted) mrcal_rotate_point_r_inverted(x_out, J, J_x, state, x_in);
+        else         mrcal_rotate_point_r         (x_out, J, J_x, state, x_in);
+        break;
+    case OP_TRANSFORM_Rt:
+        if(inverted) mrcal_transform_point_Rt_inverted(x_out, J, J_x, state, x_in);
+        else         mrcal_transform_point_Rt         (x_out, J, J_x, state, x_in);
+        break;
+    case OP_TRANSFORM_rt:
+        if(inverted) mrcal_transform_point_rt_inverted(x_out, J, J_x, state, x_in);
+        else         mrcal_transform_point_rt         (x_out, J, J_x, state, x_in);
+        break;
+    }
+}
+
+// An arbitrary rotation and translation about an oblique axis, in the
+// representation op wants
+static void make_state(double* state, op_t op)
+{
+    const double r[3] = { 0.1, -0.3, 0.25 };
+    const double t[3] = { 1.5, -2.0, 0.7 };
+    switch(op)
+    {
+    case OP_ROTATE_R:     mrcal_R_from_r(state, NULL, r);                            break;
+    case OP_ROTATE_r:     memcpy(state, r, sizeof(r));                               break;
+    case OP_TRANSFORM_Rt: mrcal_R_from_r(state, NULL, r); memcpy(&state[9], t, sizeof(t)); break;
+    case OP_TRANSFORM_rt: memcpy(state, r, sizeof(r));    memcpy(&state[3], t, sizeof(t)); break;
+    }
+}
+
+// Deterministic noise in [-1,1]
+static double noise(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)((*seed >> 8) & 0xffff) / 32767.5 - 1.0;
+}
+
+// Runs the batch, and compares each point against the single-point function.
+// If in_place, x_out is x_in: the layout must use the same strides for both
+static void test_op(op_t op, bool inverted, bool want_J, bool want_J_x,
+                    bool strided, bool in_place, int N)
+{
+    double state[12];
+    make_state(state, op);
+
+    layout_t l = strided ? layout_strided(op, N) : layout_contiguous;
+    if(in_place)
+    {
+        l.x_out_stride0 = l.x_in_stride0;
+        l.x_out_stride1 = l.x_in_stride1;
+    }
+
+    const size_t Nx_in  = size_x_in (&l, op, N);
+    const size_t Nx_out = size_x_out(&l, op, N);
+    const size_t NJ     = size_J    (&l, op, N);
+    const size_t NJ_x   = size_J_x  (&l, op, N);
+
+    double* x_in  = (double*)malloc(Nx_in*sizeof(double));
+    double* x_ref = (double*)malloc((size_t)N*3*sizeof(double));
+    double* x_out = in_place ? x_in : (double*)malloc(Nx_out*sizeof(double));
+    double* J     = want_J   ? (double*)malloc(NJ  *sizeof(double)) : NULL;
+    double* J_x   = want_J_x ? (double*)malloc(NJ_x*sizeof(double)) : NULL;
+
+    // The padding is NaN. It's never read, and never written
+    for(size_t i=0; i<Nx_in; i++)      x_in[i]  = nan("");
+    if(!in_place)
+        for(size_t i=0; i<Nx_out; i++) x_out[i] = nan("");
+    if(J   != NULL) for(size_t i=0; i<NJ;   i++) J[i]   = nan("");
+    if(J_x != NULL) for(size_t i=0; i<NJ_x; i++) J_x[i] = nan("");
+
+    unsigned int seed = 1;
+    for(int i=0; i<N; i++)
+        for(int j=0; j<3; j++)
+        {
+            x_ref[3*i+j]         = 10.*noise(&seed);
+            *el_x_in(x_in,&l,i,j) = x_ref[3*i+j];
+        }
+
+    call_batch(op, state, inverted, x_out, J, J_x, x_in, &l, N);
+
+    double err_x = 0.0, err_J = 0.0, err_J_x = 0.0;
+    for(int i=0; i<N; i++)
+    {
+        double x1[3], J1[3*12], J_x1[3*3];
+        call_single(op, state, inverted, x1,
+                    want_J   ? J1   : NULL,
+                    want_J_x ? J_x1 : NULL,
+                    &x_ref[3*i]);
+
+        for(int j=0; j<3; j++)
+        {
+            // fmax() ignores NaN, so a missing result shows up as a failed
+            // !(err <= eps)
+            const double ex = fabs(*el_x_out(x_out,&l,i,j) - x1[j]);
+            err_x = isfinite(ex) ? fmax(err_x, ex) : INFINITY;
+            if(want_J)
+                for(int k=0; k<Nstate[op]; k++)
+                {
+                    const double e = fabs(*el_J(J,&l,op,i,j,k) - J1[j*Nstate[op]+k]);
+                    err_J = isfinite(e) ? fmax(err_J, e) : INFINITY;
+                }
+            if(want_J_x)
+                for(int k=0; k<3; k++)
+                {
+                    const double e = fabs(*el_J_x(J_x,&l,i,j,k) - J_x1[3*j+k]);
+                    err_J_x = isfinite(e) ? fmax(err_J_x, e) : INFINITY;
+                }
+        }
+    }
+
+    // The padding is untouched
+    int Npadding_written = 0;
+    if(strided && !in_place)
+        for(size_t i=0; i<Nx_out; i++)
+            if(isfinite(x_out[i]))
+                Npadding_written++;
+    if(strided && !in_place)
+        confirm_eq_int(Npadding_written, 3*N);
+
+    printf("%s%s, N=%d%s%s%s%s\n",
+           op_names[op], inverted ? "_inverted" : "", N,
+           want_J   ? ", J"         : "",
+           want_J_x ? ", J_x"       : "",
+           strided  ? ", strided"   : "",
+           in_place ? ", in place"  : "");
+    // The values are O(10); the single-point functions compute them in a
+    // different order
+    confirm_eq_double(err_x,   0.0, 1e-12);
+    confirm_eq_double(err_J,   0.0, 1e-12);
+    confirm_eq_double(err_J_x, 0.0, 1e-12);
+
+    free(x_in);
+    free(x_ref);
+    if(!in_place) free(x_out);
+    free(J);
+    free(J_x);
+}
+
+int main(int argc, char* argv[])
+{
+    for(int op=OP_ROTATE_R; op<=OP_TRANSFORM_rt; op++)
+        for(int inverted=0; inverted<2; inverted++)
+        {
+            // Every combination of gradients. A partial block only, and
+            // several blocks with a partial one at the end
+            for(int want_J=0; want_J<2; want_J++)
+                for(int want_J_x=0; want_J_x<2; want_J_x++)
+                    for(int strided=0; strided<2; strided++)
+                    {
+                        test_op((op_t)op, inverted, want_J, want_J_x, strided, false, 37);
+                        test_op((op_t)op, inverted, want_J, want_J_x, strided, false, 64*5+13);
+                    }
+
+            // In place
+            test_op((op_t)op, inverted, true,  true,  false, true, 64*5+13);
+            test_op((op_t)op, inverted, true,  true,  true,  true, 64*5+13);
+            test_op((op_t)op, inverted, false, false, true,  true, 64*5+13);
+
+            // Enough points to use several threads
+            test_op((op_t)op, inverted, true, true, true, false, 3*65536+7);
+        }
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the poseutils C library that the Python tests can't reach. The
+// Python wrapper always passes explicit strides, so the stride<=0 ("contiguous")
+// paths used by the convenience macros are exercised only here
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../poseutils.h"
+
+#include "test-harness.h"
+
+// An arbitrary rotation and translation, as (4,3) Rt. The rotation is about
+// an oblique axis, so that every element of R is non-trivial
+static void make_Rt(double* Rt)
+{
+    const double r[3] = { 0.1, -0.3, 0.25 };
+    mrcal_R_from_r(Rt, NULL, r);
+    Rt[9 ] =  1.5;
+    Rt[10] = -2.0;
+    Rt[11] =  0.7;
+}
+
+static void test_transform_point_Rt_inverted_contiguous(void)
+{
+    double Rt[12];
+    make_Rt(Rt);
+    const double x_in[3] = { 3.0, -1.0, 5.0 };
+
+    // Reference: R' (x - t), computed explicitly
+    double x_ref[3];
+    for(int i=0; i<3; i++)
+    {
+        x_ref[i] = 0.0;
+        for(int j=0; j<3; j++)
+            x_ref[i] += Rt[3*j + i] * (x_in[j] - Rt[9+j]);
+    }
+
+    // The macro passes x_in_stride0 = 0: "contiguous". This used to read every
+    // component of x_in from x_in[0]
+    double x_out[3];
+    mrcal_transform_point_Rt_inverted(x_out, NULL, NULL, Rt, x_in);
+    confirm_eq_double_max_array(x_out, x_ref, 3, 1e-12);
+
+    // With the gradients too, the result must match the explicitly-strided
+    // call exactly
+    double x_out_contiguous[3], J_Rt_contiguous[3*4*3], J_x_contiguous[3*3];
+    double x_out_strided   [3], J_Rt_strided   [3*4*3], J_x_strided   [3*3];
+    mrcal_transform_point_Rt_inverted(x_out_contiguous, J_Rt_contiguous, J_x_contiguous,
+                                      Rt, x_in);
+    mrcal_transform_point_Rt_full(x_out_strided, sizeof(double),
+                                  J_Rt_strided, 4*3*sizeof(double), 3*sizeof(double), sizeof(double),
+                                  J_x_strided, 3*sizeof(double), sizeof(double),
+                                  Rt, 3*sizeof(double), sizeof(double),
+                                  x_in, sizeof(double),
+                                  true);
+    confirm_eq_double_max_array(x_out_contiguous, x_ref,           3,     1e-12);
+    confirm_eq_double_max_array(x_out_contiguous, x_out_strided,   3,     1e-15);
+    confirm_eq_double_max_array(J_Rt_contiguous,  J_Rt_strided,    3*4*3, 1e-15);
+    confirm_eq_double_max_array(J_x_contiguous,   J_x_strided,     3*3,   1e-15);
+
+    // And inverting the forward transform gets us back where we started
+    double x_fwd[3], x_back[3];
+    mrcal_transform_point_Rt         (x_fwd,  NULL, NULL, Rt, x_in);
+    mrcal_transform_point_Rt_inverted(x_back, NULL, NULL, Rt, x_fwd);
+    confirm_eq_double_max_array(x_back, x_in, 3, 1e-12);
+}
+
+int main(int argc, char* argv[])
+{
+    test_transform_point_Rt_inverted_contiguous();
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,173 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the batch projection engine behind mrcal_project(). For each lens
+// model, _mrcal_project_batch() must produce exactly what
+// _mrcal_project_internal() produces for the whole batch at once: with and
+// without gradients, at the block boundaries of the structure-of-arrays
+// kernels, and above the threshold where the batch is split across threads
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "../project-batch.h"
+#include "test-harness.h"
+
+// Deterministic noise in [-1,1]
+static double noise(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)((*seed >> 8) & 0xffff) / 32767.5 - 1.0;
+}
+
+// Points in front of the camera, within ~50 degrees of the optical axis, at
+// various distances
+static void make_points(mrcal_point3_t* p, int N)
+{
+    unsigned int seed = 3;
+    for(int i=0; i<N; i++)
+    {
+        const double th    = 0.9 * fabs(noise(&seed));
+        const double phi   = M_PI * noise(&seed);
+        const double range = 1. + 9.*fabs(noise(&seed));
+        p[i].x = range * sin(th) * cos(phi);
+        p[i].y = range * sin(th) * sin(phi);
+        p[i].z = range * cos(th);
+    }
+}
+
+// Reasonable intrinsics for any model: a core, and small distortions
+static void make_intrinsics(double* intrinsics, const mrcal_lensmodel_t* lensmodel)
+{
+    const int Nintrinsics = mrcal_lensmodel_num_params(lensmodel);
+    unsigned int seed = 5;
+
+    intrinsics[0] = 1000. + 10.*noise(&seed);
+    intrinsics[1] = 1010. + 10.*noise(&seed);
+    intrinsics[2] = 1999.5 + 5.*noise(&seed);
+    intrinsics[3] = 1499.5 + 5.*noise(&seed);
+    for(int i=4; i<Nintrinsics; i++)
+        intrinsics[i] = 0.01 * noise(&seed);
+}
+
+static void test_lensmodel(const char* lensmodel_name,
+                           bool has_gradients)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, lensmodel_name));
+    const int Nintrinsics = mrcal_lensmodel_num_params(&lensmodel);
+
+    // Single points, the block boundaries of the kernels, and more than
+    // NPOINTS_PER_THREAD_MIN points per thread, with a remainder
+    const int N_all[] = { 1, 63, 64, 65, 200, 2*16384 + 37 };
+    const int Nmax    = N_all[sizeof(N_all)/sizeof(N_all[0]) - 1];
+
+    double* intrinsics = (double*)malloc(Nintrinsics*sizeof(double));
+    make_intrinsics(intrinsics, &lensmodel);
+
+    mrcal_point3_t* p = (mrcal_point3_t*)malloc(Nmax*sizeof(mrcal_point3_t));
+    make_points(p, Nmax);
+
+    mrcal_projection_precomputed_t precomputed;
+    _mrcal_precompute_lensmodel_data(&precomputed, &lensmodel);
+
+    // The gradients take a lot of memory for the splined models: 2*Nintrinsics
+    // per point. So those are evaluated on the smaller batches only
+    const int Nmax_gradients = 200;
+
+    mrcal_point2_t* q_ref     = (mrcal_point2_t*)malloc(Nmax*sizeof(mrcal_point2_t));
+    mrcal_point2_t* q         = (mrcal_point2_t*)malloc(Nmax*sizeof(mrcal_point2_t));
+    mrcal_point3_t* dq_dp_ref = (mrcal_point3_t*)malloc(2*Nmax_gradients*sizeof(mrcal_point3_t));
+    mrcal_point3_t* dq_dp     = (mrcal_point3_t*)malloc(2*Nmax_gradients*sizeof(mrcal_point3_t));
+    double*         dq_di_ref = (double*)malloc((size_t)2*Nintrinsics*Nmax_gradients*sizeof(double));
+    double*         dq_di     = (double*)malloc((size_t)2*Nintrinsics*Nmax_gradients*sizeof(double));
+
+    for(int N : N_all)
+    {
+        // No gradients. The PINHOLE, OPENCV* and STEREOGRAPHIC models use the
+        // structure-of-arrays kernels here
+        confirm(_mrcal_project_internal(q_ref, NULL, NULL,
+                                        p, N, &lensmodel, intrinsics,
+                                        Nintrinsics, &precomputed));
+        const int Nthreads_all[] = { 1, 3 };
+        for(int Nthreads : Nthreads_all)
+        {
+            memset(q, 0x55, N*sizeof(mrcal_point2_t));
+            confirm(_mrcal_project_batch(q, NULL, NULL,
+                                         p, N, &lensmodel, intrinsics,
+                                         Nthreads == 1 ? &precomputed : NULL,
+                                         Nthreads));
+            confirm(0 == memcmp(q, q_ref, N*sizeof(mrcal_point2_t)));
+        }
+
+        // And through the public function
+        memset(q, 0x55, N*sizeof(mrcal_point2_t));
+        confirm(mrcal_project(q, NULL, NULL, p, N, &lensmodel, intrinsics));
+        confirm(0 == memcmp(q, q_ref, N*sizeof(mrcal_point2_t)));
+
+        if(!has_gradients || N > Nmax_gradients)
+            continue;
+
+        // Gradients: each gradient separately, and both together
+        for(int which = 1; which <= 3; which++)
+        {
+            mrcal_point3_t* dq_dp_want     = (which & 1) ? dq_dp_ref : NULL;
+            double*         dq_di_want     = (which & 2) ? dq_di_ref : NULL;
+            mrcal_point3_t* dq_dp_test     = (which & 1) ? dq_dp     : NULL;
+            double*         dq_di_test     = (which & 2) ? dq_di     : NULL;
+
+            confirm(_mrcal_project_internal(q_ref, dq_dp_want, dq_di_want,
+                                            p, N, &lensmodel, intrinsics,
+                                            Nintrinsics, &precomputed));
+
+            memset(q,     0x55, N*sizeof(mrcal_point2_t));
+            memset(dq_dp, 0x55, 2*N*sizeof(mrcal_point3_t));
+            memset(dq_di, 0x55, (size_t)2*Nintrinsics*N*sizeof(double));
+            confirm(_mrcal_project_batch(q, dq_dp_test, dq_di_test,
+                                         p, N, &lensmodel, intrinsics,
+                                         NULL, 3));
+            confirm(0 == memcmp(q, q_ref, N*sizeof(mrcal_point2_t)));
+            if(which & 1)
+                confirm(0 == memcmp(dq_dp, dq_dp_ref, 2*N*sizeof(mrcal_point3_t)));
+            if(which & 2)
+                confirm(0 == memcmp(dq_di, dq_di_ref, (size_t)2*Nintrinsics*N*sizeof(double)));
+        }
+    }
+
+    // An empty batch does nothing
+    confirm(_mrcal_project_batch(q, NULL, NULL, p, 0, &lensmodel, intrinsics, NULL, 3));
+
+    free(intrinsics);
+    free(p);
+    free(q_ref);
+    free(q);
+    free(dq_dp_ref);
+    free(dq_dp);
+    free(dq_di_ref);
+    free(dq_di);
+}
+
+int main(int argc, char* argv[])
+{
+    test_lensmodel("LENSMODEL_PINHOLE",       true);
+    test_lensmodel("LENSMODEL_STEREOGRAPHIC", true);
+    test_lensmodel("LENSMODEL_LONLAT",        true);
+    test_lensmodel("LENSMODEL_LATLON",        true);
+    test_lensmodel("LENSMODEL_OPENCV4",       true);
+    test_lensmodel("LENSMODEL_OPENCV5",       true);
+    test_lensmodel("LENSMODEL_OPENCV8",       true);
+    test_lensmodel("LENSMODEL_OPENCV12",      true);
+    test_lensmodel("LENSMODEL_CAHVOR",        true);
+    test_lensmodel("LENSMODEL_CAHVORE_linearity=0.00", false);
+    test_lensmodel("LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=11_Ny=8_fov_x_deg=120", true);
+
+    TEST_FOOTER();
+}
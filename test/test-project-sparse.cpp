@@ -0,0 +1,250 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of mrcal_project_sparse_intrinsics_gradients(). The sparse gradients,
+// densified using the layout from mrcal_gradient_sparse_meta(), must be exactly
+// the dq_dintrinsics reported by mrcal_project(). q and dq_dp must match too.
+// A batch large enough to be split across threads must produce the same
+// results as a sequence of small batches
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+// Deterministic noise in [-1,1]
+static double noise(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)((*seed >> 8) & 0xffff) / 32767.5 - 1.0;
+}
+
+// Points in front of the camera, some of them outside the spline domain
+static void make_points(mrcal_point3_t* p, int N)
+{
+    unsigned int seed = 13;
+    for(int i=0; i<N; i++)
+    {
+        const double th    = 1.3 * fabs(noise(&seed));
+        const double phi   = M_PI * noise(&seed);
+        const double range = 0.5 + 20.*fabs(noise(&seed));
+        p[i].x = range * sin(th) * cos(phi);
+        p[i].y = range * sin(th) * sin(phi);
+        p[i].z = range * cos(th);
+    }
+}
+
+// The sparse gradients of one point, expanded into a dense (2,Nintrinsics)
+// array, as described in mrcal.h
+static void densify(double* dq_dintrinsics,
+                    const mrcal_point2_t* dq_dfxy,
+                    int ivar0,
+                    const double* pool,
+                    const double* intrinsics,
+                    int Nintrinsics,
+                    const mrcal_gradient_sparse_meta_t* meta)
+{
+    memset(dq_dintrinsics, 0, 2*Nintrinsics*sizeof(double));
+
+    dq_dintrinsics[0*Nintrinsics + 0] = dq_dfxy->x;
+    dq_dintrinsics[1*Nintrinsics + 1] = dq_dfxy->y;
+    dq_dintrinsics[0*Nintrinsics + 2] = 1.0;
+    dq_dintrinsics[1*Nintrinsics + 3] = 1.0;
+
+    const int     len   = meta->run_side_length;
+    const double* ABCDx = &pool[0];
+    const double* ABCDy = &pool[len];
+    for(int i_xy=0; i_xy<2; i_xy++)
+        for(int iy=0; iy<len; iy++)
+            for(int ix=0; ix<len; ix++)
+            {
+                const int ivar = ivar0 + meta->ivar_stridey*iy + ix*2 + i_xy;
+                dq_dintrinsics[ivar + i_xy*Nintrinsics] =
+                    ABCDx[ix]*ABCDy[iy]*intrinsics[i_xy];
+            }
+}
+
+static void test_sparse(const char* lensmodel_name)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, lensmodel_name));
+    const int Nintrinsics = mrcal_lensmodel_num_params(&lensmodel);
+
+    mrcal_gradient_sparse_meta_t meta;
+    confirm(mrcal_gradient_sparse_meta(&meta, &lensmodel));
+    const int runlen = meta.run_side_length;
+    confirm_eq_int(runlen, lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.order + 1);
+    confirm_eq_int(meta.ivar_stridey, 2*lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config.Nx);
+
+    double* intrinsics = (double*)malloc(Nintrinsics*sizeof(double));
+    unsigned int seed = 17;
+    intrinsics[0] = 1500. + 10.*noise(&seed);
+    intrinsics[1] = 1510. + 10.*noise(&seed);
+    intrinsics[2] = 1999.5 + 5.*noise(&seed);
+    intrinsics[3] = 1499.5 + 5.*noise(&seed);
+    for(int i=4; i<Nintrinsics; i++)
+        intrinsics[i] = 0.05 * noise(&seed);
+
+    // The dense gradients are big, so they're compared on a small batch
+    const int N = 300;
+
+    mrcal_point3_t* p            = (mrcal_point3_t*)malloc(N*sizeof(mrcal_point3_t));
+    mrcal_point2_t* q_ref        = (mrcal_point2_t*)malloc(N*sizeof(mrcal_point2_t));
+    mrcal_point3_t* dq_dp_ref    = (mrcal_point3_t*)malloc(2*N*sizeof(mrcal_point3_t));
+    double*         dq_di_ref    = (double*)malloc((size_t)2*Nintrinsics*N*sizeof(double));
+    mrcal_point2_t* q            = (mrcal_point2_t*)malloc(N*sizeof(mrcal_point2_t));
+    mrcal_point3_t* dq_dp        = (mrcal_point3_t*)malloc(2*N*sizeof(mrcal_point3_t));
+    mrcal_point2_t* dq_dfxy      = (mrcal_point2_t*)malloc(N*sizeof(mrcal_point2_t));
+    int*            ivar0        = (int*)malloc(N*sizeof(int));
+    double*         pool         = (double*)malloc((size_t)2*runlen*N*sizeof(double));
+    double*         dq_di        = (double*)malloc(2*Nintrinsics*sizeof(double));
+    make_points(p, N);
+
+    confirm(mrcal_project(q_ref, dq_dp_ref, dq_di_ref,
+                          p, N, &lensmodel, intrinsics));
+    confirm(mrcal_project_sparse_intrinsics_gradients(q, dq_dp, dq_dfxy, ivar0, pool,
+                                                      p, N, &lensmodel, intrinsics));
+    confirm(0 == memcmp(q,     q_ref,     N*sizeof(mrcal_point2_t)));
+    confirm(0 == memcmp(dq_dp, dq_dp_ref, 2*N*sizeof(mrcal_point3_t)));
+
+    bool dense_match = true, ivar0_in_bounds = true;
+    for(int i=0; i<N; i++)
+    {
+        const int ivar_last = ivar0[i] + meta.ivar_stridey*(runlen-1) + 2*(runlen-1) + 1;
+        if(ivar0[i] < 4 || ivar_last >= Nintrinsics)
+        {
+            ivar0_in_bounds = false;
+            continue;
+        }
+        densify(dq_di, &dq_dfxy[i], ivar0[i], &pool[(size_t)i*2*runlen],
+                intrinsics, Nintrinsics, &meta);
+        if(0 != memcmp(dq_di, &dq_di_ref[(size_t)i*2*Nintrinsics],
+                       2*Nintrinsics*sizeof(double)))
+            dense_match = false;
+    }
+    confirm(ivar0_in_bounds);
+    confirm(dense_match);
+
+    // The optional outputs may be omitted
+    memset(q, 0x55, N*sizeof(mrcal_point2_t));
+    confirm(mrcal_project_sparse_intrinsics_gradients(q, NULL, NULL, ivar0, pool,
+                                                      p, N, &lensmodel, intrinsics));
+    confirm(0 == memcmp(q, q_ref, N*sizeof(mrcal_point2_t)));
+
+    free(intrinsics);
+    free(p);
+    free(q_ref);
+    free(dq_dp_ref);
+    free(dq_di_ref);
+    free(q);
+    free(dq_dp);
+    free(dq_dfxy);
+    free(ivar0);
+    free(pool);
+    free(dq_di);
+}
+
+// Above PROJECT_SPARSE_NPOINTS_PER_THREAD_MIN per thread the batch may be split
+// across threads. Each point is independent, so one big batch must match many
+// small ones
+static void test_sparse_large(const char* lensmodel_name)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, lensmodel_name));
+    const int Nintrinsics = mrcal_lensmodel_num_params(&lensmodel);
+
+    mrcal_gradient_sparse_meta_t meta;
+    confirm(mrcal_gradient_sparse_meta(&meta, &lensmodel));
+    const int runlen = meta.run_side_length;
+
+    double* intrinsics = (double*)malloc(Nintrinsics*sizeof(double));
+    unsigned int seed = 19;
+    intrinsics[0] = 1500.;
+    intrinsics[1] = 1510.;
+    intrinsics[2] = 1999.5;
+    intrinsics[3] = 1499.5;
+    for(int i=4; i<Nintrinsics; i++)
+        intrinsics[i] = 0.05 * noise(&seed);
+
+    const int N      = 4*16384 + 123;
+    const int Nsmall = 1000;
+
+    mrcal_point3_t* p         = (mrcal_point3_t*)malloc(N*sizeof(mrcal_point3_t));
+    mrcal_point2_t* q[2];
+    mrcal_point3_t* dq_dp[2];
+    mrcal_point2_t* dq_dfxy[2];
+    int*            ivar0[2];
+    double*         pool[2];
+    for(int k=0; k<2; k++)
+    {
+        q[k]       = (mrcal_point2_t*)malloc(N*sizeof(mrcal_point2_t));
+        dq_dp[k]   = (mrcal_point3_t*)malloc(2*N*sizeof(mrcal_point3_t));
+        dq_dfxy[k] = (mrcal_point2_t*)malloc(N*sizeof(mrcal_point2_t));
+        ivar0[k]   = (int*)malloc(N*sizeof(int));
+        pool[k]    = (double*)malloc((size_t)2*runlen*N*sizeof(double));
+    }
+    make_points(p, N);
+
+    confirm(mrcal_project_sparse_intrinsics_gradients(q[0], dq_dp[0], dq_dfxy[0], ivar0[0], pool[0],
+                                                      p, N, &lensmodel, intrinsics));
+    bool ok = true;
+    for(int i0=0; i0<N; i0 += Nsmall)
+    {
+        const int n = N-i0 < Nsmall ? N-i0 : Nsmall;
+        if(!mrcal_project_sparse_intrinsics_gradients(&q[1][i0], &dq_dp[1][2*i0], &dq_dfxy[1][i0],
+                                                      &ivar0[1][i0], &pool[1][(size_t)2*runlen*i0],
+                                                      &p[i0], n, &lensmodel, intrinsics))
+            ok = false;
+    }
+    confirm(ok);
+    confirm(0 == memcmp(q[0],       q[1],       N*sizeof(mrcal_point2_t)));
+    confirm(0 == memcmp(dq_dp[0],   dq_dp[1],   2*N*sizeof(mrcal_point3_t)));
+    confirm(0 == memcmp(dq_dfxy[0], dq_dfxy[1], N*sizeof(mrcal_point2_t)));
+    confirm(0 == memcmp(ivar0[0],   ivar0[1],   N*sizeof(int)));
+    confirm(0 == memcmp(pool[0],    pool[1],    (size_t)2*runlen*N*sizeof(double)));
+
+    free(intrinsics);
+    free(p);
+    for(int k=0; k<2; k++)
+    {
+        free(q[k]);
+        free(dq_dp[k]);
+        free(dq_dfxy[k]);
+        free(ivar0[k]);
+        free(pool[k]);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    test_sparse("LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=11_Ny=8_fov_x_deg=120");
+    test_sparse("LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=30_Ny=20_fov_x_deg=170");
+    test_sparse("LENSMODEL_SPLINED_STEREOGRAPHIC_order=2_Nx=11_Ny=8_fov_x_deg=120");
+    test_sparse_large("LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=11_Ny=8_fov_x_deg=120");
+
+    // Only the splined models have sparse gradients
+    {
+        mrcal_lensmodel_t lensmodel;
+        confirm(mrcal_lensmodel_from_name(&lensmodel, "LENSMODEL_OPENCV8"));
+        mrcal_gradient_sparse_meta_t meta;
+        confirm(!mrcal_gradient_sparse_meta(&meta, &lensmodel));
+
+        const double   intrinsics[12] = { 1000., 1000., 500., 500. };
+        const mrcal_point3_t p = { .x = 0.1, .y = 0.2, .z = 1. };
+        mrcal_point2_t q;
+        int            ivar0;
+        double         pool[8];
+        confirm(!mrcal_project_sparse_intrinsics_gradients(&q, NULL, NULL, &ivar0, pool,
+                                                           &p, 1, &lensmodel, intrinsics));
+    }
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the blocked no-gradients projection of the splined models,
+// _mrcal_project_internal_splined(). It must be bit-identical to the per-point
+// path (_project_point_splined(), used whenever gradients are requested) for
+// both spline orders, for partial blocks, and for points outside the spline
+// domain, which are clamped to the nearest valid segment
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+// Deterministic noise in [-1,1]
+static double noise(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)((*seed >> 8) & 0xffff) / 32767.5 - 1.0;
+}
+
+// Points all around the forward hemisphere and somewhat behind it. The
+// fov_x_deg of the models below is smaller than this, so many of the points
+// fall outside the spline domain
+static void make_points(mrcal_point3_t* p, int N)
+{
+    unsigned int seed = 7;
+    for(int i=0; i<N; i++)
+    {
+        const double th    = 2.0 * fabs(noise(&seed));
+        const double phi   = M_PI * noise(&seed);
+        const double range = 0.5 + 20.*fabs(noise(&seed));
+        p[i].x = range * sin(th) * cos(phi);
+        p[i].y = range * sin(th) * sin(phi);
+        p[i].z = range * cos(th);
+    }
+}
+
+static void test_splined(const char* lensmodel_name)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, lensmodel_name));
+    const int Nintrinsics = mrcal_lensmodel_num_params(&lensmodel);
+
+    double* intrinsics = (double*)malloc(Nintrinsics*sizeof(double));
+    unsigned int seed = 11;
+    intrinsics[0] = 1500. + 10.*noise(&seed);
+    intrinsics[1] = 1510. + 10.*noise(&seed);
+    intrinsics[2] = 1999.5 + 5.*noise(&seed);
+    intrinsics[3] = 1499.5 + 5.*noise(&seed);
+    for(int i=4; i<Nintrinsics; i++)
+        intrinsics[i] = 0.05 * noise(&seed);
+
+    mrcal_projection_precomputed_t precomputed;
+    _mrcal_precompute_lensmodel_data(&precomputed, &lensmodel);
+
+    // Partial blocks, exactly one block, and several blocks with a remainder
+    const int N_all[] = { 1, 5, 63, 64, 65, 1000 };
+    const int Nmax    = N_all[sizeof(N_all)/sizeof(N_all[0]) - 1];
+
+    mrcal_point3_t* p     = (mrcal_point3_t*)malloc(Nmax*sizeof(mrcal_point3_t));
+    mrcal_point2_t* q     = (mrcal_point2_t*)malloc(Nmax*sizeof(mrcal_point2_t));
+    mrcal_point2_t* q_ref = (mrcal_point2_t*)malloc(Nmax*sizeof(mrcal_point2_t));
+    mrcal_point3_t* dq_dp = (mrcal_point3_t*)malloc(2*Nmax*sizeof(mrcal_point3_t));
+    make_points(p, Nmax);
+
+    for(int N : N_all)
+    {
+        // Requesting dq_dp forces the per-point path
+        confirm(_mrcal_project_internal(q_ref, dq_dp, NULL,
+                                        p, N, &lensmodel, intrinsics,
+                                        Nintrinsics, &precomputed));
+
+        memset(q, 0x55, N*sizeof(mrcal_point2_t));
+        _mrcal_project_internal_splined(q, p, N,
+                                        &lensmodel.LENSMODEL_SPLINED_STEREOGRAPHIC__config,
+                                        intrinsics,
+                                        &precomputed.LENSMODEL_SPLINED_STEREOGRAPHIC__precomputed);
+        confirm(0 == memcmp(q, q_ref, N*sizeof(mrcal_point2_t)));
+
+        // And through the public function
+        memset(q, 0x55, N*sizeof(mrcal_point2_t));
+        confirm(mrcal_project(q, NULL, NULL, p, N, &lensmodel, intrinsics));
+        confirm(0 == memcmp(q, q_ref, N*sizeof(mrcal_point2_t)));
+    }
+
+    free(intrinsics);
+    free(p);
+    free(q);
+    free(q_ref);
+    free(dq_dp);
+}
+
+int main(int argc, char* argv[])
+{
+    test_splined("LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=11_Ny=8_fov_x_deg=120");
+    test_splined("LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=30_Ny=20_fov_x_deg=170");
+    test_splined("LENSMODEL_SPLINED_STEREOGRAPHIC_order=2_Nx=11_Ny=8_fov_x_deg=120");
+    test_splined("LENSMODEL_SPLINED_STEREOGRAPHIC_order=2_Nx=16_Ny=9_fov_x_deg=60");
+
+    TEST_FOOTER();
+}
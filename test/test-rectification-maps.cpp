@@ -0,0 +1,514 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the C rectification maps. mrcal_rectification_maps() computes the
+// maps a row at a time, in tiles of rows, with the LENSMODEL_LATLON sin/cos
+// evaluated incrementally. The results must match a plain per-pixel
+// unproject/rotate/project to within a float ulp. The sparse maps from
+// mrcal_rectification_maps_sparse() must sample the dense maps from
+// mrcal_rectification_maps() at the grid nodes, and
+// mrcal_image_..._remap_sparse() must interpolate them the same way that
+// mrcal_image_..._remap() applies an interpolated dense map. The reported
+// interpolation error must match what we see. And mrcal_image_..._rectify(),
+// which never stores the maps, must produce exactly what the maps and
+// mrcal_image_..._remap() produce, including the pixels that map outside the
+// input images
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+#define W_IN 640
+#define H_IN 480
+
+typedef struct
+{
+    mrcal_lensmodel_t      lensmodel;
+    double                 intrinsics[8];
+    double                 r_cam0_ref[3];
+    double                 r_cam1_ref[3];
+    double                 r_rect0_ref[3];
+    mrcal_lensmodel_type_t rectification_model_type;
+    double                 fxycxy_rectified[4];
+    unsigned int           imagersize_rectified[2];
+} geometry_t;
+
+// Two slightly-rotated OPENCV4 cameras. The rectified field of view is wider
+// than the cameras', so the edges of the maps fall outside the input images
+static geometry_t make_geometry(mrcal_lensmodel_type_t rectification_model_type)
+{
+    geometry_t g = {};
+    g.lensmodel.type = MRCAL_LENSMODEL_OPENCV4;
+    const double intrinsics[8] = { 500., 505., 319.5, 239.5,
+                                   -0.1, 0.02, 0.001, -0.002 };
+    memcpy(g.intrinsics, intrinsics, sizeof(intrinsics));
+
+    g.r_cam0_ref[1]  =  0.01;
+    g.r_cam1_ref[0]  =  0.01;
+    g.r_cam1_ref[1]  = -0.02;
+    g.r_cam1_ref[2]  =  0.005;
+    g.r_rect0_ref[0] = -0.003;
+    g.r_rect0_ref[2] =  0.002;
+
+    g.rectification_model_type = rectification_model_type;
+    g.imagersize_rectified[0]  = 401;
+    g.imagersize_rectified[1]  = 303;
+
+    const double fov_x = 80. * M_PI/180.;
+    const double fov_y = 60. * M_PI/180.;
+    if(rectification_model_type == MRCAL_LENSMODEL_LATLON)
+    {
+        g.fxycxy_rectified[0] = (double)g.imagersize_rectified[0] / fov_x;
+        g.fxycxy_rectified[1] = (double)g.imagersize_rectified[1] / fov_y;
+    }
+    else if(rectification_model_type == MRCAL_LENSMODEL_PINHOLE)
+    {
+        g.fxycxy_rectified[0] = (double)g.imagersize_rectified[0] / 2. / tan(fov_x/2.);
+        g.fxycxy_rectified[1] = (double)g.imagersize_rectified[1] / 2. / tan(fov_y/2.);
+    }
+    else
+    {
+        // LENSMODEL_STEREOGRAPHIC
+        g.fxycxy_rectified[0] = (double)g.imagersize_rectified[0] / 4. / tan(fov_x/4.);
+        g.fxycxy_rectified[1] = (double)g.imagersize_rectified[1] / 4. / tan(fov_y/4.);
+    }
+    g.fxycxy_rectified[2] = ((double)g.imagersize_rectified[0] - 1.) / 2.;
+    g.fxycxy_rectified[3] = ((double)g.imagersize_rectified[1] - 1.) / 2.;
+    return g;
+}
+
+static bool dense_maps(float* maps, const geometry_t* g)
+{
+    return mrcal_rectification_maps(maps,
+                                     &g->lensmodel, g->intrinsics, g->r_cam0_ref,
+                                     &g->lensmodel, g->intrinsics, g->r_cam1_ref,
+                                     g->rectification_model_type,
+                                     g->fxycxy_rectified,
+                                     g->imagersize_rectified,
+                                     g->r_rect0_ref);
+}
+
+static bool sparse_maps(float* maps, double* max_interpolation_error,
+                        const geometry_t* g, int spacing)
+{
+    return mrcal_rectification_maps_sparse(maps, max_interpolation_error,
+                                           &g->lensmodel, g->intrinsics, g->r_cam0_ref,
+                                           &g->lensmodel, g->intrinsics, g->r_cam1_ref,
+                                           g->rectification_model_type,
+                                           g->fxycxy_rectified,
+                                           g->imagersize_rectified,
+                                           g->r_rect0_ref,
+                                           spacing);
+}
+
+// How many floats apart a and b are. Both must be finite
+static int float_ulps_apart(float a, float b)
+{
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(ia));
+    memcpy(&ib, &b, sizeof(ib));
+    // Map the sign-magnitude floats to a monotonic integer sequence
+    if(ia < 0) ia = INT32_MIN - ia;
+    if(ib < 0) ib = INT32_MIN - ib;
+    const int64_t d = (int64_t)ia - (int64_t)ib;
+    return d < 0 ? (int)-d : (int)d;
+}
+
+// The maps, one pixel at a time, the obvious way
+static void test_tiles_against_per_pixel(mrcal_lensmodel_type_t rectification_model_type)
+{
+    const geometry_t g = make_geometry(rectification_model_type);
+    const int Naz = (int)g.imagersize_rectified[0];
+    const int Nel = (int)g.imagersize_rectified[1];
+
+    float* maps = (float*)malloc((size_t)2*Nel*Naz*2*sizeof(float));
+    confirm(dense_maps(maps, &g));
+
+    const mrcal_lensmodel_t lensmodel_rectified = { .type = rectification_model_type };
+
+    double R_rect0_ref[3*3];
+    mrcal_R_from_r(R_rect0_ref, NULL, g.r_rect0_ref);
+
+    int  Nulps_max  = 0;
+    bool all_ok     = true;
+    for(int icam=0; icam<2; icam++)
+    {
+        // R_cam_rect = R_cam_ref R_rect0_ref'
+        double R_cam_ref [3*3];
+        double R_cam_rect[3*3] = {};
+        mrcal_R_from_r(R_cam_ref, NULL, icam == 0 ? g.r_cam0_ref : g.r_cam1_ref);
+        for(int i=0; i<3; i++)
+            for(int j=0; j<3; j++)
+                for(int k=0; k<3; k++)
+                    R_cam_rect[i*3 + j] += R_cam_ref[i*3 + k] * R_rect0_ref[j*3 + k];
+
+        const float* map = &maps[icam*Nel*Naz*2];
+        for(int y=0; y<Nel; y++)
+            for(int x=0; x<Naz; x++)
+            {
+                const mrcal_point2_t qrect = { .x = (double)x, .y = (double)y };
+                mrcal_point3_t v, vcam;
+                mrcal_point2_t q;
+                if(!mrcal_unproject(&v, &qrect, 1,
+                                    &lensmodel_rectified, g.fxycxy_rectified))
+                {
+                    all_ok = false;
+                    continue;
+                }
+                mrcal_rotate_point_R(vcam.xyz, NULL, NULL, R_cam_rect, v.xyz);
+                if(!mrcal_project(&q, NULL, NULL, &vcam, 1,
+                                  &g.lensmodel, g.intrinsics))
+                {
+                    all_ok = false;
+                    continue;
+                }
+
+                const float* m = &map[(y*Naz + x)*2];
+                if(!isfinite(m[0]) || !isfinite(m[1]) ||
+                   !isfinite((float)q.x) || !isfinite((float)q.y))
+                {
+                    all_ok = false;
+                    continue;
+                }
+                const int Nulps_x = float_ulps_apart(m[0], (float)q.x);
+                const int Nulps_y = float_ulps_apart(m[1], (float)q.y);
+                if(Nulps_x > Nulps_max) Nulps_max = Nulps_x;
+                if(Nulps_y > Nulps_max) Nulps_max = Nulps_y;
+            }
+    }
+    confirm(all_ok);
+    confirm(Nulps_max <= 1);
+
+    free(maps);
+}
+
+// A smooth image, with some deterministic texture on top
+static void make_image(uint8_t* image, int seed)
+{
+    unsigned int s = (unsigned int)seed;
+    for(int y=0; y<H_IN; y++)
+        for(int x=0; x<W_IN; x++)
+        {
+            s = s * 1103515245u + 12345u;
+            const double v =
+                128. +
+                80.*sin((double)x*0.05 + (double)seed)*cos((double)y*0.07) +
+                (double)((s >> 16) % 16);
+            image[y*W_IN + x] = (uint8_t)v;
+        }
+}
+
+static bool remap_equal_within(const mrcal_image_uint8_t* a,
+                               const mrcal_image_uint8_t* b,
+                               int eps)
+{
+    for(int y=0; y<a->h; y++)
+        for(int x=0; x<a->w; x++)
+            if(abs((int)a->data[y*a->stride + x] - (int)b->data[y*b->stride + x]) > eps)
+                return false;
+    return true;
+}
+
+static void test_bad_spacing(void)
+{
+    const geometry_t g = make_geometry(MRCAL_LENSMODEL_LATLON);
+    unsigned int gridsize[2];
+    confirm(!mrcal_rectification_maps_sparse_gridsize(gridsize, g.imagersize_rectified, 0));
+    confirm(!mrcal_rectification_maps_sparse_gridsize(gridsize, g.imagersize_rectified, -8));
+
+    float map[2*2*2*2];
+    confirm(!sparse_maps(map, NULL, &g, 0));
+    confirm(!sparse_maps(map, NULL, &g, -8));
+
+    uint8_t in[4] = {}, out[4] = {};
+    mrcal_image_uint8_t image_in  = { .w = 2, .h = 2, .stride = 2, .data = in  };
+    mrcal_image_uint8_t image_out = { .w = 2, .h = 2, .stride = 2, .data = out };
+    confirm(!mrcal_image_uint8_remap_sparse(&image_out, &image_in, map, 0));
+}
+
+static void test_sparse(mrcal_lensmodel_type_t rectification_model_type,
+                        int spacing)
+{
+    const geometry_t g = make_geometry(rectification_model_type);
+    const int Naz = (int)g.imagersize_rectified[0];
+    const int Nel = (int)g.imagersize_rectified[1];
+
+    unsigned int gridsize[2];
+    confirm(mrcal_rectification_maps_sparse_gridsize(gridsize, g.imagersize_rectified, spacing));
+    const int Naz_grid = (int)gridsize[0];
+    const int Nel_grid = (int)gridsize[1];
+    // The grid covers the whole image
+    confirm((Naz_grid-1)*spacing >= Naz-1 && (Naz_grid-2)*spacing < Naz-1);
+    confirm((Nel_grid-1)*spacing >= Nel-1 && (Nel_grid-2)*spacing < Nel-1);
+
+    float* dense  = (float*)malloc((size_t)2*Nel     *Naz     *2*sizeof(float));
+    float* sparse = (float*)malloc((size_t)2*Nel_grid*Naz_grid*2*sizeof(float));
+    // The dense maps interpolated from the sparse ones, in double precision
+    float* interpolated = (float*)malloc((size_t)Nel*Naz*2*sizeof(float));
+
+    double max_interpolation_error = -1.;
+    confirm(dense_maps(dense, &g));
+    confirm(sparse_maps(sparse, &max_interpolation_error, &g, spacing));
+
+    uint8_t* in        = (uint8_t*)malloc(W_IN*H_IN);
+    uint8_t* out       = (uint8_t*)malloc(Naz*Nel);
+    uint8_t* out_ref   = (uint8_t*)malloc(Naz*Nel);
+    mrcal_image_uint8_t image_in      = { .w = W_IN, .h = H_IN, .stride = W_IN, .data = in      };
+    mrcal_image_uint8_t image_out     = { .w = Naz,  .h = Nel,  .stride = Naz,  .data = out     };
+    mrcal_image_uint8_t image_out_ref = { .w = Naz,  .h = Nel,  .stride = Naz,  .data = out_ref };
+
+    double max_error_seen = 0.;
+    for(int icam=0; icam<2; icam++)
+    {
+        const float* d = &dense [icam*Nel     *Naz     *2];
+        const float* s = &sparse[icam*Nel_grid*Naz_grid*2];
+
+        // The grid nodes inside the image are the dense maps at those pixels
+        double max_node_error = 0.;
+        for(int i=0; i<Nel_grid; i++)
+            for(int j=0; j<Naz_grid; j++)
+            {
+                const int x = j*spacing, y = i*spacing;
+                if(x >= Naz || y >= Nel) continue;
+                for(int k=0; k<2; k++)
+                {
+                    const double e = fabs((double)s[(i*Naz_grid + j)*2 + k] -
+                                          (double)d[(y*Naz + x)*2 + k]);
+                    if(e > max_node_error) max_node_error = e;
+                }
+            }
+        if(spacing == 1)
+            // The same computation exactly
+            confirm(0 == memcmp(d, s, (size_t)Nel*Naz*2*sizeof(float)));
+        else
+            confirm_eq_double(max_node_error, 0., 1e-3);
+
+        for(int y=0; y<Nel; y++)
+            for(int x=0; x<Naz; x++)
+            {
+                const int    i  = y / spacing;
+                const int    j  = x / spacing;
+                const double fy = (double)(y % spacing) / (double)spacing;
+                const double fx = (double)(x % spacing) / (double)spacing;
+                const int    di = fy > 0. ? 1 : 0;
+                const int    dj = fx > 0. ? 1 : 0;
+                double e2 = 0.;
+                for(int k=0; k<2; k++)
+                {
+                    const double m00 = s[((i   )*Naz_grid + j   )*2 + k];
+                    const double m01 = s[((i   )*Naz_grid + j+dj)*2 + k];
+                    const double m10 = s[((i+di)*Naz_grid + j   )*2 + k];
+                    const double m11 = s[((i+di)*Naz_grid + j+dj)*2 + k];
+                    const double m =
+                        (m00*(1.-fx) + m01*fx)*(1.-fy) +
+                        (m10*(1.-fx) + m11*fx)*fy;
+                    interpolated[(y*Naz + x)*2 + k] = (float)m;
+                    const double e = m - (double)d[(y*Naz + x)*2 + k];
+                    e2 += e*e;
+                }
+                if(e2 > max_error_seen*max_error_seen)
+                    max_error_seen = sqrt(e2);
+            }
+
+        // Remapping with the sparse map is remapping with the interpolated
+        // dense map. The interpolation is done in floats, so a sample could
+        // land on the other side of a rounding boundary
+        make_image(in, icam);
+        memset(out,     0x55, Naz*Nel);
+        memset(out_ref, 0xaa, Naz*Nel);
+        confirm(mrcal_image_uint8_remap_sparse(&image_out, &image_in, s, spacing));
+        confirm(mrcal_image_uint8_remap(&image_out_ref, &image_in, interpolated));
+        if(spacing == 1)
+            confirm(0 == memcmp(out, out_ref, Naz*Nel));
+        else
+            confirm(remap_equal_within(&image_out, &image_out_ref, 1));
+    }
+
+    // The reported error is measured at the cell centers only, including the
+    // ones past the edge of the rectified image, which we didn't look at. So
+    // it's an estimate of the worst error we see, not a bound
+    if(spacing == 1)
+    {
+        confirm_eq_double(max_interpolation_error, 0., 1e-12);
+        confirm_eq_double(max_error_seen,          0., 1e-12);
+    }
+    else
+    {
+        confirm(max_interpolation_error > 0.);
+        confirm_eq_double(max_interpolation_error, max_error_seen, 0.1*max_error_seen);
+    }
+
+    free(dense);
+    free(sparse);
+    free(interpolated);
+    free(in);
+    free(out);
+    free(out_ref);
+}
+
+// mrcal_image_..._rectify() vs mrcal_rectification_maps() followed by
+// mrcal_image_..._remap(). The output images have padded rows, and start out
+// full of garbage. The padding must be left alone
+static void test_rectify(mrcal_lensmodel_type_t rectification_model_type)
+{
+    const geometry_t g = make_geometry(rectification_model_type);
+    const int Naz    = (int)g.imagersize_rectified[0];
+    const int Nel    = (int)g.imagersize_rectified[1];
+    const int stride = Naz + 7;
+
+    float* maps = (float*)malloc((size_t)2*Nel*Naz*2*sizeof(float));
+    confirm(dense_maps(maps, &g));
+
+    // Some of the rectified pixels must map outside the input images, so that
+    // we test those
+    int Noutside = 0;
+    for(int i=0; i<2*Nel*Naz; i++)
+        if(!(maps[2*i+0] >= 0.f && maps[2*i+0] <= (float)(W_IN-1) &&
+             maps[2*i+1] >= 0.f && maps[2*i+1] <= (float)(H_IN-1)))
+            Noutside++;
+    confirm(Noutside > 0);
+    confirm(Noutside < Nel*Naz);
+
+    // uint8
+    {
+        uint8_t* in  [2];
+        uint8_t* out [2];
+        uint8_t* ref [2];
+        mrcal_image_uint8_t images[2], images_rectified[2], images_ref[2];
+        for(int icam=0; icam<2; icam++)
+        {
+            in [icam] = (uint8_t*)malloc(W_IN*H_IN);
+            out[icam] = (uint8_t*)malloc(stride*Nel);
+            ref[icam] = (uint8_t*)malloc(stride*Nel);
+            make_image(in[icam], icam + 10);
+            memset(out[icam], 0x55, stride*Nel);
+            memset(ref[icam], 0x55, stride*Nel);
+            images          [icam] = (mrcal_image_uint8_t){ .w = W_IN, .h = H_IN, .stride = W_IN,   .data = in [icam] };
+            images_rectified[icam] = (mrcal_image_uint8_t){ .w = Naz,  .h = Nel,  .stride = stride, .data = out[icam] };
+            images_ref      [icam] = (mrcal_image_uint8_t){ .w = Naz,  .h = Nel,  .stride = stride, .data = ref[icam] };
+        }
+
+        confirm(mrcal_image_uint8_rectify(images_rectified, images,
+                                          &g.lensmodel, g.intrinsics, g.r_cam0_ref,
+                                          &g.lensmodel, g.intrinsics, g.r_cam1_ref,
+                                          g.rectification_model_type,
+                                          g.fxycxy_rectified,
+                                          g.r_rect0_ref));
+        for(int icam=0; icam<2; icam++)
+        {
+            confirm(mrcal_image_uint8_remap(&images_ref[icam], &images[icam],
+                                            &maps[icam*Nel*Naz*2]));
+            confirm(0 == memcmp(out[icam], ref[icam], stride*Nel));
+
+            // The pixels outside the input image read as 0
+            bool outside_zero = true;
+            for(int y=0; y<Nel; y++)
+                for(int x=0; x<Naz; x++)
+                {
+                    const float* m = &maps[((icam*Nel + y)*Naz + x)*2];
+                    if(!(m[0] > -1.f && m[0] < (float)W_IN &&
+                         m[1] > -1.f && m[1] < (float)H_IN) &&
+                       out[icam][y*stride + x] != 0)
+                        outside_zero = false;
+                }
+            confirm(outside_zero);
+
+            free(in [icam]);
+            free(out[icam]);
+            free(ref[icam]);
+        }
+    }
+
+    // bgr
+    {
+        bgr_t* in  [2];
+        bgr_t* out [2];
+        bgr_t* ref [2];
+        uint8_t* channel = (uint8_t*)malloc(W_IN*H_IN);
+        mrcal_image_bgr_t images[2], images_rectified[2], images_ref[2];
+        for(int icam=0; icam<2; icam++)
+        {
+            in [icam] = (bgr_t*)malloc(W_IN*H_IN*sizeof(bgr_t));
+            out[icam] = (bgr_t*)malloc(stride*Nel*sizeof(bgr_t));
+            ref[icam] = (bgr_t*)malloc(stride*Nel*sizeof(bgr_t));
+            for(int k=0; k<3; k++)
+            {
+                make_image(channel, 3*icam + k + 20);
+                for(int i=0; i<W_IN*H_IN; i++)
+                    in[icam][i].bgr[k] = channel[i];
+            }
+            memset(out[icam], 0x55, stride*Nel*sizeof(bgr_t));
+            memset(ref[icam], 0x55, stride*Nel*sizeof(bgr_t));
+            images          [icam] = (mrcal_image_bgr_t){ .w = W_IN, .h = H_IN, .stride = W_IN  *(int)sizeof(bgr_t), .data = in [icam] };
+            images_rectified[icam] = (mrcal_image_bgr_t){ .w = Naz,  .h = Nel,  .stride = stride*(int)sizeof(bgr_t), .data = out[icam] };
+            images_ref      [icam] = (mrcal_image_bgr_t){ .w = Naz,  .h = Nel,  .stride = stride*(int)sizeof(bgr_t), .data = ref[icam] };
+        }
+        free(channel);
+
+        confirm(mrcal_image_bgr_rectify(images_rectified, images,
+                                        &g.lensmodel, g.intrinsics, g.r_cam0_ref,
+                                        &g.lensmodel, g.intrinsics, g.r_cam1_ref,
+                                        g.rectification_model_type,
+                                        g.fxycxy_rectified,
+                                        g.r_rect0_ref));
+        for(int icam=0; icam<2; icam++)
+        {
+            confirm(mrcal_image_bgr_remap(&images_ref[icam], &images[icam],
+                                          &maps[icam*Nel*Naz*2]));
+            confirm(0 == memcmp(out[icam], ref[icam], stride*Nel*sizeof(bgr_t)));
+
+            free(in [icam]);
+            free(out[icam]);
+            free(ref[icam]);
+        }
+    }
+
+    // Mismatched output sizes are an error
+    {
+        uint8_t in[4] = {}, out0[4], out1[6];
+        mrcal_image_uint8_t images[2] =
+            { { .w = 2, .h = 2, .stride = 2, .data = in },
+              { .w = 2, .h = 2, .stride = 2, .data = in } };
+        mrcal_image_uint8_t images_rectified[2] =
+            { { .w = 2, .h = 2, .stride = 2, .data = out0 },
+              { .w = 3, .h = 2, .stride = 3, .data = out1 } };
+        confirm(!mrcal_image_uint8_rectify(images_rectified, images,
+                                           &g.lensmodel, g.intrinsics, g.r_cam0_ref,
+                                           &g.lensmodel, g.intrinsics, g.r_cam1_ref,
+                                           g.rectification_model_type,
+                                           g.fxycxy_rectified,
+                                           g.r_rect0_ref));
+    }
+
+    free(maps);
+}
+
+int main(int argc, char* argv[])
+{
+    const mrcal_lensmodel_type_t rectification_model_types[] =
+        { MRCAL_LENSMODEL_LATLON,
+          MRCAL_LENSMODEL_PINHOLE,
+          MRCAL_LENSMODEL_STEREOGRAPHIC };
+
+    for(mrcal_lensmodel_type_t t : rectification_model_types)
+        test_tiles_against_per_pixel(t);
+    for(mrcal_lensmodel_type_t t : rectification_model_types)
+        test_rectify(t);
+
+    test_bad_spacing();
+    const int spacings[] = { 1, 8, 13 };
+    for(mrcal_lensmodel_type_t t : rectification_model_types)
+        for(int spacing : spacings)
+            test_sparse(t, spacing);
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of MRCAL_SOLVER_SCHUR. It must land at the same optimum as
+// MRCAL_SOLVER_SPARSE_CHOLMOD on a board calibration, with each preset. And a
+// problem too big for its dense reduced system must be solved by the sparse
+// solver instead
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test-harness.h"
+#include "test-calibration-problem.h"
+
+#define NFRAMES 6
+
+static void solve_both(// out
+                       test_problem_t* problem_cholmod,
+                       test_problem_t* problem_schur,
+                       mrcal_stats_t*  stats_cholmod,
+                       mrcal_stats_t*  stats_schur,
+                       // in
+                       const char* lensmodel_name,
+                       mrcal_solver_options_t solver_options)
+{
+    confirm(test_problem_init(problem_cholmod, lensmodel_name, NFRAMES));
+    *problem_schur = *problem_cholmod;
+
+    solver_options.solver = MRCAL_SOLVER_SPARSE_CHOLMOD;
+    *stats_cholmod = test_problem_optimize(problem_cholmod, NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                                           &solver_options, NULL, NULL);
+    solver_options.solver = MRCAL_SOLVER_SCHUR;
+    *stats_schur   = test_problem_optimize(problem_schur,   NFRAMES, NFRAMES*TEST_PROBLEM_NCAMERAS,
+                                           &solver_options, NULL, NULL);
+    confirm(stats_cholmod->rms_reproj_error__pixels >= 0);
+    confirm(stats_schur  ->rms_reproj_error__pixels >= 0);
+}
+
+static void test_same_optimum(mrcal_solver_preset_t preset,
+                              double eps_rms, double eps_core, double eps_poses)
+{
+    test_problem_t* problem_cholmod = (test_problem_t*)malloc(sizeof(test_problem_t));
+    test_problem_t* problem_schur   = (test_problem_t*)malloc(sizeof(test_problem_t));
+    mrcal_stats_t stats_cholmod, stats_schur;
+
+    solve_both(problem_cholmod, problem_schur, &stats_cholmod, &stats_schur,
+               "LENSMODEL_OPENCV4",
+               mrcal_solver_options_preset(preset));
+
+    confirm_eq_double(stats_schur.rms_reproj_error__pixels,
+                      stats_cholmod.rms_reproj_error__pixels, eps_rms);
+    const int Nintrinsics = problem_cholmod->Nintrinsics;
+    for(int icam=0; icam<TEST_PROBLEM_NCAMERAS; icam++)
+        confirm_eq_double_max_array(&problem_schur  ->intrinsics[icam*Nintrinsics],
+                                    &problem_cholmod->intrinsics[icam*Nintrinsics],
+                                    4, eps_core);
+    confirm_eq_double_max_array(problem_schur  ->extrinsics[0].r.xyz,
+                                problem_cholmod->extrinsics[0].r.xyz,
+                                6, eps_poses);
+    confirm_eq_double_max_array(problem_schur  ->frames[0].r.xyz,
+                                problem_cholmod->frames[0].r.xyz,
+                                NFRAMES*6, eps_poses);
+
+    free(problem_cholmod);
+    free(problem_schur);
+}
+
+// A splined model makes the reduced system too big, so the sparse solver is
+// used for both, and the results are identical
+static void test_fallback(void)
+{
+    test_problem_t* problem_cholmod = (test_problem_t*)malloc(sizeof(test_problem_t));
+    test_problem_t* problem_schur   = (test_problem_t*)malloc(sizeof(test_problem_t));
+    mrcal_stats_t stats_cholmod, stats_schur;
+
+    // 2 cameras * (4 + 2*24*18) intrinsics: over 1000 reduced variables. I
+    // don't need a converged solve to compare the paths
+    mrcal_solver_options_t solver_options =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    solver_options.max_iterations = 3;
+
+    solve_both(problem_cholmod, problem_schur, &stats_cholmod, &stats_schur,
+               "LENSMODEL_SPLINED_STEREOGRAPHIC_order=3_Nx=24_Ny=18_fov_x_deg=120",
+               solver_options);
+
+    confirm_eq_int(stats_schur.Ncallbacks, stats_cholmod.Ncallbacks);
+    confirm(0 == memcmp(problem_schur->intrinsics, problem_cholmod->intrinsics,
+                        TEST_PROBLEM_NCAMERAS*problem_cholmod->Nintrinsics*sizeof(double)));
+    confirm(0 == memcmp(problem_schur->frames, problem_cholmod->frames,
+                        NFRAMES*sizeof(mrcal_pose_t)));
+
+    free(problem_cholmod);
+    free(problem_schur);
+}
+
+int main(int argc, char* argv[])
+{
+    // Both converge tightly to the same optimum
+    test_same_optimum(MRCAL_SOLVER_PRESET_DEFAULT, 1e-6, 1e-3, 1e-6);
+    // The FAST preset stops earlier, with trustregion_threshold among other
+    // things. Both solvers still get very close to the optimum
+    test_same_optimum(MRCAL_SOLVER_PRESET_FAST,    1e-6, 1e-3, 1e-5);
+
+    test_fallback();
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,157 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of mrcal_stereo_matching_sgm() on a synthetic rectified pair with known
+// integer disparities: a background and a box in front of it. These are at
+// the two ends of the disparity search range, where the path costs rely on the
+// sentinels. Away from the edges of the box, every pixel must be matched, at
+// the right disparity. And the results must not depend on what was on the heap
+// before the call
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+#define W 240
+#define H 160
+
+static const int disparity_min        = 5;
+static const int Ndisparities         = 32;
+static const int disparity_background = disparity_min;
+static const int disparity_box        = disparity_min + Ndisparities - 1;
+
+static const int box_x0 = W/3, box_x1 = 2*W/3;
+static const int box_y0 = H/3, box_y1 = 2*H/3;
+
+// Deterministic texture values
+static uint8_t texture(unsigned int seed, int x, int y)
+{
+    unsigned int s = seed ^ ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u);
+    s = s * 1103515245u + 12345u;
+    s = s * 1103515245u + 12345u;
+    return (uint8_t)(s >> 16);
+}
+
+static bool in_box(int x, int y)
+{
+    return x >= box_x0 && x < box_x1 && y >= box_y0 && y < box_y1;
+}
+
+// image0 sees the box at pixel x, and image1 sees the same point at x -
+// disparity
+static void make_pair(uint8_t* image0, uint8_t* image1)
+{
+    for(int y=0; y<H; y++)
+        for(int x=0; x<W; x++)
+        {
+            image0[y*W + x] = in_box(x,y) ?
+                texture(2, x - disparity_box,        y) :
+                texture(1, x - disparity_background, y);
+            image1[y*W + x] = in_box(x + disparity_box, y) ?
+                texture(2, x, y) :
+                texture(1, x, y);
+        }
+}
+
+// Leaves some freed memory filled with the given byte, for the scratch buffers
+// of the matcher to land in
+static void pollute_heap(uint8_t byte)
+{
+    enum { N = 64 };
+    void* p[N];
+    for(int i=0; i<N; i++)
+    {
+        const size_t size = (size_t)(i+1) * 4096;
+        p[i] = malloc(size);
+        if(p[i] != NULL)
+            memset(p[i], byte, size);
+    }
+    for(int i=0; i<N; i++)
+        free(p[i]);
+}
+
+int main(int argc, char* argv[])
+{
+    uint8_t*  image0     = (uint8_t*) malloc(W*H*sizeof(uint8_t));
+    uint8_t*  image1     = (uint8_t*) malloc(W*H*sizeof(uint8_t));
+    uint16_t* disparity  = (uint16_t*)malloc(W*H*sizeof(uint16_t));
+    uint16_t* disparity2 = (uint16_t*)malloc(W*H*sizeof(uint16_t));
+    make_pair(image0, image1);
+
+    const mrcal_image_uint8_t  im0 = { .w = W, .h = H, .stride = W,                    .data = image0 };
+    const mrcal_image_uint8_t  im1 = { .w = W, .h = H, .stride = W,                    .data = image1 };
+    mrcal_image_uint16_t       d   = { .w = W, .h = H, .stride = W*(int)sizeof(uint16_t), .data = disparity };
+    mrcal_image_uint16_t       d2  = { .w = W, .h = H, .stride = W*(int)sizeof(uint16_t), .data = disparity2 };
+
+    mrcal_stereo_matching_sgm_parameters_t parameters = mrcal_stereo_matching_sgm_defaults();
+    parameters.disparity_min = disparity_min;
+    parameters.Ndisparities  = Ndisparities;
+
+    pollute_heap(0x00);
+    confirm(mrcal_stereo_matching_sgm(&d, &im0, &im1, &parameters));
+
+    // Each pixel far enough from the edges of the box and from the edges of the
+    // image has a match in image1, at the true disparity, up to the
+    // subpixel refinement
+    const int margin = 8;
+    int Nchecked = 0, Ninvalid = 0, Nwrong = 0;
+    for(int y=margin; y<H-margin; y++)
+        for(int x=disparity_min + margin; x<W-margin; x++)
+        {
+            // The edges of the box, and the background to its left, which is
+            // occluded by the box in image1
+            const bool near_box =
+                x >= box_x0 - (disparity_box - disparity_background) - margin &&
+                x <  box_x1 + margin &&
+                y >= box_y0 - margin &&
+                y <  box_y1 + margin;
+            const bool inside_box =
+                x >= box_x0 + margin && x < box_x1 - margin &&
+                y >= box_y0 + margin && y < box_y1 - margin;
+            if(near_box && !inside_box)
+                continue;
+
+            const int disparity_true =
+                in_box(x,y) ? disparity_box : disparity_background;
+            const int v = disparity[y*W + x];
+            Nchecked++;
+            if(v == 0)
+                Ninvalid++;
+            else if(abs(v - disparity_true*MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE) >
+                    MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE/2)
+                Nwrong++;
+        }
+    confirm(Nchecked > W*H/4);
+    confirm_eq_int(Ninvalid, 0);
+    confirm_eq_int(Nwrong,   0);
+
+    // The pixels whose matches fall off the left edge of image1 are invalid
+    bool edge_invalid = true;
+    for(int y=0; y<H; y++)
+        for(int x=0; x<disparity_min; x++)
+            if(disparity[y*W + x] != 0)
+                edge_invalid = false;
+    confirm(edge_invalid);
+
+    // Nothing depends on the contents of the heap
+    pollute_heap(0xff);
+    memset(disparity2, 0x55, W*H*sizeof(uint16_t));
+    confirm(mrcal_stereo_matching_sgm(&d2, &im0, &im1, &parameters));
+    confirm(0 == memcmp(disparity, disparity2, W*H*sizeof(uint16_t)));
+
+    free(image0);
+    free(image1);
+    free(disparity);
+    free(disparity2);
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,258 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of mrcal_stereo_range() and mrcal_stereo_unproject() against the
+// formulas in mrcal.stereo_range() and mrcal.stereo_unproject() in stereo.py,
+// for both LENSMODEL_LATLON and LENSMODEL_PINHOLE rectification. The C code
+// uses lookup tables and a different arrangement of the same math, so we
+// compare to within floating-point noise. The invalid disparities must produce
+// 0 everywhere. The outputs are strided, with padding that must be left alone
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+#define W 321
+#define H 203
+
+static const double disparity_scale = MRCAL_STEREO_MATCHING_SGM_DISPARITY_SCALE;
+static const double disparity_min   = 2.;
+static const double baseline        = 0.7;
+
+// Deterministic disparities. Some are invalid: 0, or <= disparity_min
+static void make_disparity(uint16_t* d, int stride_elems)
+{
+    unsigned int s = 1;
+    for(int i=0; i<H; i++)
+        for(int j=0; j<W; j++)
+        {
+            s = s * 1103515245u + 12345u;
+            const unsigned int r = (s >> 8) & 0xffff;
+            if(r % 10 == 0)
+                d[i*stride_elems + j] = 0;
+            else if(r % 10 == 1)
+                d[i*stride_elems + j] = (uint16_t)(disparity_min*disparity_scale);
+            else
+                d[i*stride_elems + j] = (uint16_t)(disparity_min*disparity_scale + 1 + r % 600);
+        }
+}
+
+// stereo_range() in stereo.py
+static double range_reference(int i, int j, uint16_t d,
+                              mrcal_lensmodel_type_t rectification_model_type,
+                              const double* fxycxy)
+{
+    const double fx = fxycxy[0], fy = fxycxy[1];
+    const double cx = fxycxy[2], cy = fxycxy[3];
+
+    if((double)d <= disparity_min*disparity_scale)
+        return 0.;
+
+    if(rectification_model_type == MRCAL_LENSMODEL_LATLON)
+    {
+        const double az0           = ((double)j - cx)/fx;
+        const double disparity_rad = (double)d / (fx * disparity_scale);
+        return baseline * cos(az0 - disparity_rad) / sin(disparity_rad);
+    }
+
+    const double tanaz0        = ((double)j - cx)/fx;
+    const double tanel         = ((double)i - cy)/fy;
+    const double s_sq_recip    = tanel*tanel + 1.;
+    const double tanaz0_tanaz1 = (double)d / (fx * disparity_scale);
+    const double tanaz1        = tanaz0 - tanaz0_tanaz1;
+    return baseline /
+        sqrt(s_sq_recip + tanaz0*tanaz0) *
+        ((s_sq_recip + tanaz0*tanaz1) / tanaz0_tanaz1 +
+         tanaz0);
+}
+
+// stereo_unproject() in stereo.py: the normalized unprojection of the rectified
+// pixel, scaled by the range
+static bool point_reference(double* p,
+                            int i, int j, double range,
+                            mrcal_lensmodel_type_t rectification_model_type,
+                            const double* fxycxy)
+{
+    const mrcal_lensmodel_t lensmodel = { .type = rectification_model_type };
+    const mrcal_point2_t    q         = { .x = (double)j, .y = (double)i };
+    mrcal_point3_t v;
+    if(!mrcal_unproject(&v, &q, 1, &lensmodel, fxycxy))
+        return false;
+    const double norm = sqrt(v.x*v.x + v.y*v.y + v.z*v.z);
+    for(int k=0; k<3; k++)
+        p[k] = v.xyz[k] / norm * range;
+    return true;
+}
+
+static void test_unproject(mrcal_lensmodel_type_t rectification_model_type)
+{
+    double fxycxy[4];
+    if(rectification_model_type == MRCAL_LENSMODEL_LATLON)
+    {
+        fxycxy[0] = (double)W / (90. * M_PI/180.);
+        fxycxy[1] = (double)H / (60. * M_PI/180.);
+    }
+    else
+    {
+        fxycxy[0] = (double)W / 2. / tan(90. * M_PI/180. / 2.);
+        fxycxy[1] = (double)H / 2. / tan(60. * M_PI/180. / 2.);
+    }
+    // Off-center, so that we're not symmetric
+    fxycxy[2] = ((double)W - 1.) / 2. + 13.;
+    fxycxy[3] = ((double)H - 1.) / 2. - 7.;
+
+    const double rt_rect0_ref[6] = { 0.02, -0.1, 0.03,  0.3, -0.2, 1.1 };
+
+    // Padded rows everywhere
+    const int d_stride_elems = W + 5;
+    const int r_stride_elems = W + 3;
+    const int p_stride_elems = (W + 2)*3;
+
+    uint16_t* d      = (uint16_t*)malloc(H*d_stride_elems*sizeof(uint16_t));
+    double*   range  = (double*)  malloc(H*r_stride_elems*sizeof(double));
+    double*   range2 = (double*)  malloc(H*r_stride_elems*sizeof(double));
+    double*   p      = (double*)  malloc(H*p_stride_elems*sizeof(double));
+    double*   p_ref  = (double*)  malloc(H*p_stride_elems*sizeof(double));
+    make_disparity(d, d_stride_elems);
+    const mrcal_image_uint16_t disparity = { .w = W, .h = H,
+                                             .stride = d_stride_elems*(int)sizeof(uint16_t),
+                                             .data = d };
+
+    const double pad = -12345.;
+    for(int i=0; i<H*r_stride_elems; i++) range [i] = pad;
+    for(int i=0; i<H*r_stride_elems; i++) range2[i] = pad;
+    for(int i=0; i<H*p_stride_elems; i++) p     [i] = pad;
+    for(int i=0; i<H*p_stride_elems; i++) p_ref [i] = pad;
+
+    confirm(mrcal_stereo_range(range,
+                               r_stride_elems*(int)sizeof(double), (int)sizeof(double),
+                               &disparity, disparity_scale, disparity_min,
+                               rectification_model_type, fxycxy, baseline));
+
+    // The points in the rectified camera-0 coordinates, like stereo.py
+    confirm(mrcal_stereo_unproject(p,
+                                   p_stride_elems*(int)sizeof(double), 3*(int)sizeof(double), (int)sizeof(double),
+                                   range2,
+                                   r_stride_elems*(int)sizeof(double), (int)sizeof(double),
+                                   &disparity, disparity_scale, disparity_min,
+                                   rectification_model_type, fxycxy,
+                                   NULL, baseline));
+    confirm(0 == memcmp(range, range2, H*r_stride_elems*sizeof(double)));
+
+    double max_error_range = 0., max_error_p = 0.;
+    bool   invalid_zero = true, pad_untouched = true, reference_ok = true;
+    for(int i=0; i<H; i++)
+    {
+        for(int j=0; j<W; j++)
+        {
+            const uint16_t dij = d[i*d_stride_elems + j];
+            const double   r   = range[i*r_stride_elems + j];
+            const double*  pij = &p[i*p_stride_elems + j*3];
+
+            if((double)dij <= disparity_min*disparity_scale)
+            {
+                if(r != 0. || pij[0] != 0. || pij[1] != 0. || pij[2] != 0.)
+                    invalid_zero = false;
+                continue;
+            }
+
+            const double r_ref = range_reference(i, j, dij, rectification_model_type, fxycxy);
+            double pij_ref[3];
+            if(!point_reference(pij_ref, i, j, r_ref, rectification_model_type, fxycxy))
+            {
+                reference_ok = false;
+                continue;
+            }
+
+            // Relative errors: the ranges span orders of magnitude
+            const double e = fabs(r - r_ref) / r_ref;
+            if(e > max_error_range) max_error_range = e;
+            for(int k=0; k<3; k++)
+            {
+                const double ep = fabs(pij[k] - pij_ref[k]) / r_ref;
+                if(ep > max_error_p) max_error_p = ep;
+            }
+        }
+        for(int j=W; j<r_stride_elems; j++)
+            if(range[i*r_stride_elems + j] != pad)
+                pad_untouched = false;
+        for(int j=W*3; j<p_stride_elems; j++)
+            if(p[i*p_stride_elems + j] != pad)
+                pad_untouched = false;
+    }
+    confirm(reference_ok);
+    confirm(invalid_zero);
+    confirm(pad_untouched);
+    confirm_eq_double(max_error_range, 0., 1e-12);
+    confirm_eq_double(max_error_p,     0., 1e-12);
+
+    // With rt_rect0_ref the points are in the reference coordinates. The
+    // invalid points are still at 0
+    memcpy(p_ref, p, H*p_stride_elems*sizeof(double));
+    confirm(mrcal_stereo_unproject(p,
+                                   p_stride_elems*(int)sizeof(double), 3*(int)sizeof(double), (int)sizeof(double),
+                                   NULL, 0, 0,
+                                   &disparity, disparity_scale, disparity_min,
+                                   rectification_model_type, fxycxy,
+                                   rt_rect0_ref, baseline));
+    double rt_ref_rect0[6];
+    mrcal_invert_rt(rt_ref_rect0, NULL, NULL, rt_rect0_ref);
+    double max_error_p_ref = 0.;
+    invalid_zero = true;
+    for(int i=0; i<H; i++)
+        for(int j=0; j<W; j++)
+        {
+            const uint16_t dij = d[i*d_stride_elems + j];
+            const double*  pij = &p[i*p_stride_elems + j*3];
+            if((double)dij <= disparity_min*disparity_scale)
+            {
+                if(pij[0] != 0. || pij[1] != 0. || pij[2] != 0.)
+                    invalid_zero = false;
+                continue;
+            }
+            double pij_ref[3];
+            mrcal_transform_point_rt(pij_ref, NULL, NULL,
+                                     rt_ref_rect0, &p_ref[i*p_stride_elems + j*3]);
+            for(int k=0; k<3; k++)
+            {
+                const double e = fabs(pij[k] - pij_ref[k]) / range[i*r_stride_elems + j];
+                if(e > max_error_p_ref) max_error_p_ref = e;
+            }
+        }
+    confirm(invalid_zero);
+    confirm_eq_double(max_error_p_ref, 0., 1e-12);
+
+    free(d);
+    free(range);
+    free(range2);
+    free(p);
+    free(p_ref);
+}
+
+int main(int argc, char* argv[])
+{
+    test_unproject(MRCAL_LENSMODEL_LATLON);
+    test_unproject(MRCAL_LENSMODEL_PINHOLE);
+
+    // Other rectification models aren't supported
+    {
+        uint16_t d[4] = {};
+        double   range[4];
+        const double fxycxy[4] = { 100., 100., 1., 1. };
+        const mrcal_image_uint16_t disparity = { .w = 2, .h = 2, .stride = 2*(int)sizeof(uint16_t), .data = d };
+        confirm(!mrcal_stereo_range(range, 0, 0,
+                                    &disparity, disparity_scale, disparity_min,
+                                    MRCAL_LENSMODEL_STEREOGRAPHIC, fxycxy, baseline));
+    }
+
+    TEST_FOOTER();
+}
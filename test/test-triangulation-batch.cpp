@@ -0,0 +1,224 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the batched triangulation functions. Each must produce the same
+// results as the corresponding single-point function, for every pair: the ones
+// that triangulate and the ones that don't. With strided and contiguous
+// arrays, in a single thread and in many, with partial blocks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../poseutils.h"
+extern "C" {
+#include "../triangulation.h"
+}
+
+#include "test-harness.h"
+
+// The observations, interleaved with padding to test the strides
+typedef struct
+{
+    double         pad0;
+    mrcal_point3_t v0_local;
+    double         pad1[2];
+    mrcal_point3_t v1_local;
+} pair_t;
+
+typedef struct
+{
+    mrcal_point3_t m;
+    double         pad[3];
+} result_t;
+
+// Deterministic noise in [-1,1]
+static double noise(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)((*seed >> 8) & 0xffff) / 32767.5 - 1.0;
+}
+
+static void make_Rt01(mrcal_point3_t* Rt01)
+{
+    const double r[3] = { 0.05, -0.2, 0.03 };
+    mrcal_R_from_r(Rt01[0].xyz, NULL, r);
+    Rt01[3] = (mrcal_point3_t){.xyz = { -1.0, 0.1, 0.05 }};
+}
+
+// Random observation pairs. Most observe a point in front of both cameras, with
+// a bit of noise. Every 7th pair has parallel rays and every 11th pair is
+// divergent, so those fail. And every 13th pair observes a point behind the
+// cameras
+static void make_pairs(pair_t* pairs, int N, const mrcal_point3_t* Rt01)
+{
+    unsigned int seed = 1;
+    const double* R01 = Rt01[0].xyz;
+    const double* t01 = Rt01[3].xyz;
+    for(int i=0; i<N; i++)
+    {
+        memset(&pairs[i], 0, sizeof(pairs[i]));
+
+        // The point, in camera-0 coordinates
+        double p[3] = { 5.*noise(&seed), 3.*noise(&seed), 10. + 5.*noise(&seed) };
+        if(i % 13 == 5)
+            p[2] *= -1.0;
+
+        // v0 = p, v1_local = R10 (p - t01)
+        double v1_local[3] = {};
+        for(int j=0; j<3; j++)
+            for(int k=0; k<3; k++)
+                v1_local[j] += R01[3*k+j]*(p[k] - t01[k]);
+
+        for(int j=0; j<3; j++)
+        {
+            pairs[i].v0_local.xyz[j] = p[j]        + 1e-3*noise(&seed);
+            pairs[i].v1_local.xyz[j] = v1_local[j] + 1e-3*noise(&seed);
+        }
+
+        if(i % 7 == 3)
+            // Parallel: v1_local = R10 v0
+            for(int j=0; j<3; j++)
+            {
+                pairs[i].v1_local.xyz[j] = 0.0;
+                for(int k=0; k<3; k++)
+                    pairs[i].v1_local.xyz[j] += R01[3*k+j]*pairs[i].v0_local.xyz[k];
+            }
+        else if(i % 11 == 4)
+            // Divergent: the rays point away from each other
+            pairs[i].v1_local.x += 20.0;
+    }
+}
+
+typedef mrcal_point3_t (triangulate_t)(mrcal_point3_t*, mrcal_point3_t*, mrcal_point3_t*,
+                                       const mrcal_point3_t*, const mrcal_point3_t*, const mrcal_point3_t*);
+typedef void (triangulate_batch_t)(mrcal_point3_t*, int,
+                                   const mrcal_point3_t*, int,
+                                   const mrcal_point3_t*, int,
+                                   int, const mrcal_point3_t*);
+
+static void test_method(const char* name,
+                        triangulate_t* triangulate,
+                        triangulate_batch_t* triangulate_batch,
+                        bool is_lindstrom,
+                        int N)
+{
+    mrcal_point3_t Rt01[4];
+    make_Rt01(Rt01);
+
+    pair_t*         pairs        = (pair_t*)        malloc(N*sizeof(pairs[0]));
+    mrcal_point3_t* m_ref        = (mrcal_point3_t*)malloc(N*sizeof(m_ref[0]));
+    result_t*       m_strided    = (result_t*)      malloc(N*sizeof(m_strided[0]));
+    mrcal_point3_t* v0           = (mrcal_point3_t*)malloc(N*sizeof(v0[0]));
+    mrcal_point3_t* v1           = (mrcal_point3_t*)malloc(N*sizeof(v1[0]));
+    mrcal_point3_t* m_contiguous = (mrcal_point3_t*)malloc(N*sizeof(m_contiguous[0]));
+    make_pairs(pairs, N, Rt01);
+
+    int Nfailed = 0;
+    for(int i=0; i<N; i++)
+    {
+        v0[i] = pairs[i].v0_local;
+        v1[i] = pairs[i].v1_local;
+
+        if(is_lindstrom)
+            m_ref[i] = triangulate(NULL, NULL, NULL,
+                                   &pairs[i].v0_local, &pairs[i].v1_local, Rt01);
+        else
+        {
+            // The single-point functions want v1 in camera-0 coordinates
+            mrcal_point3_t v1_cam0;
+            mrcal_rotate_point_R(v1_cam0.xyz, NULL, NULL, Rt01[0].xyz, pairs[i].v1_local.xyz);
+            m_ref[i] = triangulate(NULL, NULL, NULL,
+                                   &pairs[i].v0_local, &v1_cam0, &Rt01[3]);
+        }
+        if(m_ref[i].x == 0.0 && m_ref[i].y == 0.0 && m_ref[i].z == 0.0)
+            Nfailed++;
+    }
+    // Both kinds of pairs are present
+    confirm(Nfailed > N/20 || N < 64);
+    confirm(Nfailed < N/2);
+
+    memset(m_strided, 0xff, N*sizeof(m_strided[0]));
+    triangulate_batch(&m_strided[0].m,   (int)sizeof(result_t),
+                      &pairs[0].v0_local, (int)sizeof(pair_t),
+                      &pairs[0].v1_local, (int)sizeof(pair_t),
+                      N, Rt01);
+    triangulate_batch(m_contiguous, 0,
+                      v0, 0,
+                      v1, 0,
+                      N, Rt01);
+
+    // The failures must match exactly. The successes match up to floating-point
+    // noise: the batches evaluate the same expressions, but the compiler may
+    // vectorize and contract them differently
+    int    Nfailure_mismatch = 0;
+    double err_max           = 0.0;
+    for(int i=0; i<N; i++)
+    {
+        const mrcal_point3_t* m[] = { &m_strided[i].m, &m_contiguous[i] };
+        for(const mrcal_point3_t* mm : m)
+        {
+            const bool failed_ref = m_ref[i].x == 0.0 && m_ref[i].y == 0.0 && m_ref[i].z == 0.0;
+            const bool failed     = mm->x == 0.0 && mm->y == 0.0 && mm->z == 0.0;
+            if(failed != failed_ref)
+            {
+                Nfailure_mismatch++;
+                continue;
+            }
+            for(int j=0; j<3; j++)
+                err_max = fmax(err_max,
+                               fabs(mm->xyz[j] - m_ref[i].xyz[j]) / (1.0 + fabs(m_ref[i].xyz[j])));
+        }
+    }
+    printf("%s, N=%d: %d failed pairs\n", name, N, Nfailed);
+    confirm_eq_int(Nfailure_mismatch, 0);
+    confirm_eq_double(err_max, 0.0, 1e-9);
+
+    // The padding is untouched
+    bool padding_ok = true;
+    for(int i=0; i<N; i++)
+        for(int j=0; j<3; j++)
+        {
+            double pad;
+            memset(&pad, 0xff, sizeof(pad));
+            if(0 != memcmp(&m_strided[i].pad[j], &pad, sizeof(pad)))
+                padding_ok = false;
+        }
+    confirm(padding_ok);
+
+    free(pairs);
+    free(m_ref);
+    free(m_strided);
+    free(v0);
+    free(v1);
+    free(m_contiguous);
+}
+
+int main(int argc, char* argv[])
+{
+#define TEST_METHOD(method, is_lindstrom)                               \
+    /* A partial block only; several blocks with a partial one at the   \
+       end; and enough points to use several threads */                \
+    test_method(#method, &mrcal_triangulate_ ## method,                 \
+                &mrcal_triangulate_ ## method ## _batch, is_lindstrom, 37); \
+    test_method(#method, &mrcal_triangulate_ ## method,                 \
+                &mrcal_triangulate_ ## method ## _batch, is_lindstrom, 64*5+13); \
+    test_method(#method, &mrcal_triangulate_ ## method,                 \
+                &mrcal_triangulate_ ## method ## _batch, is_lindstrom, 100003)
+
+    TEST_METHOD(geometric,       false);
+    TEST_METHOD(lindstrom,       true);
+    TEST_METHOD(leecivera_l1,    false);
+    TEST_METHOD(leecivera_linf,  false);
+    TEST_METHOD(leecivera_mid2,  false);
+    TEST_METHOD(leecivera_wmid2, false);
+#undef TEST_METHOD
+
+    TEST_FOOTER();
+}
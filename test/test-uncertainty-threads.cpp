@@ -0,0 +1,196 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the threading in mrcal_drt_ref_refperturbed__dbpacked_no_ie(). The
+// frames are accumulated in parallel, into per-frame partial sums, which are
+// then reduced in frame order. So K must be bit-identical no matter how many
+// threads did the work
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <cholmod.h>
+
+#include "test-harness.h"
+#include "test-calibration-problem.h"
+
+#define NFRAMES TEST_PROBLEM_NFRAMES_MAX
+
+typedef struct
+{
+    int            Nstate, Nstate_noi_noe, Nmeasurements;
+    double*        b_packed;
+    double*        x;
+    int*           Jp;
+    int*           Ji;
+    double*        Jx;
+    cholmod_sparse Jt;
+} jacobian_t;
+
+// The Jacobian at the optimum of the test problem
+static bool jacobian_init(jacobian_t* J, test_problem_t* problem)
+{
+    const int Nobservations_board = NFRAMES*TEST_PROBLEM_NCAMERAS;
+    const mrcal_problem_selections_t problem_selections = problem->problem_selections;
+
+    mrcal_solver_options_t solver_options =
+        mrcal_solver_options_preset(MRCAL_SOLVER_PRESET_DEFAULT);
+    const mrcal_stats_t stats =
+        test_problem_optimize(problem, NFRAMES, Nobservations_board,
+                              &solver_options, NULL, NULL);
+    if(stats.rms_reproj_error__pixels < 0)
+        return false;
+
+    J->Nstate =
+        mrcal_num_states(TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                         NFRAMES, 0, 0, Nobservations_board,
+                         problem_selections, &problem->lensmodel);
+    J->Nstate_noi_noe = J->Nstate -
+        mrcal_num_states_intrinsics(TEST_PROBLEM_NCAMERAS,
+                                    problem_selections, &problem->lensmodel) -
+        mrcal_num_states_extrinsics(TEST_PROBLEM_NCAMERAS-1,
+                                    problem_selections);
+    J->Nmeasurements =
+        mrcal_num_measurements(Nobservations_board, 0,
+                               TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                               TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                               NFRAMES, 0, 0,
+                               problem_selections, &problem->lensmodel);
+    const int N_j_nonzero =
+        _mrcal_num_j_nonzero(Nobservations_board, 0,
+                             TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                             TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                             NFRAMES, 0, 0,
+                             problem->observations_board, NULL,
+                             problem_selections, &problem->lensmodel);
+
+    J->b_packed = (double*)malloc(J->Nstate       *sizeof(double));
+    J->x        = (double*)malloc(J->Nmeasurements*sizeof(double));
+    J->Jp       = (int*)   malloc((J->Nmeasurements+1)*sizeof(int));
+    J->Ji       = (int*)   malloc(N_j_nonzero*sizeof(int));
+    J->Jx       = (double*)malloc(N_j_nonzero*sizeof(double));
+
+    J->Jt = (cholmod_sparse){};
+    J->Jt.nrow   = J->Nstate;
+    J->Jt.ncol   = J->Nmeasurements;
+    J->Jt.nzmax  = N_j_nonzero;
+    J->Jt.p      = J->Jp;
+    J->Jt.i      = J->Ji;
+    J->Jt.x      = J->Jx;
+    J->Jt.stype  = 0;
+    J->Jt.itype  = CHOLMOD_INT;
+    J->Jt.xtype  = CHOLMOD_REAL;
+    J->Jt.dtype  = CHOLMOD_DOUBLE;
+    J->Jt.sorted = 1;
+    J->Jt.packed = 1;
+
+    return
+        mrcal_optimizer_callback(J->b_packed, J->Nstate       *(int)sizeof(double),
+                                 J->x,        J->Nmeasurements*(int)sizeof(double),
+                                 &J->Jt,
+                                 problem->intrinsics,
+                                 problem->extrinsics,
+                                 problem->frames,
+                                 NULL,
+                                 &problem->calobject_warp,
+                                 TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                                 NFRAMES, 0, 0,
+                                 problem->observations_board, NULL,
+                                 Nobservations_board, 0,
+                                 problem->observations_board_pool,
+                                 &problem->lensmodel,
+                                 problem->imagersizes,
+                                 problem_selections,
+                                 &problem->problem_constants,
+                                 TEST_PROBLEM_SPACING,
+                                 TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                                 false);
+}
+
+static void jacobian_free(jacobian_t* J)
+{
+    free(J->b_packed);
+    free(J->x);
+    free(J->Jp);
+    free(J->Ji);
+    free(J->Jx);
+}
+
+static bool compute_K(double* K,
+                      jacobian_t* J, const test_problem_t* problem,
+                      int Nthreads)
+{
+    return
+        _mrcal_drt_ref_refperturbed__dbpacked_no_ie(K, 0, 0,
+                                                    J->b_packed, J->Nstate*(int)sizeof(double),
+                                                    &J->Jt,
+                                                    TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                                                    NFRAMES, 0, 0,
+                                                    NFRAMES*TEST_PROBLEM_NCAMERAS, 0,
+                                                    &problem->lensmodel,
+                                                    problem->problem_selections,
+                                                    TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H,
+                                                    Nthreads);
+}
+
+int main(int argc, char* argv[])
+{
+    test_problem_t* problem = (test_problem_t*)malloc(sizeof(test_problem_t));
+    confirm(test_problem_init(problem, "LENSMODEL_OPENCV4", NFRAMES));
+
+    jacobian_t J;
+    confirm(jacobian_init(&J, problem));
+
+    const int NK = 6*J.Nstate_noi_noe;
+    double* K_ref = (double*)malloc(NK*sizeof(double));
+    double* K     = (double*)malloc(NK*sizeof(double));
+
+    confirm(compute_K(K_ref, &J, problem, 1));
+
+    // Something was actually computed
+    bool finite = true, nonzero = false;
+    for(int i=0; i<NK; i++)
+    {
+        if(!isfinite(K_ref[i])) finite  = false;
+        if(K_ref[i] != 0.)      nonzero = true;
+    }
+    confirm(finite);
+    confirm(nonzero);
+
+    // Each thread count splits the frames differently. The frames don't divide
+    // evenly into most of these
+    const int Nthreads_all[] = { 2, 3, 5, NFRAMES, NFRAMES+3 };
+    for(int Nthreads : Nthreads_all)
+    {
+        memset(K, 0x55, NK*sizeof(double));
+        confirm(compute_K(K, &J, problem, Nthreads));
+        confirm(0 == memcmp(K, K_ref, NK*sizeof(double)));
+    }
+
+    // And the public function, which picks its own thread count
+    memset(K, 0x55, NK*sizeof(double));
+    confirm(mrcal_drt_ref_refperturbed__dbpacked_no_ie(K, 0, 0,
+                                                       J.b_packed, J.Nstate*(int)sizeof(double),
+                                                       &J.Jt,
+                                                       TEST_PROBLEM_NCAMERAS, TEST_PROBLEM_NCAMERAS-1,
+                                                       NFRAMES, 0, 0,
+                                                       NFRAMES*TEST_PROBLEM_NCAMERAS, 0,
+                                                       &problem->lensmodel,
+                                                       problem->problem_selections,
+                                                       TEST_PROBLEM_BOARD_W, TEST_PROBLEM_BOARD_H));
+    confirm(0 == memcmp(K, K_ref, NK*sizeof(double)));
+
+    free(K_ref);
+    free(K);
+    jacobian_free(&J);
+    free(problem);
+
+    TEST_FOOTER();
+}
@@ -0,0 +1,221 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of the unprojection lookup tables. mrcal_unproject_lut() must match
+// mrcal_unproject(), up to the interpolation error, everywhere: in the cells
+// that are interpolated, in the cells that can't be (some of their nodes don't
+// unproject), and outside the imager. And a table that was written to disk and
+// read back must produce the same results
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+#define NPOINTS 20000
+
+// Deterministic noise in [0,1]
+static double uniform(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)((*seed >> 8) & 0xffff) / 65535.;
+}
+
+static bool is_finite3(const mrcal_point3_t* v)
+{
+    return isfinite(v->x) && isfinite(v->y) && isfinite(v->z);
+}
+
+// Compares the table against mrcal_unproject() at random pixels in and
+// slightly past the imager. Returns the number of pixels mrcal_unproject()
+// could unproject
+static int compare_with_exact(const mrcal_unproject_lut_t* lut,
+                              const mrcal_lensmodel_t* lensmodel,
+                              const double* intrinsics,
+                              int W, int H,
+                              double reprojection_error_max)
+{
+    mrcal_point2_t* q      = (mrcal_point2_t*)malloc(NPOINTS*sizeof(q[0]));
+    mrcal_point3_t* v_lut  = (mrcal_point3_t*)malloc(NPOINTS*sizeof(v_lut[0]));
+    mrcal_point3_t* v_ref  = (mrcal_point3_t*)malloc(NPOINTS*sizeof(v_ref[0]));
+    mrcal_point2_t* q_lut  = (mrcal_point2_t*)malloc(NPOINTS*sizeof(q_lut[0]));
+
+    unsigned int seed = 1;
+    for(int i=0; i<NPOINTS; i++)
+    {
+        q[i].x = -20. + (W+40.)*uniform(&seed);
+        q[i].y = -20. + (H+40.)*uniform(&seed);
+    }
+    confirm(mrcal_unproject    (v_ref, q, NPOINTS, lensmodel, intrinsics));
+    confirm(mrcal_unproject_lut(v_lut, q, NPOINTS, lut));
+
+    int    Nfinite    = 0;
+    int    Nmismatch  = 0;
+    double err_max    = 0.0;
+    for(int i=0; i<NPOINTS; i++)
+    {
+        if(!is_finite3(&v_ref[i]))
+            continue;
+        Nfinite++;
+        if(!is_finite3(&v_lut[i]))
+        {
+            Nmismatch++;
+            continue;
+        }
+
+        mrcal_project(&q_lut[i], NULL, NULL, &v_lut[i], 1, lensmodel, intrinsics);
+        const double e = hypot(q_lut[i].x - q[i].x, q_lut[i].y - q[i].y);
+        if(e > err_max)
+            err_max = e;
+    }
+    // Every pixel that mrcal_unproject() handles, the table handles too
+    confirm_eq_int(Nmismatch, 0);
+    confirm_eq_double(err_max, 0.0, reprojection_error_max);
+
+    free(q);
+    free(v_lut);
+    free(v_ref);
+    free(q_lut);
+    return Nfinite;
+}
+
+// A mild lens: every node unprojects, and everything is interpolated
+static void test_mild(void)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, "LENSMODEL_OPENCV4"));
+    const double intrinsics[] = { 2000., 2010., 1499.5, 999.5,
+                                  -0.1, 0.05, 0.001, -0.002 };
+
+    mrcal_unproject_lut_t* lut =
+        mrcal_unproject_lut_create(&lensmodel, intrinsics, 3000, 2000, 16);
+    confirm(lut != NULL);
+    if(lut == NULL)
+        return;
+
+    confirm_eq_int(mrcal_unproject_lut_num_cells_exact(lut), 0);
+    const double max_error = mrcal_unproject_lut_max_error(lut);
+    confirm(max_error > 0.0 && max_error < 0.1);
+
+    // The cell centers are the worst case, but only approximately: the error
+    // isn't quite symmetric in each cell
+    const int Nfinite = compare_with_exact(lut, &lensmodel, intrinsics, 3000, 2000,
+                                           2.*max_error);
+    confirm_eq_int(Nfinite, NPOINTS);
+
+    // A round trip through a file gives the same table
+    const char* filename = "/tmp/test-unproject-lut.lut";
+    confirm(mrcal_write_unproject_lut_file(filename, lut));
+    mrcal_unproject_lut_t* lut_read =
+        mrcal_read_unproject_lut_file(filename, &lensmodel, intrinsics);
+    confirm(lut_read != NULL);
+    if(lut_read != NULL)
+    {
+        confirm_eq_double(mrcal_unproject_lut_max_error(lut_read), max_error, 1e-15);
+        confirm_eq_int(mrcal_unproject_lut_num_cells_exact(lut_read), 0);
+
+        const mrcal_point2_t q[] = { {.x = 0.,     .y = 0.},
+                                     {.x = 123.4,  .y = 567.8},
+                                     {.x = 2999.,  .y = 1999.} };
+        mrcal_point3_t v0[3], v1[3];
+        confirm(mrcal_unproject_lut(v0, q, 3, lut));
+        confirm(mrcal_unproject_lut(v1, q, 3, lut_read));
+        confirm(0 == memcmp(v0, v1, sizeof(v0)));
+        mrcal_unproject_lut_free(lut_read);
+    }
+
+    // Different intrinsics: the file is refused
+    double intrinsics_other[8];
+    memcpy(intrinsics_other, intrinsics, sizeof(intrinsics));
+    intrinsics_other[4] += 1e-9;
+    lut_read = mrcal_read_unproject_lut_file(filename, &lensmodel, intrinsics_other);
+    confirm(lut_read == NULL);
+    mrcal_unproject_lut_free(lut_read);
+    remove(filename);
+
+    mrcal_unproject_lut_free(lut);
+}
+
+// spacing=1: the integer pixels are exact
+static void test_spacing1(void)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, "LENSMODEL_OPENCV4"));
+    const double intrinsics[] = { 200., 201., 39.5, 29.5,
+                                  -0.1, 0.05, 0.001, -0.002 };
+
+    mrcal_unproject_lut_t* lut =
+        mrcal_unproject_lut_create(&lensmodel, intrinsics, 80, 60, 1);
+    confirm(lut != NULL);
+    if(lut == NULL)
+        return;
+
+    mrcal_point2_t q[80*60];
+    mrcal_point3_t v_lut[80*60], v_ref[80*60];
+    for(int i=0; i<60; i++)
+        for(int j=0; j<80; j++)
+            q[i*80+j] = (mrcal_point2_t){ .x = (double)j, .y = (double)i };
+    confirm(mrcal_unproject    (v_ref, q, 80*60, &lensmodel, intrinsics));
+    confirm(mrcal_unproject_lut(v_lut, q, 80*60, lut));
+
+    // Both normalized the same way, so they should be identical. The
+    // stereographic round trip adds a bit of floating-point noise
+    double err_max = 0.0;
+    for(int i=0; i<80*60; i++)
+    {
+        const double norm_lut = sqrt(v_lut[i].x*v_lut[i].x + v_lut[i].y*v_lut[i].y + v_lut[i].z*v_lut[i].z);
+        const double norm_ref = sqrt(v_ref[i].x*v_ref[i].x + v_ref[i].y*v_ref[i].y + v_ref[i].z*v_ref[i].z);
+        for(int k=0; k<3; k++)
+            err_max = fmax(err_max, fabs(v_lut[i].xyz[k]/norm_lut - v_ref[i].xyz[k]/norm_ref));
+    }
+    confirm_eq_double(err_max, 0.0, 1e-12);
+
+    mrcal_unproject_lut_free(lut);
+}
+
+// A lens with very strong distortions. It folds back on itself, and the
+// unprojection fails in the corners of the imager. The cells around those
+// nodes are unprojected exactly, so wherever mrcal_unproject() succeeds, the
+// table must succeed too
+static void test_failing_nodes(void)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, "LENSMODEL_OPENCV8"));
+    const double intrinsics[] = { 1178., 1178., 1499.5, 999.5,
+                                  -1.136, -1.54, 0.00474, -0.00491,
+                                  1.826, 0.082, 0.548, 0.37 };
+
+    mrcal_unproject_lut_t* lut =
+        mrcal_unproject_lut_create(&lensmodel, intrinsics, 3000, 2000, 20);
+    confirm(lut != NULL);
+    if(lut == NULL)
+        return;
+
+    confirm(mrcal_unproject_lut_num_cells_exact(lut) > 0);
+    const double max_error = mrcal_unproject_lut_max_error(lut);
+    confirm(isfinite(max_error));
+
+    const int Nfinite = compare_with_exact(lut, &lensmodel, intrinsics, 3000, 2000,
+                                           2.*max_error + 1e-6);
+    confirm(Nfinite > NPOINTS/4);
+    confirm(Nfinite < NPOINTS);
+
+    mrcal_unproject_lut_free(lut);
+}
+
+int main(int argc, char* argv[])
+{
+    test_mild();
+    test_spacing1();
+    test_failing_nodes();
+
+    TEST_FOOTER();
+}
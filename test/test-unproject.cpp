@@ -0,0 +1,185 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Tests of mrcal_unproject() for the iterative models. Each point is solved
+// with Newton's method from the best seed we have, falling back to dogleg. The
+// result must match the baseline: a dogleg solve from the pinhole seed, which
+// is what mrcal_unproject() used to do. Wide lenses are the interesting case:
+// the fixed-point seed of the OPENCV models can be finite, but far off, near
+// the edges
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <dogleg.h>
+
+#include "../mrcal.h"
+#include "test-harness.h"
+
+#define NGRID_X  61
+#define NGRID_Y  41
+
+// The baseline unprojection. Returns false if it fails
+static bool unproject_baseline(mrcal_point3_t* v,
+                               const mrcal_point2_t* q,
+                               const mrcal_lensmodel_t* lensmodel,
+                               const double* intrinsics)
+{
+    const int Nintrinsics = mrcal_lensmodel_num_params(lensmodel);
+
+    dogleg_callback_dense_t cb = [&](const double* u,
+                                     double*       x,
+                                     double*       J,
+                                     void*         cookie)
+    {
+        mrcal_point2_t dv_du[3];
+        mrcal_point3_t p;
+        mrcal_unproject_stereographic(&p, dv_du,
+                                      (const mrcal_point2_t*)u, 1,
+                                      intrinsics);
+        mrcal_point3_t dq_dp[2];
+        double         dq_dintrinsics[2*Nintrinsics];
+        mrcal_point2_t q_hypothesis;
+        mrcal_project(&q_hypothesis, dq_dp, dq_dintrinsics,
+                      &p, 1, lensmodel, intrinsics);
+        x[0] = q_hypothesis.x - q->x;
+        x[1] = q_hypothesis.y - q->y;
+        for(int i=0; i<2; i++)
+            for(int j=0; j<2; j++)
+                J[i*2+j] =
+                    dq_dp[i].x*dv_du[0].xy[j] +
+                    dq_dp[i].y*dv_du[1].xy[j] +
+                    dq_dp[i].z*dv_du[2].xy[j];
+    };
+
+    const mrcal_point3_t v_pinhole = {.x = (q->x - intrinsics[2]) / intrinsics[0],
+                                      .y = (q->y - intrinsics[3]) / intrinsics[1],
+                                      .z = 1.};
+    double u[2];
+    mrcal_project_stereographic((mrcal_point2_t*)u, NULL,
+                                &v_pinhole, 1, intrinsics);
+
+    dogleg_parameters2_t dogleg_parameters;
+    dogleg_getDefaultParameters(&dogleg_parameters);
+    dogleg_parameters.dogleg_debug = 0;
+    const double norm2x =
+        dogleg_optimize_dense2(u, 2, 2, &cb, NULL, &dogleg_parameters, NULL);
+    if(!(norm2x/2.0 <= 1e-4))
+        return false;
+
+    mrcal_unproject_stereographic(v, NULL, (const mrcal_point2_t*)u, 1,
+                                  intrinsics);
+    if(v->z < 0.0)
+        for(int i=0; i<3; i++)
+            v->xyz[i] *= -1.0;
+    return true;
+}
+
+static void normalize(mrcal_point3_t* v)
+{
+    const double norm = sqrt(v->x*v->x + v->y*v->y + v->z*v->z);
+    for(int i=0; i<3; i++)
+        v->xyz[i] /= norm;
+}
+
+// Unprojects a grid of pixels covering the imager, and compares the results to
+// the baseline. Only the pixels within radius_max of the center are used: wide
+// OPENCV models fold back on themselves past some radius. Wherever the baseline
+// succeeds, we must succeed too, with the same observation vector
+static void test_lens(const char* lensmodel_name, const double* intrinsics,
+                      int W, int H, double radius_max,
+                      int Nbaseline_min)
+{
+    mrcal_lensmodel_t lensmodel;
+    confirm(mrcal_lensmodel_from_name(&lensmodel, lensmodel_name));
+
+    mrcal_point2_t* q = (mrcal_point2_t*)malloc(NGRID_X*NGRID_Y*sizeof(q[0]));
+    mrcal_point3_t* v = (mrcal_point3_t*)malloc(NGRID_X*NGRID_Y*sizeof(v[0]));
+    int N = 0;
+    for(int i=0; i<NGRID_Y; i++)
+        for(int j=0; j<NGRID_X; j++)
+        {
+            const mrcal_point2_t qq = { .x = (double)j*(W-1)/(NGRID_X-1),
+                                        .y = (double)i*(H-1)/(NGRID_Y-1) };
+            if(hypot(qq.x - intrinsics[2], qq.y - intrinsics[3]) <= radius_max)
+                q[N++] = qq;
+        }
+    confirm(mrcal_unproject(v, q, N, &lensmodel, intrinsics));
+
+    int    Nbaseline  = 0;
+    int    Nmissing   = 0;
+    double err_max    = 0.0;
+    double reproj_max = 0.0;
+    for(int i=0; i<N; i++)
+    {
+        mrcal_point3_t v_ref;
+        if(!unproject_baseline(&v_ref, &q[i], &lensmodel, intrinsics))
+            continue;
+        Nbaseline++;
+
+        if(!(isfinite(v[i].x) && isfinite(v[i].y) && isfinite(v[i].z)))
+        {
+            Nmissing++;
+            continue;
+        }
+
+        mrcal_point3_t vn = v[i];
+        normalize(&vn);
+        normalize(&v_ref);
+        for(int k=0; k<3; k++)
+            err_max = fmax(err_max, fabs(vn.xyz[k] - v_ref.xyz[k]));
+
+        mrcal_point2_t qq;
+        mrcal_project(&qq, NULL, NULL, &v[i], 1, &lensmodel, intrinsics);
+        reproj_max = fmax(reproj_max, fmax(fabs(qq.x - q[i].x), fabs(qq.y - q[i].y)));
+    }
+
+    confirm(Nbaseline >= Nbaseline_min);
+    confirm_eq_int(Nmissing, 0);
+    confirm_eq_double(err_max,    0.0, 1e-6);
+    confirm_eq_double(reproj_max, 0.0, 1e-3);
+
+    free(q);
+    free(v);
+}
+
+int main(int argc, char* argv[])
+{
+    // A real-world wide lens, with a 6000x3376 imager. The model is monotonic
+    // out to a radius of ~1790 pixels: ~130 degrees across
+    const double intrinsics_opencv8_wide[] =
+        { 1761.18, 1761.25, 2999.5, 1687.5,
+          2.153317, 0.2902068, -0.0009141125, 0.0001160566,
+          0.005658489, 2.47683, 0.8174102, 0.07302505 };
+    test_lens("LENSMODEL_OPENCV8", intrinsics_opencv8_wide,
+              6000, 3376, 1750.,
+              NGRID_X*NGRID_Y/3);
+
+    // Very strong distortions. The fixed-point seed is finite but far off in
+    // much of the imager. The model folds back on itself, so the baseline
+    // fails in the corners; we only look at the pixels where it succeeds
+    const double intrinsics_opencv8_strong[] =
+        { 1178., 1178., 1499.5, 999.5,
+          -1.136, -1.54, 0.00474, -0.00491,
+          1.826, 0.082, 0.548, 0.37 };
+    test_lens("LENSMODEL_OPENCV8", intrinsics_opencv8_strong,
+              3000, 2000, 1e6,
+              NGRID_X*NGRID_Y/2);
+
+    // A mild lens, where the fixed-point seed is good everywhere
+    const double intrinsics_opencv4[] =
+        { 2000., 2010., 1499.5, 999.5,
+          -0.1, 0.05, 0.001, -0.002 };
+    test_lens("LENSMODEL_OPENCV4", intrinsics_opencv4,
+              3000, 2000, 1e6,
+              NGRID_X*NGRID_Y);
+
+    TEST_FOOTER();
+}
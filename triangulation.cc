@@ -6,12 +6,25 @@
 //
 //     http://www.apache.org/licenses/LICENSE-2.0
 
+#include <math.h>
+#include <algorithm>
+
 #include "autodiff.hh"
+#include "parallel.h"
 
 extern "C" {
 #include "triangulation.h"
 }
 
+// The batched functions process the points in blocks of this many. Each block
+// is transposed into separate x,y,z arrays, and each step of the computation is
+// a simple loop over the block, with no branches: the failure checks are
+// evaluated for all the points, and applied at the end
+#define TRIANGULATE_BLOCK                  64
+
+// Don't bother with threads unless each one gets at least this many points
+#define TRIANGULATE_NPOINTS_PER_THREAD_MIN 16384
+
 template <int NGRAD>
 static
 bool
@@ -720,3 +733,507 @@ mrcal_triangulate_leecivera_wmid2(// outputs
 
     return _m;
 }
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Batched, no-gradient triangulation
+////////////////////////////////////////////////////////////////////////////////
+//
+// Each of these does the same computations, in the same order, as its
+// single-point counterpart above, so the results match. The branches
+// are replaced by selects
+
+// Each block is stored as block_row_t[3]: the x, y, z of all the points
+typedef double block_row_t[TRIANGULATE_BLOCK];
+
+// Same as triangulate_assume_intersect()
+static void
+triangulate_assume_intersect_block( // output
+                                   block_row_t* __restrict m,
+                                   // input. camera-0 coordinates
+                                   const block_row_t* __restrict v0,
+                                   const block_row_t* __restrict v1,
+                                   const double* t01,
+                                   int N)
+{
+    const double t01_x = t01[0];
+    const double t01_y = t01[1];
+    const double t01_z = t01[2];
+
+    for(int i=0; i<N; i++)
+    {
+        const double fabs_det_xz = fabs(-v0[0][i]*v1[2][i] + v0[2][i]*v1[0][i]);
+        const double fabs_det_yz = fabs(-v0[1][i]*v1[2][i] + v0[2][i]*v1[1][i]);
+
+        // Use xz or yz: [0] -> [1] if using yz
+        const bool   xz       = fabs_det_xz > fabs_det_yz;
+        const double fabs_det = xz ? fabs_det_xz : fabs_det_yz;
+        const double v0a      = xz ? v0[0][i]    : v0[1][i];
+        const double v1a      = xz ? v1[0][i]    : v1[1][i];
+        const double ta       = xz ? t01_x       : t01_y;
+
+        const double det = v1a*v0[2][i] - v0a*v1[2][i];
+        const double k0  = (t01_z*v1a - ta*v1[2][i]) / det;
+        const bool   k1_negative = (t01_z*v0a > ta*v0[2][i]) ^ (det > 0);
+
+        const bool ok =
+            !(fabs_det <= 1e-10) &
+            !(k0 <= 0.0)         &
+            !k1_negative;
+
+        for(int j=0; j<3; j++)
+            m[j][i] = ok ? v0[j][i]*k0 : 0.0;
+    }
+}
+
+// Same as chirality()
+static inline bool
+chirality_1(double l0, const block_row_t* v0,
+            double l1, const block_row_t* v1,
+            const double* t01,
+            int i)
+{
+    double len2_nominal = 0.0;
+    double len2a        = 0.0;
+    double len2b        = 0.0;
+    double len2c        = 0.0;
+    for(int j=0; j<3; j++)
+    {
+        double x;
+        x = ( l1*v1[j][i] + t01[j]) - l0*v0[j][i]; len2_nominal += x*x;
+        x = ( l1*v1[j][i] + t01[j]) + l0*v0[j][i]; len2a        += x*x;
+        x = (-l1*v1[j][i] + t01[j]) + l0*v0[j][i]; len2b        += x*x;
+        x = (-l1*v1[j][i] + t01[j]) - l0*v0[j][i]; len2c        += x*x;
+    }
+    return
+        !(len2a < len2_nominal) &
+        !(len2b < len2_nominal) &
+        !(len2c < len2_nominal);
+}
+
+static inline double dot_1(const block_row_t* a, const block_row_t* b, int i)
+{
+    double d = 0.0;
+    for(int j=0; j<3; j++)
+        d += b[j][i]*a[j][i];
+    return d;
+}
+static inline double dot_1(const block_row_t* a, const double* b, int i)
+{
+    double d = 0.0;
+    for(int j=0; j<3; j++)
+        d += b[j]*a[j][i];
+    return d;
+}
+static inline void cross_1(double* c,
+                           const double* a, const double* b)
+{
+    c[0] = a[1]*b[2] - a[2]*b[1];
+    c[1] = a[2]*b[0] - a[0]*b[2];
+    c[2] = a[0]*b[1] - a[1]*b[0];
+}
+static inline double norm2_1(const double* a)
+{
+    double d = 0.0;
+    for(int j=0; j<3; j++)
+        d += a[j]*a[j];
+    return d;
+}
+static inline double mag_1(const block_row_t* a, int i)
+{
+    return sqrt(dot_1(a,a,i));
+}
+static inline void get_1(double* a, const block_row_t* v, int i)
+{
+    for(int j=0; j<3; j++)
+        a[j] = v[j][i];
+}
+
+static void
+triangulate_geometric_block(// output
+                            block_row_t* __restrict m,
+                            // input. May be modified
+                            block_row_t* __restrict v0,
+                            block_row_t* __restrict v1,
+                            const mrcal_point3_t* Rt01,
+                            int N)
+{
+    const double* t01 = Rt01[3].xyz;
+    for(int i=0; i<N; i++)
+    {
+        const double dot_v0v0 = dot_1(v0, v0,  i);
+        const double dot_v1v1 = dot_1(v1, v1,  i);
+        const double dot_v0v1 = dot_1(v0, v1,  i);
+        const double dot_v0t  = dot_1(v0, t01, i);
+        const double dot_v1t  = dot_1(v1, t01, i);
+
+        const double denom       = dot_v0v0*dot_v1v1 - dot_v0v1*dot_v0v1;
+        const double denom_recip = 1./denom;
+        const double k0 = denom_recip * (dot_v1v1*dot_v0t - dot_v0v1*dot_v1t);
+        const double k1 = denom_recip * (dot_v0v1*dot_v0t - dot_v0v0*dot_v1t);
+
+        const bool ok =
+            !(-1e-10 <= denom && denom <= 1e-10) &
+            !(k0 <= 0.0) &
+            !(k1 <= 0.0);
+
+        for(int j=0; j<3; j++)
+            m[j][i] = ok ? (v0[j][i]*k0 + v1[j][i]*k1 + t01[j]) * 0.5 : 0.0;
+    }
+}
+
+static void
+triangulate_lindstrom_block(// output
+                            block_row_t* __restrict m,
+                            // input. LOCAL coordinates. May be modified
+                            block_row_t* __restrict v0,
+                            block_row_t* __restrict v1,
+                            const mrcal_point3_t* Rt01,
+                            int N)
+{
+    const double* R01 = Rt01[0].xyz;
+    const double* t01 = Rt01[3].xyz;
+
+    // The essential matrix is shared by all the points
+    const double E[9] = { R01[6]*t01[1] - R01[3]*t01[2],
+                          R01[7]*t01[1] - R01[4]*t01[2],
+                          R01[8]*t01[1] - R01[5]*t01[2],
+
+                          R01[0]*t01[2] - R01[6]*t01[0],
+                          R01[1]*t01[2] - R01[7]*t01[0],
+                          R01[2]*t01[2] - R01[8]*t01[0],
+
+                          R01[3]*t01[0] - R01[0]*t01[1],
+                          R01[4]*t01[0] - R01[1]*t01[1],
+                          R01[5]*t01[0] - R01[2]*t01[1] };
+
+    // Steps 1-16 from mrcal_triangulate_lindstrom(). v0 is updated in place,
+    // and v1 is updated, and then rotated into the camera-0 coord system
+    for(int i=0; i<N; i++)
+    {
+        const double x0[2] = { v0[0][i]/v0[2][i], v0[1][i]/v0[2][i] };
+        const double x1[2] = { v1[0][i]/v1[2][i], v1[1][i]/v1[2][i] };
+
+        double n[2], nn[2];
+        n [0] = E[0]*x1[0] + E[1]*x1[1] + E[2];
+        n [1] = E[3]*x1[0] + E[4]*x1[1] + E[5];
+        nn[0] = E[0]*x0[0] + E[3]*x0[1] + E[6];
+        nn[1] = E[1]*x0[0] + E[4]*x0[1] + E[7];
+
+        const double a =
+            n[0]*E[0]*nn[0] +
+            n[0]*E[1]*nn[1] +
+            n[1]*E[3]*nn[0] +
+            n[1]*E[4]*nn[1];
+        const double b = (n [0]*n [0] + n [1]*n [1] +
+                          nn[0]*nn[0] + nn[1]*nn[1]) * 0.5;
+        const double n_2 =
+            E[6]*x1[0] +
+            E[7]*x1[1] +
+            E[8];
+        const double c =
+            n[0]*x0[0] +
+            n[1]*x0[1] +
+            n_2;
+        const double d = sqrt(b*b - a*c);
+        double l = c / (b + d);
+
+        double dx [2] = { l * n [0], l * n [1] };
+        double dxx[2] = { l * nn[0], l * nn[1] };
+
+        n [0] = n [0] - E[0]*dxx[0] - E[1]*dxx[1] ;
+        n [1] = n [1] - E[3]*dxx[0] - E[4]*dxx[1] ;
+        nn[0] = nn[0] - E[0]*dx [0] - E[3]*dx [1] ;
+        nn[1] = nn[1] - E[1]*dx [0] - E[4]*dx [1] ;
+
+        const double bb = (n [0]*n [0] + n [1]*n [1] +
+                           nn[0]*nn[0] + nn[1]*nn[1]) * 0.5;
+        l = l/d * bb;
+
+        dx [0] = l * n [0];
+        dx [1] = l * n [1];
+        dxx[0] = l * nn[0];
+        dxx[1] = l * nn[1];
+
+        v0[0][i] = x0[0] - dx[0];
+        v0[1][i] = x0[1] - dx[1];
+        v0[2][i] = 1.0;
+
+        const double v1_local[3] = { x1[0] - dxx[0],
+                                     x1[1] - dxx[1],
+                                     1.0 };
+        for(int j=0; j<3; j++)
+            v1[j][i] =
+                R01[3*j+0]*v1_local[0] +
+                R01[3*j+1]*v1_local[1] +
+                R01[3*j+2]*v1_local[2];
+    }
+
+    triangulate_assume_intersect_block(m, v0, v1, t01, N);
+}
+
+static void
+triangulate_leecivera_l1_block(// output
+                               block_row_t* __restrict m,
+                               // input. May be modified
+                               block_row_t* __restrict v0,
+                               block_row_t* __restrict v1,
+                               const mrcal_point3_t* Rt01,
+                               int N)
+{
+    const double* t01 = Rt01[3].xyz;
+    for(int i=0; i<N; i++)
+    {
+        const double dot_v0v0 = dot_1(v0, v0,  i);
+        const double dot_v1v1 = dot_1(v1, v1,  i);
+        const double dot_v0t  = dot_1(v0, t01, i);
+        const double dot_v1t  = dot_1(v1, t01, i);
+
+        // Equation (12) or (13): I adjust v0 or v1
+        const bool adjust_v0 = dot_v0t*dot_v0t * dot_v1v1 > dot_v1t*dot_v1t * dot_v0v0;
+
+        double v[3], vother[3], n[3];
+        for(int j=0; j<3; j++)
+        {
+            v     [j] = adjust_v0 ? v0[j][i] : v1[j][i];
+            vother[j] = adjust_v0 ? v1[j][i] : v0[j][i];
+        }
+        cross_1(n, vother, t01);
+
+        double dot_vn = 0.0;
+        for(int j=0; j<3; j++)
+            dot_vn += n[j]*v[j];
+        const double norm2_n = norm2_1(n);
+        for(int j=0; j<3; j++)
+        {
+            v[j] = v[j] - n[j]*dot_vn/norm2_n;
+
+            v0[j][i] = adjust_v0 ? v[j]     : v0[j][i];
+            v1[j][i] = adjust_v0 ? v1[j][i] : v[j];
+        }
+    }
+
+    triangulate_assume_intersect_block(m, v0, v1, t01, N);
+}
+
+static void
+triangulate_leecivera_linf_block(// output
+                                 block_row_t* __restrict m,
+                                 // input. May be modified
+                                 block_row_t* __restrict v0,
+                                 block_row_t* __restrict v1,
+                                 const mrcal_point3_t* Rt01,
+                                 int N)
+{
+    const double* t01 = Rt01[3].xyz;
+    for(int i=0; i<N; i++)
+    {
+        const double mag0 = mag_1(v0, i);
+        const double mag1 = mag_1(v1, i);
+        for(int j=0; j<3; j++)
+        {
+            v0[j][i] = v0[j][i] / mag0;
+            v1[j][i] = v1[j][i] / mag1;
+        }
+
+        double vsum[3], vdiff[3];
+        for(int j=0; j<3; j++)
+        {
+            vsum [j] = v0[j][i] + v1[j][i];
+            vdiff[j] = v0[j][i] - v1[j][i];
+        }
+        double na[3], nb[3];
+        cross_1(na, vsum,  t01);
+        cross_1(nb, vdiff, t01);
+
+        const double* n = norm2_1(na) > norm2_1(nb) ? na : nb;
+
+        const double dot_v0n = dot_1(v0, n, i);
+        const double dot_v1n = dot_1(v1, n, i);
+        const double norm2_n = norm2_1(n);
+        for(int j=0; j<3; j++)
+        {
+            v0[j][i] = v0[j][i] - n[j]*dot_v0n/norm2_n;
+            v1[j][i] = v1[j][i] - n[j]*dot_v1n/norm2_n;
+        }
+    }
+
+    triangulate_assume_intersect_block(m, v0, v1, t01, N);
+}
+
+static void
+triangulate_leecivera_mid2_block(// output
+                                 block_row_t* __restrict m,
+                                 // input. May be modified
+                                 block_row_t* __restrict v0,
+                                 block_row_t* __restrict v1,
+                                 const mrcal_point3_t* Rt01,
+                                 int N)
+{
+    const double* t01 = Rt01[3].xyz;
+    for(int i=0; i<N; i++)
+    {
+        double _v0[3], _v1[3], c[3];
+        get_1(_v0, v0, i);
+        get_1(_v1, v1, i);
+
+        cross_1(c, _v0, _v1);
+        const double p_norm2_recip = 1.0 / norm2_1(c);
+        cross_1(c, _v1, t01);
+        const double l0 = sqrt(norm2_1(c) * p_norm2_recip);
+        cross_1(c, _v0, t01);
+        const double l1 = sqrt(norm2_1(c) * p_norm2_recip);
+
+        const bool ok = chirality_1(l0, v0, l1, v1, t01, i);
+        for(int j=0; j<3; j++)
+            m[j][i] = ok ? (_v0[j]*l0 + t01[j] + _v1[j]*l1) / 2.0 : 0.0;
+    }
+}
+
+static void
+triangulate_leecivera_wmid2_block(// output
+                                  block_row_t* __restrict m,
+                                  // input. May be modified
+                                  block_row_t* __restrict v0,
+                                  block_row_t* __restrict v1,
+                                  const mrcal_point3_t* Rt01,
+                                  int N)
+{
+    const double* t01 = Rt01[3].xyz;
+    for(int i=0; i<N; i++)
+    {
+        const double mag0 = mag_1(v0, i);
+        const double mag1 = mag_1(v1, i);
+        for(int j=0; j<3; j++)
+        {
+            v0[j][i] = v0[j][i] / mag0;
+            v1[j][i] = v1[j][i] / mag1;
+        }
+
+        double _v0[3], _v1[3], c[3];
+        get_1(_v0, v0, i);
+        get_1(_v1, v1, i);
+
+        cross_1(c, _v0, _v1);
+        const double p_mag_recip = 1.0 / sqrt(norm2_1(c));
+        cross_1(c, _v1, t01);
+        const double l0 = sqrt(norm2_1(c)) * p_mag_recip;
+        cross_1(c, _v0, t01);
+        const double l1 = sqrt(norm2_1(c)) * p_mag_recip;
+
+        const bool ok = chirality_1(l0, v0, l1, v1, t01, i);
+        for(int j=0; j<3; j++)
+            m[j][i] = ok ?
+                (_v0[j]*l0*l1 + t01[j]*l0 + _v1[j]*l0*l1) / (l0 + l1) :
+                0.0;
+    }
+}
+
+typedef void (triangulate_block_t)(block_row_t* __restrict m,
+                                   block_row_t* __restrict v0,
+                                   block_row_t* __restrict v1,
+                                   const mrcal_point3_t* Rt01,
+                                   int N);
+
+static void
+triangulate_batch(// output
+                  mrcal_point3_t* m,
+                  int m_stride,
+                  // input
+                  const mrcal_point3_t* v0_local,
+                  int v0_local_stride,
+                  const mrcal_point3_t* v1_local,
+                  int v1_local_stride,
+                  int N,
+                  const mrcal_point3_t* Rt01,
+
+                  triangulate_block_t* triangulate_block,
+                  // lindstrom works in the local coordinate systems. The
+                  // others want v1 in camera-0 coordinates
+                  bool rotate_v1)
+{
+    if(N <= 0)
+        return;
+
+    if(m_stride        <= 0) m_stride        = sizeof(mrcal_point3_t);
+    if(v0_local_stride <= 0) v0_local_stride = sizeof(mrcal_point3_t);
+    if(v1_local_stride <= 0) v1_local_stride = sizeof(mrcal_point3_t);
+
+    const double* R01 = Rt01[0].xyz;
+
+    const int Nblocks  = (N + TRIANGULATE_BLOCK-1) / TRIANGULATE_BLOCK;
+    const int Nthreads =
+        std::min(_mrcal_num_threads(0),
+                 std::max(1, N / TRIANGULATE_NPOINTS_PER_THREAD_MIN));
+
+    _mrcal_parallel_for(Nblocks, Nthreads,
+                        [&](int iblock0, int iblock1, int)
+                        {
+                            block_row_t bm[3], bv0[3], bv1[3];
+
+                            for(int iblock=iblock0; iblock<iblock1; iblock++)
+                            {
+                                const int i0 = iblock*TRIANGULATE_BLOCK;
+                                const int n  = std::min(TRIANGULATE_BLOCK, N - i0);
+
+                                for(int i=0; i<n; i++)
+                                {
+                                    const double* p0 = (const double*)&((const char*)v0_local)[(size_t)(i0+i)*v0_local_stride];
+                                    const double* p1 = (const double*)&((const char*)v1_local)[(size_t)(i0+i)*v1_local_stride];
+                                    for(int j=0; j<3; j++)
+                                    {
+                                        bv0[j][i] = p0[j];
+                                        bv1[j][i] = p1[j];
+                                    }
+                                }
+                                if(rotate_v1)
+                                    for(int i=0; i<n; i++)
+                                    {
+                                        const double v[3] = { bv1[0][i], bv1[1][i], bv1[2][i] };
+                                        for(int j=0; j<3; j++)
+                                            bv1[j][i] =
+                                                R01[3*j+0]*v[0] +
+                                                R01[3*j+1]*v[1] +
+                                                R01[3*j+2]*v[2];
+                                    }
+
+                                triangulate_block(bm, bv0, bv1, Rt01, n);
+
+                                for(int i=0; i<n; i++)
+                                {
+                                    double* pm = (double*)&((char*)m)[(size_t)(i0+i)*m_stride];
+                                    for(int j=0; j<3; j++)
+                                        pm[j] = bm[j][i];
+                                }
+                            }
+                        });
+}
+
+#define TRIANGULATE_BATCH_DEFINE(method, rotate_v1)                     \
+extern "C"                                                              \
+void mrcal_triangulate_ ## method ## _batch(/* output */                \
+                                            mrcal_point3_t* m,          \
+                                            int m_stride,               \
+                                            /* input */                 \
+                                            const mrcal_point3_t* v0_local, \
+                                            int v0_local_stride,        \
+                                            const mrcal_point3_t* v1_local, \
+                                            int v1_local_stride,        \
+                                            int N,                      \
+                                            const mrcal_point3_t* Rt01) \
+{                                                                       \
+    triangulate_batch(m,        m_stride,                               \
+                      v0_local, v0_local_stride,                        \
+                      v1_local, v1_local_stride,                        \
+                      N, Rt01,                                          \
+                      &triangulate_ ## method ## _block,                \
+                      rotate_v1);                                       \
+}
+TRIANGULATE_BATCH_DEFINE(geometric,        true)
+TRIANGULATE_BATCH_DEFINE(lindstrom,        false)
+TRIANGULATE_BATCH_DEFINE(leecivera_l1,     true)
+TRIANGULATE_BATCH_DEFINE(leecivera_linf,   true)
+TRIANGULATE_BATCH_DEFINE(leecivera_mid2,   true)
+TRIANGULATE_BATCH_DEFINE(leecivera_wmid2,  true)
+#undef TRIANGULATE_BATCH_DEFINE
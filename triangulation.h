@@ -129,3 +129,43 @@ mrcal_triangulate_leecivera_wmid2(// outputs
 // I don't implement triangulate_leecivera_l2() yet because it requires
 // computing an SVD, which is far slower than what the rest of these functions
 // do
+
+// Batched triangulation: N observation pairs from the same two cameras. These
+// are the no-gradient versions of the functions above: they produce the same
+// results, but they process the points in blocks, in loops that the compiler
+// can vectorize, and they split the work across threads. Use these when
+// triangulating lots of points at once, such as the output of a dense stereo
+// matcher
+//
+// Unlike the functions above, the observation vectors v0_local, v1_local are
+// given in the LOCAL coordinate system of each camera (for all the methods, not
+// just lindstrom), and the shared relative transform Rt01 (4 mrcal_point3_t:
+// the rotation matrix R01 followed by t01) maps points in camera-1 coordinates
+// to camera-0 coordinates. The non-lindstrom methods compute v1 = R01 v1_local,
+// and then proceed as the single-point functions do. The triangulated points
+// are reported in camera-0 coordinates
+//
+// The strides are in bytes, and describe the spacing between successive
+// mrcal_point3_t. <= 0 means "contiguous". Pairs that can't be triangulated
+// produce (0,0,0), exactly like the single-point functions
+#define MRCAL_TRIANGULATE_BATCH_LIST(_) \
+    _(geometric)                        \
+    _(lindstrom)                        \
+    _(leecivera_l1)                     \
+    _(leecivera_linf)                   \
+    _(leecivera_mid2)                   \
+    _(leecivera_wmid2)
+
+#define MRCAL_TRIANGULATE_BATCH_DECLARE(method)                         \
+void mrcal_triangulate_ ## method ## _batch(/* output */                \
+                                            mrcal_point3_t* m,          \
+                                            int m_stride,               \
+                                            /* input */                 \
+                                            const mrcal_point3_t* v0_local, \
+                                            int v0_local_stride,        \
+                                            const mrcal_point3_t* v1_local, \
+                                            int v1_local_stride,        \
+                                            int N,                      \
+                                            const mrcal_point3_t* Rt01);
+MRCAL_TRIANGULATE_BATCH_LIST(MRCAL_TRIANGULATE_BATCH_DECLARE)
+#undef MRCAL_TRIANGULATE_BATCH_DECLARE
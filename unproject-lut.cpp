@@ -0,0 +1,492 @@
+// Copyright (c) 2017-2023 California Institute of Technology ("Caltech"). U.S.
+// Government sponsorship acknowledged. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <new>
+
+#include "mrcal.h"
+#include "mrcal-internal.h"
+#include "parallel.h"
+#include "util.h"
+
+// Don't bother with threads unless each one gets at least this many points. A
+// lookup is a few multiplications
+#define NPOINTS_PER_THREAD_MIN 65536
+
+// Identifies the file format. Bump the version if the layout changes
+#define LUT_FILE_MAGIC   "MRCALLUT"
+#define LUT_FILE_VERSION 1
+
+struct mrcal_unproject_lut_t
+{
+    mrcal_lensmodel_t              lensmodel;
+    std::vector<double>            intrinsics;
+    mrcal_projection_precomputed_t precomputed;
+
+    int width, height, spacing;
+
+    // The grid of nodes is Nx*Ny, with node (ix,iy) at pixel
+    // (ix*spacing,iy*spacing). It covers the whole imager, and may extend past
+    // its far edges
+    int Nx, Ny;
+
+    // The stereographic representation of the unprojection at each node, as in
+    // _mrcal_unproject_internal(). Stored row-first: (Ny,Nx) mrcal_point2_t
+    // objects. NaN where the unprojection failed
+    std::vector<mrcal_point2_t> u;
+
+    double max_error;
+
+    // How many cells have a NaN node, and are unprojected exactly
+    int Ncells_exact;
+};
+
+// On-disk header. Followed by Nintrinsics doubles of intrinsics and Nx*Ny
+// mrcal_point2_t nodes
+struct lut_file_header_t
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t width, height, spacing;
+    uint32_t Nx, Ny;
+    uint32_t Nintrinsics;
+    double   max_error;
+    char     lensmodel[256];
+};
+
+static bool init_lut(mrcal_unproject_lut_t* lut,
+                     const mrcal_lensmodel_t* lensmodel,
+                     const double* intrinsics,
+                     int width, int height,
+                     int spacing)
+{
+    if(width <= 0 || height <= 0 || spacing <= 0)
+    {
+        MSG("The imager size and the spacing must be positive. Got width=%d height=%d spacing=%d",
+            width, height, spacing);
+        return false;
+    }
+
+    mrcal_lensmodel_metadata_t meta = mrcal_lensmodel_metadata(lensmodel);
+    if(!meta.has_gradients)
+    {
+        MSG("mrcal_unproject_lut_create(lensmodel='%s') is not yet implemented: we need gradients",
+            mrcal_lensmodel_name_unconfigured(lensmodel));
+        return false;
+    }
+
+    const int Nintrinsics = mrcal_lensmodel_num_params(lensmodel);
+
+    lut->lensmodel = *lensmodel;
+    lut->intrinsics.assign(intrinsics, intrinsics + Nintrinsics);
+    _mrcal_precompute_lensmodel_data(&lut->precomputed, lensmodel);
+
+    lut->width   = width;
+    lut->height  = height;
+    lut->spacing = spacing;
+    lut->Nx      = (width -1 + spacing-1) / spacing + 1;
+    lut->Ny      = (height-1 + spacing-1) / spacing + 1;
+    lut->u.resize((size_t)lut->Nx*lut->Ny);
+    lut->max_error    = 0.0;
+    lut->Ncells_exact = 0;
+    return true;
+}
+
+// Bilinear interpolation of the nodes. Returns false if q is outside the grid,
+// or if any node of its cell is NaN
+static bool interpolate(// out
+                        mrcal_point2_t* u,
+
+                        // in
+                        const mrcal_point2_t* q,
+                        const mrcal_unproject_lut_t* lut)
+{
+    const double x = q->x / (double)lut->spacing;
+    const double y = q->y / (double)lut->spacing;
+
+    // The far edge of the grid belongs to the last cell. The negated
+    // comparisons reject NaN too
+    if(!(x >= 0.0 && x <= (double)(lut->Nx-1) &&
+         y >= 0.0 && y <= (double)(lut->Ny-1)))
+        return false;
+
+    const int ix = std::min((int)x, lut->Nx-2 < 0 ? 0 : lut->Nx-2);
+    const int iy = std::min((int)y, lut->Ny-2 < 0 ? 0 : lut->Ny-2);
+
+    // A single row or column of nodes has nothing to interpolate along that
+    // axis
+    const int dix = lut->Nx > 1 ? 1 : 0;
+    const int diy = lut->Ny > 1 ? lut->Nx : 0;
+
+    const double fx = x - (double)ix;
+    const double fy = y - (double)iy;
+
+    const mrcal_point2_t* u00 = &lut->u[(size_t)iy*lut->Nx + ix];
+    const mrcal_point2_t* u01 = u00 + dix;
+    const mrcal_point2_t* u10 = u00 + diy;
+    const mrcal_point2_t* u11 = u10 + dix;
+
+    for(int i=0; i<2; i++)
+    {
+        const double u0 = u00->xy[i] + (u01->xy[i] - u00->xy[i])*fx;
+        const double u1 = u10->xy[i] + (u11->xy[i] - u10->xy[i])*fx;
+        u->xy[i] = u0 + (u1 - u0)*fy;
+    }
+    // Any NaN node makes the result NaN, even if its weight is 0
+    return std::isfinite(u->x) && std::isfinite(u->y);
+}
+
+// The cells with at least one NaN node. We can't interpolate in these
+static int count_cells_exact(const mrcal_unproject_lut_t* lut)
+{
+    const int Nx  = lut->Nx;
+    const int Ny  = lut->Ny;
+    const int dix = Nx > 1 ? 1  : 0;
+    const int diy = Ny > 1 ? Nx : 0;
+
+    int N = 0;
+    for(int iy=0; iy<std::max(Ny-1, 1); iy++)
+        for(int ix=0; ix<std::max(Nx-1, 1); ix++)
+        {
+            const mrcal_point2_t* u00 = &lut->u[(size_t)iy*Nx + ix];
+            const mrcal_point2_t* u[] = { u00, u00+dix, u00+diy, u00+diy+dix };
+            for(const mrcal_point2_t* uu : u)
+                if(!(std::isfinite(uu->x) && std::isfinite(uu->y)))
+                {
+                    N++;
+                    break;
+                }
+        }
+    return N;
+}
+
+static bool lookup(// out
+                   mrcal_point3_t* v,
+
+                   // in
+                   const mrcal_point2_t* q,
+                   const mrcal_unproject_lut_t* lut)
+{
+    // Outside the grid, or in a cell we can't interpolate: we solve exactly
+    mrcal_point2_t u;
+    if(!interpolate(&u, q, lut))
+        return _mrcal_unproject_internal(v, q, 1,
+                                         &lut->lensmodel, lut->intrinsics.data(),
+                                         &lut->precomputed);
+
+    mrcal_unproject_stereographic(v, NULL, &u, 1, lut->intrinsics.data());
+    return true;
+}
+
+// Solves for the nodes, and measures the interpolation error at the center of
+// each cell. The cells with a NaN node are unprojected exactly, and they're
+// measured the same way
+static bool fill_lut(mrcal_unproject_lut_t* lut)
+{
+    const int Nx = lut->Nx;
+    const int Ny = lut->Ny;
+    const double* intrinsics = lut->intrinsics.data();
+
+    std::vector<mrcal_point2_t> q((size_t)Nx*Ny);
+    std::vector<mrcal_point3_t> v((size_t)Nx*Ny);
+    for(int iy=0; iy<Ny; iy++)
+        for(int ix=0; ix<Nx; ix++)
+        {
+            q[(size_t)iy*Nx + ix].x = (double)(ix*lut->spacing);
+            q[(size_t)iy*Nx + ix].y = (double)(iy*lut->spacing);
+        }
+
+    if(!mrcal_unproject(v.data(), q.data(), Nx*Ny,
+                        &lut->lensmodel, intrinsics))
+        return false;
+    // Unprojection failures are NaN, and stay NaN here
+    mrcal_project_stereographic(lut->u.data(), NULL, v.data(), Nx*Ny,
+                                intrinsics);
+    lut->Ncells_exact = count_cells_exact(lut);
+
+    // The cell centers. With spacing == 1 the nodes are every integer pixel, so
+    // we compare at the half-pixels. Only these are measured, so max_error is
+    // an estimate of the interpolation error, not a bound
+    const int Ncx = std::max(Nx-1, 1);
+    const int Ncy = std::max(Ny-1, 1);
+    const double half = (double)lut->spacing / 2.0;
+    q.resize((size_t)Ncx*Ncy);
+    v.resize((size_t)Ncx*Ncy);
+    for(int iy=0; iy<Ncy; iy++)
+        for(int ix=0; ix<Ncx; ix++)
+        {
+            mrcal_point2_t* qc = &q[(size_t)iy*Ncx + ix];
+            qc->x = Nx > 1 ? (double)(ix*lut->spacing) + half : 0.0;
+            qc->y = Ny > 1 ? (double)(iy*lut->spacing) + half : 0.0;
+            if(!lookup(&v[(size_t)iy*Ncx + ix], qc, lut))
+                return false;
+        }
+
+    std::vector<mrcal_point2_t> qlut(q.size());
+    if(!mrcal_project(qlut.data(), NULL, NULL,
+                      v.data(), (int)v.size(),
+                      &lut->lensmodel, intrinsics))
+        return false;
+
+    // A NaN here means that the exact solve failed at this cell center:
+    // mrcal_unproject() can't unproject it either, so there's nothing to compare
+    // against. Any other NaN would come from the interpolation, but
+    // interpolate() doesn't produce those
+    double max_error = 0.0;
+    for(size_t i=0; i<q.size(); i++)
+    {
+        const double dx = qlut[i].x - q[i].x;
+        const double dy = qlut[i].y - q[i].y;
+        const double e  = sqrt(dx*dx + dy*dy);
+        if(std::isfinite(e) && e > max_error)
+            max_error = e;
+    }
+    lut->max_error = max_error;
+    return true;
+}
+
+mrcal_unproject_lut_t*
+mrcal_unproject_lut_create( // in
+                            const mrcal_lensmodel_t* lensmodel,
+                            // core, distortions concatenated
+                            const double* intrinsics,
+                            int width, int height,
+                            int spacing)
+{
+    mrcal_unproject_lut_t* lut = new (std::nothrow) mrcal_unproject_lut_t;
+    if(lut == NULL)
+    {
+        MSG("Couldn't allocate the lookup table");
+        return NULL;
+    }
+
+    try
+    {
+        if(init_lut(lut, lensmodel, intrinsics, width, height, spacing) &&
+           fill_lut(lut))
+            return lut;
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the lookup table");
+    }
+    delete lut;
+    return NULL;
+}
+
+void mrcal_unproject_lut_free(mrcal_unproject_lut_t* lut)
+{
+    delete lut;
+}
+
+bool mrcal_unproject_lut( // out
+                          mrcal_point3_t* v,
+
+                          // in
+                          const mrcal_point2_t* q,
+                          int N,
+                          const mrcal_unproject_lut_t* lut)
+{
+    if(N <= 0)
+        return true;
+
+    const int Nthreads = std::min(_mrcal_num_threads(0),
+                                  std::max(1, N / NPOINTS_PER_THREAD_MIN));
+
+    std::vector<char> result_chunk;
+    try
+    {
+        result_chunk.resize(Nthreads, 1);
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the per-thread results");
+        return false;
+    }
+
+    _mrcal_parallel_for(N, Nthreads,
+                        [&](int i0, int i1, int ichunk)
+                        {
+                            for(int i=i0; i<i1; i++)
+                                if(!lookup(&v[i], &q[i], lut))
+                                    result_chunk[ichunk] = 0;
+                        });
+
+    for(char r : result_chunk)
+        if(!r)
+            return false;
+    return true;
+}
+
+double mrcal_unproject_lut_max_error(const mrcal_unproject_lut_t* lut)
+{
+    return lut->max_error;
+}
+
+int mrcal_unproject_lut_num_cells_exact(const mrcal_unproject_lut_t* lut)
+{
+    return lut->Ncells_exact;
+}
+
+bool mrcal_write_unproject_lut_file(const char* filename,
+                                    const mrcal_unproject_lut_t* lut)
+{
+    lut_file_header_t header = {};
+    memcpy(header.magic, LUT_FILE_MAGIC, sizeof(header.magic));
+    header.version     = LUT_FILE_VERSION;
+    header.width       = (uint32_t)lut->width;
+    header.height      = (uint32_t)lut->height;
+    header.spacing     = (uint32_t)lut->spacing;
+    header.Nx          = (uint32_t)lut->Nx;
+    header.Ny          = (uint32_t)lut->Ny;
+    header.Nintrinsics = (uint32_t)lut->intrinsics.size();
+    header.max_error   = lut->max_error;
+    if(!mrcal_lensmodel_name(header.lensmodel, sizeof(header.lensmodel),
+                             &lut->lensmodel))
+    {
+        MSG("Couldn't construct lensmodel string. Unconfigured string: '%s'",
+            mrcal_lensmodel_name_unconfigured(&lut->lensmodel));
+        return false;
+    }
+
+    FILE* fp = fopen(filename, "wb");
+    if(fp == NULL)
+    {
+        MSG("Couldn't open('%s')", filename);
+        return false;
+    }
+
+    bool result =
+        1 == fwrite(&header, sizeof(header), 1, fp) &&
+        lut->intrinsics.size() == fwrite(lut->intrinsics.data(), sizeof(double),
+                                         lut->intrinsics.size(), fp) &&
+        lut->u.size() == fwrite(lut->u.data(), sizeof(mrcal_point2_t),
+                                lut->u.size(), fp);
+    if(0 != fclose(fp))
+        result = false;
+    if(!result)
+        MSG("Couldn't write '%s'", filename);
+    return result;
+}
+
+mrcal_unproject_lut_t*
+mrcal_read_unproject_lut_file( // in
+                               const char* filename,
+                               const mrcal_lensmodel_t* lensmodel,
+                               // core, distortions concatenated
+                               const double* intrinsics)
+{
+    mrcal_unproject_lut_t* lut    = NULL;
+    mrcal_unproject_lut_t* result = NULL;
+    lut_file_header_t      header;
+    std::vector<double>    intrinsics_file;
+    char lensmodel_string[sizeof(header.lensmodel)];
+
+    FILE* fp = fopen(filename, "rb");
+    if(fp == NULL)
+    {
+        MSG("Couldn't open('%s')", filename);
+        return NULL;
+    }
+
+    if(1 != fread(&header, sizeof(header), 1, fp) ||
+       0 != memcmp(header.magic, LUT_FILE_MAGIC, sizeof(header.magic)))
+    {
+        MSG("'%s' is not an unprojection lookup table", filename);
+        goto done;
+    }
+    if(header.version != LUT_FILE_VERSION)
+    {
+        MSG("'%s' has an unsupported version %u; I only know about version %d",
+            filename, header.version, LUT_FILE_VERSION);
+        goto done;
+    }
+
+    // The table must have been built for this exact camera
+    header.lensmodel[sizeof(header.lensmodel)-1] = '\0';
+    if(!mrcal_lensmodel_name(lensmodel_string, sizeof(lensmodel_string),
+                             lensmodel))
+    {
+        MSG("Couldn't construct lensmodel string. Unconfigured string: '%s'",
+            mrcal_lensmodel_name_unconfigured(lensmodel));
+        goto done;
+    }
+    if(0 != strcmp(lensmodel_string, header.lensmodel))
+    {
+        MSG("'%s' was built for lensmodel '%s', but we want '%s'",
+            filename, header.lensmodel, lensmodel_string);
+        goto done;
+    }
+    if((int)header.Nintrinsics != mrcal_lensmodel_num_params(lensmodel))
+    {
+        MSG("'%s' has %u intrinsics, but lensmodel '%s' needs %d",
+            filename, header.Nintrinsics, lensmodel_string,
+            mrcal_lensmodel_num_params(lensmodel));
+        goto done;
+    }
+
+    lut = new (std::nothrow) mrcal_unproject_lut_t;
+    if(lut == NULL)
+    {
+        MSG("Couldn't allocate the lookup table");
+        goto done;
+    }
+
+    try
+    {
+        intrinsics_file.resize(header.Nintrinsics);
+        if(header.Nintrinsics != fread(intrinsics_file.data(), sizeof(double),
+                                       header.Nintrinsics, fp))
+        {
+            MSG("'%s' is truncated", filename);
+            goto done;
+        }
+        if(0 != memcmp(intrinsics_file.data(), intrinsics,
+                       header.Nintrinsics*sizeof(double)))
+        {
+            MSG("'%s' was built for different intrinsics", filename);
+            goto done;
+        }
+
+        if(!init_lut(lut, lensmodel, intrinsics,
+                     (int)header.width, (int)header.height, (int)header.spacing))
+            goto done;
+        if((int)header.Nx != lut->Nx || (int)header.Ny != lut->Ny)
+        {
+            MSG("'%s' is corrupt: its grid size doesn't match its imager size and spacing",
+                filename);
+            goto done;
+        }
+        if(lut->u.size() != fread(lut->u.data(), sizeof(mrcal_point2_t),
+                                  lut->u.size(), fp))
+        {
+            MSG("'%s' is truncated", filename);
+            goto done;
+        }
+    }
+    catch(...)
+    {
+        MSG("Couldn't allocate the lookup table");
+        goto done;
+    }
+    lut->max_error    = header.max_error;
+    lut->Ncells_exact = count_cells_exact(lut);
+
+    result = lut;
+    lut    = NULL;
+
+ done:
+    delete lut;
+    fclose(fp);
+    return result;
+}
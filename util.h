@@ -9,5 +9,32 @@
 #pragma once
 
 #include <stdio.h>
+#include <locale.h>
 
 #define MSG(fmt, ...) fprintf(stderr, "%s(%d): " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__)
+
+// Diagnostic output from the internals, in the categories listed in
+// MRCAL_TRACE_CATEGORY_LIST. This is compiled out entirely unless
+// MRCAL_ENABLE_TRACE is defined: the arguments aren't even evaluated. If it IS
+// defined, each category is off until it is turned on at runtime with
+// mrcal_trace_set_categories(). Usage:
+//
+//   MRCAL_TRACE(MRCAL_TRACE_REGULARIZATION, "scale: %g", scale);
+//
+//   if(MRCAL_TRACE_ENABLED(MRCAL_TRACE_REGULARIZATION))
+//   { ... expensive diagnostics ... }
+#ifdef MRCAL_ENABLE_TRACE
+extern unsigned int _mrcal_trace_categories;
+#define MRCAL_TRACE_ENABLED(category) (_mrcal_trace_categories & (category))
+#define MRCAL_TRACE(category, fmt, ...)                                 \
+    do { if(MRCAL_TRACE_ENABLED(category)) MSG(#category ": " fmt, ##__VA_ARGS__); } while(0)
+#else
+#define MRCAL_TRACE_ENABLED(category) 0
+#define MRCAL_TRACE(category, fmt, ...) do {} while(0)
+#endif
+
+// The C locale, for the parsers and the formatters that must use '.' as the
+// decimal point whatever the current locale is. Created on the first call, and
+// shared by all the threads for the life of the process: locale_t objects are
+// expensive to create. Returns (locale_t)0 if it couldn't be created
+locale_t _mrcal_locale_C(void);